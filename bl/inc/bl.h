@@ -37,13 +37,43 @@
  */
 typedef enum {
 	BL_Status_OK, /**< BL_Status_OK */
-	BL_Status_Error /**< BL_Status_Error */
+	BL_Status_Error, /**< BL_Status_Error */
+	BL_Status_Busy /**< BL_Status_Busy */
 } BL_Status_t;
 
+/**
+ * @struct	BL_IoVec_t
+ * @brief	One buffer of a vectored send
+ *
+ */
+typedef struct {
+	const uint8_t *data; /**< Buffer, may point into flash */
+	uint32_t len; /**< Length of the buffer in bytes */
+} BL_IoVec_t;
+
+/*******************************************************************************
+ *                        Global Public variables                              *
+ *******************************************************************************/
+
+/**
+ * @brief	Update request left by the application before a reset. The
+ * 	application sets it to BL_ENTER_CMD_MODE_KEY to stay in the bootloader
+ * 	on the next boot. Lives in the BL_NOINIT section, which the linker scripts
+ * 	of the bootloader and the application must place at the same RAM address
+ * 	and the start-up code must not clear:
+ *
+ * 	BL_NOINIT (NOLOAD) : { KEEP(*(BL_NOINIT)) } > NOINIT_RAM
+ *
+ */
+extern volatile uint32_t bl_boot_request;
+
 /*******************************************************************************
  *                         Weak public functions prototypes                    *
  *******************************************************************************/
 
+/* Hooks with a weak default in the core are declared without BL_WEAK, so the
+ * definition of a port overrides the default whatever the link order */
+
 /**
  * @fn void BL_delay(uint32_t)
  * @brief	Provides a millisecond polling delay
@@ -110,6 +140,21 @@ BL_WEAK void BL_SetLEDState(uint8_t state);
  */
 BL_WEAK BL_Status_t BL_send(uint8_t *data, uint32_t len, uint32_t timeout);
 
+/**
+ * @fn BL_Status_t BL_sendv(const BL_IoVec_t[], uint32_t, uint32_t)
+ * @brief	Sends several buffers back to back as one transmission, e.g. a
+ * 	packet header from RAM followed by its payload straight from flash
+ *
+ * 	The default implementation calls BL_send for every buffer.
+ *
+ * @param iov		Buffers to send, in order
+ * @param iov_count	Number of buffers
+ * @param timeout	Timeout in milliseconds
+ * @return
+ */
+BL_Status_t BL_sendv(const BL_IoVec_t iov[], uint32_t iov_count,
+		uint32_t timeout);
+
 /**
  * @fn BL_Status_t BL_receive(uint8_t*, uint8_t, uint32_t)
  * @brief	Receives an array of bytes with specified length and returns after a timeout
@@ -176,10 +221,167 @@ BL_WEAK BL_Status_t BL_erase_flash(uint32_t page_address, uint32_t page_count);
 BL_WEAK BL_Status_t BL_flash_write(uint32_t start_address, uint8_t data[],
 		uint32_t data_len);
 
+/**
+ * @fn BL_Status_t BL_flash_write_start(uint32_t, uint8_t[], uint32_t)
+ * @brief	Starts programming a block without waiting for it to complete. The
+ * 	data buffer stays untouched until BL_flash_write_poll reports completion.
+ *
+ * 	The default implementation programs synchronously with BL_flash_write.
+ *
+ * @param start_address
+ * @param data
+ * @param data_len
+ * @return	BL_Status_OK	If programming was started
+ * @return	BL_Status_Error	If programming could not be started
+ */
+BL_Status_t BL_flash_write_start(uint32_t start_address,
+		uint8_t data[], uint32_t data_len);
+
+/**
+ * @fn BL_Status_t BL_flash_write_poll(void)
+ * @brief	Polls the block started by BL_flash_write_start
+ *
+ * @return	BL_Status_Busy	If still programming
+ * @return	BL_Status_OK	If programming completed successfully
+ * @return	BL_Status_Error	If programming failed
+ */
+BL_Status_t BL_flash_write_poll(void);
+
+/**
+ * @fn BL_Status_t BL_erase_flash_start(uint32_t, uint32_t)
+ * @brief	Starts erasing pages without waiting for it to complete
+ *
+ * 	The default implementation erases synchronously with BL_erase_flash.
+ *
+ * @param page_address
+ * @param page_count
+ * @return	BL_Status_OK	If erasing was started
+ * @return	BL_Status_Error	If erasing could not be started
+ */
+BL_Status_t BL_erase_flash_start(uint32_t page_address,
+		uint32_t page_count);
+
+/**
+ * @fn BL_Status_t BL_erase_flash_poll(void)
+ * @brief	Polls the erase started by BL_erase_flash_start
+ *
+ * @return	BL_Status_Busy	If still erasing
+ * @return	BL_Status_OK	If erasing completed successfully
+ * @return	BL_Status_Error	If erasing failed
+ */
+BL_Status_t BL_erase_flash_poll(void);
+
+/**
+ * @fn void BL_jump_to_app(uint32_t*)
+ * @brief	Hands control over to the application and does not return. The
+ * 	default (Cortex-M only) relocates the vector table, loads the application
+ * 	stack pointer and calls its reset handler.
+ *
+ * @param app_address	Application start address (start of its vector table)
+ */
+void BL_jump_to_app(uint32_t *app_address);
+
+/**
+ * @fn BL_Status_t BL_capture_edges(uint32_t[], uint32_t, uint32_t)
+ * @brief	Timestamps the next edges of the receive line, both rising and
+ * 	falling, e.g. with an input capture timer or an edge interrupt on the RX
+ * 	pin reading BL_get_cycles. The byte they belong to must not reach the
+ * 	receive path.
+ *
+ * 	The default cannot capture edges, the line rate set by BL_initComm is
+ * 	kept.
+ *
+ * @param timestamps	Receives the edge times, in BL_get_cycles counts
+ * @param count			Number of edges
+ * @param timeout		Timeout in milliseconds
+ * @return	BL_Status_OK	If every edge was captured
+ * @return	BL_Status_Busy	If no edge came in time
+ * @return	BL_Status_Error	If edges cannot be captured
+ */
+BL_Status_t BL_capture_edges(uint32_t timestamps[], uint32_t count,
+		uint32_t timeout);
+
+/**
+ * @fn BL_Status_t BL_set_baud_rate(uint32_t)
+ * @brief	Changes the line rate, deriving the divisor from the nominal
+ * 	clock that BL_get_cycle_frequency reports. Bytes being transmitted must
+ * 	go out at the old rate first.
+ *
+ * 	The default cannot change the rate.
+ *
+ * @param baud	Rate in bits per second
+ * @return	BL_Status_OK	If the rate was set
+ * @return	BL_Status_Error	If the rate is out of range or cannot be set
+ */
+BL_Status_t BL_set_baud_rate(uint32_t baud);
+
+/**
+ * @fn uint8_t BL_update_requested(void)
+ * @brief	Checks whether the application asked to stay in the bootloader,
+ * 	before anything else is initialized. Ports may keep the request in a
+ * 	backup register instead.
+ *
+ * 	The default checks and clears bl_boot_request, so the next reset starts
+ * 	the application again.
+ *
+ * @return 0	If the application may be started right away
+ * @return Else If update mode was requested
+ */
+uint8_t BL_update_requested(void);
+
+/**
+ * @fn uint32_t BL_get_cycles(void)
+ * @brief	Reads a free running cycle counter, used to time commands and
+ * 	phases for BL_GET_STATS_CMD. Samples longer than one wrap of the counter
+ * 	are not measured correctly.
+ *
+ * 	The default reads DWT CYCCNT on Cortex-M3 and up, enabling it on first
+ * 	use, and returns 0 elsewhere.
+ *
+ * @return	Counter value
+ */
+uint32_t BL_get_cycles(void);
+
+/**
+ * @fn uint32_t BL_get_cycle_frequency(void)
+ * @brief	Rate of the counter read by BL_get_cycles
+ *
+ * 	The default returns BL_VS_CORE_CLOCK_HZ on ARM and 0 elsewhere.
+ *
+ * @return	Counter frequency in Hz, 0 if there is no counter
+ */
+uint32_t BL_get_cycle_frequency(void);
+
+/**
+ * @fn BL_Status_t BL_verify_signature(const uint8_t*, const uint8_t*, uint32_t)
+ * @brief	Checks a signature over the SHA-256 digest of an image with the
+ * 	public key of the product, e.g. Ed25519 with the 32 byte digest as message
+ * 	or ECDSA P-256 over the digest
+ *
+ * 	The default rejects every signature: images cannot be authenticated until
+ * 	the port provides a verifier.
+ *
+ * @param digest		SHA-256 digest of the image, 32 bytes
+ * @param signature		Signature sent by the host
+ * @param signature_len	Length of the signature in bytes
+ * @return	BL_Status_OK	If the signature is valid
+ * @return	BL_Status_Error	If not
+ */
+BL_Status_t BL_verify_signature(const uint8_t *digest,
+		const uint8_t *signature, uint32_t signature_len);
+
 /*******************************************************************************
  *                         Public functions prototypes                    	   *
  *******************************************************************************/
 
 void BL_main();
 
+/**
+ * @fn void BL_HandleCommand(void*)
+ * @brief	Dispatches a received command frame to its handler
+ *
+ * @param buffer	Command frame, starting with BL_CommandHeader_t
+ */
+void BL_HandleCommand(void *buffer);
+
 #endif /* BL_H_ */
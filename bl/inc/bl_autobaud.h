@@ -0,0 +1,68 @@
+/**
+ * @file bl_autobaud.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Line rate detection on the edges of the sync byte
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Sent LSB first in 8N1, the sync byte 0xA5 has 8 edges on the line:
+ *
+ * @code
+ * idle start  1   0   1   0   0   1   0   1  stop
+ * -----+___+---+___+---+_______+---+___+-------
+ *      t0  t1  t2  t3  t4      t5  t6  t7
+ * @endcode
+ *
+ * t7 - t0 spans 8 bit times. The other edges are checked against it, so
+ * other bytes and noise are rejected.
+ *
+ */
+
+#ifndef BL_AUTOBAUD_H_
+#define BL_AUTOBAUD_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Edges of the sync byte */
+#define BL_AUTOBAUD_EDGES (8U)
+
+/** Bit times between the first and the last edge */
+#define BL_AUTOBAUD_SPAN_BITS (8U)
+
+/** Edges may be off from their expected time by 1/N bit */
+#define BL_AUTOBAUD_EDGE_TOLERANCE (4U)
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn BL_Status_t bl_autobaud_measure(const uint32_t[], uint32_t, uint32_t*)
+ * @brief	Calculates the line rate from the edges of a sync byte
+ *
+ * 	The rate is calculated with the nominal counter frequency. A divisor
+ * 	derived from it with the same nominal clock matches the measured bit
+ * 	time, so the error of the clock cancels out.
+ *
+ * @param edges		BL_AUTOBAUD_EDGES timestamps, in counts of a free running
+ * 	counter that may wrap
+ * @param frequency	Nominal rate of the counter in Hz
+ * @param baud		Receives the rate in bits per second
+ * @return	BL_Status_OK	If the edges are the ones of the sync byte
+ * @return	BL_Status_Error	If not
+ */
+BL_Status_t bl_autobaud_measure(const uint32_t edges[BL_AUTOBAUD_EDGES],
+		uint32_t frequency, uint32_t *baud);
+
+#endif /* BL_AUTOBAUD_H_ */
@@ -22,6 +22,15 @@
  */
 #define BL_MAX_BUFFER_SIZE_BYTES (1512U)
 
+/**
+ * @def BL_DATA_BLOCK_SIZE
+ * @brief	Largest data block carried by a data packet. Hosts may negotiate a
+ * 	smaller one with BL_GET_CAPABILITIES_CMD. A data packet must fit in
+ * 	BL_MAX_BUFFER_SIZE_BYTES.
+ *
+ */
+#define BL_DATA_BLOCK_SIZE (1024U)
+
 /**
  * @brief	Enter command mode key value
  *
@@ -33,6 +42,85 @@
  */
 #define BL_JUMP_TO_APP_KEY (0x4032AFE5)
 
+/**
+ * @def BL_FAST_BOOT_ENABLE
+ * @brief	Check for an application before initializing the LED, button and
+ * 	link, and start it right away unless BL_update_requested. Without a
+ * 	valid application, or on request, the bootloader waits for the host.
+ *
+ */
+#define BL_FAST_BOOT_ENABLE (1)
+
+/**
+ * @def BL_AB_SLOTS_ENABLE
+ * @brief	Two application slots and a boot record selecting the active one.
+ * 	The application stages an image into the other slot through BL_API, the
+ * 	bootloader checks it and switches at the next reset. The linker script
+ * 	must provide the symbols listed in bl_slots.h.
+ *
+ */
+#define BL_AB_SLOTS_ENABLE (1)
+
+/**
+ * @def BL_JOURNAL_ENABLE
+ * @brief	Journal the progress of BL_MEM_WRITE_CMD transfers that carry an
+ * 	image ID in reserved flash pages, so the host can resume them after a
+ * 	broken link or a reset with BL_QUERY_PROGRESS_CMD. The linker script
+ * 	must provide the symbol listed in bl_journal.h.
+ *
+ */
+#define BL_JOURNAL_ENABLE (1)
+
+/**
+ * @def BL_JOURNAL_INTERVAL_PAGES
+ * @brief	Pages programmed between two journal entries: the most a host
+ * 	sends again after resuming, against wear of the journal pages
+ *
+ */
+#define BL_JOURNAL_INTERVAL_PAGES (4U)
+
+/**
+ * @def BL_COMMAND_TIMEOUT_MS
+ * @brief	Command window: how long the bootloader waits for the host to
+ * 	synchronize before it starts the application. Applies on request, or at
+ * 	every boot without BL_FAST_BOOT_ENABLE.
+ *
+ */
+#define BL_COMMAND_TIMEOUT_MS (5000U)
+
+/**
+ * @def BL_DEFAULT_BAUD_RATE
+ * @brief	Line rate set by BL_initComm (Vendor specific)
+ *
+ */
+#define BL_DEFAULT_BAUD_RATE (115200U)
+
+/**
+ * @def BL_AUTOBAUD_ENABLE
+ * @brief	Measure the line rate on the sync byte with BL_capture_edges and
+ * 	switch to it with BL_set_baud_rate, so the host may open the link at any
+ * 	rate. Ports without edge capture keep the rate set by BL_initComm.
+ *
+ */
+#define BL_AUTOBAUD_ENABLE (1)
+
+/**
+ * @def BL_LINK_SPEED_ENABLE
+ * @brief	Let the host switch the line rate with BL_SET_LINK_SPEED_CMD,
+ * 	through BL_set_baud_rate
+ *
+ */
+#define BL_LINK_SPEED_ENABLE (1)
+
+/**
+ * @def BL_LINK_SPEED_TIMEOUT_MS
+ * @brief	After switching the line rate, the bootloader waits this long for
+ * 	the sync byte of the host at the new rate, then goes back to the previous
+ * 	rate
+ *
+ */
+#define BL_LINK_SPEED_TIMEOUT_MS (200U)
+
 /**
  * @def BL_MAX_RETRIES
  * @brief	Max retries that a host can try or re-send a sub-command data
@@ -40,6 +128,120 @@
  */
 #define BL_MAX_RETRIES (5)
 
+/**
+ * @def BL_MAX_WRITE_WINDOW
+ * @brief	Maximum number of data packets the host may have in flight during a
+ * 	windowed write. Bounded by how many packets the receive path of the port
+ * 	can buffer while a block is being programmed. At most 32.
+ *
+ */
+#define BL_MAX_WRITE_WINDOW (4U)
+
+/**
+ * @def BL_MAX_READ_WINDOW
+ * @brief	Maximum number of data packets in flight during a windowed read.
+ * 	Blocks are sent straight from flash, so only the host limits it. At
+ * 	most 32.
+ *
+ */
+#define BL_MAX_READ_WINDOW (16U)
+
+/**
+ * @def BL_BATCH_RESULTS_SIZE_BYTES
+ * @brief	Room for the result vector of a BL_BATCH_CMD
+ *
+ */
+#define BL_BATCH_RESULTS_SIZE_BYTES (128U)
+
+/**
+ * @def BL_RX_RING_ENABLE
+ * @brief	Receive through a ring fed by BL_receiveInterrupt (or bl_ring_write
+ * 	from a DMA port) instead of polling BL_receive. Commands are handled in
+ * 	place in the ring.
+ *
+ */
+#define BL_RX_RING_ENABLE (1)
+
+/**
+ * @def BL_RX_RING_SIZE_BYTES
+ * @brief	Size of the receive ring, a power of two of at least
+ * 	BL_MAX_BUFFER_SIZE_BYTES. The first BL_MAX_BUFFER_SIZE_BYTES are
+ * 	mirrored, so the ring uses BL_RX_RING_SIZE_BYTES + BL_MAX_BUFFER_SIZE_BYTES
+ * 	of RAM. Windowed writes run at full rate when the ring holds
+ * 	BL_MAX_WRITE_WINDOW data packets, bytes lost to a full ring are resent
+ * 	through selective repeat.
+ *
+ */
+#define BL_RX_RING_SIZE_BYTES (2048U)
+
+/**
+ * @def BL_RX_RESYNC_IDLE_MS
+ * @brief	After a frame with an invalid size, received bytes are dropped until
+ * 	the line has been idle this long, so reception starts over at the beginning
+ * 	of a frame and not in the middle of one the host is still sending. Must be
+ * 	shorter than the time the host waits for an ACK.
+ *
+ */
+#define BL_RX_RESYNC_IDLE_MS (2U)
+
+/**
+ * @def BL_RECEIVE_CHUNK_BYTES
+ * @brief	Data packets are received in chunks of this size, flash operations
+ * 	are advanced between chunks. The receive path of the port must buffer
+ * 	incoming bytes between BL_receive calls.
+ *
+ */
+#define BL_RECEIVE_CHUNK_BYTES (128U)
+
+/**
+ * @def BL_WRITE_COMBINE_ENABLE
+ * @brief	Collect the blocks of memory writes into a page buffer and program
+ * 	each page in one burst of whole BL_VS_FLASH_PROGRAM_UNIT_BYTES units,
+ * 	whatever the size and alignment of the blocks. Takes two pages of RAM.
+ *
+ */
+#define BL_WRITE_COMBINE_ENABLE (1)
+
+/**
+ * @def BL_STATS_ENABLE
+ * @brief	Time commands, CRCs, flash operations and receive waits with
+ * 	BL_get_cycles and report them through BL_GET_STATS_CMD
+ *
+ */
+#define BL_STATS_ENABLE (1)
+
+/**
+ * @def BL_STATS_CMD_SLOTS
+ * @brief	Commands are timed by ID, IDs from this value up are not. Every
+ * 	slot takes 20 bytes of RAM.
+ *
+ */
+#define BL_STATS_CMD_SLOTS (32U)
+
+/**
+ * @def BL_SIGNATURE_ENABLE
+ * @brief	Hash the data of BL_MEM_WRITE_CMD with SHA-256 while it is written,
+ * 	so BL_VERIFY_SIGNATURE_CMD authenticates the image without reading the
+ * 	flash again
+ *
+ */
+#define BL_SIGNATURE_ENABLE (1)
+
+/**
+ * @def BL_SIGNATURE_MAX_BYTES
+ * @brief	Largest signature accepted by BL_VERIFY_SIGNATURE_CMD. Ed25519 and
+ * 	raw (r, s) ECDSA P-256 signatures are 64 bytes.
+ *
+ */
+#define BL_SIGNATURE_MAX_BYTES (64U)
+
+/**
+ * @def BL_VS_CORE_CLOCK_HZ
+ * @brief	Core clock, the rate of the default cycle counter (Vendor specific)
+ *
+ */
+#define BL_VS_CORE_CLOCK_HZ (72000000U)
+
 /**
  * @brief	Maximum page size for bootloader (Vendor specific)
  *
@@ -60,4 +262,24 @@
  */
 #define BL_VS_FLASH_END_ADDRESS (0x08007FFF)
 
+/**
+ * @def BL_VS_FLASH_PROGRAM_UNIT_BYTES
+ * @brief	Smallest amount of flash programmed at once, e.g. a double word or
+ * 	a row. Multiple of 4 that divides the page size (Vendor specific)
+ *
+ */
+#define BL_VS_FLASH_PROGRAM_UNIT_BYTES (8U)
+
+/**
+ * @def BL_CRC_ENGINE
+ * @brief	CRC32 engine used for command and data packet checks, one of the
+ * 	BL_CRC_ENGINE_xxx values in bl_crc.h. Trades flash for speed:
+ * 	BITWISE (no table) < NIBBLE (64 B) < TABLE (1 KiB) < SLICE8 (8 KiB),
+ * 	HW uses the vendor CRC peripheral.
+ *
+ */
+#ifndef BL_CRC_ENGINE
+#define BL_CRC_ENGINE (BL_CRC_ENGINE_TABLE)
+#endif
+
 #endif /* BL_CFG_H_ */
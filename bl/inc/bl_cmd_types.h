@@ -16,11 +16,11 @@
  *                              Includes                                       *
  *******************************************************************************/
 
+#include "bl_cfg.h"
 #include <stdint.h>
 
 #define BL_PACKED_ALIGNED __attribute__((packed, aligned(1)))
 
-#define BL_DATA_BLOCK_SIZE (1024U)
 /*******************************************************************************
  *							Typedefs						        		   *
  *******************************************************************************/
@@ -42,6 +42,20 @@ typedef enum
 	BL_ENTER_CMD_MODE_CMD_ID,	/**< BL_ENTER_CMD_MODE_CMD_ID */
 	BL_JUMP_TO_APP_CMD_ID,		/**< BL_JUMP_TO_APP_CMD_ID */
 	BL_DATA_PACKET_CMD_ID,		/**< BL_DATA_PACKET_CMD_ID */
+	BL_MEM_WRITE_EX_CMD_ID,		/**< BL_MEM_WRITE_EX_CMD_ID */
+	BL_SEQ_DATA_PACKET_CMD_ID,	/**< BL_SEQ_DATA_PACKET_CMD_ID */
+	BL_GET_CAPABILITIES_CMD_ID,	/**< BL_GET_CAPABILITIES_CMD_ID */
+	BL_PATCH_CMD_ID,			/**< BL_PATCH_CMD_ID */
+	BL_MEM_WRITE_LZ_CMD_ID,		/**< BL_MEM_WRITE_LZ_CMD_ID */
+	BL_PAGE_CRC_CMD_ID,			/**< BL_PAGE_CRC_CMD_ID */
+	BL_BATCH_CMD_ID,			/**< BL_BATCH_CMD_ID */
+	BL_MEM_READ_EX_CMD_ID,		/**< BL_MEM_READ_EX_CMD_ID */
+	BL_GET_STATS_CMD_ID,		/**< BL_GET_STATS_CMD_ID */
+	BL_VERIFY_SIGNATURE_CMD_ID,	/**< BL_VERIFY_SIGNATURE_CMD_ID */
+	BL_SET_LINK_SPEED_CMD_ID,	/**< BL_SET_LINK_SPEED_CMD_ID */
+	BL_QUERY_PROGRESS_CMD_ID,	/**< BL_QUERY_PROGRESS_CMD_ID */
+	BL_APP_CMD_ID_FIRST = 0x80,	/**< First ID of product commands, see BL_COMMAND */
+	BL_APP_CMD_ID_LAST = 0xFE,	/**< Last ID of product commands */
 	BL_RESPONSE_CMD_ID = 0xFF	/**< BL_RESPONSE_CMD_ID */
 } BL_CommandID_t;
 
@@ -63,6 +77,49 @@ typedef enum
 	BL_NACK_OPERATION_FAILURE = 1 << 6 /**< BL_NACK_OPERATION_FAILURE */
 } BL_NACK_t;
 
+/**
+ * @enum BL_Feature_t
+ * @brief	Protocol features reported by BL_GET_CAPABILITIES_CMD
+ *
+ */
+typedef enum {
+	BL_FEATURE_WINDOWED_WRITE = 1 << 0,	 /**< BL_MEM_WRITE_EX_CMD */
+	BL_FEATURE_SELECTIVE_REPEAT = 1 << 1, /**< Selective repeat of missing packets */
+	BL_FEATURE_PATCH = 1 << 2,			  /**< BL_PATCH_CMD */
+	BL_FEATURE_LZ_WRITE = 1 << 3,		  /**< BL_MEM_WRITE_LZ_CMD */
+	BL_FEATURE_PAGE_CRC = 1 << 4,		  /**< BL_PAGE_CRC_CMD */
+	BL_FEATURE_AUTO_ERASE = 1 << 5,		  /**< BL_WRITE_FLAG_AUTO_ERASE */
+	BL_FEATURE_BATCH = 1 << 6,			  /**< BL_BATCH_CMD */
+	BL_FEATURE_WINDOWED_READ = 1 << 7,	  /**< BL_MEM_READ_EX_CMD */
+	BL_FEATURE_STATS = 1 << 8,			  /**< BL_GET_STATS_CMD */
+	BL_FEATURE_SIGNATURE = 1 << 9,		  /**< BL_VERIFY_SIGNATURE_CMD */
+	BL_FEATURE_LINK_SPEED = 1 << 10,	  /**< BL_SET_LINK_SPEED_CMD */
+	BL_FEATURE_AB_SLOTS = 1 << 11,		  /**< Application region is the active slot */
+	BL_FEATURE_JOURNAL = 1 << 12		  /**< BL_QUERY_PROGRESS_CMD */
+} BL_Feature_t;
+
+/**
+ * @enum BL_StatsPhase_t
+ * @brief	Operations timed across all commands, reported by BL_GET_STATS_CMD
+ *
+ */
+typedef enum {
+	BL_STATS_PHASE_CRC,			/**< CRC of a command or data packet */
+	BL_STATS_PHASE_FLASH_WRITE, /**< Programming a block, until completion */
+	BL_STATS_PHASE_FLASH_ERASE, /**< Erasing pages, until completion */
+	BL_STATS_PHASE_RECEIVE,		/**< Waiting for a data packet or an ACK */
+	BL_STATS_PHASE_COUNT
+} BL_StatsPhase_t;
+
+/**
+ * @enum BL_WriteFlag_t
+ * @brief	Flags of BL_MEM_WRITE_CMD and BL_MEM_WRITE_EX_CMD
+ *
+ */
+typedef enum {
+	BL_WRITE_FLAG_AUTO_ERASE = 1 << 0 /**< Erase pages of the range on first write */
+} BL_WriteFlag_t;
+
 /* Received commands */
 
 /**
@@ -114,14 +171,44 @@ typedef union BL_PACKED_ALIGNED
  */
 typedef union BL_PACKED_ALIGNED
 {
-	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 4];
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 17];
 	struct BL_PACKED_ALIGNED
 	{
 		BL_CommandHeader_t header;
 		uint32_t start_address;
+		/* Optional, older hosts send the command without them */
+		uint8_t flags;	 /**< BL_WriteFlag_t */
+		uint32_t length; /**< Length of the written range */
+		uint32_t image_id;	/**< Journals the progress if not 0 */
+		uint32_t image_crc; /**< CRC32 of the whole image */
 	} data;
 } BL_MEM_WRITE_CMD;
 
+/** Size of BL_MEM_WRITE_CMD without the optional fields */
+#define BL_MEM_WRITE_CMD_LEGACY_SIZE (sizeof(BL_CommandHeader_t) + 4)
+
+/** Size of BL_MEM_WRITE_CMD without the image fields */
+#define BL_MEM_WRITE_CMD_NO_IMAGE_SIZE (sizeof(BL_CommandHeader_t) + 9)
+
+/**
+ * @union BL_MEM_WRITE_EX_CMD
+ * @brief Union representing the received "MEM WRITE EX" command (windowed
+ * 	write).
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 10];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t start_address;
+		uint8_t window;	 /**< Requested number of packets in flight */
+		uint8_t flags;	 /**< BL_WriteFlag_t */
+		uint32_t length; /**< Length of the written range */
+	} data;
+} BL_MEM_WRITE_EX_CMD;
+
 /**
  * @union BL_MEM_READ_CMD
  * @brief Union representing the received "MEM READ" command.
@@ -138,6 +225,71 @@ typedef union BL_PACKED_ALIGNED
 	} data;
 } BL_MEM_READ_CMD;
 
+/**
+ * @union BL_MEM_READ_EX_CMD
+ * @brief Union representing the received "MEM READ EX" command (windowed
+ * 	read).
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 9];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t start_addr; /**< Start address */
+		uint32_t length;	 /**< Length of data to read */
+		uint8_t window;		 /**< Packets the host can take in flight */
+	} data;
+} BL_MEM_READ_EX_CMD;
+
+/**
+ * @union BL_PAGE_CRC_CMD
+ * @brief Union representing the received "PAGE CRC" command.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 8];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t start_address; /**< Page aligned start address */
+		uint32_t page_count;	/**< Page count, 0 for the whole application */
+	} data;
+} BL_PAGE_CRC_CMD;
+
+/**
+ * @union BL_BATCH_CMD
+ * @brief Union representing the received "BATCH" command. It is followed by
+ * 	'count' complete sub-command frames, each with its own header and CRC.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 1];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint8_t count; /**< Number of sub-commands */
+	} data;
+} BL_BATCH_CMD;
+
+/**
+ * @union BL_GET_STATS_CMD
+ * @brief Union representing the received "GET STATS" command.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 1];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint8_t reset; /**< Non-zero to clear the statistics once sent */
+	} data;
+} BL_GET_STATS_CMD;
+
 /**
  * @union BL_FLASH_ERASE_CMD
  * @brief Union representing the received "FLASH ERASE" command.
@@ -168,6 +320,57 @@ typedef union BL_PACKED_ALIGNED
 	} data;
 } BL_VER_CMD;
 
+/**
+ * @union BL_GET_CAPABILITIES_CMD
+ * @brief Union representing the received "GET CAPABILITIES" command.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 4];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t max_block_size; /**< Largest block the host supports, 0 for any */
+	} data;
+} BL_GET_CAPABILITIES_CMD;
+
+/**
+ * @union BL_PATCH_CMD
+ * @brief Union representing the received "PATCH" command.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 16];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t old_length; /**< Length of the installed image */
+		uint32_t old_crc;	 /**< CRC32 of the installed image */
+		uint32_t new_length; /**< Length of the new image */
+		uint32_t new_crc;	 /**< CRC32 of the new image */
+	} data;
+} BL_PATCH_CMD;
+
+/**
+ * @union BL_MEM_WRITE_LZ_CMD
+ * @brief Union representing the received "MEM WRITE LZ" command (LZ4
+ * 	compressed write).
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 12];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t start_address; /**< Page aligned start address */
+		uint32_t length;		/**< Decompressed length */
+		uint32_t crc;			/**< CRC32 of the decompressed data */
+	} data;
+} BL_MEM_WRITE_LZ_CMD;
+
 /**
  * @union	BL_DATA_PACKET_CMD
  * @brief	Union representing the received "DATA PACKET" command.
@@ -186,6 +389,63 @@ typedef union BL_PACKED_ALIGNED
 	} data;
 } BL_DATA_PACKET_CMD;
 
+/**
+ * @union	BL_DATA_PACKET_HEADER
+ * @brief	Fixed part of BL_DATA_PACKET_CMD, sent ahead of a data block that is
+ * 	not copied into the packet.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 9];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t data_len;
+		uint32_t next_len;
+		uint8_t end_flag;
+	} data;
+} BL_DATA_PACKET_HEADER;
+
+/**
+ * @union	BL_SEQ_DATA_PACKET_CMD
+ * @brief	Union representing the received "SEQ DATA PACKET" command, used by
+ * 	the windowed write.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + BL_DATA_BLOCK_SIZE + 13];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t seq;		/**< Packet sequence number, starts at 0 */
+		uint32_t offset;	/**< Byte offset of the block from the start address */
+		uint32_t data_len;
+		uint8_t end_flag;
+		uint8_t data_block[BL_DATA_BLOCK_SIZE];
+	} data;
+} BL_SEQ_DATA_PACKET_CMD;
+
+/**
+ * @union	BL_SEQ_DATA_PACKET_HEADER
+ * @brief	Fixed part of BL_SEQ_DATA_PACKET_CMD, sent ahead of a data block
+ * 	that is not copied into the packet.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 13];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t seq;
+		uint32_t offset;
+		uint32_t data_len;
+		uint8_t end_flag;
+	} data;
+} BL_SEQ_DATA_PACKET_HEADER;
+
 /**
  * @union	BL_JUMP_TO_APP_CMD
  * @brief	Union representing the received "JUMP TO APP" command.
@@ -201,6 +461,35 @@ typedef union BL_PACKED_ALIGNED
 	} data;
 } BL_JUMP_TO_APP_CMD;
 
+/**
+ * @union	BL_SET_LINK_SPEED_CMD
+ * @brief	Union representing the received "SET LINK SPEED" command.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 4];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t baud_rate; /**< Proposed line rate in bits per second */
+	} data;
+} BL_SET_LINK_SPEED_CMD;
+
+/**
+ * @union	BL_QUERY_PROGRESS_CMD
+ * @brief	Union representing the received "QUERY PROGRESS" command.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t)];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+	} data;
+} BL_QUERY_PROGRESS_CMD;
+
 /* Sent data */
 
 /**
@@ -219,6 +508,24 @@ typedef union BL_PACKED_ALIGNED
 	} data;
 } BL_ACK;
 
+/**
+ * @union BL_WINDOW_ACK
+ * @brief Union representing the sent cumulative ACK of the windowed write.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[11];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandID_t cmd_id; /**< Command ID */
+		uint8_t ack;		   /**< ACK value */
+		BL_NACK_t field;	   /**< NACK field */
+		uint32_t next_seq;	   /**< First sequence number not yet received */
+		uint32_t missing;	   /**< Bit i set: packet next_seq + i is missing */
+	} data;
+} BL_WINDOW_ACK;
+
 /**
  * @union BL_Response
  * @brief Union representing the response data.
@@ -234,6 +541,161 @@ typedef union BL_PACKED_ALIGNED
 	} data;
 } BL_Response;
 
+/**
+ * @union BL_CAPABILITIES_RESPONSE
+ * @brief Union representing the response to "GET CAPABILITIES".
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 38];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint8_t version;		  /**< Bootloader version */
+		uint8_t max_window;		  /**< Deepest windowed write */
+		uint32_t features;		  /**< Bitwise OR of BL_Feature_t */
+		uint32_t block_size;	  /**< Negotiated data block size */
+		uint32_t max_block_size;  /**< Largest supported data block size */
+		uint32_t max_packet_size; /**< Largest packet, header included */
+		uint32_t page_size;		  /**< Flash page size */
+		uint32_t flash_start;	  /**< Flash start address */
+		uint32_t flash_end;		  /**< Flash end address */
+		uint32_t app_start;		  /**< Application region start address */
+		uint32_t app_end;		  /**< Application region end address */
+	} data;
+} BL_CAPABILITIES_RESPONSE;
+
+/**
+ * @struct BL_BATCH_RESULT
+ * @brief Result of one sub-command of a batch: its ACKs merged into one,
+ * 	followed by the data of the responses it sent.
+ *
+ */
+typedef struct BL_PACKED_ALIGNED
+{
+	BL_CommandID_t cmd_id; /**< Sub-command ID */
+	uint8_t ack;		   /**< 1 if every ACK of the sub-command was positive */
+	uint8_t field;		   /**< NACK fields of all its ACKs */
+	uint8_t data_len;	   /**< Length of the response data that follows */
+} BL_BATCH_RESULT;
+
+/**
+ * @union BL_BATCH_RESPONSE
+ * @brief Union representing the result vector of a "BATCH" command.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 2
+			+ BL_BATCH_RESULTS_SIZE_BYTES];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint8_t count;	   /**< Number of results */
+		uint8_t truncated; /**< 1 if response data did not fit */
+		uint8_t results[BL_BATCH_RESULTS_SIZE_BYTES]; /**< BL_BATCH_RESULT
+		 entries, each followed by its data */
+	} data;
+} BL_BATCH_RESPONSE;
+
+/**
+ * @struct BL_STATS_ENTRY
+ * @brief Timing of one command or phase, in cycles of BL_get_cycles
+ *
+ */
+typedef struct BL_PACKED_ALIGNED
+{
+	uint32_t count; /**< Number of samples */
+	uint32_t min;	/**< Shortest sample, 0 if there is none */
+	uint32_t max;	/**< Longest sample */
+	uint64_t total; /**< Sum of the samples */
+} BL_STATS_ENTRY;
+
+/**
+ * @union BL_STATS_RESPONSE
+ * @brief Union representing the response to "GET STATS".
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 14
+			+ (BL_STATS_PHASE_COUNT + BL_STATS_CMD_SLOTS)
+					* sizeof(BL_STATS_ENTRY)];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t cycle_frequency; /**< Rate of the cycle counter in Hz, 0 if
+		 commands are counted but not timed */
+		uint32_t crc_failures;	  /**< Commands and packets with a bad CRC */
+		uint32_t retries;		  /**< Packets received or sent again */
+		uint8_t phase_count;	  /**< BL_STATS_PHASE_COUNT */
+		uint8_t cmd_slots;		  /**< BL_STATS_CMD_SLOTS */
+		BL_STATS_ENTRY phases[BL_STATS_PHASE_COUNT]; /**< By BL_StatsPhase_t */
+		BL_STATS_ENTRY commands[BL_STATS_CMD_SLOTS]; /**< By command ID */
+	} data;
+} BL_STATS_RESPONSE;
+
+/**
+ * @union BL_VERIFY_SIGNATURE_CMD
+ * @brief Union representing the received "VERIFY SIGNATURE" command. The
+ * 	frame ends with the signature, it is signature_len bytes shorter than the
+ * 	union when the signature is shorter than BL_SIGNATURE_MAX_BYTES.
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 9
+			+ BL_SIGNATURE_MAX_BYTES];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t start_address; /**< Start address of the signed image */
+		uint32_t length;		/**< Length of the signed image */
+		uint8_t signature_len;	/**< Length of the signature in bytes */
+		uint8_t signature[BL_SIGNATURE_MAX_BYTES]; /**< Signature over the
+		 SHA-256 digest of the image */
+	} data;
+} BL_VERIFY_SIGNATURE_CMD;
+
+/** Size of BL_VERIFY_SIGNATURE_CMD without the signature */
+#define BL_VERIFY_SIGNATURE_CMD_MIN_SIZE (sizeof(BL_CommandHeader_t) + 9)
+
+/**
+ * @union BL_VERIFY_SIGNATURE_RESPONSE
+ * @brief Union representing the response to "VERIFY SIGNATURE".
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 33];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint8_t valid;		/**< 1 if the signature matches the image */
+		uint8_t digest[32]; /**< SHA-256 of the image as written */
+	} data;
+} BL_VERIFY_SIGNATURE_RESPONSE;
+
+/**
+ * @union BL_PROGRESS_RESPONSE
+ * @brief Union representing the response to "QUERY PROGRESS".
+ *
+ */
+typedef union BL_PACKED_ALIGNED
+{
+	uint8_t serialized_data[sizeof(BL_CommandHeader_t) + 20];
+	struct BL_PACKED_ALIGNED
+	{
+		BL_CommandHeader_t header;
+		uint32_t image_id;		/**< Image of the last journaled write, 0 if none */
+		uint32_t image_crc;		/**< CRC32 of the whole image */
+		uint32_t start_address; /**< Start address of the image */
+		uint32_t length;		/**< Length of the image */
+		uint32_t committed;		/**< Bytes from the start known to be programmed */
+	} data;
+} BL_PROGRESS_RESPONSE;
+
 /**
  * @struct BL_Response_data
  * @brief Structure representing the response data with crc.
@@ -0,0 +1,144 @@
+/**
+ * @file bl_commands.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Command registry, built from descriptors linked into a section
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Every command is described by a BL_CommandDesc_t placed in the bl_commands
+ * section with BL_COMMAND. The core commands are registered in bl_handlers.c;
+ * a product adds its own commands by registering them in any linked source
+ * file, without editing the core:
+ *
+ * @code
+ * static void my_handler(MY_CMD *cmd) { ... }
+ * BL_COMMAND(MY_CMD_ID, my_handler, sizeof(MY_CMD), "MY", 0);
+ * @endcode
+ *
+ * The dispatcher checks the length and CRC of a command before its handler
+ * runs, and sends a negative ACK for a frame that fails either check.
+ *
+ * Firmware linker scripts must keep the section in flash, e.g. in SECTIONS:
+ *
+ * @code
+ * bl_commands : { KEEP(*(bl_commands)) } > FLASH
+ * @endcode
+ *
+ */
+
+#ifndef BL_COMMANDS_H_
+#define BL_COMMANDS_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include "bl_cmd_types.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/**
+ * @def BL_COMMAND
+ * @brief	Registers a command handler
+ *
+ * @param id_			Command ID, BL_APP_CMD_ID_FIRST and up for product
+ * 	commands
+ * @param handler_		Handler, taking a pointer to the command frame
+ * @param min_length_	Smallest accepted payload_size
+ * @param name_			Name printed in the debug logs, without "CMD"
+ * @param flags_		BL_CommandFlag_t
+ */
+#define BL_COMMAND(id_, handler_, min_length_, name_, flags_) \
+	static const BL_CommandDesc_t bl_command_desc_##handler_ \
+	__attribute__((section("bl_commands"), used, \
+			aligned(__alignof__(BL_CommandDesc_t)))) = { \
+		.id = (id_), \
+		.flags = (flags_), \
+		.min_length = (min_length_), \
+		.handler = (BL_CommandHandler_t) (handler_), \
+		.name = (name_) \
+	}
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @enum	BL_CommandFlag_t
+ * @brief	Properties of a registered command
+ *
+ */
+typedef enum {
+	/** Exchanges data packets with the host, not only ACKs and responses, so
+	 * it can only be the last command of a batch and is copied out of the
+	 * receive ring before it runs */
+	BL_CMD_FLAG_DATA_PHASE = 1 << 0,
+} BL_CommandFlag_t;
+
+/**
+ * @brief	Command handler, called with the validated command frame
+ *
+ */
+typedef void (*BL_CommandHandler_t)(void *cmd);
+
+/**
+ * @struct	BL_CommandDesc_t
+ * @brief	Descriptor of a registered command
+ *
+ */
+typedef struct {
+	uint8_t id; /**< Command ID */
+	uint8_t flags; /**< BL_CommandFlag_t */
+	uint16_t min_length; /**< Smallest accepted payload_size */
+	BL_CommandHandler_t handler; /**< Handler */
+	const char *name; /**< Name printed in the debug logs */
+} BL_CommandDesc_t;
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_commands_init(void)
+ * @brief	Builds the ID lookup table from the registered descriptors
+ *
+ */
+void bl_commands_init(void);
+
+/**
+ * @fn const BL_CommandDesc_t bl_command_find*(uint8_t)
+ * @brief	Looks up the descriptor of a command
+ *
+ * @param id	Command ID
+ * @return	The descriptor, or NULL if no command is registered with this ID
+ */
+const BL_CommandDesc_t* bl_command_find(uint8_t id);
+
+/**
+ * @fn uint8_t bl_has_data_phase(uint8_t)
+ * @brief	Checks whether a command exchanges more than ACKs and responses with
+ * 	the host (data packets), so it cannot run inside a batch
+ *
+ * @param id	Command ID
+ * @return	1 if the command transfers data packets
+ */
+uint8_t bl_has_data_phase(uint8_t id);
+
+/**
+ * @fn BL_NACK_t bl_command_validate(const BL_CommandDesc_t*, uint8_t*)
+ * @brief	Checks the length and CRC of a command frame
+ *
+ * @param desc	Descriptor of the command
+ * @param frame	Command frame, starting with BL_CommandHeader_t
+ * @return	BL_NACK_SUCCESS or the errored fields
+ */
+BL_NACK_t bl_command_validate(const BL_CommandDesc_t *desc,
+		uint8_t *frame);
+
+#endif /* BL_COMMANDS_H_ */
@@ -32,6 +32,15 @@
  */
 BL_Status_t BL_send_response(BL_Response *response);
 
+/**
+ * @fn BL_Status_t BL_send_frame(uint8_t*)
+ * @brief   Sends any framed response, its header holds the size to send
+ *
+ * @param frame	Frame starting with BL_CommandHeader_t
+ * @return BL_Status_t
+ */
+BL_Status_t BL_send_frame(uint8_t *frame);
+
 /**
  * @brief   Sends an ack
  *
@@ -43,6 +52,34 @@ BL_Status_t BL_send_response(BL_Response *response);
 BL_Status_t BL_send_ack(BL_CommandID_t id, uint8_t ack_value,
 		uint8_t nack_field);
 
+/**
+ * @fn BL_Status_t BL_send_window_ack(BL_CommandID_t, uint8_t, uint8_t, uint32_t)
+ * @brief   Sends a cumulative ack of the windowed write
+ *
+ * @param id        Command ID which is acked
+ * @param ack_value Ack value (0 for no ack, 1 for ack)
+ * @param nack_field Nack field (bitwise OR of the NACK fields)
+ * @param next_seq	First sequence number not yet received, every packet
+ * 	before it has been written
+ * @param missing	Bitmap of the packets to resend, bit i is packet
+ * 	next_seq + i
+ * @return BL_Status_t
+ */
+BL_Status_t BL_send_window_ack(BL_CommandID_t id, uint8_t ack_value,
+		uint8_t nack_field, uint32_t next_seq, uint32_t missing);
+
+/**
+ * @fn BL_Status_t BL_receive_packet(uint8_t*, uint32_t)
+ * @brief	Receives a framed packet: polls for the command header, then
+ * 	receives the rest of the payload announced in the header.
+ *
+ * @param buffer	Buffer to receive into, starts with BL_CommandHeader_t
+ * @param max_size	Size of the buffer in bytes
+ * @return BL_Status_OK	If a complete packet was received
+ * @return BL_Status_Error If the announced payload size is invalid
+ */
+BL_Status_t BL_receive_packet(uint8_t *buffer, uint32_t max_size);
+
 /**
  * @fn BL_Status_t BL_receive_ack(void)
  * @brief 	Attempts to receive an acknowledgment from the host.
@@ -52,6 +89,45 @@ BL_Status_t BL_send_ack(BL_CommandID_t id, uint8_t ack_value,
  */
 BL_Status_t BL_receive_ack(void);
 
+/**
+ * @fn BL_Status_t BL_send_data_packet(const uint8_t*, uint32_t, uint32_t, uint8_t)
+ * @brief	Sends a data packet whose block is transmitted straight from its
+ * 	location (e.g. flash), only the packet header is built in RAM
+ *
+ * @param data		Data block
+ * @param data_len	Length of the data block
+ * @param next_len	Size of the next packet, 0 if none
+ * @param end_flag	1 for the last packet
+ * @return BL_Status_t
+ */
+BL_Status_t BL_send_data_packet(const uint8_t *data, uint32_t data_len,
+		uint32_t next_len, uint8_t end_flag);
+
+/**
+ * @fn BL_Status_t BL_send_seq_data_packet(uint32_t, uint32_t, const uint8_t*, uint32_t, uint8_t)
+ * @brief	Sends a sequenced data packet of a windowed read, its block is
+ * 	transmitted straight from its location
+ *
+ * @param seq		Packet sequence number
+ * @param offset	Byte offset of the block from the start address
+ * @param data		Data block
+ * @param data_len	Length of the data block
+ * @param end_flag	1 for the last packet
+ * @return BL_Status_t
+ */
+BL_Status_t BL_send_seq_data_packet(uint32_t seq, uint32_t offset,
+		const uint8_t *data, uint32_t data_len, uint8_t end_flag);
+
+/**
+ * @fn BL_Status_t BL_receive_window_ack(BL_WINDOW_ACK*)
+ * @brief	Receives a cumulative ack of a windowed read from the host
+ *
+ * @param ack	Receives the ack
+ * @return BL_Status_OK	If an ack was received in time
+ * @return BL_Status_Error If no ack was received
+ */
+BL_Status_t BL_receive_window_ack(BL_WINDOW_ACK *ack);
+
 /**
  * @fn BL_Status_t BL_send_packet(BL_DATA_PACKET_CMD*)
  * @brief
@@ -68,4 +144,23 @@ BL_Status_t BL_send_packet(BL_DATA_PACKET_CMD *packet);
  */
 BL_Status_t BL_receive_ack();
 
+/**
+ * @fn void BL_capture_begin(BL_BATCH_RESULT*, uint32_t)
+ * @brief	Captures what a command sends into a batch result instead of
+ * 	sending it: ACKs are merged into the result, the data of responses is
+ * 	appended after it.
+ *
+ * @param result		Result to fill
+ * @param max_data_len	Room for response data after the result
+ */
+void BL_capture_begin(BL_BATCH_RESULT *result, uint32_t max_data_len);
+
+/**
+ * @fn uint8_t BL_capture_end(void)
+ * @brief	Stops capturing
+ *
+ * @return	1 if response data was dropped for lack of room
+ */
+uint8_t BL_capture_end(void);
+
 #endif
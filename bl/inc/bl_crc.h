@@ -0,0 +1,111 @@
+/**
+ * @file bl_crc.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   CRC32 engine (IEEE 802.3, reflected, polynomial 0xEDB88320)
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef BL_CRC_H_
+#define BL_CRC_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/**
+ * @brief	Available CRC engines, selected with BL_CRC_ENGINE in bl_cfg.h
+ *
+ * - BITWISE:	8 shift/xor iterations per byte, no table
+ * - NIBBLE:	16-entry table (64 bytes), 2 lookups per byte
+ * - TABLE:		256-entry table (1 KiB), 1 lookup per byte
+ * - SLICE8:	8x256-entry tables (8 KiB), 8 bytes per iteration
+ * - HW:		Vendor CRC peripheral through BL_crc32_hw_update()
+ */
+#define BL_CRC_ENGINE_BITWISE (0)
+#define BL_CRC_ENGINE_NIBBLE (1)
+#define BL_CRC_ENGINE_TABLE (2)
+#define BL_CRC_ENGINE_SLICE8 (3)
+#define BL_CRC_ENGINE_HW (4)
+
+#define BL_CRC32_INIT_VALUE (0xFFFFFFFFU)
+
+/*******************************************************************************
+ *                         Weak public functions prototypes                    *
+ *******************************************************************************/
+
+/**
+ * @fn uint32_t BL_crc32_hw_update(uint32_t, const uint8_t*, uint32_t)
+ * @brief	Feeds a buffer to a hardware CRC peripheral. Only used when
+ * 	BL_CRC_ENGINE is BL_CRC_ENGINE_HW.
+ *
+ * 	The peripheral must be configured for the reflected CRC32 (input and
+ * 	output reflection, polynomial 0x04C11DB7) and must continue from the
+ * 	given running value. The default implementation falls back to the
+ * 	software table engine.
+ *
+ * @param crc	Running (non-finalized) CRC value
+ * @param data	Data buffer
+ * @param len	Length of the data in bytes
+ * @return	Updated running CRC value
+ */
+uint32_t BL_crc32_hw_update(uint32_t crc, const uint8_t *data,
+		uint32_t len);
+
+/*******************************************************************************
+ *                            Public functions                                 *
+ *******************************************************************************/
+
+/**
+ * @fn uint32_t bl_crc32_init(void)
+ * @brief	Returns the initial running CRC value
+ *
+ * @return	Initial running CRC value
+ */
+static inline uint32_t bl_crc32_init(void) {
+	return BL_CRC32_INIT_VALUE;
+}
+
+/**
+ * @fn uint32_t bl_crc32_update(uint32_t, const void*, uint32_t)
+ * @brief	Feeds a buffer to the running CRC using the configured engine
+ *
+ * @param crc	Running CRC value (from bl_crc32_init or a previous update)
+ * @param data	Data buffer
+ * @param len	Length of the data in bytes
+ * @return	Updated running CRC value
+ */
+uint32_t bl_crc32_update(uint32_t crc, const void *data, uint32_t len);
+
+/**
+ * @fn uint32_t bl_crc32_final(uint32_t)
+ * @brief	Finalizes the running CRC value
+ *
+ * @param crc	Running CRC value
+ * @return	Final CRC32
+ */
+static inline uint32_t bl_crc32_final(uint32_t crc) {
+	return ~crc;
+}
+
+/**
+ * @fn uint32_t bl_crc32_update_bitwise(uint32_t, const void*, uint32_t)
+ * @brief	Bit-serial reference engine, always available
+ *
+ * @param crc	Running CRC value
+ * @param data	Data buffer
+ * @param len	Length of the data in bytes
+ * @return	Updated running CRC value
+ */
+uint32_t bl_crc32_update_bitwise(uint32_t crc, const void *data, uint32_t len);
+
+#endif /* BL_CRC_H_ */
@@ -15,6 +15,8 @@
  *                              Includes                                       *
  *******************************************************************************/
 
+#include "bl_cfg.h"
+#include "bl_cmd_types.h"
 #include <stdint.h>
 
 /*******************************************************************************
@@ -34,7 +36,6 @@
 #define BL_FLASH_ERASED_STATE_1 (0xFFFFFFFF)
 #define BL_FLASH_ERASED_STATE_2 (0x00000000)
 
-#define BL_COMMAND_TIMEOUT_MS (1000000U) /**	@brief	Bootloader command timeout **/
 #define BL_RECEIVE_TIMEOUT_MS (1000U)	 /**	@brief	Bootloader receive timeout **/
 #define BL_SEND_TIMEOUT_MS (1000U)		 /**	@brief	Bootloader send timeout **/
 
@@ -84,11 +85,13 @@ typedef struct {
 	uint32_t AppLength;
 	uint32_t *BL_startAddress;
 	uint32_t *BL_endAddress;
-	BL_Mode_t Mode;
+	volatile BL_Mode_t Mode; /**< Changed from the receive and timeout interrupts */
+	uint32_t BlockSize; /**< Data block size negotiated with the host */
+	uint32_t BaudRate; /**< Current line rate */
 
 	struct CommandBuffer {
 		BL_CommandHeader_t header;
-		uint8_t buff[1512];
+		uint8_t buff[BL_MAX_BUFFER_SIZE_BYTES];
 	} CommandBuffer;
 } BL_Context_t;
 
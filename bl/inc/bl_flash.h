@@ -0,0 +1,239 @@
+/**
+ * @file bl_flash.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Bootloader flash programming pipeline
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BL_FLASH_H_
+#define BL_FLASH_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn BL_Status_t bl_flash_begin(uint32_t, uint32_t, uint8_t)
+ * @brief	Starts a write session over a flash range
+ *
+ * 	With auto-erase, every page is erased right before the first block lands
+ * 	in it, and the page following a block is erased ahead, while the next
+ * 	block is being received. Only pages inside the range are ever erased.
+ *
+ * @param address		Start address of the range, page aligned with auto-erase
+ * @param length		Length of the range in bytes
+ * @param auto_erase	Non-zero to erase pages on first write
+ * @return	BL_Status_OK	If the session was started
+ * @return	BL_Status_Error	If the range is unsuitable for auto-erase
+ */
+BL_Status_t bl_flash_begin(uint32_t address, uint32_t length,
+		uint8_t auto_erase);
+
+/**
+ * @fn void bl_flash_service(void)
+ * @brief	Advances the asynchronous flash operations: completes a finished
+ * 	program or erase and starts a pending erase-ahead. Called while waiting for
+ * 	data so flash work overlaps reception.
+ *
+ */
+void bl_flash_service(void);
+
+/**
+ * @fn uint8_t bl_flash_is_blank(uint32_t, uint32_t)
+ * @brief	Checks whether a word aligned flash range is erased
+ *
+ * @param address	Start address of the range
+ * @param length	Length of the range in bytes, multiple of 4
+ * @return	Non-zero if every word of the range is erased
+ */
+uint8_t bl_flash_is_blank(uint32_t address, uint32_t length);
+
+/**
+ * @fn BL_Status_t bl_flash_erase_pages(uint32_t, uint32_t, uint32_t*)
+ * @brief	Erases pages, skipping the ones that are already blank
+ *
+ * 	Pages erased or found blank are remembered, so they are not read again
+ * 	until something is written to them.
+ *
+ * @param page_address	Address of the first page
+ * @param page_count	Number of pages
+ * @param erased		Receives the number of pages actually erased, may be
+ * 	NULL
+ * @return	BL_Status_OK	If every page is blank
+ * @return	BL_Status_Error	If erasing failed
+ */
+BL_Status_t bl_flash_erase_pages(uint32_t page_address, uint32_t page_count,
+		uint32_t *erased);
+
+/**
+ * @fn void bl_flash_mark_written(uint32_t, uint32_t)
+ * @brief	Forgets that the pages of a range are blank before writing to them.
+ * 	Flash programmed or erased without this module (e.g. the logs of bl_log)
+ * 	must be reported, or its pages may be taken for blank.
+ *
+ * @param address	Start address of the range
+ * @param len		Length of the range in bytes
+ */
+void bl_flash_mark_written(uint32_t address, uint32_t len);
+
+/**
+ * @fn uint8_t bl_flash_get_rx_buffer*(void)
+ * @brief	Returns the ping-pong buffer that is not being programmed, a data
+ * 	packet can be received into it while the other one is programmed.
+ *
+ * @return	Receive buffer, large enough for any data packet
+ */
+uint8_t* bl_flash_get_rx_buffer(void);
+
+/**
+ * @fn BL_Status_t bl_flash_queue_write(uint32_t, uint8_t*, uint32_t)
+ * @brief	Waits for the previously queued block to be programmed, erases the
+ * 	pages of the block that were not prepared yet (auto-erase), then starts
+ * 	programming the given block and swaps the ping-pong buffers.
+ *
+ * 	With BL_WRITE_COMBINE_ENABLE, the block is copied into a page buffer
+ * 	instead, and the page is programmed as above in one burst once it is
+ * 	complete, or once a block does not follow the previous one. Bursts are
+ * 	padded to whole BL_VS_FLASH_PROGRAM_UNIT_BYTES units with the erased
+ * 	value, so a block that does not follow the previous one must start on a
+ * 	unit, or on erased flash.
+ *
+ * @param address	Flash address to program
+ * @param data		Data to program, must point inside the buffer returned by
+ * 	bl_flash_get_rx_buffer
+ * @param len		Length of the data in bytes
+ * @return	BL_Status_OK	If the previous block was programmed and this one was
+ * 	started
+ * @return	BL_Status_Error	If programming the previous block failed or this
+ * 	one could not be started
+ */
+BL_Status_t bl_flash_queue_write(uint32_t address, uint8_t *data,
+		uint32_t len);
+
+/**
+ * @fn BL_Status_t bl_flash_flush(void)
+ * @brief	Programs the bytes collected for write-combining, then waits as
+ * 	bl_flash_wait. Called at the end of a write.
+ *
+ * @return	BL_Status_OK	If every queued operation succeeded
+ * @return	BL_Status_Error	If programming or erasing failed
+ */
+BL_Status_t bl_flash_flush(void);
+
+/**
+ * @fn BL_Status_t bl_flash_wait(void)
+ * @brief	Waits for the last queued block to be programmed and for a started
+ * 	erase-ahead. An erase-ahead that did not start yet is dropped. Bytes
+ * 	collected for write-combining stay in their page buffer, so the write may
+ * 	go on in the middle of a program unit.
+ *
+ * @return	BL_Status_OK	If every queued operation succeeded
+ * @return	BL_Status_Error	If programming or erasing failed
+ */
+BL_Status_t bl_flash_wait(void);
+
+/**
+ * @fn BL_Status_t bl_flash_drain(void)
+ * @brief	Waits for the operation in progress like bl_flash_wait, but keeps an
+ * 	erase-ahead that did not start yet for the next bl_flash_service. Used
+ * 	when the write goes on right after, with the flash idle.
+ *
+ * @return	BL_Status_OK	If every queued operation succeeded
+ * @return	BL_Status_Error	If programming or erasing failed
+ */
+BL_Status_t bl_flash_drain(void);
+
+/**
+ * @fn void bl_flash_page_writer_begin(uint32_t, uint8_t)
+ * @brief	Starts assembling an image page by page at a page aligned address.
+ * 	Every full page is erased and programmed in one go.
+ *
+ * @param base				Page aligned address of the image
+ * @param hold_first_page	If non-zero, the first page is kept in RAM until
+ * 	bl_flash_page_writer_commit. The old one stays in flash until the second
+ * 	page is programmed, then it is erased so a partly written image is never
+ * 	booted.
+ */
+void bl_flash_page_writer_begin(uint32_t base, uint8_t hold_first_page);
+
+/**
+ * @fn BL_Status_t bl_flash_page_writer_write(const uint8_t*, uint32_t)
+ * @brief	Appends data to the image, programming every page it completes
+ *
+ * @param data	Data to append, may point to flash
+ * @param len	Length of the data in bytes
+ * @return	BL_Status_OK	If appended successfully
+ * @return	BL_Status_Error	If erasing or programming a page failed
+ */
+BL_Status_t bl_flash_page_writer_write(const uint8_t *data, uint32_t len);
+
+/**
+ * @fn uint32_t bl_flash_page_writer_length(void)
+ * @brief	Returns the number of bytes appended so far
+ *
+ * @return	Image length in bytes
+ */
+uint32_t bl_flash_page_writer_length(void);
+
+/**
+ * @fn uint32_t bl_flash_page_writer_room(void)
+ * @brief	Returns the number of bytes left before the current page is full
+ *
+ * @return	Bytes left in the current page
+ */
+uint32_t bl_flash_page_writer_room(void);
+
+/**
+ * @fn const uint8_t bl_flash_page_writer_output*(uint32_t, uint32_t*)
+ * @brief	Returns where an already appended byte of the image can be read:
+ * 	the page being assembled, the held first page, or flash.
+ *
+ * @param offset		Offset of the byte in the image, below the image length
+ * @param contiguous	Number of bytes readable contiguously from the returned
+ * 	pointer
+ * @return	Pointer to the byte
+ */
+const uint8_t* bl_flash_page_writer_output(uint32_t offset,
+		uint32_t *contiguous);
+
+/**
+ * @fn BL_Status_t bl_flash_page_writer_end(void)
+ * @brief	Programs the last partial page, padded with the erased value
+ *
+ * @return	BL_Status_OK	If programmed successfully
+ * @return	BL_Status_Error	If erasing or programming the page failed
+ */
+BL_Status_t bl_flash_page_writer_end(void);
+
+/**
+ * @fn uint32_t bl_flash_page_writer_crc(void)
+ * @brief	Calculates the CRC32 of the assembled image, including a held first
+ * 	page. Must be called after bl_flash_page_writer_end.
+ *
+ * @return	CRC32 of the image
+ */
+uint32_t bl_flash_page_writer_crc(void);
+
+/**
+ * @fn BL_Status_t bl_flash_page_writer_commit(uint8_t)
+ * @brief	Programs the held first page, or erases it to leave no bootable
+ * 	image behind. Does nothing if the first page was not held.
+ *
+ * @param commit	Non-zero to program the first page, zero to erase it
+ * @return	BL_Status_OK	If programmed or erased successfully
+ * @return	BL_Status_Error	If erasing or programming the page failed
+ */
+BL_Status_t bl_flash_page_writer_commit(uint8_t commit);
+
+#endif /* BL_FLASH_H_ */
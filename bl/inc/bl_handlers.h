@@ -24,9 +24,20 @@
 
 void bl_handle_goto_addr_cmd(BL_GOTO_ADDR_CMD *cmd);
 void bl_handle_mem_write_cmd(BL_MEM_WRITE_CMD *cmd);
+void bl_handle_mem_write_ex_cmd(BL_MEM_WRITE_EX_CMD *cmd);
 void bl_handle_mem_read_cmd(BL_MEM_READ_CMD *cmd);
+void bl_handle_mem_read_ex_cmd(BL_MEM_READ_EX_CMD *cmd);
+void bl_handle_page_crc_cmd(BL_PAGE_CRC_CMD *cmd);
 void bl_handle_ver_cmd(BL_VER_CMD *cmd);
+void bl_handle_get_capabilities_cmd(BL_GET_CAPABILITIES_CMD *cmd);
+void bl_handle_get_stats_cmd(BL_GET_STATS_CMD *cmd);
+void bl_handle_verify_signature_cmd(BL_VERIFY_SIGNATURE_CMD *cmd);
+void bl_handle_set_link_speed_cmd(BL_SET_LINK_SPEED_CMD *cmd);
+void bl_handle_query_progress_cmd(BL_QUERY_PROGRESS_CMD *cmd);
+void bl_handle_patch_cmd(BL_PATCH_CMD *cmd);
+void bl_handle_mem_write_lz_cmd(BL_MEM_WRITE_LZ_CMD *cmd);
 void bl_handle_flash_erase_cmd(BL_FLASH_ERASE_CMD *cmd);
+void bl_handle_batch_cmd(BL_BATCH_CMD *cmd);
 void bl_handle_enter_cmd_mode_cmd(BL_ENTER_CMD_MODE_CMD *cmd);
 void bl_handle_jump_to_app_cmd(BL_JUMP_TO_APP_CMD *cmd);
 
@@ -0,0 +1,114 @@
+/**
+ * @file bl_journal.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Progress journal of resumable BL_MEM_WRITE_CMD transfers
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The journal is a log of BL_JournalEntry_t (see bl_log.h) in the
+ * BL_JOURNAL_PAGES pages at _JournalAddr. A write that carries an image ID
+ * appends an entry when it starts and every BL_JOURNAL_INTERVAL_PAGES pages,
+ * once everything before is programmed, and when it completes. The committed
+ * length only ever covers programmed flash, what was programmed after it is
+ * sent again on resume.
+ *
+ */
+
+#ifndef BL_JOURNAL_H_
+#define BL_JOURNAL_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include "bl_log.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Flash pages holding the journal */
+#define BL_JOURNAL_PAGES (2U)
+
+#define BL_JOURNAL_MAGIC (0x4C4E524AU) /**< "JRNL" */
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @struct	BL_JournalEntry_t
+ * @brief	Entry of the journal, programmed in one go
+ *
+ */
+typedef struct {
+	BL_LogHeader_t header; /**< BL_JOURNAL_MAGIC and sequence */
+	uint32_t image_id; /**< Image being written, 0 if none */
+	uint32_t image_crc; /**< CRC32 of the whole image */
+	uint32_t start_address; /**< Page aligned start address of the image */
+	uint32_t length; /**< Length of the image */
+	uint32_t committed; /**< Bytes from the start known to be programmed */
+	uint32_t crc; /**< CRC32 of the fields above */
+} BL_JournalEntry_t;
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn uint32_t bl_journal_begin(uint32_t, uint32_t, uint32_t, uint32_t)
+ * @brief	Starts journaling a write. It resumes the journaled image if the
+ * 	ID and CRC32 match and the write starts at its committed length and runs
+ * 	to its end, otherwise a new image starts at the address.
+ *
+ * 	Without an image ID, or for an unaligned or empty range, the journal is
+ * 	dropped and the write is not journaled.
+ *
+ * @param image_id		Image ID, 0 for none
+ * @param image_crc		CRC32 of the whole image
+ * @param start_address	Start address of the write
+ * @param length		Length of the write
+ * @return	Offset of the write in the image, 0 unless resumed
+ */
+uint32_t bl_journal_begin(uint32_t image_id, uint32_t image_crc,
+		uint32_t start_address, uint32_t length);
+
+/**
+ * @fn BL_Status_t bl_journal_progress(uint32_t)
+ * @brief	Journals the bytes written so far if another interval is
+ * 	complete. Waits for the flash queue first, so call it before queueing the
+ * 	next block, when the write waits for the previous one anyway.
+ *
+ * @param written	Bytes queued since the start of the write
+ * @return	BL_Status_OK	Unless the flash queue failed
+ */
+BL_Status_t bl_journal_progress(uint32_t written);
+
+/**
+ * @fn void bl_journal_end(void)
+ * @brief	Journals the completed image, once its last block is programmed
+ *
+ */
+void bl_journal_end(void);
+
+/**
+ * @fn void bl_journal_forget(void)
+ * @brief	Drops the journaled image, when flash is modified by any other
+ * 	means than a journaled write
+ *
+ */
+void bl_journal_forget(void);
+
+/**
+ * @fn const BL_JournalEntry_t bl_journal_get*(void)
+ * @brief	Returns the newest entry
+ *
+ * @return	Entry in flash, or NULL if the journal is empty
+ */
+const BL_JournalEntry_t* bl_journal_get(void);
+
+#endif /* BL_JOURNAL_H_ */
@@ -0,0 +1,83 @@
+/**
+ * @file bl_log.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Power loss safe record log in reserved flash pages
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Records are appended to erased flash, the valid one with the highest
+ * sequence number wins. A record is a single program operation, a torn one
+ * fails its CRC and the previous one stays in effect. When a page is full the
+ * next one is erased and the log continues there, so the newest record is
+ * never erased.
+ *
+ * Records start with BL_LogHeader_t and end with the CRC32 of everything
+ * before it. The functions keep no state in RAM, they may run from the
+ * application under the port requirements of BL_Api_t.
+ *
+ */
+
+#ifndef BL_LOG_H_
+#define BL_LOG_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @struct	BL_LogHeader_t
+ * @brief	Start of every record
+ *
+ */
+typedef struct {
+	uint32_t magic; /**< Magic of the log */
+	uint32_t sequence; /**< Incremented by every record */
+} BL_LogHeader_t;
+
+/**
+ * @struct	BL_Log_t
+ * @brief	Location and format of a log
+ *
+ */
+typedef struct {
+	const void *base; /**< Page aligned start of the log */
+	uint32_t pages; /**< Pages of the log, at least 2 */
+	uint32_t record_size; /**< Multiple of 4 that divides the page size */
+	uint32_t magic; /**< Identifies the records of the log */
+} BL_Log_t;
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn const void bl_log_newest*(const BL_Log_t*)
+ * @brief	Finds the valid record with the highest sequence number
+ *
+ * @param log	Log
+ * @return	Record in flash, or NULL if the log holds none
+ */
+const void* bl_log_newest(const BL_Log_t *log);
+
+/**
+ * @fn BL_Status_t bl_log_append(const BL_Log_t*, void*)
+ * @brief	Programs a record after the newest one, moving to the next page
+ * 	if its page is full
+ *
+ * @param log		Log
+ * @param record	Record, its header and CRC are filled in
+ * @return	BL_Status_OK	If the record was programmed and reads back
+ * @return	BL_Status_Error	If erasing or programming failed
+ */
+BL_Status_t bl_log_append(const BL_Log_t *log, void *record);
+
+#endif /* BL_LOG_H_ */
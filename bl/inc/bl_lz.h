@@ -0,0 +1,73 @@
+/**
+ * @file bl_lz.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Streaming LZ4 block decompressor writing straight to flash pages
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BL_LZ_H_
+#define BL_LZ_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_cmd_types.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_lz_begin(uint32_t, uint32_t)
+ * @brief	Starts decompressing an LZ4 block (raw block format, no frame
+ * 	header) to a page aligned flash address.
+ *
+ * 	Matches are copied from the already decompressed output, which is read
+ * 	back from flash, so only the page being assembled is kept in RAM and the
+ * 	full 64 KiB LZ4 window is supported.
+ *
+ * @param address	Page aligned destination address
+ * @param length	Decompressed length in bytes
+ */
+void bl_lz_begin(uint32_t address, uint32_t length);
+
+/**
+ * @fn BL_NACK_t bl_lz_feed(const uint8_t*, uint32_t)
+ * @brief	Decompresses the next chunk of the compressed stream, sequences may
+ * 	span chunks
+ *
+ * @param data	Compressed chunk
+ * @param len	Length of the chunk in bytes
+ * @return	BL_NACK_SUCCESS				If decoded successfully
+ * @return	BL_NACK_INVALID_DATA		If the stream is malformed
+ * @return	BL_NACK_OPERATION_FAILURE	If programming a page failed
+ */
+BL_NACK_t bl_lz_feed(const uint8_t *data, uint32_t len);
+
+/**
+ * @fn BL_NACK_t bl_lz_finish(uint32_t)
+ * @brief	Programs the last page and verifies the decompressed data
+ *
+ * @param crc	Expected CRC32 of the decompressed data
+ * @return	BL_NACK_SUCCESS				If the data was written and matches
+ * @return	BL_NACK_INVALID_LENGTH		If the stream ended early
+ * @return	BL_NACK_INVALID_CRC			If the data does not match
+ * @return	BL_NACK_OPERATION_FAILURE	If programming a page failed
+ */
+BL_NACK_t bl_lz_finish(uint32_t crc);
+
+/**
+ * @fn void bl_lz_abort(void)
+ * @brief	Aborts the decompression. The page being assembled is programmed,
+ * 	so flash holds everything decoded so far, and the page writer is closed.
+ *
+ */
+void bl_lz_abort(void);
+
+#endif /* BL_LZ_H_ */
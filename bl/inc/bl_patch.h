@@ -0,0 +1,98 @@
+/**
+ * @file bl_patch.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Delta (binary diff) update applied in place over the application
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BL_PATCH_H_
+#define BL_PATCH_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_cmd_types.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/**
+ * @enum	BL_PatchOp_t
+ * @brief	Patch stream operations. Every operation is an opcode byte followed
+ * 	by little-endian arguments, and appends to the new image:
+ *
+ * 	- COPY:		src_offset (4), length (4). Copies from the installed image.
+ * 	- INSERT:	length (4), followed by length literal bytes.
+ * 	- FILL:		length (4), value (1). Repeats a byte.
+ *
+ * 	The image is rebuilt in place, page by page. A COPY may only read pages
+ * 	that have not been rewritten yet: its source must start at or after the
+ * 	page being produced, or lie in the first page, which is read from a copy in
+ * 	RAM. The first page is erased before any other page is rewritten, and the
+ * 	new one is only programmed once the whole image has been verified, so a
+ * 	reset midway never leaves a bootable mix of both images.
+ */
+typedef enum {
+	BL_PATCH_OP_COPY = 0x00, /**< BL_PATCH_OP_COPY */
+	BL_PATCH_OP_INSERT = 0x01, /**< BL_PATCH_OP_INSERT */
+	BL_PATCH_OP_FILL = 0x02 /**< BL_PATCH_OP_FILL */
+} BL_PatchOp_t;
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_patch_begin(uint32_t, uint32_t, uint32_t)
+ * @brief	Starts applying a patch over the image installed at base
+ *
+ * @param base			Page aligned address of the installed image
+ * @param old_length	Length of the installed image in bytes
+ * @param new_length	Length of the new image in bytes
+ */
+void bl_patch_begin(uint32_t base, uint32_t old_length, uint32_t new_length);
+
+/**
+ * @fn BL_NACK_t bl_patch_feed(const uint8_t*, uint32_t)
+ * @brief	Decodes the next chunk of the patch stream, operations may span
+ * 	chunks
+ *
+ * @param data	Patch stream chunk
+ * @param len	Length of the chunk in bytes
+ * @return	BL_NACK_SUCCESS				If decoded successfully
+ * @return	BL_NACK_INVALID_DATA		If the stream is malformed or breaks the
+ * 	in-place constraints
+ * @return	BL_NACK_OPERATION_FAILURE	If programming a page failed
+ */
+BL_NACK_t bl_patch_feed(const uint8_t *data, uint32_t len);
+
+/**
+ * @fn BL_NACK_t bl_patch_finish(uint32_t)
+ * @brief	Programs the last page, verifies the new image and commits it by
+ * 	programming its first page. A new image that fails verification is left
+ * 	without a first page so it is never booted.
+ *
+ * @param target_crc	Expected CRC32 of the new image
+ * @return	BL_NACK_SUCCESS				If the new image was committed
+ * @return	BL_NACK_INVALID_LENGTH		If the stream ended early
+ * @return	BL_NACK_INVALID_CRC			If the new image does not match
+ * @return	BL_NACK_OPERATION_FAILURE	If programming a page failed
+ */
+BL_NACK_t bl_patch_finish(uint32_t target_crc);
+
+/**
+ * @fn void bl_patch_abort(void)
+ * @brief	Aborts the patch. If the installed image was already partially
+ * 	rewritten, its first page is erased so it is never booted.
+ *
+ */
+void bl_patch_abort(void);
+
+#endif /* BL_PATCH_H_ */
@@ -0,0 +1,83 @@
+/**
+ * @file bl_ring.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Interrupt fed receive ring and in-place command framer
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BL_RING_H_
+#define BL_RING_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_ring_start(void)
+ * @brief	Empties the ring and starts receiving into it through
+ * 	BL_receiveInterrupt. The callback re-arms itself after every byte.
+ *
+ */
+void bl_ring_start(void);
+
+/**
+ * @fn void bl_ring_write(const uint8_t*, uint32_t)
+ * @brief	Appends received bytes to the ring, for ports that receive with DMA
+ * 	instead of a per-byte interrupt. Safe to call from an interrupt.
+ *
+ * 	Bytes that do not fit are dropped, the framer then sees a corrupted frame.
+ *
+ * @param data	Received bytes
+ * @param len	Number of bytes
+ */
+void bl_ring_write(const uint8_t *data, uint32_t len);
+
+/**
+ * @fn BL_Status_t bl_ring_get_frame(uint8_t**, uint32_t)
+ * @brief	Returns the next complete frame without copying it out of the ring
+ *
+ * 	The frame is contiguous in memory even when it wraps around the end of the
+ * 	ring, and stays valid until released with bl_ring_release. Frames must be
+ * 	released in the order they were returned.
+ *
+ * @param frame		Receives a pointer to the frame, starting with its header
+ * @param max_size	Largest acceptable frame size
+ * @return	BL_Status_OK	If a frame was returned
+ * @return	BL_Status_Busy	If the frame is not complete yet
+ * @return	BL_Status_Error	If the header announced an invalid size, every
+ * 	byte received until the line goes idle for BL_RX_RESYNC_IDLE_MS is dropped
+ */
+BL_Status_t bl_ring_get_frame(uint8_t **frame, uint32_t max_size);
+
+/**
+ * @fn void bl_ring_release(const uint8_t*)
+ * @brief	Gives the room of a frame back to the ring
+ *
+ * @param frame	Frame returned by bl_ring_get_frame
+ */
+void bl_ring_release(const uint8_t *frame);
+
+/**
+ * @fn BL_Status_t bl_ring_read(uint8_t*, uint32_t, uint32_t)
+ * @brief	Copies unframed bytes out of the ring, waiting for them to arrive
+ *
+ * @param data		Destination buffer
+ * @param len		Number of bytes, at most BL_MAX_BUFFER_SIZE_BYTES
+ * @param timeout	Timeout in milliseconds
+ * @return	BL_Status_OK	If the bytes were read
+ * @return	BL_Status_Error	If they did not arrive in time
+ */
+BL_Status_t bl_ring_read(uint8_t *data, uint32_t len, uint32_t timeout);
+
+#endif /* BL_RING_H_ */
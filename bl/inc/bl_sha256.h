@@ -0,0 +1,108 @@
+/**
+ * @file bl_sha256.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Incremental SHA-256, used to authenticate images as they are written
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BL_SHA256_H_
+#define BL_SHA256_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#define BL_SHA256_BLOCK_BYTES (64U)
+
+#define BL_SHA256_DIGEST_BYTES (32U)
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @struct	BL_Sha256_t
+ * @brief	Running SHA-256
+ *
+ */
+typedef struct {
+	uint32_t state[8]; /**< Intermediate hash value */
+	uint64_t length; /**< Bytes hashed so far */
+	uint8_t buffer[BL_SHA256_BLOCK_BYTES]; /**< Partial block */
+} BL_Sha256_t;
+
+/*******************************************************************************
+ *                         Weak public functions prototypes                    *
+ *******************************************************************************/
+
+/**
+ * @fn void BL_sha256_hw_compress(uint32_t[8], const uint8_t*, uint32_t)
+ * @brief	Runs the SHA-256 compression function over whole blocks, for ports
+ * 	with a hash peripheral or SHA instructions that can continue from a given
+ * 	intermediate hash value
+ *
+ * 	The default implementation is the software one.
+ *
+ * @param state			Intermediate hash value, updated in place
+ * @param blocks		Blocks of BL_SHA256_BLOCK_BYTES
+ * @param block_count	Number of blocks
+ */
+void BL_sha256_hw_compress(uint32_t state[8], const uint8_t *blocks,
+		uint32_t block_count);
+
+/*******************************************************************************
+ *                            Public functions                                 *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_sha256_init(BL_Sha256_t*)
+ * @brief	Starts a new hash
+ *
+ * @param sha	Running hash
+ */
+void bl_sha256_init(BL_Sha256_t *sha);
+
+/**
+ * @fn void bl_sha256_update(BL_Sha256_t*, const void*, uint32_t)
+ * @brief	Feeds a buffer to the running hash
+ *
+ * @param sha	Running hash
+ * @param data	Data buffer
+ * @param len	Length of the data in bytes
+ */
+void bl_sha256_update(BL_Sha256_t *sha, const void *data, uint32_t len);
+
+/**
+ * @fn void bl_sha256_final(const BL_Sha256_t*, uint8_t[])
+ * @brief	Returns the digest of everything hashed so far. The running hash is
+ * 	left untouched and can be updated further.
+ *
+ * @param sha		Running hash
+ * @param digest	Receives BL_SHA256_DIGEST_BYTES bytes
+ */
+void bl_sha256_final(const BL_Sha256_t *sha,
+		uint8_t digest[BL_SHA256_DIGEST_BYTES]);
+
+/**
+ * @fn void bl_sha256_compress(uint32_t[8], const uint8_t*, uint32_t)
+ * @brief	Software compression function, always available
+ *
+ * @param state			Intermediate hash value, updated in place
+ * @param blocks		Blocks of BL_SHA256_BLOCK_BYTES
+ * @param block_count	Number of blocks
+ */
+void bl_sha256_compress(uint32_t state[8], const uint8_t *blocks,
+		uint32_t block_count);
+
+#endif /* BL_SHA256_H_ */
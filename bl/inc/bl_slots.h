@@ -0,0 +1,211 @@
+/**
+ * @file bl_slots.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   A/B application slots, boot record and the API shared with the
+ * 	application
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Flash layout, from the linker symbols:
+ *
+ * 	_AppStartAddr .. _AppEndAddr			slot A
+ * 	_AppSlotBStartAddr .. _AppSlotBEndAddr	slot B
+ * 	_BootRecordAddr							BL_BOOT_RECORD_PAGES pages
+ *
+ * The boot record is a log of BL_BootRecord_t (see bl_log.h), a reset while
+ * a record is programmed leaves the previous one in effect.
+ *
+ * The running application stages an image into the inactive slot through
+ * BL_Api_t and commits it, which appends a record with the slot pending. At
+ * the next boot the bootloader checks the staged image and flips the active
+ * slot, or drops the request. Images must be linked for the slot they are
+ * staged in.
+ *
+ */
+
+#ifndef BL_SLOTS_H_
+#define BL_SLOTS_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include "bl_log.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Flash pages holding the boot record log */
+#define BL_BOOT_RECORD_PAGES (2U)
+
+#define BL_BOOT_RECORD_MAGIC (0x52544F42U) /**< "BOTR" */
+
+#define BL_API_MAGIC (0x49504142U) /**< "BAPI" */
+
+#define BL_API_VERSION (1U)
+
+/** No slot, the erased value */
+#define BL_SLOT_NONE (0xFFFFFFFFU)
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @enum	BL_Slot_t
+ * @brief	Application slot
+ *
+ */
+typedef enum {
+	BL_SLOT_A, /**< Slot at _AppStartAddr */
+	BL_SLOT_B /**< Slot at _AppSlotBStartAddr */
+} BL_Slot_t;
+
+/**
+ * @struct	BL_BootRecord_t
+ * @brief	Entry of the boot record log, programmed in one go
+ *
+ */
+typedef struct {
+	BL_LogHeader_t header; /**< BL_BOOT_RECORD_MAGIC and sequence */
+	uint32_t active; /**< Slot that boots */
+	uint32_t pending; /**< Slot to check and activate at boot, or BL_SLOT_NONE */
+	uint32_t image_length; /**< Length of the image in the pending slot */
+	uint32_t image_crc; /**< CRC32 of the image in the pending slot */
+	uint32_t reserved; /**< Erased value */
+	uint32_t crc; /**< CRC32 of the fields above */
+} BL_BootRecord_t;
+
+/**
+ * @struct	BL_SlotInfo_t
+ * @brief	Slot layout reported to the application
+ *
+ */
+typedef struct {
+	uint32_t active; /**< Slot that runs, BL_Slot_t */
+	uint32_t active_address; /**< Start address of the running slot */
+	uint32_t staging; /**< Slot that can be staged, BL_Slot_t */
+	uint32_t staging_address; /**< Start address of the staging slot */
+	uint32_t staging_size; /**< Size of the staging slot in bytes */
+} BL_SlotInfo_t;
+
+/**
+ * @struct	BL_Api_t
+ * @brief	Functions of the bootloader callable from the application
+ *
+ * 	The table is placed in the BL_API section. The application linker script
+ * 	must define _BLApiAddr at the address the bootloader linker script gives
+ * 	the section, the application then calls through BL_API.
+ *
+ * 	The functions run with the RAM of the application. They keep no state of
+ * 	their own and reach the port only through BL_erase_flash, BL_flash_write
+ * 	and, with BL_CRC_ENGINE_HW, BL_crc32_hw_update. Ports must implement
+ * 	these three without variables or handles in the RAM of the bootloader.
+ * 	The functions must not be called from an interrupt that may preempt
+ * 	another call.
+ *
+ */
+typedef struct {
+	uint32_t magic; /**< BL_API_MAGIC */
+	uint32_t version; /**< BL_API_VERSION */
+
+	/** Reports the slots, see bl_slots_get_info */
+	BL_Status_t (*get_info)(BL_SlotInfo_t *info);
+
+	/** Erases part of the staging slot, see bl_slots_stage_erase */
+	BL_Status_t (*stage_erase)(uint32_t offset, uint32_t length);
+
+	/** Programs part of the staging slot, see bl_slots_stage_write */
+	BL_Status_t (*stage_write)(uint32_t offset, const uint8_t *data,
+			uint32_t length);
+
+	/** Requests the staged image for the next boot, see bl_slots_commit */
+	BL_Status_t (*commit)(uint32_t image_length, uint32_t image_crc);
+} BL_Api_t;
+
+/** Table of the bootloader */
+extern const BL_Api_t bl_api;
+
+/** Table seen from the application, at _BLApiAddr */
+extern const uint32_t _BLApiAddr;
+#define BL_API ((const BL_Api_t*) &_BLApiAddr)
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn uint32_t bl_slots_boot*(void)
+ * @brief	Reads the boot record and returns the slot to run. A pending slot
+ * 	is activated if its image matches the committed length and CRC32 and its
+ * 	vector table points inside the slot, otherwise the request is dropped.
+ * 	Either way the outcome is recorded, so it is checked at one boot only.
+ *
+ * @return	Start address of the active slot
+ */
+uint32_t* bl_slots_boot(void);
+
+/**
+ * @fn uint32_t* bl_slots_end*(const uint32_t*)
+ * @brief	Returns the last address of a slot
+ *
+ * @param start	Start address of the slot, as returned by bl_slots_boot
+ * @return	Address of the last byte of the slot
+ */
+uint32_t* bl_slots_end(const uint32_t *start);
+
+/**
+ * @fn BL_Status_t bl_slots_get_info(BL_SlotInfo_t*)
+ * @brief	Reports which slot runs and which one can be staged
+ *
+ * @param info	Output: slot layout
+ * @return	BL_Status_OK
+ */
+BL_Status_t bl_slots_get_info(BL_SlotInfo_t *info);
+
+/**
+ * @fn BL_Status_t bl_slots_stage_erase(uint32_t, uint32_t)
+ * @brief	Erases the pages of the staging slot covering a range. Slow, the
+ * 	application may erase page by page to keep running in between.
+ *
+ * @param offset	Offset of the range in the slot
+ * @param length	Length of the range in bytes
+ * @return	BL_Status_OK	If erased
+ * @return	BL_Status_Error	If the range leaves the slot or erasing failed
+ */
+BL_Status_t bl_slots_stage_erase(uint32_t offset, uint32_t length);
+
+/**
+ * @fn BL_Status_t bl_slots_stage_write(uint32_t, const uint8_t*, uint32_t)
+ * @brief	Programs erased flash of the staging slot
+ *
+ * @param offset	Word aligned offset in the slot
+ * @param data		Data
+ * @param length	Length in bytes, a trailing partial word is padded with the
+ * 	erased value
+ * @return	BL_Status_OK	If programmed
+ * @return	BL_Status_Error	If the range leaves the slot or programming failed
+ */
+BL_Status_t bl_slots_stage_write(uint32_t offset, const uint8_t *data,
+		uint32_t length);
+
+/**
+ * @fn BL_Status_t bl_slots_commit(uint32_t, uint32_t)
+ * @brief	Appends a boot record with the staging slot pending. The bootloader
+ * 	checks and activates it at the next reset, which the application starts
+ * 	when it suits it.
+ *
+ * @param image_length	Length of the staged image in bytes
+ * @param image_crc		CRC32 of the staged image
+ * @return	BL_Status_OK	If recorded
+ * @return	BL_Status_Error	If the length does not fit the slot or the record
+ * 	could not be programmed
+ */
+BL_Status_t bl_slots_commit(uint32_t image_length, uint32_t image_crc);
+
+#endif /* BL_SLOTS_H_ */
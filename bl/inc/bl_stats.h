@@ -0,0 +1,102 @@
+/**
+ * @file bl_stats.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Timing and error statistics reported by BL_GET_STATS_CMD
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BL_STATS_H_
+#define BL_STATS_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl.h"
+#include "bl_cfg.h"
+#include "bl_cmd_types.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/* Instrumentation points, compiled out without BL_STATS_ENABLE. A sample is
+ * the BL_get_cycles difference between BL_STATS_TIMESTAMP and the call that
+ * records it. */
+#if BL_STATS_ENABLE
+#define BL_STATS_TIMESTAMP() BL_get_cycles()
+#define BL_STATS_PHASE(phase, start) bl_stats_add_phase((phase), (start))
+#define BL_STATS_COMMAND(id, start) bl_stats_add_command((id), (start))
+#define BL_STATS_CRC_FAILURE() bl_stats_count_crc_failure()
+#define BL_STATS_RETRIES(count) bl_stats_count_retries(count)
+#else
+#define BL_STATS_TIMESTAMP() (0U)
+#define BL_STATS_PHASE(phase, start) ((void) (start))
+#define BL_STATS_COMMAND(id, start) ((void) (start))
+#define BL_STATS_CRC_FAILURE() ((void) 0)
+#define BL_STATS_RETRIES(count) ((void) (count))
+#endif
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_stats_add_phase(BL_StatsPhase_t, uint32_t)
+ * @brief	Records one sample of a phase, ending now
+ *
+ * @param phase	Phase
+ * @param start	BL_STATS_TIMESTAMP taken when the phase started
+ */
+void bl_stats_add_phase(BL_StatsPhase_t phase, uint32_t start);
+
+/**
+ * @fn void bl_stats_add_command(BL_CommandID_t, uint32_t)
+ * @brief	Records one run of a command, ending now
+ *
+ * @param id	Command ID, not recorded from BL_STATS_CMD_SLOTS up
+ * @param start	BL_STATS_TIMESTAMP taken when the command was dispatched
+ */
+void bl_stats_add_command(BL_CommandID_t id, uint32_t start);
+
+/**
+ * @fn void bl_stats_count_crc_failure(void)
+ * @brief	Counts a command or data packet rejected for its CRC
+ *
+ */
+void bl_stats_count_crc_failure(void);
+
+/**
+ * @fn void bl_stats_count_retries(uint32_t)
+ * @brief	Counts packets received or sent again
+ *
+ * @param count	Number of packets
+ */
+void bl_stats_count_retries(uint32_t count);
+
+/**
+ * @fn BL_STATS_RESPONSE bl_stats_snapshot*(void)
+ * @brief	Freezes the statistics and returns them as a response frame, with
+ * 	every field but the header filled in
+ *
+ * 	Nothing is recorded until bl_stats_release, so the frame does not change
+ * 	while its CRC is calculated and it is sent.
+ *
+ * @return	The statistics
+ */
+BL_STATS_RESPONSE* bl_stats_snapshot(void);
+
+/**
+ * @fn void bl_stats_release(uint8_t)
+ * @brief	Resumes recording after bl_stats_snapshot
+ *
+ * @param reset	Non-zero to clear the statistics first
+ */
+void bl_stats_release(uint8_t reset);
+
+#endif /* BL_STATS_H_ */
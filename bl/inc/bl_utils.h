@@ -14,6 +14,8 @@
  *                              Includes                                       *
  *******************************************************************************/
 
+#include "bl.h"
+#include "bl_stats.h"
 #include <stdint.h>
 
 /*******************************************************************************
@@ -24,7 +26,8 @@
     (((start) < (end)) && ((end) - (start) + 1) <= (max_length))
 
 #define VALIDATE_CMD(data, length, crc) \
-	(bl_calculate_command_crc(data, length) == crc)
+	(bl_calculate_command_crc(data, length) == crc \
+			|| (BL_STATS_CRC_FAILURE(), 0))
 
 #define BL_VALID_ADDRESS(bl_addr_start,bl_addr_end,address)\
 	(((bl_addr_start) >(address)) || ((bl_addr_end) > (address)))
@@ -45,4 +48,15 @@
  */
 uint32_t bl_calculate_command_crc(void *command, uint32_t size);
 
+/**
+ * @fn uint32_t bl_calculate_vector_crc(const BL_IoVec_t[], uint32_t)
+ * @brief	Calculates the CRC for a command split over several buffers, the
+ * 	first one holding the command header
+ *
+ * @param iov		Buffers of the command, in order
+ * @param iov_count	Number of buffers
+ * @return
+ */
+uint32_t bl_calculate_vector_crc(const BL_IoVec_t iov[], uint32_t iov_count);
+
 #endif
@@ -0,0 +1,43 @@
+/**
+ * @file DEBUG_UTILS.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Debug output of the host port, printed to stderr when BL_SIM_DEBUG
+ * 	is defined
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef DEBUG_UTILS_H_
+#define DEBUG_UTILS_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#ifdef BL_SIM_DEBUG
+#define DEBUG_PRINT(level, ...) \
+		do { \
+			fprintf(stderr, "[BL " level "] " __VA_ARGS__); \
+			fputc('\n', stderr); \
+		} while (0)
+#else
+#define DEBUG_PRINT(level, ...) ((void) 0)
+#endif
+
+#define DEBUG_INFO(...) DEBUG_PRINT("INFO", __VA_ARGS__)
+#define DEBUG_WARN(...) DEBUG_PRINT("WARN", __VA_ARGS__)
+#define DEBUG_ERROR(...) DEBUG_PRINT("ERROR", __VA_ARGS__)
+#define DEBUG_ASSERT(x) assert(x)
+
+#endif /* DEBUG_UTILS_H_ */
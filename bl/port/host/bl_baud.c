@@ -0,0 +1,211 @@
+/**
+ * @file bl_baud.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Timing model of the line rate detection
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * For every line rate and error of the bootloader clock, sends sync bytes
+ * with a random phase against the counter, timestamps their edges the way a
+ * capture timer clocked by the bootloader clock would (quantized, plus
+ * capture latency jitter), runs bl_autobaud_measure and derives the UART
+ * divisor from the result and the nominal clock, like BL_set_baud_rate does
+ * on STM32 (USARTDIV = f_PCLK / baud, 16x oversampling, at least 16).
+ *
+ * Prints the worst error of the resulting UART rate against the line rate.
+ * A cell passes while it stays within the share of the 8N1 receiver tolerance
+ * left to the bootloader. Exits with 1 if any rate up to the checked one
+ * fails.
+ *
+ * Usage: bl_baud [-f clock_hz] [-j jitter_cycles] [-t max_error_percent]
+ * 	[-r checked_baud] [-n trials]
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../../inc/bl_autobaud.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Smallest USART divisor with 16x oversampling */
+#define BL_BAUD_MIN_DIVISOR (16U)
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static const uint32_t bl_baud_rates[] = { 9600, 19200, 38400, 57600, 115200,
+		230400, 460800, 921600, 1000000, 1500000, 2000000, 3000000, 4000000 };
+
+/** Clock errors in percent: crystal, then internal RC oscillators */
+static const double bl_baud_clock_errors[] = { -3.0, -2.0, -1.0, -0.1, 0.0,
+		0.1, 1.0, 2.0, 3.0 };
+
+#define BL_BAUD_RATE_COUNT (sizeof(bl_baud_rates) / sizeof(bl_baud_rates[0]))
+
+#define BL_BAUD_CLOCK_ERROR_COUNT \
+		(sizeof(bl_baud_clock_errors) / sizeof(bl_baud_clock_errors[0]))
+
+/** Bit time of every edge of the sync byte */
+static const uint8_t bl_baud_edge_bits[BL_AUTOBAUD_EDGES] = { 0, 1, 2, 3, 4,
+		6, 7, 8 };
+
+static unsigned short bl_baud_seed[3] = { 0x330E, 0xBA0D, 0x1234 };
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn double bl_baud_trial(uint32_t, double, uint32_t, uint32_t)
+ * @brief	Detects one sync byte
+ *
+ * @param baud			Line rate
+ * @param clock_error	Error of the bootloader clock, relative
+ * @param clock_hz		Nominal bootloader clock
+ * @param jitter		Largest capture latency in clock cycles
+ * @return	Relative error of the UART rate set from the detection, NAN if
+ * 	the byte was rejected or the rate cannot be set
+ */
+static double bl_baud_trial(uint32_t baud, double clock_error,
+		uint32_t clock_hz, uint32_t jitter);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static double bl_baud_trial(uint32_t baud, double clock_error,
+		uint32_t clock_hz, uint32_t jitter) {
+	double cycles_per_bit = clock_hz * (1.0 + clock_error) / baud;
+	/* Anywhere in the counter range, wraps included */
+	double phase = erand48(bl_baud_seed) * 4294967296.0;
+	uint32_t edges[BL_AUTOBAUD_EDGES];
+	uint32_t measured;
+
+	for (uint32_t i = 0; i < BL_AUTOBAUD_EDGES; i++) {
+		double at = phase + bl_baud_edge_bits[i] * cycles_per_bit;
+		uint32_t latency = (uint32_t) (erand48(bl_baud_seed) * (jitter + 1));
+
+		edges[i] = (uint32_t) fmod(floor(at) + latency, 4294967296.0);
+	}
+
+	if (bl_autobaud_measure(edges, clock_hz, &measured) != BL_Status_OK) {
+		return NAN;
+	}
+
+	uint32_t divisor = (clock_hz + measured / 2) / measured;
+	if (divisor < BL_BAUD_MIN_DIVISOR) {
+		return NAN;
+	}
+
+	/* The UART runs on the actual clock */
+	return divisor / cycles_per_bit - 1.0;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	uint32_t clock_hz = 72000000;
+	uint32_t jitter = 1;
+	double max_error = 2.0;
+	uint32_t checked_baud = 921600;
+	uint32_t trials = 1000;
+	int failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:j:t:r:n:")) != -1) {
+		switch (opt) {
+		case 'f':
+			clock_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			jitter = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_error = strtod(optarg, NULL);
+			break;
+		case 'r':
+			checked_baud = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			trials = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f clock_hz] [-j jitter_cycles] "
+					"[-t max_error_percent] [-r checked_baud] [-n trials]\n",
+					argv[0]);
+			return 2;
+		}
+	}
+
+	if (clock_hz == 0 || trials == 0) {
+		fprintf(stderr, "Invalid settings\n");
+		return 2;
+	}
+
+	printf("clock: %u Hz, capture jitter %u cycles, %u trials per cell\n",
+			clock_hz, jitter, trials);
+	printf("worst UART rate error [%%] by bootloader clock error, "
+			"pass within %.1f %%\n\n", max_error);
+
+	printf("%9s", "baud");
+	for (uint32_t c = 0; c < BL_BAUD_CLOCK_ERROR_COUNT; c++) {
+		printf(" %+6.1f%%", bl_baud_clock_errors[c]);
+	}
+	printf("\n");
+
+	for (uint32_t r = 0; r < BL_BAUD_RATE_COUNT; r++) {
+		uint32_t baud = bl_baud_rates[r];
+		int row_failed = 0;
+
+		printf("%9u", baud);
+
+		for (uint32_t c = 0; c < BL_BAUD_CLOCK_ERROR_COUNT; c++) {
+			double worst = 0;
+			uint32_t rejected = 0;
+
+			for (uint32_t t = 0; t < trials; t++) {
+				double error = bl_baud_trial(baud,
+						bl_baud_clock_errors[c] / 100.0, clock_hz, jitter);
+
+				if (isnan(error)) {
+					rejected++;
+				} else if (fabs(error) > fabs(worst)) {
+					worst = error;
+				}
+			}
+
+			if (rejected) {
+				printf(" %7s", "reject");
+				row_failed = 1;
+			} else if (fabs(worst) * 100.0 > max_error) {
+				printf(" %6.2f!", worst * 100.0);
+				row_failed = 1;
+			} else {
+				printf(" %7.2f", worst * 100.0);
+			}
+		}
+
+		printf("  %s\n", row_failed ? "FAILED" : "ok");
+
+		if (row_failed && baud <= checked_baud) {
+			failed = 1;
+		}
+	}
+
+	return failed;
+}
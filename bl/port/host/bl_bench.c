@@ -0,0 +1,2186 @@
+/**
+ * @file bl_bench.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Throughput benchmark of the bootloader protocols on the host port
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Plays the host side of every transfer mode against the bootloader running
+ * on the emulated flash and link, checks the data, and reports end-to-end
+ * throughput and per-packet timing:
+ *
+ * - writes: time from sending a data packet to the ACK that covers it
+ * - reads: time between the arrival of consecutive data packets
+ * - erase: one packet, the whole command
+ *
+ * With -B the line rate is switched with BL_SET_LINK_SPEED_CMD after the
+ * synchronization, the transfers then run at the new rate.
+ *
+ * With the journal, one write is journaled to compare with the plain one,
+ * and one is cut halfway and resumed from the progress reported by
+ * BL_QUERY_PROGRESS_CMD.
+ *
+ * With BL_PAGE_CRC_CMD, the pages of the image in flash are mapped and checked
+ * against the host CRCs. With BL_BATCH_CMD, a batch must stop at its failing
+ * sub-command, and a page CRC map must run as its last sub-command.
+ *
+ * With BL_MEM_WRITE_LZ_CMD, an image that compresses like firmware is sent as
+ * an LZ4 block, compressed on the host, and checked after decoding.
+ *
+ * With BL_PATCH_CMD, the last image is patched in place, then patched again
+ * and cut halfway: the first page must be erased by then, and the next command
+ * must end the patch.
+ *
+ * Finally the bootloader is reset with the last image in flash, to time the
+ * start of the application. With A/B slots, the bench then stages an image
+ * through the API table like the running application would, and resets to
+ * activate it.
+ *
+ * Exits with 1 if any case failed, so it can gate a build.
+ *
+ * Usage: bl_bench [-b baud] [-l latency_us] [-e bit_error_rate]
+ * 	[-s image_bytes] [-w window] [-k block_bytes] [-E page_erase_us]
+ * 	[-P word_program_us] [-f flash_file] [-B switched_baud]
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_sim.h"
+#include "../../inc/bl_cfg.h"
+#include "../../inc/bl_cmd_types.h"
+#include "../../inc/bl_crc.h"
+#include "../../inc/bl_defs.h"
+#include "../../inc/bl_journal.h"
+#include "../../inc/bl_patch.h"
+#include "../../inc/bl_slots.h"
+#include "../../inc/bl_sha256.h"
+#include "../../inc/bl_utils.h"
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Time given to the bootloader to start and answer the sync byte */
+#define BL_BENCH_SYNC_TIMEOUT_MS (10000U)
+
+/** Time without traffic after which the link is considered drained */
+#define BL_BENCH_DRAIN_MS (50U)
+
+/** Wait for the answer to each sync byte sent at a new line rate */
+#define BL_BENCH_LINK_SPEED_RETRY_MS (20U)
+
+/** Size of the match finder table of the LZ4 compressor, a power of two */
+#define BL_BENCH_LZ_HASH_BITS (12U)
+
+/** LZ4 block format: shortest match, and end of block rules */
+#define BL_BENCH_LZ_MIN_MATCH (4U)
+#define BL_BENCH_LZ_LAST_LITERALS (5U)
+#define BL_BENCH_LZ_MATCH_LIMIT (12U)
+#define BL_BENCH_LZ_MAX_OFFSET (0xFFFFU)
+
+/** Literal bytes the patch inserts, the stream spans several packets */
+#define BL_BENCH_PATCH_INSERT_BYTES (2 * BL_VS_PAGE_SIZE_BYTES)
+
+/** Repeated bytes the patch writes */
+#define BL_BENCH_PATCH_FILL_BYTES (600U)
+
+/** Bytes of the first page the patch copies to the end of the image */
+#define BL_BENCH_PATCH_TAIL_BYTES (256U)
+
+#define BL_BENCH_MAX_FRAME_BYTES \
+		(sizeof(BL_SEQ_DATA_PACKET_HEADER) + BL_DATA_BLOCK_SIZE)
+
+/**
+ * @struct	BL_BenchResult_t
+ * @brief	Outcome of one transfer
+ *
+ */
+typedef struct {
+	const char *name;
+	uint32_t bytes; /**< Payload transferred */
+	uint64_t elapsed_ns;
+	uint32_t packets; /**< Data packets sent or received, resends included */
+	uint32_t resent; /**< Packets sent or requested again */
+	uint64_t latency_sum_ns;
+	uint64_t latency_max_ns;
+	uint32_t latency_count;
+	BL_SimStats_t stats;
+	uint8_t ok;
+} BL_BenchResult_t;
+
+#if BL_JOURNAL_ENABLE
+/* Journal location from the linker script */
+extern uint32_t _JournalAddr;
+#endif
+
+#if BL_AB_SLOTS_ENABLE
+/* Boot record location from the linker script */
+extern uint32_t _BootRecordAddr;
+#endif
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static BL_SimLinkConfig_t bl_bench_link = { .baud_rate = 115200 };
+
+static BL_SimFlashConfig_t bl_bench_flash = { .page_erase_us = 20000,
+		.word_program_us = 100 };
+
+/** Settings negotiated with the bootloader */
+static BL_CAPABILITIES_RESPONSE bl_bench_caps;
+
+static uint32_t bl_bench_window = 8;
+
+static uint32_t bl_bench_block_size = BL_DATA_BLOCK_SIZE;
+
+/** Image last written to flash, the reads are checked against it */
+static uint8_t *bl_bench_image;
+
+static uint8_t *bl_bench_readback;
+
+static uint32_t bl_bench_size;
+
+static uint8_t bl_bench_frame[BL_BENCH_MAX_FRAME_BYTES];
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn uint32_t bl_bench_crc(const void*, uint32_t)
+ * @brief	Calculates the CRC of a frame like bl_calculate_command_crc, which
+ * 	is left to the bootloader so its statistics only cover its own work
+ *
+ * @param frame	Frame, starting with BL_CommandHeader_t
+ * @param size	Size of the frame
+ * @return	CRC32 of the frame without its CRC field
+ */
+static uint32_t bl_bench_crc(const void *frame, uint32_t size);
+
+/**
+ * @fn void bl_bench_send_command(void*, uint32_t)
+ * @brief	Fills in the size and CRC of a command and sends it
+ *
+ * @param command	Command, starting with BL_CommandHeader_t
+ * @param size		Size of the command
+ */
+static void bl_bench_send_command(void *command, uint32_t size);
+
+/**
+ * @fn BL_Status_t bl_bench_receive_ack(BL_CommandID_t, uint32_t)
+ * @brief	Receives a BL_ACK
+ *
+ * @param id		Expected command ID
+ * @param timeout	Timeout in milliseconds
+ * @return	BL_Status_OK	If a positive ACK for the command arrived
+ * @return	BL_Status_Error	Otherwise
+ */
+static BL_Status_t bl_bench_receive_ack(BL_CommandID_t id, uint32_t timeout);
+
+/**
+ * @fn BL_Status_t bl_bench_receive_frame(uint8_t*, uint32_t, uint32_t)
+ * @brief	Receives a frame and checks its size and CRC
+ *
+ * @param frame		Destination buffer
+ * @param max_size	Size of the buffer
+ * @param timeout	Timeout in milliseconds
+ * @return	BL_Status_OK	If a valid frame arrived
+ * @return	BL_Status_Error	On timeout or corruption, the link is drained
+ */
+static BL_Status_t bl_bench_receive_frame(uint8_t *frame, uint32_t max_size,
+		uint32_t timeout);
+
+/**
+ * @fn void bl_bench_drain(uint32_t)
+ * @brief	Drops everything the bootloader sends until the link is quiet
+ *
+ * @param quiet_ms	Time without traffic after which the link is quiet
+ */
+static void bl_bench_drain(uint32_t quiet_ms);
+
+/**
+ * @fn uint32_t bl_bench_timeout_ms(uint32_t)
+ * @brief	Time a reply may take on the configured link
+ *
+ * @param packets	Data packets that may be in flight before the reply
+ * @return	Timeout in milliseconds
+ */
+static uint32_t bl_bench_timeout_ms(uint32_t packets);
+
+/**
+ * @fn void bl_bench_begin(BL_BenchResult_t*, const char*, uint32_t)
+ * @brief	Starts timing a transfer
+ *
+ * @param result	Result to fill in
+ * @param name		Transfer mode
+ * @param bytes		Payload size
+ */
+static void bl_bench_begin(BL_BenchResult_t *result, const char *name,
+		uint32_t bytes);
+
+/**
+ * @fn uint8_t bl_bench_end(BL_BenchResult_t*, uint8_t)
+ * @brief	Stops timing a transfer and prints its result
+ *
+ * @param result	Result
+ * @param ok		Non-zero if the transfer succeeded and the data matches
+ * @return	ok
+ */
+static uint8_t bl_bench_end(BL_BenchResult_t *result, uint8_t ok);
+
+/**
+ * @fn void bl_bench_latency(BL_BenchResult_t*, uint64_t)
+ * @brief	Accounts the timing of one packet
+ *
+ * @param result	Result
+ * @param ns		Time in nanoseconds
+ */
+static void bl_bench_latency(BL_BenchResult_t *result, uint64_t ns);
+
+/**
+ * @fn uint32_t bl_bench_packets(void)
+ * @brief	Number of data packets carrying the image
+ *
+ * @return	Packet count
+ */
+static uint32_t bl_bench_packets(void);
+
+/**
+ * @fn uint8_t bl_bench_sync(void)
+ * @brief	Synchronizes with the bootloader and negotiates the block size
+ *
+ * @return	Non-zero on success
+ */
+static uint8_t bl_bench_sync(void);
+
+/**
+ * @fn uint8_t bl_bench_link_speed(uint32_t)
+ * @brief	Switches the line rate with BL_SET_LINK_SPEED_CMD, falls back to
+ * 	the current rate if the bootloader does not answer at the new one
+ *
+ * @param baud	New line rate
+ * @return	Non-zero if the line runs at the new rate
+ */
+static uint8_t bl_bench_link_speed(uint32_t baud);
+
+/**
+ * @fn uint8_t bl_bench_erase(const char*)
+ * @brief	Erases the pages of the image with BL_FLASH_ERASE_CMD
+ *
+ * @param name	Transfer mode
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_erase(const char *name);
+
+/**
+ * @fn uint8_t bl_bench_send_image(BL_BenchResult_t*, uint8_t, uint32_t, uint32_t, uint32_t)
+ * @brief	Sends BL_MEM_WRITE_CMD for the image from an offset to its end, and
+ * 	its blocks up to another offset
+ *
+ * @param result	Transfer, counts the packets
+ * @param flags		BL_WriteFlag_t
+ * @param image_id	Image ID, 0 to write without journal
+ * @param offset	Offset of the write in the image
+ * @param stop		Offset of the first block not sent, the image size to
+ * 	complete it
+ * @return	Non-zero if every block sent was acknowledged
+ */
+static uint8_t bl_bench_send_image(BL_BenchResult_t *result, uint8_t flags,
+		uint32_t image_id, uint32_t offset, uint32_t stop);
+
+/**
+ * @fn uint8_t bl_bench_send_blocks(BL_BenchResult_t*, const uint8_t*, uint32_t, uint32_t, uint32_t, uint32_t)
+ * @brief	Sends the data packets of a transfer from an offset up to another
+ * 	one, each one waiting for its ACK like BL_MEM_WRITE_CMD
+ *
+ * @param result	Transfer, counts the packets
+ * @param data		Data of the whole transfer
+ * @param offset	Offset of the first block sent
+ * @param length	Length of the whole transfer, the block that reaches it
+ * 	has 'end_flag' set
+ * @param stop		Offset of the first block not sent, length to complete the
+ * 	transfer
+ * @param timeout	Wait for each ACK in ms
+ * @return	Non-zero if every block sent was acknowledged
+ */
+static uint8_t bl_bench_send_blocks(BL_BenchResult_t *result,
+		const uint8_t *data, uint32_t offset, uint32_t length, uint32_t stop,
+		uint32_t timeout);
+
+/**
+ * @fn uint8_t bl_bench_query_progress(BL_PROGRESS_RESPONSE*)
+ * @brief	Reads the journaled progress with BL_QUERY_PROGRESS_CMD
+ *
+ * @param response	Receives the response
+ * @return	Non-zero if it was received
+ */
+static uint8_t bl_bench_query_progress(BL_PROGRESS_RESPONSE *response);
+
+/**
+ * @fn void bl_bench_fill(uint32_t)
+ * @brief	Fills the image with new contents
+ *
+ * @param seed	Seed of the contents
+ */
+static void bl_bench_fill(uint32_t seed);
+
+/**
+ * @fn void bl_bench_fill_code(uint32_t)
+ * @brief	Fills the image with contents that compress like firmware: words
+ * 	drawn from a small set with a skewed distribution, and erased or zeroed
+ * 	runs
+ *
+ * @param seed	Seed of the contents
+ */
+static void bl_bench_fill_code(uint32_t seed);
+
+/**
+ * @fn uint32_t bl_bench_image_timeout_ms(uint32_t)
+ * @brief	Wait for an ACK that may erase and program every page of an image
+ *
+ * @param length	Length of the image in bytes
+ * @return	Timeout in ms
+ */
+static uint32_t bl_bench_image_timeout_ms(uint32_t length);
+
+/**
+ * @fn uint8_t bl_bench_write(const char*, uint8_t, uint32_t)
+ * @brief	Writes a new image with BL_MEM_WRITE_CMD, one packet at a time
+ *
+ * @param name	Transfer mode
+ * @param flags	BL_WriteFlag_t
+ * @param seed	Seed of the image contents
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_write(const char *name, uint8_t flags, uint32_t seed);
+
+/**
+ * @fn uint8_t bl_bench_write_journaled(const char*, uint32_t)
+ * @brief	Writes a new image with BL_MEM_WRITE_CMD and auto-erase like
+ * 	bl_bench_write, with an image ID so the progress is journaled
+ *
+ * @param name	Transfer mode
+ * @param seed	Seed of the image contents, also its image ID
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_write_journaled(const char *name, uint32_t seed);
+
+/**
+ * @fn uint8_t bl_bench_write_resumed(const char*, uint32_t)
+ * @brief	Writes a new image with BL_MEM_WRITE_CMD, stops halfway like a lost
+ * 	link, then asks for the progress with BL_QUERY_PROGRESS_CMD and sends the
+ * 	rest
+ *
+ * @param name	Transfer mode
+ * @param seed	Seed of the image contents, also its image ID
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_write_resumed(const char *name, uint32_t seed);
+
+/**
+ * @fn uint8_t bl_bench_write_ex(const char*, uint8_t, uint32_t)
+ * @brief	Writes a new image with BL_MEM_WRITE_EX_CMD, a window at a time
+ *
+ * @param name	Transfer mode
+ * @param flags	BL_WriteFlag_t
+ * @param seed	Seed of the image contents
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_write_ex(const char *name, uint8_t flags, uint32_t seed);
+
+/**
+ * @fn uint32_t bl_bench_lz_length(uint8_t*, uint32_t)
+ * @brief	Encodes the extension bytes of an LZ4 literal or match length
+ *
+ * @param out		Receives the bytes
+ * @param length	Length left after the 15 of the token
+ * @return	Number of bytes
+ */
+static uint32_t bl_bench_lz_length(uint8_t *out, uint32_t length);
+
+/**
+ * @fn uint32_t bl_bench_lz_compress(const uint8_t*, uint32_t, uint8_t*)
+ * @brief	Compresses to one LZ4 block (raw block format) with a greedy hash
+ * 	match finder, following the end of block rules of the format
+ *
+ * @param in		Data
+ * @param length	Length of the data
+ * @param out		Receives the block, length + length / 255 + 16 bytes
+ * @return	Length of the block
+ */
+static uint32_t bl_bench_lz_compress(const uint8_t *in, uint32_t length,
+		uint8_t *out);
+
+/**
+ * @fn uint8_t bl_bench_write_lz(const char*, uint32_t)
+ * @brief	Writes a new image that compresses like firmware with
+ * 	BL_MEM_WRITE_LZ_CMD, one packet at a time, and prints the compression
+ * 	ratio
+ *
+ * @param name	Transfer mode
+ * @param seed	Seed of the image contents
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_write_lz(const char *name, uint32_t seed);
+
+/**
+ * @fn uint8_t bl_bench_read(const char*)
+ * @brief	Reads the image back with BL_MEM_READ_CMD
+ *
+ * @param name	Transfer mode
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_read(const char *name);
+
+/**
+ * @fn uint8_t bl_bench_verify(const char*)
+ * @brief	Checks that the digest the bootloader hashed during the last
+ * 	BL_MEM_WRITE_CMD is the one of the image, with an empty signature
+ *
+ * @param name	Name of the result
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_verify(const char *name);
+
+/**
+ * @fn uint8_t bl_bench_read_ex(const char*)
+ * @brief	Reads the image back with BL_MEM_READ_EX_CMD
+ *
+ * @param name	Transfer mode
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_read_ex(const char *name);
+
+/**
+ * @fn uint8_t bl_bench_rejected(BL_CommandID_t, BL_NACK_t)
+ * @brief	Receives the ACK of a request that must be rejected
+ *
+ * @param id	Command ID the ACK must carry
+ * @param field	Errored field the negative ACK must report
+ * @return	Non-zero if a negative ACK reporting the field was received
+ */
+static uint8_t bl_bench_rejected(BL_CommandID_t id, BL_NACK_t field);
+
+/**
+ * @fn uint8_t bl_bench_bad_ranges(const char*)
+ * @brief	Sends requests that reach outside flash or into protected flash,
+ * 	and checks that each one is rejected
+ *
+ * @param name	Name of the result
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_bad_ranges(const char *name);
+
+/**
+ * @fn uint8_t bl_bench_receive_page_crcs(BL_BenchResult_t*, uint32_t, uint32_t)
+ * @brief	Receives the CRC map of a BL_PAGE_CRC_CMD and compares it with the
+ * 	pages of the image
+ *
+ * @param result		Transfer being timed
+ * @param offset		Offset of the first page in the image
+ * @param page_count	Pages mapped
+ * @return	1 if every CRC matched
+ */
+static uint8_t bl_bench_receive_page_crcs(BL_BenchResult_t *result,
+		uint32_t offset, uint32_t page_count);
+
+/**
+ * @fn uint8_t bl_bench_page_crc(const char*)
+ * @brief	Maps the pages of the image in flash with BL_PAGE_CRC_CMD, after a
+ * 	page count that wraps the range size around is refused
+ *
+ * @param name	Mode name
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_page_crc(const char *name);
+
+/**
+ * @fn uint32_t bl_bench_batch_add(uint8_t*, uint32_t, void*, uint32_t)
+ * @brief	Appends a complete sub-command frame to a BL_BATCH_CMD
+ *
+ * @param batch		Batch being built
+ * @param size		Size of the batch so far
+ * @param command	Sub-command, its header is filled in
+ * @param cmd_size	Size of the sub-command
+ * @return	New size of the batch
+ */
+static uint32_t bl_bench_batch_add(uint8_t *batch, uint32_t size,
+		void *command, uint32_t cmd_size);
+
+/**
+ * @fn uint8_t bl_bench_batch_send(uint8_t*, uint32_t, uint8_t, BL_BATCH_RESPONSE*)
+ * @brief	Sends a BL_BATCH_CMD and receives its result vector
+ *
+ * @param batch		Batch, its header is filled in
+ * @param size		Size of the batch
+ * @param count		Sub-commands in the batch
+ * @param response	Receives the result vector
+ * @return	1 if the batch was acknowledged and its results received
+ */
+static uint8_t bl_bench_batch_send(uint8_t *batch, uint32_t size,
+		uint8_t count, BL_BATCH_RESPONSE *response);
+
+/**
+ * @fn uint8_t bl_bench_batch(const char*)
+ * @brief	Runs a batch that stops at a failing sub-command, then a batch that
+ * 	ends with the page CRC map of the image
+ *
+ * @param name	Mode name
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_batch(const char *name);
+
+/**
+ * @fn uint32_t bl_bench_patch_op(uint8_t*, uint8_t, uint32_t, uint32_t)
+ * @brief	Encodes a patch operation
+ *
+ * @param stream	Receives the operation
+ * @param op		BL_PatchOp_t
+ * @param first		First argument
+ * @param second	Second argument, 4 bytes for COPY, 1 for FILL, none for
+ * 	INSERT
+ * @return	Size of the operation in bytes
+ */
+static uint32_t bl_bench_patch_op(uint8_t *stream, uint8_t op, uint32_t first,
+		uint32_t second);
+
+/**
+ * @fn uint8_t bl_bench_patch(const char*, uint8_t)
+ * @brief	Patches the image in flash with BL_PATCH_CMD: keeps its start,
+ * 	replaces a range with literal and repeated bytes, keeps its end moved
+ * 	back, and ends with a copy of the first page, which was erased from flash
+ * 	by then
+ *
+ * @param name	Transfer mode
+ * @param cut	Non-zero to stop halfway like a lost link, then check that no
+ * 	bootable image is left and that the next command aborts the patch
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_patch(const char *name, uint8_t cut);
+
+/**
+ * @fn void bl_bench_print_entry(const char*, const BL_STATS_ENTRY*, uint32_t)
+ * @brief	Prints one line of the bootloader statistics
+ *
+ * @param name		Command or phase
+ * @param entry		Its timing
+ * @param frequency	Rate of the bootloader cycle counter
+ */
+static void bl_bench_print_entry(const char *name, const BL_STATS_ENTRY *entry,
+		uint32_t frequency);
+
+/**
+ * @fn uint8_t bl_bench_stats(void)
+ * @brief	Reads the statistics of the bootloader with BL_GET_STATS_CMD and
+ * 	prints where its time went
+ *
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_stats(void);
+
+/**
+ * @fn uint8_t bl_bench_boot(void)
+ * @brief	Starts the image in flash with BL_JUMP_TO_APP_CMD, then resets the
+ * 	bootloader and prints how long it takes to start the application, and to
+ * 	answer the host when the application requested update mode
+ *
+ * @return	Non-zero if the case passed
+ */
+static uint8_t bl_bench_boot(void);
+
+/**
+ * @fn uint8_t bl_bench_stage(void)
+ * @brief	Plays the application: stages an image into the inactive slot
+ * 	through the API table and commits it, then resets the bootloader and
+ * 	checks that it starts the new slot
+ *
+ * @return	Non-zero if the case passed
+ */
+#if BL_AB_SLOTS_ENABLE
+static uint8_t bl_bench_stage(void);
+#endif
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static uint32_t bl_bench_crc(const void *frame, uint32_t size) {
+	const uint8_t *data = frame;
+	const uint32_t crc_offset = offsetof(BL_CommandHeader_t, CRC32);
+	const uint32_t crc_end = crc_offset + sizeof(uint32_t);
+	uint32_t crc = bl_crc32_init();
+
+	crc = bl_crc32_update(crc, data, crc_offset);
+	crc = bl_crc32_update(crc, &data[crc_end], size - crc_end);
+
+	return bl_crc32_final(crc);
+}
+
+static void bl_bench_send_command(void *command, uint32_t size) {
+	BL_CommandHeader_t *header = command;
+
+	header->payload_size = size;
+	header->CRC32 = bl_bench_crc(command, size);
+
+	bl_sim_host_send(command, size);
+}
+
+static BL_Status_t bl_bench_receive_ack(BL_CommandID_t id, uint32_t timeout) {
+	BL_ACK ack = { 0 };
+
+	if (bl_sim_host_receive(ack.serialized_data, sizeof(ack), timeout)
+			!= BL_Status_OK) {
+		return BL_Status_Error;
+	}
+
+	return (ack.data.ack == 1 && ack.data.cmd_id == id) ?
+			BL_Status_OK : BL_Status_Error;
+}
+
+static BL_Status_t bl_bench_receive_frame(uint8_t *frame, uint32_t max_size,
+		uint32_t timeout) {
+	BL_CommandHeader_t *header = (BL_CommandHeader_t*) frame;
+
+	if (bl_sim_host_receive(frame, sizeof(*header), timeout) != BL_Status_OK) {
+		return BL_Status_Error;
+	}
+
+	if (header->payload_size < sizeof(*header)
+			|| header->payload_size > max_size
+			|| bl_sim_host_receive(frame + sizeof(*header),
+					header->payload_size - sizeof(*header), timeout)
+					!= BL_Status_OK
+			|| bl_bench_crc(frame, header->payload_size)
+					!= header->CRC32) {
+		bl_bench_drain(BL_BENCH_DRAIN_MS);
+		return BL_Status_Error;
+	}
+
+	return BL_Status_OK;
+}
+
+static void bl_bench_drain(uint32_t quiet_ms) {
+	uint8_t byte;
+
+	while (bl_sim_host_receive(&byte, 1, quiet_ms) == BL_Status_OK)
+		;
+}
+
+static uint32_t bl_bench_timeout_ms(uint32_t packets) {
+	uint64_t packet_ms = (uint64_t) (bl_bench_block_size + 32) * 10 * 1000
+			/ bl_bench_link.baud_rate;
+
+	return 200 + 2 * bl_bench_link.latency_us / 1000
+			+ (uint32_t) (2 * packets * packet_ms);
+}
+
+static void bl_bench_begin(BL_BenchResult_t *result, const char *name,
+		uint32_t bytes) {
+	memset(result, 0, sizeof(*result));
+	result->name = name;
+	result->bytes = bytes;
+
+	bl_sim_reset_stats();
+	result->elapsed_ns = bl_sim_now_us() * 1000;
+}
+
+static uint8_t bl_bench_end(BL_BenchResult_t *result, uint8_t ok) {
+	result->elapsed_ns = bl_sim_now_us() * 1000 - result->elapsed_ns;
+	result->ok = ok;
+	bl_sim_get_stats(&result->stats);
+
+	if (!ok) {
+		/* Let the bootloader run out of retries and give up on the transfer,
+		 * or it takes the next command for a reply */
+		bl_bench_drain((BL_MAX_RETRIES + 1) * BL_RECEIVE_TIMEOUT_MS);
+	}
+
+	double ms = result->elapsed_ns / 1e6;
+	double kib_s = ms > 0 ? (result->bytes / 1024.0) / (ms / 1000.0) : 0;
+	double avg_ms =
+			result->latency_count ?
+					result->latency_sum_ns / 1e6 / result->latency_count : 0;
+
+	printf("%-22s %7u %9.1f %9.2f %7u %6u %9.2f %9.2f %9.1f %8u  %s\n",
+			result->name, result->bytes, ms, kib_s, result->packets,
+			result->resent, avg_ms, result->latency_max_ns / 1e6,
+			result->stats.flash_busy_us / 1e3, result->stats.program_ops,
+			ok ? "ok" : "FAILED");
+
+	return ok;
+}
+
+static void bl_bench_latency(BL_BenchResult_t *result, uint64_t ns) {
+	result->latency_sum_ns += ns;
+	result->latency_count++;
+	if (ns > result->latency_max_ns) {
+		result->latency_max_ns = ns;
+	}
+}
+
+static uint32_t bl_bench_packets(void) {
+	return (bl_bench_size + bl_bench_block_size - 1) / bl_bench_block_size;
+}
+
+static uint8_t bl_bench_sync(void) {
+	uint8_t sync = BL_SYNC_BYTE_VALUE;
+
+	bl_sim_host_send(&sync, 1);
+	if (bl_sim_host_receive(&sync, 1, BL_BENCH_SYNC_TIMEOUT_MS) != BL_Status_OK
+			|| sync != BL_SYNC_BYTE_VALUE) {
+		return 0;
+	}
+
+	BL_GET_CAPABILITIES_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_GET_CAPABILITIES_CMD_ID;
+	cmd.data.max_block_size = bl_bench_block_size;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	if (bl_bench_receive_ack(BL_GET_CAPABILITIES_CMD_ID, bl_bench_timeout_ms(0))
+			!= BL_Status_OK
+			|| bl_bench_receive_frame(bl_bench_caps.serialized_data,
+					sizeof(bl_bench_caps), bl_bench_timeout_ms(0))
+					!= BL_Status_OK) {
+		return 0;
+	}
+
+	bl_bench_block_size = bl_bench_caps.data.block_size;
+
+	return 1;
+}
+
+static uint8_t bl_bench_link_speed(uint32_t baud) {
+	uint32_t old_rate = bl_bench_link.baud_rate;
+	uint8_t sync = 0;
+
+	BL_SET_LINK_SPEED_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_SET_LINK_SPEED_CMD_ID;
+	cmd.data.baud_rate = baud;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	if (bl_bench_receive_ack(BL_SET_LINK_SPEED_CMD_ID, bl_bench_timeout_ms(0))
+			!= BL_Status_OK) {
+		return 0;
+	}
+
+	bl_sim_host_set_baud_rate(baud);
+	bl_bench_link.baud_rate = baud;
+
+	/* Keep the attempts well inside the window of the bootloader */
+	for (uint32_t waited = 0; waited < BL_LINK_SPEED_TIMEOUT_MS / 2;
+			waited += BL_BENCH_LINK_SPEED_RETRY_MS) {
+		sync = BL_SYNC_BYTE_VALUE;
+		bl_sim_host_send(&sync, 1);
+		if (bl_sim_host_receive(&sync, 1, BL_BENCH_LINK_SPEED_RETRY_MS)
+				== BL_Status_OK && sync == BL_SYNC_BYTE_VALUE) {
+			return 1;
+		}
+	}
+
+	/* The bootloader goes back once the line stays quiet for its timeout */
+	bl_bench_drain(BL_LINK_SPEED_TIMEOUT_MS + BL_BENCH_DRAIN_MS);
+	bl_sim_host_set_baud_rate(old_rate);
+	bl_bench_link.baud_rate = old_rate;
+	bl_sim_host_flush();
+
+	return 0;
+}
+
+static uint8_t bl_bench_erase(const char *name) {
+	BL_BenchResult_t result;
+	uint32_t pages = (bl_bench_size + BL_VS_PAGE_SIZE_BYTES - 1)
+			/ BL_VS_PAGE_SIZE_BYTES;
+	uint32_t timeout = bl_bench_timeout_ms(0)
+			+ pages * bl_bench_flash.page_erase_us / 1000;
+
+	bl_bench_begin(&result, name, pages * BL_VS_PAGE_SIZE_BYTES);
+
+	BL_FLASH_ERASE_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_FLASH_ERASE_CMD_ID;
+	cmd.data.address = bl_bench_caps.data.app_start;
+	cmd.data.page_count = pages;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	BL_Response response = { 0 };
+	uint8_t ok = bl_bench_receive_ack(BL_FLASH_ERASE_CMD_ID, timeout)
+			== BL_Status_OK
+			&& bl_bench_receive_ack(BL_FLASH_ERASE_CMD_ID, timeout)
+					== BL_Status_OK
+			&& bl_bench_receive_frame(response.serialized_data,
+					sizeof(response), timeout) == BL_Status_OK;
+
+	result.packets = 1;
+	bl_bench_latency(&result, bl_sim_now_us() * 1000 - result.elapsed_ns);
+	return bl_bench_end(&result, ok);
+}
+
+static uint8_t bl_bench_send_image(BL_BenchResult_t *result, uint8_t flags,
+		uint32_t image_id, uint32_t offset, uint32_t stop) {
+	uint32_t timeout = bl_bench_timeout_ms(1);
+
+	BL_MEM_WRITE_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_MEM_WRITE_CMD_ID;
+	cmd.data.start_address = bl_bench_caps.data.app_start + offset;
+	cmd.data.flags = flags;
+	cmd.data.length = bl_bench_size - offset;
+	cmd.data.image_id = image_id;
+	cmd.data.image_crc = bl_crc32_final(
+			bl_crc32_update(bl_crc32_init(), bl_bench_image, bl_bench_size));
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	/* Rebuilding the digest of a resumed image reads its start from flash */
+	if (bl_bench_receive_ack(BL_MEM_WRITE_CMD_ID,
+			timeout + bl_bench_timeout_ms(0)) != BL_Status_OK) {
+		return 0;
+	}
+
+	return bl_bench_send_blocks(result, bl_bench_image, offset, bl_bench_size,
+			stop, timeout);
+}
+
+static uint8_t bl_bench_send_blocks(BL_BenchResult_t *result,
+		const uint8_t *data, uint32_t offset, uint32_t length, uint32_t stop,
+		uint32_t timeout) {
+	static BL_DATA_PACKET_CMD packet;
+
+	while (offset < stop) {
+		uint32_t len = length - offset;
+		if (len > bl_bench_block_size) {
+			len = bl_bench_block_size;
+		}
+
+		memset(&packet, 0, sizeof(BL_DATA_PACKET_HEADER));
+		packet.data.header.cmd_id = BL_DATA_PACKET_CMD_ID;
+		packet.data.data_len = len;
+		packet.data.end_flag = offset + len == length;
+		memcpy(packet.data.data_block, data + offset, len);
+
+		/* Sent again on a negative ACK, as long as the bootloader retries */
+		uint32_t retries = 0;
+		for (;;) {
+			uint64_t sent_ns = bl_sim_now_us() * 1000;
+
+			bl_bench_send_command(&packet,
+					sizeof(BL_DATA_PACKET_HEADER) + len);
+			result->packets++;
+
+			if (bl_bench_receive_ack(BL_DATA_PACKET_CMD_ID, timeout)
+					== BL_Status_OK) {
+				bl_bench_latency(result, bl_sim_now_us() * 1000 - sent_ns);
+				break;
+			}
+			if (++retries > BL_MAX_RETRIES) {
+				return 0;
+			}
+			result->resent++;
+		}
+
+		offset += len;
+	}
+
+	return 1;
+}
+
+static uint8_t bl_bench_query_progress(BL_PROGRESS_RESPONSE *response) {
+	BL_QUERY_PROGRESS_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_QUERY_PROGRESS_CMD_ID;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	return bl_bench_receive_ack(BL_QUERY_PROGRESS_CMD_ID,
+			bl_bench_timeout_ms(0)) == BL_Status_OK
+			&& bl_bench_receive_frame(response->serialized_data,
+					sizeof(*response), bl_bench_timeout_ms(0))
+					== BL_Status_OK;
+}
+
+static void bl_bench_fill(uint32_t seed) {
+	srand(seed);
+	for (uint32_t i = 0; i < bl_bench_size; i++) {
+		bl_bench_image[i] = (uint8_t) rand();
+	}
+}
+
+static void bl_bench_fill_code(uint32_t seed) {
+	uint32_t words[64];
+
+	srand(seed);
+	for (uint32_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		words[i] = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+	}
+
+	for (uint32_t i = 0; i < bl_bench_size;) {
+		uint32_t run = rand() % 64;
+		uint32_t word;
+
+		if (run == 0) {
+			/* Padding, or zero initialized data */
+			run = 16 + rand() % 128;
+			memset(&bl_bench_image[i], (rand() & 1) ? 0xFF : 0x00,
+					(run < bl_bench_size - i) ? run : bl_bench_size - i);
+			i += run;
+			continue;
+		}
+
+		/* Few words are frequent, like common instructions */
+		word = words[(rand() % 8) * (rand() % 8)];
+		for (uint32_t b = 0; b < sizeof(word) && i < bl_bench_size; b++) {
+			bl_bench_image[i++] = (uint8_t) (word >> (8 * b));
+		}
+	}
+}
+
+static uint32_t bl_bench_image_timeout_ms(uint32_t length) {
+	uint32_t pages = (length + BL_VS_PAGE_SIZE_BYTES - 1)
+			/ BL_VS_PAGE_SIZE_BYTES;
+
+	return bl_bench_timeout_ms(1)
+			+ (pages + 1)
+					* (bl_bench_flash.page_erase_us
+							+ BL_VS_PAGE_SIZE_BYTES / sizeof(uint32_t)
+									* bl_bench_flash.word_program_us) / 1000;
+}
+
+static uint8_t bl_bench_write(const char *name, uint8_t flags, uint32_t seed) {
+	BL_BenchResult_t result;
+
+	bl_bench_fill(seed);
+
+	bl_bench_begin(&result, name, bl_bench_size);
+
+	uint8_t ok = bl_bench_send_image(&result, flags, 0, 0, bl_bench_size)
+			&& memcmp((const void*) (uintptr_t) bl_bench_caps.data.app_start,
+					bl_bench_image, bl_bench_size) == 0;
+	return bl_bench_end(&result, ok);
+}
+
+static uint8_t bl_bench_write_journaled(const char *name, uint32_t seed) {
+	BL_PROGRESS_RESPONSE progress;
+	BL_BenchResult_t result;
+
+	bl_bench_fill(seed);
+
+	bl_bench_begin(&result, name, bl_bench_size);
+
+	uint8_t ok = bl_bench_send_image(&result, BL_WRITE_FLAG_AUTO_ERASE, seed, 0,
+			bl_bench_size)
+			&& memcmp((const void*) (uintptr_t) bl_bench_caps.data.app_start,
+					bl_bench_image, bl_bench_size) == 0
+			&& bl_bench_query_progress(&progress)
+			&& progress.data.committed == bl_bench_size;
+	return bl_bench_end(&result, ok);
+}
+
+static uint8_t bl_bench_write_resumed(const char *name, uint32_t seed) {
+	BL_PROGRESS_RESPONSE progress;
+	BL_BenchResult_t result;
+	uint32_t stop = bl_bench_packets() / 2 * bl_bench_block_size;
+	uint8_t ok;
+
+	bl_bench_fill(seed);
+
+	bl_bench_begin(&result, name, 0);
+
+	/* The link goes down halfway through the image */
+	ok = bl_bench_send_image(&result, BL_WRITE_FLAG_AUTO_ERASE, seed, 0, stop);
+
+	/* The bootloader still waits for the rest of the image, it drops the
+	 * write and rejects the first command that is not a data packet */
+	bl_bench_query_progress(&progress);
+
+	ok = ok && bl_bench_query_progress(&progress)
+			&& progress.data.image_id == seed
+			&& progress.data.committed <= stop;
+
+	uint32_t committed = ok ? progress.data.committed : 0;
+
+	ok = ok
+			&& bl_bench_send_image(&result, BL_WRITE_FLAG_AUTO_ERASE, seed,
+					committed, bl_bench_size)
+			&& memcmp((const void*) (uintptr_t) bl_bench_caps.data.app_start,
+					bl_bench_image, bl_bench_size) == 0
+			&& bl_bench_query_progress(&progress)
+			&& progress.data.committed == bl_bench_size;
+
+	result.bytes = stop + bl_bench_size - committed;
+	bl_bench_end(&result, ok);
+	printf("%-22s resumed at offset %u after losing the link at %u\n", "",
+			committed, stop);
+
+	return ok;
+}
+
+static uint8_t bl_bench_verify(const char *name) {
+	BL_VERIFY_SIGNATURE_RESPONSE response;
+	BL_BenchResult_t result;
+	BL_Sha256_t sha;
+	uint8_t digest[BL_SHA256_DIGEST_BYTES];
+
+	bl_sha256_init(&sha);
+	bl_sha256_update(&sha, bl_bench_image, bl_bench_size);
+	bl_sha256_final(&sha, digest);
+
+	bl_bench_begin(&result, name, bl_bench_size);
+
+	/* The signature is sent empty, only the digest is checked */
+	BL_VERIFY_SIGNATURE_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_VERIFY_SIGNATURE_CMD_ID;
+	cmd.data.start_address = bl_bench_caps.data.app_start;
+	cmd.data.length = bl_bench_size;
+	bl_bench_send_command(&cmd, BL_VERIFY_SIGNATURE_CMD_MIN_SIZE);
+
+	uint8_t ok = bl_bench_receive_ack(BL_VERIFY_SIGNATURE_CMD_ID,
+			bl_bench_timeout_ms(0)) == BL_Status_OK
+			&& bl_bench_receive_frame(response.serialized_data,
+					sizeof(response), bl_bench_timeout_ms(1)) == BL_Status_OK
+			&& memcmp(response.data.digest, digest, sizeof(digest)) == 0;
+
+	result.packets = 1;
+	bl_bench_latency(&result, bl_sim_now_us() * 1000 - result.elapsed_ns);
+	return bl_bench_end(&result, ok);
+}
+
+static uint8_t bl_bench_write_ex(const char *name, uint8_t flags, uint32_t seed) {
+	static BL_SEQ_DATA_PACKET_CMD packet;
+	BL_BenchResult_t result;
+	uint32_t total = bl_bench_packets();
+	uint64_t *sent_ns = calloc(total, sizeof(uint64_t));
+	uint8_t ok = 1;
+
+	bl_bench_fill(seed);
+
+	bl_bench_begin(&result, name, bl_bench_size);
+
+	BL_MEM_WRITE_EX_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_MEM_WRITE_EX_CMD_ID;
+	cmd.data.start_address = bl_bench_caps.data.app_start;
+	cmd.data.window = (uint8_t) bl_bench_window;
+	cmd.data.flags = flags;
+	cmd.data.length = bl_bench_size;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	BL_Response response = { 0 };
+	if (bl_bench_receive_ack(BL_MEM_WRITE_EX_CMD_ID, bl_bench_timeout_ms(0))
+			!= BL_Status_OK
+			|| bl_bench_receive_frame(response.serialized_data,
+					sizeof(response), bl_bench_timeout_ms(0))
+					!= BL_Status_OK) {
+		free(sent_ns);
+		return bl_bench_end(&result, 0);
+	}
+
+	uint32_t window = response.data.data[0];
+	uint32_t timeout = bl_bench_timeout_ms(window);
+	uint32_t base = 0; /* First packet not acknowledged */
+	uint32_t next = 0; /* First packet never sent */
+	uint32_t resend = 0; /* Bit i: packet base + i must be sent again */
+	uint32_t retries = 0;
+
+	while (ok && base < total) {
+		for (uint32_t seq = base; seq < total && seq < base + window; seq++) {
+			if (seq < next && !(resend & (1UL << (seq - base)))) {
+				continue;
+			}
+
+			uint32_t offset = seq * bl_bench_block_size;
+			uint32_t len = bl_bench_size - offset;
+			if (len > bl_bench_block_size) {
+				len = bl_bench_block_size;
+			}
+
+			memset(&packet, 0, sizeof(BL_SEQ_DATA_PACKET_HEADER));
+			packet.data.header.cmd_id = BL_SEQ_DATA_PACKET_CMD_ID;
+			packet.data.seq = seq;
+			packet.data.offset = offset;
+			packet.data.data_len = len;
+			packet.data.end_flag = seq == total - 1;
+			memcpy(packet.data.data_block, bl_bench_image + offset, len);
+
+			if (seq < next) {
+				result.resent++;
+			} else {
+				next = seq + 1;
+			}
+			sent_ns[seq] = bl_sim_now_us() * 1000;
+			bl_bench_send_command(&packet,
+					sizeof(BL_SEQ_DATA_PACKET_HEADER) + len);
+			result.packets++;
+		}
+		resend = 0;
+
+		BL_WINDOW_ACK ack = { 0 };
+		if (bl_sim_host_receive(ack.serialized_data, sizeof(ack), timeout)
+				!= BL_Status_OK
+				|| ack.data.cmd_id != BL_SEQ_DATA_PACKET_CMD_ID) {
+			/* Nothing came back, send the whole window again */
+			bl_bench_drain(BL_BENCH_DRAIN_MS);
+			resend = 0xFFFFFFFFU;
+			ok = ++retries <= BL_MAX_RETRIES;
+			continue;
+		}
+
+		if (!ack.data.ack
+				&& (ack.data.field
+						& (BL_NACK_INVALID_ADDRESS | BL_NACK_OPERATION_FAILURE))) {
+			ok = 0;
+			break;
+		}
+
+		if (ack.data.next_seq > base && ack.data.next_seq <= next) {
+			uint64_t now = bl_sim_now_us() * 1000;
+			for (uint32_t seq = base; seq < ack.data.next_seq; seq++) {
+				bl_bench_latency(&result, now - sent_ns[seq]);
+			}
+			base = ack.data.next_seq;
+			retries = 0;
+		}
+		if (!ack.data.ack) {
+			/* Packets past the last one received are not listed as missing */
+			resend = 0xFFFFFFFFU;
+		} else if (ack.data.next_seq == base) {
+			resend = ack.data.missing;
+		}
+	}
+
+	free(sent_ns);
+
+	ok = ok
+			&& memcmp((const void*) (uintptr_t) bl_bench_caps.data.app_start,
+					bl_bench_image, bl_bench_size) == 0;
+	return bl_bench_end(&result, ok);
+}
+
+static uint32_t bl_bench_lz_length(uint8_t *out, uint32_t length) {
+	uint32_t size = 0;
+
+	while (length >= 255) {
+		out[size++] = 255;
+		length -= 255;
+	}
+	out[size++] = (uint8_t) length;
+
+	return size;
+}
+
+static uint32_t bl_bench_lz_compress(const uint8_t *in, uint32_t length,
+		uint8_t *out) {
+	static uint32_t table[1U << BL_BENCH_LZ_HASH_BITS];
+	uint32_t limit = (length > BL_BENCH_LZ_MATCH_LIMIT) ?
+			length - BL_BENCH_LZ_MATCH_LIMIT : 0;
+	uint32_t anchor = 0;
+	uint32_t size = 0;
+
+	/* Positions are stored plus one, zero is an empty slot */
+	memset(table, 0, sizeof(table));
+
+	for (uint32_t i = 0; i < limit;) {
+		uint32_t sequence;
+		uint32_t candidate;
+
+		memcpy(&sequence, &in[i], sizeof(sequence));
+		uint32_t hash = (sequence * 2654435761U)
+				>> (32 - BL_BENCH_LZ_HASH_BITS);
+		candidate = table[hash];
+		table[hash] = i + 1;
+
+		if (candidate == 0 || i - (candidate - 1) > BL_BENCH_LZ_MAX_OFFSET
+				|| memcmp(&in[candidate - 1], &in[i], BL_BENCH_LZ_MIN_MATCH)
+						!= 0) {
+			i++;
+			continue;
+		}
+		candidate--;
+
+		/* The last literals of the block are never part of a match */
+		uint32_t match = BL_BENCH_LZ_MIN_MATCH;
+		while (i + match < length - BL_BENCH_LZ_LAST_LITERALS
+				&& in[candidate + match] == in[i + match]) {
+			match++;
+		}
+
+		uint32_t literals = i - anchor;
+		uint32_t extra = match - BL_BENCH_LZ_MIN_MATCH;
+		uint8_t *token = &out[size++];
+
+		*token = (uint8_t) (((literals < 15) ? literals : 15) << 4
+				| ((extra < 15) ? extra : 15));
+		if (literals >= 15) {
+			size += bl_bench_lz_length(&out[size], literals - 15);
+		}
+		memcpy(&out[size], &in[anchor], literals);
+		size += literals;
+
+		out[size++] = (uint8_t) (i - candidate);
+		out[size++] = (uint8_t) ((i - candidate) >> 8);
+		if (extra >= 15) {
+			size += bl_bench_lz_length(&out[size], extra - 15);
+		}
+
+		i += match;
+		anchor = i;
+	}
+
+	/* Last sequence: literals only */
+	uint32_t literals = length - anchor;
+
+	out[size++] = (uint8_t) (((literals < 15) ? literals : 15) << 4);
+	if (literals >= 15) {
+		size += bl_bench_lz_length(&out[size], literals - 15);
+	}
+	memcpy(&out[size], &in[anchor], literals);
+	size += literals;
+
+	return size;
+}
+
+static uint8_t bl_bench_write_lz(const char *name, uint32_t seed) {
+	BL_BenchResult_t result;
+	uint8_t *block = malloc(bl_bench_size + bl_bench_size / 255 + 16);
+
+	bl_bench_fill_code(seed);
+	uint32_t length = bl_bench_lz_compress(bl_bench_image, bl_bench_size,
+			block);
+
+	bl_bench_begin(&result, name, bl_bench_size);
+
+	BL_MEM_WRITE_LZ_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_MEM_WRITE_LZ_CMD_ID;
+	cmd.data.start_address = bl_bench_caps.data.app_start;
+	cmd.data.length = bl_bench_size;
+	cmd.data.crc = bl_crc32_final(
+			bl_crc32_update(bl_crc32_init(), bl_bench_image, bl_bench_size));
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	/* A packet of matches may complete many pages */
+	uint8_t ok = bl_bench_receive_ack(BL_MEM_WRITE_LZ_CMD_ID,
+			bl_bench_timeout_ms(0)) == BL_Status_OK
+			&& bl_bench_send_blocks(&result, block, 0, length, length,
+					bl_bench_image_timeout_ms(bl_bench_size))
+			&& memcmp((const void*) (uintptr_t) bl_bench_caps.data.app_start,
+					bl_bench_image, bl_bench_size) == 0;
+
+	bl_bench_end(&result, ok);
+	printf("%-22s %u compressed bytes, ratio %.2f\n", "", length,
+			(double) bl_bench_size / length);
+
+	free(block);
+
+	return ok;
+}
+
+static uint8_t bl_bench_read(const char *name) {
+	BL_BenchResult_t result;
+	BL_DATA_PACKET_CMD *packet = (BL_DATA_PACKET_CMD*) bl_bench_frame;
+	uint32_t timeout = bl_bench_timeout_ms(1);
+	uint8_t ok = 1;
+
+	bl_bench_begin(&result, name, bl_bench_size);
+
+	BL_MEM_READ_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_MEM_READ_CMD_ID;
+	cmd.data.start_addr = bl_bench_caps.data.app_start;
+	cmd.data.length = bl_bench_size;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	if (bl_bench_receive_ack(BL_MEM_READ_CMD_ID, timeout) != BL_Status_OK) {
+		return bl_bench_end(&result, 0);
+	}
+
+	uint64_t last_ns = bl_sim_now_us() * 1000;
+	uint32_t retries = 0;
+
+	for (uint32_t offset = 0; offset < bl_bench_size;) {
+		BL_ACK ack = { 0 };
+
+		ack.data.cmd_id = BL_ACK_CMD_ID;
+		ack.data.ack = bl_bench_receive_frame(bl_bench_frame,
+				sizeof(BL_DATA_PACKET_HEADER) + bl_bench_block_size, timeout)
+				== BL_Status_OK && packet->data.header.cmd_id
+						== BL_DATA_PACKET_CMD_ID
+				&& packet->data.data_len <= bl_bench_size - offset;
+		result.packets++;
+
+		if (!ack.data.ack) {
+			/* Ask for the block again */
+			if (++retries > BL_MAX_RETRIES) {
+				ok = 0;
+				break;
+			}
+			result.resent++;
+			bl_sim_host_send(ack.serialized_data, sizeof(ack));
+			continue;
+		}
+
+		uint64_t now = bl_sim_now_us() * 1000;
+		bl_bench_latency(&result, now - last_ns);
+		last_ns = now;
+		retries = 0;
+
+		memcpy(bl_bench_readback + offset, packet->data.data_block,
+				packet->data.data_len);
+		offset += packet->data.data_len;
+
+		bl_sim_host_send(ack.serialized_data, sizeof(ack));
+	}
+
+	ok = ok && memcmp(bl_bench_readback, bl_bench_image, bl_bench_size) == 0;
+	return bl_bench_end(&result, ok);
+}
+
+static uint8_t bl_bench_read_ex(const char *name) {
+	BL_BenchResult_t result;
+	BL_SEQ_DATA_PACKET_CMD *packet = (BL_SEQ_DATA_PACKET_CMD*) bl_bench_frame;
+	uint32_t total = bl_bench_packets();
+	uint8_t *received = calloc(total, 1);
+	uint8_t ok = 1;
+
+	bl_bench_begin(&result, name, bl_bench_size);
+
+	BL_MEM_READ_EX_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_MEM_READ_EX_CMD_ID;
+	cmd.data.start_addr = bl_bench_caps.data.app_start;
+	cmd.data.length = bl_bench_size;
+	cmd.data.window = (uint8_t) bl_bench_window;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	BL_Response response = { 0 };
+	if (bl_bench_receive_ack(BL_MEM_READ_EX_CMD_ID, bl_bench_timeout_ms(0))
+			!= BL_Status_OK
+			|| bl_bench_receive_frame(response.serialized_data,
+					sizeof(response), bl_bench_timeout_ms(0))
+					!= BL_Status_OK) {
+		free(received);
+		return bl_bench_end(&result, 0);
+	}
+
+	uint32_t window = response.data.data[0];
+	/* Acknowledge twice per window so the bootloader never runs dry */
+	uint32_t ack_every = (window > 1) ? window / 2 : 1;
+	uint32_t timeout = bl_bench_timeout_ms(1);
+	uint32_t base = 0; /* First packet not received */
+	uint32_t highest = 0; /* Highest packet received */
+	uint32_t fresh = 0; /* Packets received since the last ACK */
+	uint32_t retries = 0;
+	uint64_t last_ns = bl_sim_now_us() * 1000;
+
+	while (base < total) {
+		uint32_t last = highest; /* Last packet that may be reported missing */
+		uint8_t valid = bl_bench_receive_frame(bl_bench_frame,
+				sizeof(BL_SEQ_DATA_PACKET_HEADER) + bl_bench_block_size,
+				timeout) == BL_Status_OK
+				&& packet->data.header.cmd_id == BL_SEQ_DATA_PACKET_CMD_ID
+				&& packet->data.seq < total
+				&& packet->data.offset == packet->data.seq * bl_bench_block_size
+				&& packet->data.data_len
+						<= bl_bench_size - packet->data.offset;
+
+		if (valid) {
+			uint32_t seq = packet->data.seq;
+			uint64_t now = bl_sim_now_us() * 1000;
+
+			result.packets++;
+			bl_bench_latency(&result, now - last_ns);
+			last_ns = now;
+
+			if (received[seq]) {
+				result.resent++;
+				continue;
+			}
+			received[seq] = 1;
+			memcpy(bl_bench_readback + packet->data.offset,
+					packet->data.data_block, packet->data.data_len);
+			if (seq > highest) {
+				highest = seq;
+			}
+			while (base < total && received[base]) {
+				base++;
+			}
+			if (++fresh < ack_every && base < total) {
+				continue;
+			}
+			retries = 0;
+		} else {
+			if (++retries > BL_MAX_RETRIES) {
+				ok = 0;
+				break;
+			}
+			/* Whatever was sent after the highest packet is lost as well */
+			last = base + window - 1;
+		}
+
+		/* Cumulative ACK listing the gaps */
+		BL_WINDOW_ACK ack = { 0 };
+		ack.data.cmd_id = BL_SEQ_DATA_PACKET_CMD_ID;
+		ack.data.ack = 1;
+		ack.data.next_seq = base;
+		for (uint32_t i = 0; i < 32 && base + i <= last && base + i < total;
+				i++) {
+			if (!received[base + i]) {
+				ack.data.missing |= 1UL << i;
+			}
+		}
+		bl_sim_host_send(ack.serialized_data, sizeof(ack));
+		fresh = 0;
+	}
+
+	free(received);
+
+	ok = ok && memcmp(bl_bench_readback, bl_bench_image, bl_bench_size) == 0;
+	return bl_bench_end(&result, ok);
+}
+
+static uint8_t bl_bench_rejected(BL_CommandID_t id, BL_NACK_t field) {
+	BL_ACK ack = { 0 };
+
+	return bl_sim_host_receive(ack.serialized_data, sizeof(ack),
+			bl_bench_timeout_ms(1)) == BL_Status_OK && ack.data.cmd_id == id
+			&& ack.data.ack == 0 && (ack.data.field & field);
+}
+
+static uint8_t bl_bench_bad_ranges(const char *name) {
+	static BL_DATA_PACKET_CMD packet;
+	BL_BenchResult_t result;
+	uint8_t ok = 1;
+
+	bl_bench_begin(&result, name, 0);
+
+	/* RAM, right after flash */
+	BL_MEM_WRITE_CMD write = { 0 };
+	write.data.header.cmd_id = BL_MEM_WRITE_CMD_ID;
+	write.data.start_address = bl_bench_caps.data.flash_end + 1;
+	write.data.length = bl_bench_block_size;
+	bl_bench_send_command(&write, BL_MEM_WRITE_CMD_NO_IMAGE_SIZE);
+	ok = ok && bl_bench_rejected(BL_MEM_WRITE_CMD_ID, BL_NACK_INVALID_ADDRESS);
+	result.packets++;
+
+	/* A range that wraps around the address space */
+	BL_MEM_WRITE_EX_CMD write_ex = { 0 };
+	write_ex.data.header.cmd_id = BL_MEM_WRITE_EX_CMD_ID;
+	write_ex.data.start_address = bl_bench_caps.data.app_start;
+	write_ex.data.window = 1;
+	write_ex.data.flags = BL_WRITE_FLAG_AUTO_ERASE;
+	write_ex.data.length = 0 - bl_bench_caps.data.app_start;
+	bl_bench_send_command(&write_ex, sizeof(write_ex));
+	ok = ok
+			&& bl_bench_rejected(BL_MEM_WRITE_EX_CMD_ID,
+					BL_NACK_INVALID_ADDRESS);
+	result.packets++;
+
+	/* Compressed write and read whose ends wrap around to the first page of
+	 * the address space */
+	if (bl_bench_caps.data.features & BL_FEATURE_LZ_WRITE) {
+		BL_MEM_WRITE_LZ_CMD write_lz = { 0 };
+		write_lz.data.header.cmd_id = BL_MEM_WRITE_LZ_CMD_ID;
+		write_lz.data.start_address = bl_bench_caps.data.app_start;
+		write_lz.data.length = 0 - bl_bench_caps.data.app_start
+				+ BL_VS_PAGE_SIZE_BYTES;
+		bl_bench_send_command(&write_lz, sizeof(write_lz));
+		ok = ok
+				&& bl_bench_rejected(BL_MEM_WRITE_LZ_CMD_ID,
+						BL_NACK_INVALID_ADDRESS);
+		result.packets++;
+	}
+
+	BL_MEM_READ_CMD read = { 0 };
+	read.data.header.cmd_id = BL_MEM_READ_CMD_ID;
+	read.data.start_addr = bl_bench_caps.data.app_start;
+	read.data.length = 0 - bl_bench_caps.data.app_start + BL_VS_PAGE_SIZE_BYTES;
+	bl_bench_send_command(&read, sizeof(read));
+	ok = ok && bl_bench_rejected(BL_MEM_READ_CMD_ID, BL_NACK_INVALID_ADDRESS);
+	result.packets++;
+
+	/* Pages after the application reserved for the logs, a write must end
+	 * before the first one */
+	uint32_t writable_end = bl_bench_caps.data.flash_end + 1;
+	uint32_t journal = 0;
+	uint32_t boot_record = 0;
+
+#if BL_JOURNAL_ENABLE
+	journal = (uint32_t) (uintptr_t) &_JournalAddr;
+	if (journal > bl_bench_caps.data.app_start && journal < writable_end) {
+		writable_end = journal;
+	}
+#endif
+#if BL_AB_SLOTS_ENABLE
+	boot_record = (uint32_t) (uintptr_t) &_BootRecordAddr;
+	if (boot_record > bl_bench_caps.data.app_start
+			&& boot_record < writable_end) {
+		writable_end = boot_record;
+	}
+#endif
+
+	/* The journal, with a length */
+	if (journal != 0) {
+		write.data.start_address = journal;
+		write.data.length = bl_bench_block_size;
+		bl_bench_send_command(&write, BL_MEM_WRITE_CMD_NO_IMAGE_SIZE);
+		ok = ok
+				&& bl_bench_rejected(BL_MEM_WRITE_CMD_ID,
+						BL_NACK_INVALID_ADDRESS);
+		result.packets++;
+	}
+
+	/* The boot record, with an erase */
+	if (boot_record != 0) {
+		BL_FLASH_ERASE_CMD erase = { 0 };
+		erase.data.header.cmd_id = BL_FLASH_ERASE_CMD_ID;
+		erase.data.address = boot_record;
+		erase.data.page_count = BL_BOOT_RECORD_PAGES;
+		bl_bench_send_command(&erase, sizeof(erase));
+		ok = ok
+				&& bl_bench_rejected(BL_FLASH_ERASE_CMD_ID,
+						BL_NACK_INVALID_ADDRESS);
+		result.packets++;
+	}
+
+	/* Auto-erase of the last writable page and the first reserved one */
+	if (writable_end != bl_bench_caps.data.flash_end + 1) {
+		write_ex.data.start_address = writable_end - BL_VS_PAGE_SIZE_BYTES;
+		write_ex.data.length = 2 * BL_VS_PAGE_SIZE_BYTES;
+		bl_bench_send_command(&write_ex, sizeof(write_ex));
+		ok = ok
+				&& bl_bench_rejected(BL_MEM_WRITE_EX_CMD_ID,
+						BL_NACK_INVALID_ADDRESS);
+		result.packets++;
+	}
+
+	/* Without a length, the block that crosses the end of flash, or into the
+	 * pages of the logs, is refused */
+	write.data.start_address = writable_end - bl_bench_block_size / 2;
+	write.data.length = 0;
+	bl_bench_send_command(&write, BL_MEM_WRITE_CMD_NO_IMAGE_SIZE);
+	ok = ok
+			&& bl_bench_receive_ack(BL_MEM_WRITE_CMD_ID, bl_bench_timeout_ms(0))
+					== BL_Status_OK;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.data.header.cmd_id = BL_DATA_PACKET_CMD_ID;
+	packet.data.data_len = bl_bench_block_size;
+	packet.data.end_flag = 1;
+	bl_bench_send_command(&packet,
+			sizeof(BL_DATA_PACKET_HEADER) + bl_bench_block_size);
+	ok = ok
+			&& bl_bench_rejected(BL_DATA_PACKET_CMD_ID,
+					BL_NACK_INVALID_ADDRESS);
+	result.packets += 2;
+
+	return bl_bench_end(&result, ok);
+}
+
+static uint8_t bl_bench_receive_page_crcs(BL_BenchResult_t *result,
+		uint32_t offset, uint32_t page_count) {
+	BL_DATA_PACKET_CMD *packet = (BL_DATA_PACKET_CMD*) bl_bench_frame;
+	uint32_t timeout = bl_bench_timeout_ms(1);
+	uint64_t last_ns = bl_sim_now_us() * 1000;
+	uint32_t retries = 0;
+	uint8_t ok = 1;
+
+	for (uint32_t page = 0; page < page_count;) {
+		BL_ACK ack = { 0 };
+
+		ack.data.cmd_id = BL_ACK_CMD_ID;
+		ack.data.ack = bl_bench_receive_frame(bl_bench_frame,
+				sizeof(BL_DATA_PACKET_HEADER) + bl_bench_block_size, timeout)
+				== BL_Status_OK && packet->data.header.cmd_id
+						== BL_DATA_PACKET_CMD_ID
+				&& packet->data.data_len % sizeof(uint32_t) == 0
+				&& packet->data.data_len / sizeof(uint32_t)
+						<= page_count - page;
+		result->packets++;
+
+		if (!ack.data.ack) {
+			if (++retries > BL_MAX_RETRIES) {
+				return 0;
+			}
+			result->resent++;
+			bl_sim_host_send(ack.serialized_data, sizeof(ack));
+			continue;
+		}
+
+		uint64_t now = bl_sim_now_us() * 1000;
+		bl_bench_latency(result, now - last_ns);
+		last_ns = now;
+		retries = 0;
+
+		for (uint32_t i = 0; i < packet->data.data_len / sizeof(uint32_t);
+				i++, page++) {
+			const uint8_t *image = bl_bench_image + offset
+					+ page * BL_VS_PAGE_SIZE_BYTES;
+			uint32_t crc;
+
+			memcpy(&crc, &packet->data.data_block[i * sizeof(uint32_t)],
+					sizeof(crc));
+			ok = ok
+					&& crc == bl_crc32_final(
+							bl_crc32_update(bl_crc32_init(), image,
+									BL_VS_PAGE_SIZE_BYTES));
+		}
+
+		bl_sim_host_send(ack.serialized_data, sizeof(ack));
+	}
+
+	return ok;
+}
+
+static uint8_t bl_bench_page_crc(const char *name) {
+	uint32_t pages = bl_bench_size / BL_VS_PAGE_SIZE_BYTES;
+	BL_BenchResult_t result;
+	uint8_t ok = 1;
+
+	bl_bench_begin(&result, name, pages * sizeof(uint32_t));
+
+	/* The range size of this count wraps around to a single page */
+	BL_PAGE_CRC_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_PAGE_CRC_CMD_ID;
+	cmd.data.start_address = bl_bench_caps.data.app_start;
+	cmd.data.page_count = (uint32_t) (0x100000000ULL / BL_VS_PAGE_SIZE_BYTES
+			+ 1);
+	bl_bench_send_command(&cmd, sizeof(cmd));
+	ok = ok && bl_bench_rejected(BL_PAGE_CRC_CMD_ID, BL_NACK_INVALID_ADDRESS);
+
+	/* The full pages of the image */
+	cmd.data.page_count = pages;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+	ok = ok
+			&& bl_bench_receive_ack(BL_PAGE_CRC_CMD_ID, bl_bench_timeout_ms(1))
+					== BL_Status_OK
+			&& bl_bench_receive_page_crcs(&result, 0, pages);
+
+	return bl_bench_end(&result, ok);
+}
+
+static uint32_t bl_bench_batch_add(uint8_t *batch, uint32_t size,
+		void *command, uint32_t cmd_size) {
+	BL_CommandHeader_t *header = command;
+
+	header->payload_size = cmd_size;
+	header->CRC32 = bl_bench_crc(command, cmd_size);
+	memcpy(&batch[size], command, cmd_size);
+
+	return size + cmd_size;
+}
+
+static uint8_t bl_bench_batch_send(uint8_t *batch, uint32_t size,
+		uint8_t count, BL_BATCH_RESPONSE *response) {
+	BL_BATCH_CMD *cmd = (BL_BATCH_CMD*) batch;
+
+	cmd->data.header.cmd_id = BL_BATCH_CMD_ID;
+	cmd->data.count = count;
+	bl_bench_send_command(batch, size);
+
+	return bl_bench_receive_ack(BL_BATCH_CMD_ID, bl_bench_timeout_ms(1))
+			== BL_Status_OK
+			&& bl_bench_receive_frame(response->serialized_data,
+					sizeof(*response), bl_bench_timeout_ms(1)) == BL_Status_OK
+			&& response->data.header.cmd_id == BL_RESPONSE_CMD_ID;
+}
+
+static uint8_t bl_bench_batch(const char *name) {
+	static uint8_t batch[sizeof(BL_BATCH_CMD) + 2 * sizeof(BL_VER_CMD)
+			+ sizeof(BL_FLASH_ERASE_CMD) + sizeof(BL_PAGE_CRC_CMD)];
+	uint32_t pages = bl_bench_size / BL_VS_PAGE_SIZE_BYTES;
+	BL_BATCH_RESPONSE response;
+	BL_BenchResult_t result;
+	uint32_t size;
+	uint8_t ok;
+
+	bl_bench_begin(&result, name, pages * sizeof(uint32_t));
+
+	/* Stops at the erase past the end of flash, the last version never runs */
+	BL_VER_CMD ver = { 0 };
+	ver.data.header.cmd_id = BL_VER_CMD_ID;
+	BL_FLASH_ERASE_CMD erase = { 0 };
+	erase.data.header.cmd_id = BL_FLASH_ERASE_CMD_ID;
+	erase.data.address = bl_bench_caps.data.flash_end + 1;
+	erase.data.page_count = 1;
+
+	size = bl_bench_batch_add(batch, sizeof(BL_BATCH_CMD), &ver, sizeof(ver));
+	size = bl_bench_batch_add(batch, size, &erase, sizeof(erase));
+	size = bl_bench_batch_add(batch, size, &ver, sizeof(ver));
+
+	const BL_BATCH_RESULT *first =
+			(const BL_BATCH_RESULT*) response.data.results;
+	const uint8_t *version = response.data.results + sizeof(*first);
+
+	ok = bl_bench_batch_send(batch, size, 3, &response)
+			&& response.data.count == 2 && !response.data.truncated
+			&& first->cmd_id == BL_VER_CMD_ID && first->ack
+			&& first->data_len == 1 && version[0] == BL_VERSION;
+
+	const BL_BATCH_RESULT *second = (const BL_BATCH_RESULT*) (version
+			+ first->data_len);
+
+	ok = ok && second->cmd_id == BL_FLASH_ERASE_CMD_ID && !second->ack
+			&& (second->field & BL_NACK_INVALID_ADDRESS);
+
+	/* The page CRC map runs after the results, like a command of its own */
+	BL_PAGE_CRC_CMD map = { 0 };
+	map.data.header.cmd_id = BL_PAGE_CRC_CMD_ID;
+	map.data.start_address = bl_bench_caps.data.app_start;
+	map.data.page_count = pages;
+
+	size = bl_bench_batch_add(batch, sizeof(BL_BATCH_CMD), &ver, sizeof(ver));
+	size = bl_bench_batch_add(batch, size, &map, sizeof(map));
+
+	ok = ok && bl_bench_batch_send(batch, size, 2, &response)
+			&& response.data.count == 1 && first->ack
+			&& bl_bench_receive_ack(BL_PAGE_CRC_CMD_ID, bl_bench_timeout_ms(1))
+					== BL_Status_OK
+			&& bl_bench_receive_page_crcs(&result, 0, pages);
+
+	return bl_bench_end(&result, ok);
+}
+
+static uint32_t bl_bench_patch_op(uint8_t *stream, uint8_t op, uint32_t first,
+		uint32_t second) {
+	uint32_t size = 1;
+
+	stream[0] = op;
+	memcpy(&stream[size], &first, sizeof(first));
+	size += sizeof(first);
+
+	if (op == BL_PATCH_OP_COPY) {
+		memcpy(&stream[size], &second, sizeof(second));
+		size += sizeof(second);
+	} else if (op == BL_PATCH_OP_FILL) {
+		stream[size++] = (uint8_t) second;
+	}
+
+	return size;
+}
+
+static uint8_t bl_bench_patch(const char *name, uint8_t cut) {
+	static uint8_t stream[5 * 9 + BL_BENCH_PATCH_INSERT_BYTES];
+	BL_BenchResult_t result;
+	uint8_t *patched = bl_bench_readback;
+	uint32_t head = bl_bench_size / 4;
+	uint32_t moved = BL_BENCH_PATCH_INSERT_BYTES + BL_BENCH_PATCH_FILL_BYTES
+			+ BL_BENCH_PATCH_TAIL_BYTES;
+	uint32_t tail = bl_bench_size - head - moved;
+	uint32_t length = 0;
+	uint32_t out = 0;
+
+	/* The new image, built along with the patch stream */
+	length += bl_bench_patch_op(&stream[length], BL_PATCH_OP_COPY, 0, head);
+	memcpy(&patched[out], bl_bench_image, head);
+	out += head;
+
+	length += bl_bench_patch_op(&stream[length], BL_PATCH_OP_INSERT,
+			BL_BENCH_PATCH_INSERT_BYTES, 0);
+	srand(6);
+	for (uint32_t i = 0; i < BL_BENCH_PATCH_INSERT_BYTES; i++) {
+		stream[length++] = patched[out++] = (uint8_t) rand();
+	}
+
+	length += bl_bench_patch_op(&stream[length], BL_PATCH_OP_FILL,
+			BL_BENCH_PATCH_FILL_BYTES, 0x5A);
+	memset(&patched[out], 0x5A, BL_BENCH_PATCH_FILL_BYTES);
+	out += BL_BENCH_PATCH_FILL_BYTES;
+
+	/* The source stays ahead of the page being rewritten */
+	length += bl_bench_patch_op(&stream[length], BL_PATCH_OP_COPY,
+			head + moved, tail);
+	memcpy(&patched[out], &bl_bench_image[head + moved], tail);
+	out += tail;
+
+	length += bl_bench_patch_op(&stream[length], BL_PATCH_OP_COPY, 0,
+			BL_BENCH_PATCH_TAIL_BYTES);
+	memcpy(&patched[out], bl_bench_image, BL_BENCH_PATCH_TAIL_BYTES);
+	out += BL_BENCH_PATCH_TAIL_BYTES;
+
+	uint32_t stop = cut ? length / 2 : length;
+
+	/* One packet may rebuild every page, and the last one commits the image */
+	uint32_t timeout = bl_bench_image_timeout_ms(out);
+
+	bl_bench_begin(&result, name, 0);
+
+	BL_PATCH_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_PATCH_CMD_ID;
+	cmd.data.old_length = bl_bench_size;
+	cmd.data.old_crc = bl_crc32_final(
+			bl_crc32_update(bl_crc32_init(), bl_bench_image, bl_bench_size));
+	cmd.data.new_length = out;
+	cmd.data.new_crc = bl_crc32_final(
+			bl_crc32_update(bl_crc32_init(), patched, out));
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	uint8_t ok = bl_bench_receive_ack(BL_PATCH_CMD_ID, bl_bench_timeout_ms(1))
+			== BL_Status_OK
+			&& bl_bench_send_blocks(&result, stream, 0, length, stop, timeout);
+
+	if (cut) {
+		/* A reset now must not start the half patched image, and the next
+		 * command ends the patch */
+		BL_ACK ack = { 0 };
+		BL_VER_CMD ver = { 0 };
+		ver.data.header.cmd_id = BL_VER_CMD_ID;
+
+		ok = ok
+				&& *(const volatile uint32_t*) (uintptr_t) bl_bench_caps.data.app_start
+						== 0xFFFFFFFF;
+
+		bl_bench_send_command(&ver, sizeof(ver));
+		ok = ok
+				&& bl_sim_host_receive(ack.serialized_data, sizeof(ack),
+						bl_bench_timeout_ms(1)) == BL_Status_OK
+				&& ack.data.ack == 0 && ack.data.field == BL_NACK_INVALID_CMD;
+	} else {
+		ok = ok
+				&& memcmp((const void*) (uintptr_t) bl_bench_caps.data.app_start,
+						patched, out) == 0;
+		memcpy(bl_bench_image, patched, out);
+	}
+
+	result.bytes = (stop < length) ? stop : length;
+	bl_bench_end(&result, ok);
+	if (!cut) {
+		printf("%-22s %u byte patch for a %u byte image\n", "", length, out);
+	}
+
+	return ok;
+}
+
+static void bl_bench_print_entry(const char *name, const BL_STATS_ENTRY *entry,
+		uint32_t frequency) {
+	double us = 1e6 / frequency;
+
+	printf("%-22s %7u %9.1f %9.1f %9.1f %10.1f\n", name, entry->count,
+			entry->min * us, entry->total * us / entry->count, entry->max * us,
+			entry->total * us / 1000);
+}
+
+static uint8_t bl_bench_stats(void) {
+	static const char *const phases[BL_STATS_PHASE_COUNT] = { "crc",
+			"flash write", "flash erase", "receive wait" };
+	BL_STATS_RESPONSE stats;
+
+	BL_GET_STATS_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_GET_STATS_CMD_ID;
+	cmd.data.reset = 1;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	if (bl_bench_receive_ack(BL_GET_STATS_CMD_ID, bl_bench_timeout_ms(0))
+			!= BL_Status_OK
+			|| bl_bench_receive_frame(stats.serialized_data, sizeof(stats),
+					bl_bench_timeout_ms(1)) != BL_Status_OK
+			|| stats.data.cycle_frequency == 0) {
+		printf("\nNo bootloader statistics\n");
+		return 0;
+	}
+
+	printf("\nbootloader: %u CRC failures, %u retries\n",
+			stats.data.crc_failures, stats.data.retries);
+	printf("%-22s %7s %9s %9s %9s %10s\n", "phase/command", "count",
+			"min[us]", "avg[us]", "max[us]", "total[ms]");
+
+	for (uint32_t i = 0; i < BL_STATS_PHASE_COUNT; i++) {
+		if (stats.data.phases[i].count) {
+			bl_bench_print_entry(phases[i], &stats.data.phases[i],
+					stats.data.cycle_frequency);
+		}
+	}
+	for (uint32_t i = 0; i < BL_STATS_CMD_SLOTS; i++) {
+		if (stats.data.commands[i].count) {
+			char name[16];
+			snprintf(name, sizeof(name), "command 0x%02X", (unsigned) i);
+			bl_bench_print_entry(name, &stats.data.commands[i],
+					stats.data.cycle_frequency);
+		}
+	}
+
+	return 1;
+}
+
+static uint8_t bl_bench_boot(void) {
+	uint64_t boot_ns;
+	uint8_t ok = 1;
+
+	BL_JUMP_TO_APP_CMD cmd = { 0 };
+	cmd.data.header.cmd_id = BL_JUMP_TO_APP_CMD_ID;
+	cmd.data.key = BL_JUMP_TO_APP_KEY;
+	bl_bench_send_command(&cmd, sizeof(cmd));
+
+	if (bl_bench_receive_ack(BL_JUMP_TO_APP_CMD_ID, bl_bench_timeout_ms(0))
+			!= BL_Status_OK
+			|| bl_sim_wait_for_app(BL_BENCH_SYNC_TIMEOUT_MS, &boot_ns)
+					!= BL_Status_OK) {
+		printf("\nboot: the application was not started\n");
+		return 0;
+	}
+
+	/* Reset, nothing requests update mode */
+	bl_sim_start();
+	if (bl_sim_wait_for_app(BL_COMMAND_TIMEOUT_MS + BL_BENCH_SYNC_TIMEOUT_MS,
+			&boot_ns) != BL_Status_OK) {
+		printf("\nboot: the application was not started after reset\n");
+		return 0;
+	}
+	printf("\nboot: application started %.1f us after reset\n",
+			boot_ns / 1e3);
+
+#if BL_AB_SLOTS_ENABLE
+	if (bl_bench_caps.data.features & BL_FEATURE_AB_SLOTS) {
+		ok = bl_bench_stage();
+	}
+#endif
+
+	/* Reset, requested by the application */
+	bl_boot_request = BL_ENTER_CMD_MODE_KEY;
+	uint64_t start_ns = bl_sim_now_us() * 1000;
+	bl_sim_start();
+	if (!bl_bench_sync()) {
+		printf("boot: no answer from the bootloader after an update request\n");
+		return 0;
+	}
+	printf("boot: bootloader answered %.2f ms after an update request\n",
+			(bl_sim_now_us() * 1000 - start_ns) / 1e6);
+
+	return ok;
+}
+
+#if BL_AB_SLOTS_ENABLE
+static uint8_t bl_bench_stage(void) {
+	const BL_Api_t *api = &bl_api;
+	BL_SlotInfo_t info;
+	uint64_t boot_ns;
+
+	if (api->magic != BL_API_MAGIC || api->version != BL_API_VERSION) {
+		printf("stage: no API table\n");
+		return 0;
+	}
+	api->get_info(&info);
+
+	uint32_t length =
+			bl_bench_size < info.staging_size ?
+					bl_bench_size : info.staging_size;
+	uint32_t active = info.active;
+
+	srand(5);
+	for (uint32_t i = 0; i < length; i++) {
+		bl_bench_image[i] = (uint8_t) rand();
+	}
+
+	/* Vector table of an image linked for the staging slot */
+	uint32_t vectors[2] = { 0x20005000, info.staging_address + 8 + 1 };
+	memcpy(bl_bench_image, vectors, sizeof(vectors));
+
+	/* Page by page, the application keeps running in between */
+	uint64_t start_us = bl_sim_now_us();
+	for (uint32_t offset = 0; offset < length; offset +=
+			BL_VS_PAGE_SIZE_BYTES) {
+		uint32_t chunk =
+				length - offset < BL_VS_PAGE_SIZE_BYTES ?
+						length - offset : BL_VS_PAGE_SIZE_BYTES;
+
+		if (api->stage_erase(offset, chunk) != BL_Status_OK
+				|| api->stage_write(offset, bl_bench_image + offset, chunk)
+						!= BL_Status_OK) {
+			printf("stage: failed at offset %u\n", offset);
+			return 0;
+		}
+	}
+
+	uint32_t crc = bl_crc32_final(
+			bl_crc32_update(bl_crc32_init(), bl_bench_image, length));
+	if (api->commit(length, crc) != BL_Status_OK) {
+		printf("stage: commit rejected\n");
+		return 0;
+	}
+	printf("stage: %u bytes into slot %c in %.1f ms, the application runs "
+			"meanwhile\n", length, 'A' + info.staging,
+			(bl_sim_now_us() - start_us) / 1e3);
+
+	/* The application resets whenever it suits it */
+	bl_sim_start();
+	if (bl_sim_wait_for_app(BL_BENCH_SYNC_TIMEOUT_MS, &boot_ns)
+			!= BL_Status_OK) {
+		printf("stage: the application was not started after reset\n");
+		return 0;
+	}
+
+	api->get_info(&info);
+	printf("stage: slot %c %s, application started %.1f us after reset\n",
+			'A' + info.active,
+			info.active != active ? "activated" : "kept, FAILED",
+			boot_ns / 1e3);
+
+	return info.active != active;
+}
+#endif
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	const char *flash_file = NULL;
+	uint32_t switched_baud = 0;
+	uint8_t failed = 0;
+	int opt;
+
+	bl_bench_size = 16 * 1024;
+
+	while ((opt = getopt(argc, argv, "b:l:e:s:w:k:E:P:f:B:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bl_bench_link.baud_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			bl_bench_link.latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			bl_bench_link.bit_error_rate = strtod(optarg, NULL);
+			break;
+		case 's':
+			bl_bench_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			bl_bench_window = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			bl_bench_block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'E':
+			bl_bench_flash.page_erase_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			bl_bench_flash.word_program_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			flash_file = optarg;
+			break;
+		case 'B':
+			switched_baud = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b baud] [-l latency_us] "
+					"[-e bit_error_rate] [-s image_bytes] [-w window] "
+					"[-k block_bytes] [-E page_erase_us] "
+					"[-P word_program_us] [-f flash_file] "
+					"[-B switched_baud]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (bl_bench_link.baud_rate == 0 || bl_bench_size == 0
+			|| bl_bench_block_size == 0 || bl_bench_window > 255) {
+		fprintf(stderr, "Invalid settings\n");
+		return 2;
+	}
+
+	if (bl_sim_flash_open(flash_file, &bl_bench_flash) != BL_Status_OK) {
+		fprintf(stderr, "Cannot map the emulated flash at 0x%08X\n",
+				BL_VS_FLASH_START_ADDRESS);
+		return 1;
+	}
+
+	bl_sim_link_open(&bl_bench_link, &bl_bench_link);
+
+	/* Like an application asking for an update, whatever the flash holds */
+	bl_boot_request = BL_ENTER_CMD_MODE_KEY;
+	bl_sim_start();
+
+	if (!bl_bench_sync()) {
+		fprintf(stderr, "No answer from the bootloader\n");
+		return 1;
+	}
+
+	if (switched_baud != 0
+			&& (bl_bench_caps.data.features & BL_FEATURE_LINK_SPEED)) {
+		uint32_t old_rate = bl_bench_link.baud_rate;
+
+		if (bl_bench_link_speed(switched_baud)) {
+			printf("link: switched from %u to %u baud\n", old_rate,
+					switched_baud);
+		} else {
+			printf("link: no answer at %u baud, staying at %u baud\n",
+					switched_baud, old_rate);
+		}
+	}
+
+	uint32_t app_size = bl_bench_caps.data.app_end
+			- bl_bench_caps.data.app_start + 1;
+	if (bl_bench_size > app_size) {
+		bl_bench_size = app_size;
+	}
+
+	bl_bench_image = malloc(bl_bench_size);
+	bl_bench_readback = malloc(bl_bench_size);
+
+	printf("link: %u baud, %u us latency, bit error rate %g\n",
+			bl_bench_link.baud_rate, bl_bench_link.latency_us,
+			bl_bench_link.bit_error_rate);
+	printf("flash: %u us per page erase, %u us per word program\n",
+			bl_bench_flash.page_erase_us, bl_bench_flash.word_program_us);
+	printf("image: %u bytes at 0x%08X, %u byte blocks, window %u\n\n",
+			bl_bench_size, bl_bench_caps.data.app_start, bl_bench_block_size,
+			bl_bench_window);
+	printf("%-22s %7s %9s %9s %7s %6s %9s %9s %9s %8s  %s\n", "mode",
+			"bytes", "time[ms]", "KiB/s", "packets", "resent", "pkt[ms]",
+			"max[ms]", "flash[ms]", "programs", "result");
+
+	failed |= !bl_bench_erase("erase");
+	failed |= !bl_bench_write("write", 0, 1);
+	failed |= !bl_bench_read("read");
+	failed |= !bl_bench_read_ex("read windowed");
+	failed |= !bl_bench_write("write auto-erase", BL_WRITE_FLAG_AUTO_ERASE,
+			2);
+	if (bl_bench_caps.data.features & BL_FEATURE_SIGNATURE) {
+		failed |= !bl_bench_verify("verify digest");
+	}
+	if (bl_bench_caps.data.features & BL_FEATURE_JOURNAL) {
+		failed |= !bl_bench_write_journaled("write journaled", 8);
+		failed |= !bl_bench_write_resumed("write resumed", 5);
+		if (bl_bench_caps.data.features & BL_FEATURE_SIGNATURE) {
+			failed |= !bl_bench_verify("verify digest");
+		}
+	}
+	failed |= !bl_bench_write_ex("write windowed", BL_WRITE_FLAG_AUTO_ERASE,
+			3);
+	failed |= !bl_bench_read_ex("read windowed");
+	failed |= !bl_bench_erase("erase");
+	failed |= !bl_bench_erase("erase blank");
+	failed |= !bl_bench_bad_ranges("bad ranges");
+	failed |= !bl_bench_write("write", 0, 4);
+	if ((bl_bench_caps.data.features & BL_FEATURE_PAGE_CRC)
+			&& bl_bench_size >= BL_VS_PAGE_SIZE_BYTES) {
+		failed |= !bl_bench_page_crc("page crc");
+		if (bl_bench_caps.data.features & BL_FEATURE_BATCH) {
+			failed |= !bl_bench_batch("batch");
+		}
+	}
+	if (bl_bench_caps.data.features & BL_FEATURE_LZ_WRITE) {
+		failed |= !bl_bench_write_lz("write lz", 7);
+	}
+	if ((bl_bench_caps.data.features & BL_FEATURE_PATCH)
+			&& bl_bench_size >= 8 * BL_VS_PAGE_SIZE_BYTES) {
+		failed |= !bl_bench_patch("patch", 0);
+		failed |= !bl_bench_patch("patch cut", 1);
+		failed |= !bl_bench_write("write auto-erase",
+				BL_WRITE_FLAG_AUTO_ERASE, 6);
+	}
+
+	if (bl_bench_caps.data.features & BL_FEATURE_STATS) {
+		failed |= !bl_bench_stats();
+	}
+
+	failed |= !bl_bench_boot();
+
+	bl_sim_flash_close();
+	free(bl_bench_image);
+	free(bl_bench_readback);
+
+	return failed;
+}
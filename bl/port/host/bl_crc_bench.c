@@ -0,0 +1,249 @@
+/**
+ * @file bl_crc_bench.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Throughput and conformance of the CRC32 engines
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Checks the command CRC built on bl_crc32_update (init, the runs around the
+ * CRC field, final) against the original bit-serial function, for every
+ * size up to a few packets and every input alignment. Then times
+ * bl_crc32_update and the bit-serial engine over a buffer and prints
+ * bytes/cycle for both.
+ *
+ * The engine is the one selected with BL_CRC_ENGINE, build once per engine
+ * with -DBL_CRC_ENGINE=... to compare them. Cycles are read from the time
+ * stamp counter on x86, other hosts report bytes/ns. Exits with 1 on a
+ * mismatch.
+ *
+ * Usage: bl_crc_bench [-s buffer_bytes] [-n passes]
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../../inc/bl_cfg.h"
+#include "../../inc/bl_cmd_types.h"
+#include "../../inc/bl_crc.h"
+#include "../../inc/bl_utils.h"
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Largest command checked against the original function */
+#define BL_CRC_BENCH_CHECK_BYTES (3 * BL_MAX_BUFFER_SIZE_BYTES)
+
+/** Input alignments checked */
+#define BL_CRC_BENCH_ALIGNMENTS (8U)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BL_CRC_BENCH_UNIT "cycle"
+#else
+#define BL_CRC_BENCH_UNIT "ns"
+#endif
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static const char *const bl_crc_bench_engines[] = { "bitwise", "nibble",
+		"table", "slice8", "hw" };
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn uint32_t bl_crc_bench_legacy(const uint8_t*, uint32_t)
+ * @brief	Command CRC as originally calculated: bit by bit, skipping the CRC
+ * 	field with a branch on every byte
+ *
+ * @param data	Command
+ * @param size	Size of the command
+ * @return	CRC32
+ */
+static uint32_t bl_crc_bench_legacy(const uint8_t *data, uint32_t size);
+
+/**
+ * @fn uint32_t bl_crc_bench_command(const uint8_t*, uint32_t)
+ * @brief	Command CRC as bl_calculate_command_crc calculates it
+ *
+ * @param data	Command
+ * @param size	Size of the command
+ * @return	CRC32
+ */
+static uint32_t bl_crc_bench_command(const uint8_t *data, uint32_t size);
+
+/**
+ * @fn uint64_t bl_crc_bench_now(void)
+ * @brief	Reads the cycle counter, or the time on hosts without one
+ *
+ * @return	Cycles or nanoseconds
+ */
+static uint64_t bl_crc_bench_now(void);
+
+/**
+ * @fn double bl_crc_bench_rate(uint32_t(*)(uint32_t, const void*, uint32_t), const uint8_t*, uint32_t, uint32_t, uint32_t*)
+ * @brief	Times an engine over a buffer
+ *
+ * @param update	Update function of the engine
+ * @param data		Buffer
+ * @param size		Size of the buffer
+ * @param passes	Passes over the buffer, the fastest one counts
+ * @param crc		Receives the CRC32 of the buffer
+ * @return	Bytes per cycle (or per ns)
+ */
+static double bl_crc_bench_rate(
+		uint32_t (*update)(uint32_t, const void*, uint32_t),
+		const uint8_t *data, uint32_t size, uint32_t passes, uint32_t *crc);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static uint32_t bl_crc_bench_legacy(const uint8_t *data, uint32_t size) {
+	uint32_t crc = 0xFFFFFFFF;
+	uint32_t crc_offset = offsetof(BL_CommandHeader_t, CRC32);
+
+	for (uint32_t i = 0; i < size; i++) {
+		if (i < crc_offset || i >= crc_offset + sizeof(uint32_t)) {
+			crc ^= data[i];
+
+			for (int j = 0; j < 8; j++) {
+				crc = (crc >> 1) ^ ((crc & 1) * CRC32_POLY);
+			}
+		}
+	}
+
+	return ~crc;
+}
+
+static uint32_t bl_crc_bench_command(const uint8_t *data, uint32_t size) {
+	const uint32_t crc_offset = offsetof(BL_CommandHeader_t, CRC32);
+	const uint32_t crc_end = crc_offset + sizeof(uint32_t);
+	uint32_t crc = bl_crc32_init();
+
+	crc = bl_crc32_update(crc, data, (size < crc_offset) ? size : crc_offset);
+	if (size > crc_end) {
+		crc = bl_crc32_update(crc, &data[crc_end], size - crc_end);
+	}
+
+	return bl_crc32_final(crc);
+}
+
+static uint64_t bl_crc_bench_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+static double bl_crc_bench_rate(
+		uint32_t (*update)(uint32_t, const void*, uint32_t),
+		const uint8_t *data, uint32_t size, uint32_t passes, uint32_t *crc) {
+	uint64_t best = UINT64_MAX;
+
+	for (uint32_t i = 0; i < passes; i++) {
+		uint64_t start = bl_crc_bench_now();
+
+		*crc = bl_crc32_final(update(bl_crc32_init(), data, size));
+
+		uint64_t elapsed = bl_crc_bench_now() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	return best ? (double) size / best : 0;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	uint32_t size = 64 * 1024;
+	uint32_t passes = 20;
+	uint32_t mismatches = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s buffer_bytes] [-n passes]\n",
+					argv[0]);
+			return 2;
+		}
+	}
+
+	if (size == 0 || passes == 0) {
+		fprintf(stderr, "Invalid settings\n");
+		return 2;
+	}
+
+	uint32_t buffer_size = (size > BL_CRC_BENCH_CHECK_BYTES ?
+			size : BL_CRC_BENCH_CHECK_BYTES) + BL_CRC_BENCH_ALIGNMENTS;
+	uint8_t *buffer = malloc(buffer_size);
+
+	srand(1);
+	for (uint32_t i = 0; i < buffer_size; i++) {
+		buffer[i] = (uint8_t) rand();
+	}
+
+	/* Every size, with the CRC field cut at any point, at every alignment */
+	for (uint32_t align = 0; align < BL_CRC_BENCH_ALIGNMENTS; align++) {
+		for (uint32_t len = 0; len <= BL_CRC_BENCH_CHECK_BYTES; len++) {
+			if (bl_crc_bench_command(&buffer[align], len)
+					!= bl_crc_bench_legacy(&buffer[align], len)) {
+				mismatches++;
+			}
+		}
+	}
+
+	uint32_t engine_crc;
+	uint32_t bitwise_crc;
+	double engine_rate = bl_crc_bench_rate(bl_crc32_update, buffer, size,
+			passes, &engine_crc);
+	double bitwise_rate = bl_crc_bench_rate(bl_crc32_update_bitwise, buffer,
+			size, passes, &bitwise_crc);
+
+	if (engine_crc != bitwise_crc) {
+		mismatches++;
+	}
+
+	printf("%-8s %8.3f bytes/%s, bitwise %8.3f bytes/%s, %.1fx, %s\n",
+			BL_CRC_ENGINE < sizeof(bl_crc_bench_engines)
+					/ sizeof(bl_crc_bench_engines[0]) ?
+					bl_crc_bench_engines[BL_CRC_ENGINE] : "?",
+			engine_rate, BL_CRC_BENCH_UNIT, bitwise_rate, BL_CRC_BENCH_UNIT,
+			bitwise_rate > 0 ? engine_rate / bitwise_rate : 0,
+			mismatches ? "MISMATCH" : "matches the original");
+
+	free(buffer);
+
+	return mismatches ? 1 : 0;
+}
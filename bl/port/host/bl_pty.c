@@ -0,0 +1,164 @@
+/**
+ * @file bl_pty.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Exposes the simulated bootloader as a pseudo terminal
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Runs the bootloader on the emulated flash and link and bridges the host end
+ * of the link to a pseudo terminal, whose path is printed on stdout. Any tool
+ * that talks to a serial port can then be used against it, e.g. bl_fleet
+ * against several instances at once.
+ *
+ * Usage: bl_pty [-b baud] [-l latency_us] [-e bit_error_rate] [-f flash_file]
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+/* posix_openpt() and friends */
+#define _GNU_SOURCE
+
+#include "bl_sim.h"
+#include "../../inc/bl_cfg.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static BL_SimLinkConfig_t bl_pty_link = { .baud_rate = 115200 };
+
+static BL_SimFlashConfig_t bl_pty_flash = { .page_erase_us = 20000,
+		.word_program_us = 100 };
+
+/** Master side of the pseudo terminal */
+static int bl_pty_master = -1;
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_pty_to_bl*(void*)
+ * @brief	Forwards what is written to the pseudo terminal to the bootloader
+ *
+ * @param arg	Unused
+ * @return	Never returns
+ */
+static void* bl_pty_to_bl(void *arg);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static void* bl_pty_to_bl(void *arg) {
+	uint8_t buffer[256];
+
+	(void) arg;
+
+	for (;;) {
+		ssize_t count = read(bl_pty_master, buffer, sizeof(buffer));
+
+		if (count > 0) {
+			bl_sim_host_send(buffer, count);
+		} else {
+			/* Nobody holds the terminal open, wait for the next user */
+			usleep(10000);
+		}
+	}
+
+	return NULL;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	const char *flash_file = NULL;
+	struct termios tio;
+	pthread_t thread;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:l:e:f:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bl_pty_link.baud_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			bl_pty_link.latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			bl_pty_link.bit_error_rate = strtod(optarg, NULL);
+			break;
+		case 'f':
+			flash_file = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b baud] [-l latency_us] "
+					"[-e bit_error_rate] [-f flash_file]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (bl_pty_link.baud_rate == 0) {
+		fprintf(stderr, "Invalid settings\n");
+		return 2;
+	}
+
+	bl_pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (bl_pty_master < 0 || grantpt(bl_pty_master) != 0
+			|| unlockpt(bl_pty_master) != 0) {
+		fprintf(stderr, "Cannot create a pseudo terminal\n");
+		return 1;
+	}
+
+	/* The slave stays open so the line settings survive its users and the
+	 * master never reads end of file */
+	int slave = open(ptsname(bl_pty_master), O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr(slave, &tio) != 0) {
+		fprintf(stderr, "Cannot open %s\n", ptsname(bl_pty_master));
+		return 1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	if (bl_sim_flash_open(flash_file, &bl_pty_flash) != BL_Status_OK) {
+		fprintf(stderr, "Cannot map the emulated flash\n");
+		return 1;
+	}
+
+	bl_sim_link_open(&bl_pty_link, &bl_pty_link);
+
+	printf("%s\n", ptsname(bl_pty_master));
+	fflush(stdout);
+
+	pthread_create(&thread, NULL, bl_pty_to_bl, NULL);
+
+	/* Stay in the bootloader even if the flash file holds an application */
+	bl_boot_request = BL_ENTER_CMD_MODE_KEY;
+	bl_sim_start();
+
+	/* Forwards what the bootloader sends to the pseudo terminal */
+	for (;;) {
+		uint8_t byte;
+
+		if (bl_sim_host_receive(&byte, 1, 1000) == BL_Status_OK) {
+			write(bl_pty_master, &byte, 1);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,399 @@
+/**
+ * @file bl_ring_loop.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Line rate loopback test of the receive ring
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Streams back to back data packets of random sizes into the receive ring at
+ * a line rate (10 bits per byte), while the main loop frames them in place
+ * with bl_ring_get_frame, checks their CRC and sequence, copies them out like
+ * BL_receive_packet, spends the handling time of a packet and releases them.
+ *
+ * The receive interrupt is a periodic timer signal, so it preempts the main
+ * loop like a UART interrupt would, even on a single core. On every tick it
+ * delivers the bytes due since the last one through the callback registered
+ * with BL_receiveInterrupt, or with bl_ring_write like a DMA port (-d). It
+ * also runs the timeout of BL_setTimeout.
+ *
+ * Prints, for every line rate, the packets received, lost and corrupted and
+ * the throughput against the line rate. Exits with 1 if a packet is lost at a
+ * rate up to the checked one.
+ *
+ * Usage: bl_ring_loop [-s stream_bytes] [-p handling_us] [-t tick_us]
+ * 	[-r checked_baud] [-d]
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../../inc/bl.h"
+#include "../../inc/bl_cfg.h"
+#include "../../inc/bl_cmd_types.h"
+#include "../../inc/bl_crc.h"
+#include "../../inc/bl_ring.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Smallest packet: the header, the sequence number and one byte */
+#define BL_RING_LOOP_MIN_FRAME \
+		(sizeof(BL_DATA_PACKET_HEADER) + sizeof(uint32_t) + 1)
+
+/** Wait for the last packets once the whole stream is delivered */
+#define BL_RING_LOOP_DRAIN_NS (50000000ULL)
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static const uint32_t bl_ring_loop_rates[] = { 115200, 460800, 921600, 2000000,
+		3000000, 4000000 };
+
+#define BL_RING_LOOP_RATE_COUNT \
+		(sizeof(bl_ring_loop_rates) / sizeof(bl_ring_loop_rates[0]))
+
+/** Stream of packets, delivered by the timer signal */
+static uint8_t *bl_ring_loop_stream;
+static uint32_t bl_ring_loop_length;
+static volatile uint32_t bl_ring_loop_delivered;
+static uint64_t bl_ring_loop_start_ns;
+static uint32_t bl_ring_loop_baud;
+static uint8_t bl_ring_loop_dma;
+
+/** Receive callback armed with BL_receiveInterrupt */
+static void (*volatile bl_ring_loop_callback)(uint8_t);
+
+/** Timeout armed with BL_setTimeout, 0 when disarmed */
+static volatile uint64_t bl_ring_loop_deadline_ns;
+static void (*volatile bl_ring_loop_timeout)(void);
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn uint64_t bl_ring_loop_now_ns(void)
+ * @brief	Reads the monotonic clock
+ *
+ * @return	Time in nanoseconds
+ */
+static uint64_t bl_ring_loop_now_ns(void);
+
+/**
+ * @fn uint32_t bl_ring_loop_crc(const uint8_t*, uint32_t)
+ * @brief	Calculates the CRC of a frame like bl_calculate_command_crc
+ *
+ * @param frame	Frame, starting with BL_CommandHeader_t
+ * @param size	Size of the frame
+ * @return	CRC32 of the frame without its CRC field
+ */
+static uint32_t bl_ring_loop_crc(const uint8_t *frame, uint32_t size);
+
+/**
+ * @fn uint32_t bl_ring_loop_build(uint32_t)
+ * @brief	Builds the stream of packets
+ *
+ * @param length	Length of the stream in bytes
+ * @return	Number of packets
+ */
+static uint32_t bl_ring_loop_build(uint32_t length);
+
+/**
+ * @fn void bl_ring_loop_tick(int)
+ * @brief	Receive interrupt: delivers the bytes due by now, then runs an
+ * 	expired timeout
+ *
+ * @param signal	Unused
+ */
+static void bl_ring_loop_tick(int signal);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static uint64_t bl_ring_loop_now_ns(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint32_t bl_ring_loop_crc(const uint8_t *frame, uint32_t size) {
+	const uint32_t crc_offset = offsetof(BL_CommandHeader_t, CRC32);
+	const uint32_t crc_end = crc_offset + sizeof(uint32_t);
+	uint32_t crc = bl_crc32_init();
+
+	crc = bl_crc32_update(crc, frame, crc_offset);
+	crc = bl_crc32_update(crc, &frame[crc_end], size - crc_end);
+
+	return bl_crc32_final(crc);
+}
+
+static uint32_t bl_ring_loop_build(uint32_t length) {
+	uint32_t offset = 0;
+	uint32_t seq = 0;
+
+	while (length - offset >= BL_RING_LOOP_MIN_FRAME) {
+		uint32_t size = BL_RING_LOOP_MIN_FRAME
+				+ rand() % (BL_MAX_BUFFER_SIZE_BYTES - BL_RING_LOOP_MIN_FRAME + 1);
+
+		if (size > length - offset) {
+			size = length - offset;
+		}
+
+		BL_DATA_PACKET_CMD *packet =
+				(BL_DATA_PACKET_CMD*) &bl_ring_loop_stream[offset];
+
+		packet->data.header.cmd_id = BL_DATA_PACKET_CMD_ID;
+		packet->data.header.payload_size = size;
+		packet->data.data_len = size - sizeof(BL_DATA_PACKET_HEADER);
+		packet->data.end_flag = 0;
+		memcpy(packet->data.data_block, &seq, sizeof(seq));
+		for (uint32_t i = sizeof(seq); i < packet->data.data_len; i++) {
+			packet->data.data_block[i] = (uint8_t) rand();
+		}
+		packet->data.header.CRC32 = bl_ring_loop_crc(
+				&bl_ring_loop_stream[offset], size);
+
+		offset += size;
+		seq++;
+	}
+
+	bl_ring_loop_length = offset;
+
+	return seq;
+}
+
+static void bl_ring_loop_tick(int signal) {
+	uint64_t now = bl_ring_loop_now_ns();
+	uint64_t due = (now - bl_ring_loop_start_ns) * bl_ring_loop_baud / 10
+			/ 1000000000ULL;
+	uint32_t delivered = bl_ring_loop_delivered;
+
+	(void) signal;
+
+	if (due > bl_ring_loop_length) {
+		due = bl_ring_loop_length;
+	}
+
+	if (bl_ring_loop_dma) {
+		bl_ring_write(&bl_ring_loop_stream[delivered], due - delivered);
+		delivered = due;
+	} else {
+		/* One interrupt per byte, each one re-arms the next */
+		while (delivered < due) {
+			void (*callback)(uint8_t) = bl_ring_loop_callback;
+
+			if (callback == NULL) {
+				break;
+			}
+			bl_ring_loop_callback = NULL;
+			callback(bl_ring_loop_stream[delivered++]);
+		}
+	}
+	bl_ring_loop_delivered = delivered;
+
+	if (bl_ring_loop_deadline_ns != 0 && now >= bl_ring_loop_deadline_ns) {
+		bl_ring_loop_deadline_ns = 0;
+		bl_ring_loop_timeout();
+	}
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+BL_Status_t BL_receiveInterrupt(void (*callback)(uint8_t)) {
+	bl_ring_loop_callback = callback;
+	return BL_Status_OK;
+}
+
+void BL_setTimeout(uint32_t msec, void (*callback)(void)) {
+	bl_ring_loop_deadline_ns = 0;
+	bl_ring_loop_timeout = callback;
+	bl_ring_loop_deadline_ns = bl_ring_loop_now_ns() + msec * 1000000ULL;
+}
+
+void BL_disableTimeout(void) {
+	bl_ring_loop_deadline_ns = 0;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t stream_bytes = 32 * 1024;
+	uint32_t handling_us = 0;
+	uint32_t tick_us = 100;
+	uint32_t checked_baud = 4000000;
+	uint8_t failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:p:t:r:d")) != -1) {
+		switch (opt) {
+		case 's':
+			stream_bytes = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			handling_us = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			tick_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			checked_baud = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			bl_ring_loop_dma = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s stream_bytes] [-p handling_us] "
+					"[-t tick_us] [-r checked_baud] [-d]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (stream_bytes < BL_RING_LOOP_MIN_FRAME || tick_us == 0) {
+		fprintf(stderr, "Invalid settings\n");
+		return 2;
+	}
+
+	bl_ring_loop_stream = malloc(stream_bytes);
+
+	struct sigaction action = { 0 };
+	action.sa_handler = bl_ring_loop_tick;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGALRM, &action, NULL);
+
+	struct sigevent event = { 0 };
+	event.sigev_notify = SIGEV_SIGNAL;
+	event.sigev_signo = SIGALRM;
+	timer_t timer;
+	if (timer_create(CLOCK_MONOTONIC, &event, &timer) != 0) {
+		fprintf(stderr, "Cannot create the receive timer\n");
+		return 1;
+	}
+
+	printf("ring: %u bytes, %u bytes per frame at most, %s, %u us ticks, "
+			"%u us per packet\n\n", BL_RX_RING_SIZE_BYTES,
+			BL_MAX_BUFFER_SIZE_BYTES,
+			bl_ring_loop_dma ? "DMA" : "byte interrupts", tick_us,
+			handling_us);
+	printf("%9s %8s %8s %6s %9s %7s %9s %6s  %s\n", "baud", "bytes", "packets",
+			"lost", "corrupted", "resyncs", "KiB/s", "line%", "result");
+
+	for (uint32_t r = 0; r < BL_RING_LOOP_RATE_COUNT; r++) {
+		uint32_t seed = r + 1;
+		uint32_t expected = 0;
+		uint32_t received = 0;
+		uint32_t lost = 0;
+		uint32_t corrupted = 0;
+		uint32_t resyncs = 0;
+		uint64_t received_bytes = 0;
+		uint64_t last_ns = 0;
+		uint64_t idle_since = 0;
+		static uint8_t packet[BL_MAX_BUFFER_SIZE_BYTES];
+
+		srand(seed);
+		uint32_t packets = bl_ring_loop_build(stream_bytes);
+
+		bl_ring_loop_baud = bl_ring_loop_rates[r];
+		bl_ring_loop_delivered = 0;
+		bl_ring_loop_deadline_ns = 0;
+		bl_ring_start();
+		bl_ring_loop_start_ns = bl_ring_loop_now_ns();
+
+		struct itimerspec period = { 0 };
+		period.it_interval.tv_nsec = tick_us * 1000L;
+		period.it_value.tv_nsec = tick_us * 1000L;
+		timer_settime(timer, 0, &period, NULL);
+
+		for (;;) {
+			uint8_t *frame = NULL;
+			BL_Status_t status = bl_ring_get_frame(&frame,
+					BL_MAX_BUFFER_SIZE_BYTES);
+
+			if (status == BL_Status_Error) {
+				resyncs++;
+				continue;
+			}
+
+			if (status == BL_Status_Busy) {
+				/* Whatever is left once the stream ended never completes */
+				if (bl_ring_loop_delivered == bl_ring_loop_length) {
+					if (idle_since == 0) {
+						idle_since = bl_ring_loop_now_ns();
+					} else if (bl_ring_loop_now_ns() - idle_since
+							> BL_RING_LOOP_DRAIN_NS) {
+						break;
+					}
+				}
+				continue;
+			}
+			idle_since = 0;
+
+			/* Copied out like BL_receive_packet, then handled */
+			uint32_t size = ((BL_CommandHeader_t*) frame)->payload_size;
+			memcpy(packet, frame, size);
+			bl_ring_release(frame);
+
+			BL_DATA_PACKET_CMD *data = (BL_DATA_PACKET_CMD*) packet;
+			uint32_t seq;
+
+			if (bl_ring_loop_crc(packet, size) != data->data.header.CRC32) {
+				corrupted++;
+				continue;
+			}
+
+			memcpy(&seq, data->data.data_block, sizeof(seq));
+			if (seq < expected) {
+				corrupted++;
+				continue;
+			}
+			lost += seq - expected;
+			expected = seq + 1;
+			received++;
+			received_bytes += size;
+			last_ns = bl_ring_loop_now_ns();
+
+			for (uint64_t until = last_ns + handling_us * 1000ULL;
+					bl_ring_loop_now_ns() < until;)
+				;
+		}
+
+		struct itimerspec stop = { 0 };
+		timer_settime(timer, 0, &stop, NULL);
+
+		lost += packets - expected;
+
+		double seconds = (last_ns > bl_ring_loop_start_ns) ?
+				(last_ns - bl_ring_loop_start_ns) / 1e9 : 0;
+		double kib_s = seconds > 0 ? received_bytes / 1024.0 / seconds : 0;
+		double line = kib_s * 1024.0 * 10 * 100 / bl_ring_loop_baud;
+		uint8_t ok = lost == 0 && corrupted == 0 && resyncs == 0;
+
+		if (!ok && bl_ring_loop_baud <= checked_baud) {
+			failed = 1;
+		}
+
+		printf("%9u %8u %8u %6u %9u %7u %9.1f %6.1f  %s\n", bl_ring_loop_baud,
+				bl_ring_loop_length, received, lost, corrupted, resyncs, kib_s,
+				line, ok ? "ok" : "FAILED");
+	}
+
+	timer_delete(timer);
+	free(bl_ring_loop_stream);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file bl_sim.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Host (Linux) port of the bootloader: emulated flash and serial link
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The port implements the weak hooks of bl.h so the unmodified core runs as a
+ * process. Flash is a file mapped at BL_VS_FLASH_START_ADDRESS, the bootloader
+ * runs BL_main in its own thread and the host side of the link is driven
+ * through bl_sim_host_send/bl_sim_host_receive.
+ *
+ * The linker symbols of the bootloader context must be provided on the link
+ * command line, e.g. for a bootloader in the first 8 KiB of flash, two 10 KiB
+ * slots, the journal and the boot record in the last 4 KiB:
+ *
+ * 	-Wl,--defsym,_BLStartAddr=0x08000000 -Wl,--defsym,_BLEndAddr=0x08001FFF
+ * 	-Wl,--defsym,_AppStartAddr=0x08002000 -Wl,--defsym,_AppEndAddr=0x080047FF
+ * 	-Wl,--defsym,_AppLength=0x2800
+ * 	-Wl,--defsym,_AppSlotBStartAddr=0x08004800
+ * 	-Wl,--defsym,_AppSlotBEndAddr=0x08006FFF
+ * 	-Wl,--defsym,_JournalAddr=0x08007000
+ * 	-Wl,--defsym,_BootRecordAddr=0x08007800
+ *
+ */
+
+#ifndef BL_SIM_H_
+#define BL_SIM_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../../inc/bl.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @struct	BL_SimFlashConfig_t
+ * @brief	Timing model of the emulated flash
+ *
+ */
+typedef struct {
+	uint32_t page_erase_us; /**< Time to erase one page */
+	uint32_t word_program_us; /**< Time to program one 32 bit word */
+} BL_SimFlashConfig_t;
+
+/**
+ * @struct	BL_SimLinkConfig_t
+ * @brief	Model of one direction of the serial link
+ *
+ */
+typedef struct {
+	uint32_t baud_rate; /**< Line rate in bits per second, 10 bits per byte */
+	uint32_t latency_us; /**< Propagation delay added to every byte */
+	double bit_error_rate; /**< Probability of a bit being flipped */
+} BL_SimLinkConfig_t;
+
+/**
+ * @struct	BL_SimStats_t
+ * @brief	Counters kept by the emulated flash and link
+ *
+ */
+typedef struct {
+	uint32_t pages_erased; /**< Pages erased */
+	uint32_t words_programmed; /**< 32 bit words programmed */
+	uint32_t program_ops; /**< Program operations, whatever their length */
+	uint64_t flash_busy_us; /**< Time spent erasing and programming */
+	uint32_t program_errors; /**< Writes to words that were not erased */
+	uint64_t bytes_to_bl; /**< Bytes sent by the host */
+	uint64_t bytes_to_host; /**< Bytes sent by the bootloader */
+	uint32_t bits_flipped; /**< Bit errors injected in both directions */
+} BL_SimStats_t;
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn BL_Status_t bl_sim_flash_open(const char*, const BL_SimFlashConfig_t*)
+ * @brief	Maps the emulated flash at BL_VS_FLASH_START_ADDRESS
+ *
+ * 	A new or shorter file is extended with erased bytes, so the image persists
+ * 	across runs.
+ *
+ * @param path		Backing file, NULL for an erased anonymous mapping
+ * @param config	Timing model
+ * @return	BL_Status_OK	If the flash was mapped
+ * @return	BL_Status_Error	If the file or the address range is unavailable
+ */
+BL_Status_t bl_sim_flash_open(const char *path,
+		const BL_SimFlashConfig_t *config);
+
+/**
+ * @fn void bl_sim_flash_close(void)
+ * @brief	Writes the emulated flash back to its file and unmaps it
+ *
+ */
+void bl_sim_flash_close(void);
+
+/**
+ * @fn void bl_sim_link_open(const BL_SimLinkConfig_t*, const BL_SimLinkConfig_t*)
+ * @brief	Creates both directions of the link and starts delivering bytes
+ * 	to the bootloader
+ *
+ * @param to_bl		Host to bootloader direction
+ * @param to_host	Bootloader to host direction
+ */
+void bl_sim_link_open(const BL_SimLinkConfig_t *to_bl,
+		const BL_SimLinkConfig_t *to_host);
+
+/**
+ * @fn void bl_sim_start(void)
+ * @brief	Runs BL_main in a thread of its own. Once the bootloader has jumped
+ * 	to the application, calling it again models a reset.
+ *
+ */
+void bl_sim_start(void);
+
+/**
+ * @fn BL_Status_t bl_sim_wait_for_app(uint32_t, uint64_t*)
+ * @brief	Waits for the bootloader to jump to the application
+ *
+ * @param timeout	Timeout in milliseconds
+ * @param boot_ns	Receives the time from the start of BL_main to
+ * 	BL_jump_to_app
+ * @return	BL_Status_OK	If the bootloader jumped in time
+ * @return	BL_Status_Error	On timeout
+ */
+BL_Status_t bl_sim_wait_for_app(uint32_t timeout, uint64_t *boot_ns);
+
+/**
+ * @fn BL_Status_t bl_sim_host_send(const uint8_t*, uint32_t)
+ * @brief	Sends bytes to the bootloader, returns once they are on the line
+ *
+ * @param data	Bytes to send
+ * @param len	Number of bytes
+ * @return	BL_Status_OK	Always
+ */
+BL_Status_t bl_sim_host_send(const uint8_t *data, uint32_t len);
+
+/**
+ * @fn BL_Status_t bl_sim_host_receive(uint8_t*, uint32_t, uint32_t)
+ * @brief	Receives bytes sent by the bootloader
+ *
+ * @param data		Destination buffer
+ * @param len		Number of bytes
+ * @param timeout	Timeout in milliseconds
+ * @return	BL_Status_OK	If every byte arrived in time
+ * @return	BL_Status_Error	On timeout, the bytes received are dropped
+ */
+BL_Status_t bl_sim_host_receive(uint8_t *data, uint32_t len,
+		uint32_t timeout);
+
+/**
+ * @fn void bl_sim_host_set_baud_rate(uint32_t)
+ * @brief	Changes the line rate of the host in both directions. Bytes
+ * 	already on the line keep the rate they were sent at.
+ *
+ * @param baud	Rate in bits per second
+ */
+void bl_sim_host_set_baud_rate(uint32_t baud);
+
+/**
+ * @fn void bl_sim_host_flush(void)
+ * @brief	Drops every byte waiting for the host, to resynchronize after an
+ * 	error
+ *
+ */
+void bl_sim_host_flush(void);
+
+/**
+ * @fn uint64_t bl_sim_now_us(void)
+ * @brief	Returns the monotonic time used by the link and flash models
+ *
+ * @return	Time in microseconds
+ */
+uint64_t bl_sim_now_us(void);
+
+/**
+ * @fn void bl_sim_get_stats(BL_SimStats_t*)
+ * @brief	Reads the counters of the emulated flash and link
+ *
+ * @param stats	Receives the counters
+ */
+void bl_sim_get_stats(BL_SimStats_t *stats);
+
+/**
+ * @fn void bl_sim_reset_stats(void)
+ * @brief	Clears the counters of the emulated flash and link
+ *
+ */
+void bl_sim_reset_stats(void);
+
+#endif /* BL_SIM_H_ */
@@ -0,0 +1,336 @@
+/**
+ * @file bl_sim_flash.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Emulated NOR flash of the host port
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The flash is mapped at its real address, so the core reads it in place as on
+ * the target. Erasing sets a page to 0xFF, programming can only clear bits and
+ * fails on words that are not erased, like the STM32F1 controller does.
+ * Operations take the time given by the timing model.
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_sim_internal.h"
+#include "../../inc/bl.h"
+#include "../../inc/bl_cfg.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#define BL_SIM_FLASH_SIZE \
+		(BL_VS_FLASH_END_ADDRESS - BL_VS_FLASH_START_ADDRESS + 1)
+
+#define BL_SIM_FLASH_ERASED_WORD (0xFFFFFFFFU)
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE MAP_FIXED
+#endif
+
+/**
+ * @enum	BL_SimFlashOp_t
+ * @brief	Asynchronous operation in progress
+ *
+ */
+typedef enum {
+	BL_SimFlashOp_none, /**< Idle */
+	BL_SimFlashOp_program, /**< Programming, see BL_flash_write_start */
+	BL_SimFlashOp_erase /**< Erasing, see BL_erase_flash_start */
+} BL_SimFlashOp_t;
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static BL_SimFlashConfig_t bl_sim_flash_config;
+
+static int bl_sim_flash_fd = -1;
+
+static uint8_t *bl_sim_flash;
+
+/** Asynchronous operation, applied once its completion time has passed */
+static struct {
+	BL_SimFlashOp_t op;
+	uint64_t done_ns;
+	uint32_t address;
+	const uint8_t *data;
+	uint32_t len;
+} bl_sim_flash_pending;
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn uint8_t bl_sim_flash_in_range(uint32_t, uint32_t)
+ * @brief	Checks that a range lies inside the emulated flash
+ *
+ * @param address	Start address
+ * @param len		Length in bytes
+ * @return	Non-zero if the range is inside the flash
+ */
+static uint8_t bl_sim_flash_in_range(uint32_t address, uint32_t len);
+
+/**
+ * @fn BL_Status_t bl_sim_flash_program(uint32_t, const uint8_t*, uint32_t)
+ * @brief	Programs a range, without any delay
+ *
+ * @param address	Word aligned start address
+ * @param data		Data
+ * @param len		Length in bytes, rounded up to whole words with 0xFF
+ * @return	BL_Status_OK	If every word was erased before
+ * @return	BL_Status_Error	If the range is invalid or a word was not erased
+ */
+static BL_Status_t bl_sim_flash_program(uint32_t address, const uint8_t *data,
+		uint32_t len);
+
+/**
+ * @fn BL_Status_t bl_sim_flash_erase(uint32_t, uint32_t)
+ * @brief	Erases pages, without any delay
+ *
+ * @param page_address	Page aligned address
+ * @param page_count	Number of pages
+ * @return	BL_Status_OK	If the pages were erased
+ * @return	BL_Status_Error	If the range is invalid
+ */
+static BL_Status_t bl_sim_flash_erase(uint32_t page_address,
+		uint32_t page_count);
+
+/**
+ * @fn uint64_t bl_sim_flash_program_time(uint32_t)
+ * @brief	Time taken to program a range
+ *
+ * @param len	Length in bytes
+ * @return	Time in microseconds
+ */
+static uint64_t bl_sim_flash_program_time(uint32_t len);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static uint8_t bl_sim_flash_in_range(uint32_t address, uint32_t len) {
+	return bl_sim_flash != NULL && address >= BL_VS_FLASH_START_ADDRESS
+			&& address - BL_VS_FLASH_START_ADDRESS <= BL_SIM_FLASH_SIZE
+			&& len <= BL_SIM_FLASH_SIZE - (address - BL_VS_FLASH_START_ADDRESS);
+}
+
+static BL_Status_t bl_sim_flash_program(uint32_t address, const uint8_t *data,
+		uint32_t len) {
+	uint32_t words = (len + 3) / 4;
+
+	if ((address & 3) || !bl_sim_flash_in_range(address, words * 4)) {
+		return BL_Status_Error;
+	}
+
+	BL_Status_t status = BL_Status_OK;
+	uint8_t *dst = bl_sim_flash + (address - BL_VS_FLASH_START_ADDRESS);
+
+	for (uint32_t i = 0; i < words; i++) {
+		uint32_t word = BL_SIM_FLASH_ERASED_WORD;
+		uint32_t current;
+
+		memcpy(&word, data + i * 4, (len - i * 4 < 4) ? len - i * 4 : 4);
+		memcpy(&current, dst + i * 4, 4);
+
+		/* Programming clears bits, a word must be erased before it is
+		 * programmed with anything but zero */
+		if (current != BL_SIM_FLASH_ERASED_WORD && word != 0) {
+			BL_SIM_COUNT(program_errors, 1);
+			status = BL_Status_Error;
+		}
+		current &= word;
+		memcpy(dst + i * 4, &current, 4);
+	}
+
+	BL_SIM_COUNT(words_programmed, words);
+	BL_SIM_COUNT(program_ops, 1);
+
+	return status;
+}
+
+static BL_Status_t bl_sim_flash_erase(uint32_t page_address,
+		uint32_t page_count) {
+	if ((page_address % BL_VS_PAGE_SIZE_BYTES)
+			|| page_count > BL_SIM_FLASH_SIZE / BL_VS_PAGE_SIZE_BYTES
+			|| !bl_sim_flash_in_range(page_address,
+					page_count * BL_VS_PAGE_SIZE_BYTES)) {
+		return BL_Status_Error;
+	}
+
+	memset(bl_sim_flash + (page_address - BL_VS_FLASH_START_ADDRESS), 0xFF,
+			page_count * BL_VS_PAGE_SIZE_BYTES);
+
+	BL_SIM_COUNT(pages_erased, page_count);
+
+	return BL_Status_OK;
+}
+
+static uint64_t bl_sim_flash_program_time(uint32_t len) {
+	return (uint64_t) ((len + 3) / 4) * bl_sim_flash_config.word_program_us;
+}
+
+/*******************************************************************************
+ *                         	Weak functions overrides	                       *
+ *******************************************************************************/
+
+BL_Status_t BL_erase_flash(uint32_t page_address, uint32_t page_count) {
+	uint64_t duration = (uint64_t) page_count
+			* bl_sim_flash_config.page_erase_us;
+
+	bl_sim_sleep_until(bl_sim_now_ns() + duration * 1000);
+	BL_SIM_COUNT(flash_busy_us, duration);
+
+	return bl_sim_flash_erase(page_address, page_count);
+}
+
+BL_Status_t BL_flash_write(uint32_t start_address, uint8_t data[],
+		uint32_t data_len) {
+	uint64_t duration = bl_sim_flash_program_time(data_len);
+
+	bl_sim_sleep_until(bl_sim_now_ns() + duration * 1000);
+	BL_SIM_COUNT(flash_busy_us, duration);
+
+	return bl_sim_flash_program(start_address, data, data_len);
+}
+
+BL_Status_t BL_flash_write_start(uint32_t start_address, uint8_t data[],
+		uint32_t data_len) {
+	uint64_t duration = bl_sim_flash_program_time(data_len);
+
+	/* The data is read when the operation completes: a caller reusing the
+	 * buffer too early programs the wrong bytes, as with DMA */
+	bl_sim_flash_pending.op = BL_SimFlashOp_program;
+	bl_sim_flash_pending.done_ns = bl_sim_now_ns() + duration * 1000;
+	bl_sim_flash_pending.address = start_address;
+	bl_sim_flash_pending.data = data;
+	bl_sim_flash_pending.len = data_len;
+	BL_SIM_COUNT(flash_busy_us, duration);
+
+	return BL_Status_OK;
+}
+
+BL_Status_t BL_flash_write_poll(void) {
+	if (bl_sim_flash_pending.op != BL_SimFlashOp_program) {
+		return BL_Status_OK;
+	}
+	if (bl_sim_now_ns() < bl_sim_flash_pending.done_ns) {
+		return BL_Status_Busy;
+	}
+
+	bl_sim_flash_pending.op = BL_SimFlashOp_none;
+
+	return bl_sim_flash_program(bl_sim_flash_pending.address,
+			bl_sim_flash_pending.data, bl_sim_flash_pending.len);
+}
+
+BL_Status_t BL_erase_flash_start(uint32_t page_address, uint32_t page_count) {
+	uint64_t duration = (uint64_t) page_count
+			* bl_sim_flash_config.page_erase_us;
+
+	bl_sim_flash_pending.op = BL_SimFlashOp_erase;
+	bl_sim_flash_pending.done_ns = bl_sim_now_ns() + duration * 1000;
+	bl_sim_flash_pending.address = page_address;
+	bl_sim_flash_pending.len = page_count;
+	BL_SIM_COUNT(flash_busy_us, duration);
+
+	return BL_Status_OK;
+}
+
+BL_Status_t BL_erase_flash_poll(void) {
+	if (bl_sim_flash_pending.op != BL_SimFlashOp_erase) {
+		return BL_Status_OK;
+	}
+	if (bl_sim_now_ns() < bl_sim_flash_pending.done_ns) {
+		return BL_Status_Busy;
+	}
+
+	bl_sim_flash_pending.op = BL_SimFlashOp_none;
+
+	return bl_sim_flash_erase(bl_sim_flash_pending.address,
+			bl_sim_flash_pending.len);
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+BL_Status_t bl_sim_flash_open(const char *path,
+		const BL_SimFlashConfig_t *config) {
+	void *address = (void*) (uintptr_t) BL_VS_FLASH_START_ADDRESS;
+	void *map;
+
+	bl_sim_flash_config = *config;
+
+	if (path == NULL) {
+		map = mmap(address, BL_SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (map != MAP_FAILED) {
+			memset(map, 0xFF, BL_SIM_FLASH_SIZE);
+		}
+	} else {
+		struct stat st;
+
+		bl_sim_flash_fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (bl_sim_flash_fd < 0 || fstat(bl_sim_flash_fd, &st) != 0) {
+			return BL_Status_Error;
+		}
+
+		/* Extend the file with erased bytes */
+		static const uint8_t erased[BL_VS_PAGE_SIZE_BYTES] = { [0
+				... BL_VS_PAGE_SIZE_BYTES - 1] = 0xFF };
+		for (off_t size = st.st_size; size < BL_SIM_FLASH_SIZE;) {
+			size_t chunk = BL_SIM_FLASH_SIZE - size;
+			if (chunk > sizeof(erased)) {
+				chunk = sizeof(erased);
+			}
+			if (pwrite(bl_sim_flash_fd, erased, chunk, size) <= 0) {
+				return BL_Status_Error;
+			}
+			size += chunk;
+		}
+
+		map = mmap(address, BL_SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED_NOREPLACE, bl_sim_flash_fd, 0);
+	}
+
+	if (map != address) {
+		return BL_Status_Error;
+	}
+
+	bl_sim_flash = map;
+	bl_sim_flash_pending.op = BL_SimFlashOp_none;
+
+	return BL_Status_OK;
+}
+
+void bl_sim_flash_close(void) {
+	if (bl_sim_flash == NULL) {
+		return;
+	}
+
+	if (bl_sim_flash_fd >= 0) {
+		msync(bl_sim_flash, BL_SIM_FLASH_SIZE, MS_SYNC);
+	}
+	munmap(bl_sim_flash, BL_SIM_FLASH_SIZE);
+	bl_sim_flash = NULL;
+
+	if (bl_sim_flash_fd >= 0) {
+		close(bl_sim_flash_fd);
+		bl_sim_flash_fd = -1;
+	}
+}
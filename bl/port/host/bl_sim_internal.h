@@ -0,0 +1,56 @@
+/**
+ * @file bl_sim_internal.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Definitions shared by the modules of the host port
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BL_SIM_INTERNAL_H_
+#define BL_SIM_INTERNAL_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_sim.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Counters are updated from several threads */
+#define BL_SIM_COUNT(field, value) \
+		__atomic_fetch_add(&bl_sim_stats.field, (value), __ATOMIC_RELAXED)
+
+/*******************************************************************************
+ *                        Global Public variables                              *
+ *******************************************************************************/
+
+extern BL_SimStats_t bl_sim_stats;
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn uint64_t bl_sim_now_ns(void)
+ * @brief	Returns the monotonic time with the resolution the link model needs
+ *
+ * @return	Time in nanoseconds
+ */
+uint64_t bl_sim_now_ns(void);
+
+/**
+ * @fn void bl_sim_sleep_until(uint64_t)
+ * @brief	Sleeps until the given time
+ *
+ * @param deadline_ns	Time from bl_sim_now_ns
+ */
+void bl_sim_sleep_until(uint64_t deadline_ns);
+
+#endif /* BL_SIM_INTERNAL_H_ */
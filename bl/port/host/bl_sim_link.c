@@ -0,0 +1,536 @@
+/**
+ * @file bl_sim_link.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Emulated serial link of the host port
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Each direction is a queue of bytes stamped with the time they reach the far
+ * end: the transmitter serializes bytes at the line rate (10 bits per byte,
+ * as 8N1), each byte then takes the propagation latency to arrive. Bits are
+ * flipped at the configured error rate. The bootloader receives either with
+ * BL_receive or through BL_receiveInterrupt, whose callback runs on a thread
+ * of its own, like an interrupt preempting the main loop.
+ *
+ * The configured rate is the one of the host, bl_sim_host_set_baud_rate
+ * changes it. The bootloader runs at the same rate until it sets its own with
+ * BL_set_baud_rate. Every byte is sent at the rate of its transmitter and
+ * misframed when the receiver runs at a rate too far from it.
+ * BL_capture_edges takes the next bytes off the line whole and returns the
+ * edges of their bits.
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_sim_internal.h"
+#include "../../inc/bl.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Bytes in flight per direction, a power of two */
+#define BL_SIM_LINK_QUEUE_BYTES (1U << 16)
+
+#define BL_SIM_LINK_QUEUE_MASK (BL_SIM_LINK_QUEUE_BYTES - 1)
+
+#define BL_SIM_LINK_BITS_PER_BYTE (10U)
+
+/** Largest difference of the bootloader and line rates that still frames
+ * bytes right, in 1/1000 */
+#define BL_SIM_LINK_RATE_TOLERANCE (30U)
+
+/** Fastest rate the bootloader UART can be set to */
+#define BL_SIM_LINK_MAX_BAUD_RATE (12000000U)
+
+/**
+ * @struct	BL_SimChannel_t
+ * @brief	One direction of the link
+ *
+ */
+typedef struct {
+	BL_SimLinkConfig_t config;
+	pthread_mutex_t lock;
+	pthread_cond_t cond; /**< Signaled when bytes are queued or removed */
+	uint8_t data[BL_SIM_LINK_QUEUE_BYTES];
+	uint64_t arrival_ns[BL_SIM_LINK_QUEUE_BYTES];
+	uint32_t tx_rate[BL_SIM_LINK_QUEUE_BYTES]; /**< Rate each byte was sent at */
+	uint8_t from_bl; /**< Transmitted by the bootloader */
+	uint32_t head; /**< Next byte to queue */
+	uint32_t tail; /**< Next byte to deliver */
+	uint64_t line_free_ns; /**< End of the transmission of the last byte */
+	unsigned short seed[3]; /**< State of the bit error generator */
+	uint64_t *sent; /**< Byte counter of this direction */
+} BL_SimChannel_t;
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static BL_SimChannel_t bl_sim_to_bl;
+
+static BL_SimChannel_t bl_sim_to_host;
+
+/** Rate set by BL_set_baud_rate, 0 until then */
+static uint32_t bl_sim_bl_baud_rate;
+
+/** Armed receive interrupt, cleared before it runs */
+static void (*bl_sim_rx_callback)(uint8_t);
+
+static pthread_t bl_sim_rx_thread;
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_sim_channel_init(BL_SimChannel_t*, const BL_SimLinkConfig_t*, uint64_t*, unsigned short, uint8_t)
+ * @brief	Initializes a direction of the link
+ *
+ * @param channel	Channel
+ * @param config	Link model
+ * @param sent		Byte counter of the direction
+ * @param seed		Seed of the bit error generator
+ * @param from_bl	1 for the direction from the bootloader to the host
+ */
+static void bl_sim_channel_init(BL_SimChannel_t *channel,
+		const BL_SimLinkConfig_t *config, uint64_t *sent, unsigned short seed,
+		uint8_t from_bl);
+
+/**
+ * @fn uint32_t bl_sim_channel_rates(BL_SimChannel_t*, uint32_t*)
+ * @brief	Current rates of both ends of a direction
+ *
+ * @param channel	Channel
+ * @param rx_rate	Receives the rate of the receiver
+ * @return	Rate of the transmitter
+ */
+static uint32_t bl_sim_channel_rates(BL_SimChannel_t *channel,
+		uint32_t *rx_rate);
+
+/**
+ * @fn uint64_t bl_sim_channel_write(BL_SimChannel_t*, const uint8_t*, uint32_t)
+ * @brief	Queues bytes behind the ones already on the line
+ *
+ * @param channel	Channel
+ * @param data		Bytes
+ * @param len		Number of bytes
+ * @return	Time at which the transmitter is done with the bytes
+ */
+static uint64_t bl_sim_channel_write(BL_SimChannel_t *channel,
+		const uint8_t *data, uint32_t len);
+
+/**
+ * @fn BL_Status_t bl_sim_channel_read(BL_SimChannel_t*, uint8_t*, uint32_t, uint32_t)
+ * @brief	Takes bytes that have arrived, waiting for them
+ *
+ * @param channel	Channel
+ * @param data		Destination buffer
+ * @param len		Number of bytes
+ * @param timeout	Timeout in milliseconds
+ * @return	BL_Status_OK	If every byte arrived in time
+ * @return	BL_Status_Error	On timeout
+ */
+static BL_Status_t bl_sim_channel_read(BL_SimChannel_t *channel, uint8_t *data,
+		uint32_t len, uint32_t timeout);
+
+/**
+ * @fn void bl_sim_channel_wait(BL_SimChannel_t*, uint64_t)
+ * @brief	Waits for the channel to be signaled, at most until the deadline.
+ * 	Called with the channel locked.
+ *
+ * @param channel		Channel
+ * @param deadline_ns	Time from bl_sim_now_ns, 0 to wait without limit
+ */
+static void bl_sim_channel_wait(BL_SimChannel_t *channel, uint64_t deadline_ns);
+
+/**
+ * @fn uint8_t bl_sim_channel_corrupt(BL_SimChannel_t*, uint8_t)
+ * @brief	Flips the bits of a byte at the configured error rate
+ *
+ * @param channel	Channel
+ * @param byte		Byte as sent
+ * @return	Byte as received
+ */
+static uint8_t bl_sim_channel_corrupt(BL_SimChannel_t *channel, uint8_t byte);
+
+/**
+ * @fn uint8_t bl_sim_channel_deliver(BL_SimChannel_t*)
+ * @brief	Takes the byte at the tail of the channel, as the receiver frames
+ * 	it. Called with the channel locked.
+ *
+ * @param channel	Channel
+ * @return	Byte as received
+ */
+static uint8_t bl_sim_channel_deliver(BL_SimChannel_t *channel);
+
+/**
+ * @fn void bl_sim_rx_task*(void*)
+ * @brief	Delivers the bytes for the bootloader to the armed receive interrupt
+ *
+ * @param arg	Unused
+ * @return	Never returns
+ */
+static void* bl_sim_rx_task(void *arg);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static void bl_sim_channel_init(BL_SimChannel_t *channel,
+		const BL_SimLinkConfig_t *config, uint64_t *sent, unsigned short seed,
+		uint8_t from_bl) {
+	pthread_condattr_t attr;
+
+	channel->config = *config;
+	if (channel->config.baud_rate == 0) {
+		channel->config.baud_rate = 115200;
+	}
+	channel->head = 0;
+	channel->tail = 0;
+	channel->line_free_ns = 0;
+	channel->seed[0] = 0x330E;
+	channel->seed[1] = seed;
+	channel->seed[2] = 0x1234;
+	channel->sent = sent;
+	channel->from_bl = from_bl;
+
+	pthread_mutex_init(&channel->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&channel->cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static uint8_t bl_sim_channel_corrupt(BL_SimChannel_t *channel, uint8_t byte) {
+	if (channel->config.bit_error_rate <= 0.0) {
+		return byte;
+	}
+
+	for (uint32_t bit = 0; bit < 8; bit++) {
+		if (erand48(channel->seed) < channel->config.bit_error_rate) {
+			byte ^= 1U << bit;
+			BL_SIM_COUNT(bits_flipped, 1);
+		}
+	}
+
+	return byte;
+}
+
+static uint32_t bl_sim_channel_rates(BL_SimChannel_t *channel,
+		uint32_t *rx_rate) {
+	uint32_t host_rate = channel->config.baud_rate;
+	uint32_t bl_rate = __atomic_load_n(&bl_sim_bl_baud_rate, __ATOMIC_RELAXED);
+
+	if (bl_rate == 0) {
+		bl_rate = host_rate;
+	}
+
+	*rx_rate = channel->from_bl ? host_rate : bl_rate;
+
+	return channel->from_bl ? bl_rate : host_rate;
+}
+
+static uint8_t bl_sim_channel_deliver(BL_SimChannel_t *channel) {
+	uint32_t index = channel->tail & BL_SIM_LINK_QUEUE_MASK;
+	uint8_t byte = channel->data[index];
+	uint32_t tx_rate = channel->tx_rate[index];
+	uint32_t rx_rate;
+
+	bl_sim_channel_rates(channel, &rx_rate);
+
+	channel->tail++;
+	pthread_cond_broadcast(&channel->cond);
+
+	/* Sampled at the wrong rate, the bits drift away from their slots */
+	if ((uint64_t) (tx_rate > rx_rate ? tx_rate - rx_rate : rx_rate - tx_rate)
+			* 1000 > (uint64_t) tx_rate * BL_SIM_LINK_RATE_TOLERANCE) {
+		byte ^= 0x5A;
+	}
+
+	return byte;
+}
+
+static void bl_sim_channel_wait(BL_SimChannel_t *channel, uint64_t deadline_ns) {
+	if (deadline_ns == 0) {
+		pthread_cond_wait(&channel->cond, &channel->lock);
+	} else {
+		struct timespec ts = { .tv_sec = deadline_ns / 1000000000ULL,
+				.tv_nsec = deadline_ns % 1000000000ULL };
+		pthread_cond_timedwait(&channel->cond, &channel->lock, &ts);
+	}
+}
+
+static uint64_t bl_sim_channel_write(BL_SimChannel_t *channel,
+		const uint8_t *data, uint32_t len) {
+	pthread_mutex_lock(&channel->lock);
+
+	uint32_t rx_rate;
+	uint32_t tx_rate = bl_sim_channel_rates(channel, &rx_rate);
+	uint64_t byte_ns = (uint64_t) BL_SIM_LINK_BITS_PER_BYTE * 1000000000ULL
+			/ tx_rate;
+
+	for (uint32_t i = 0; i < len; i++) {
+		while (channel->head - channel->tail == BL_SIM_LINK_QUEUE_BYTES) {
+			bl_sim_channel_wait(channel, 0);
+		}
+
+		uint64_t now = bl_sim_now_ns();
+		if (channel->line_free_ns < now) {
+			channel->line_free_ns = now;
+		}
+		channel->line_free_ns += byte_ns;
+
+		uint32_t index = channel->head & BL_SIM_LINK_QUEUE_MASK;
+		channel->data[index] = bl_sim_channel_corrupt(channel, data[i]);
+		channel->arrival_ns[index] = channel->line_free_ns
+				+ (uint64_t) channel->config.latency_us * 1000;
+		channel->tx_rate[index] = tx_rate;
+		channel->head++;
+	}
+
+	__atomic_fetch_add(channel->sent, len, __ATOMIC_RELAXED);
+
+	uint64_t done_ns = channel->line_free_ns;
+
+	pthread_cond_broadcast(&channel->cond);
+	pthread_mutex_unlock(&channel->lock);
+
+	return done_ns;
+}
+
+static BL_Status_t bl_sim_channel_read(BL_SimChannel_t *channel, uint8_t *data,
+		uint32_t len, uint32_t timeout) {
+	uint64_t deadline_ns = bl_sim_now_ns() + (uint64_t) timeout * 1000000ULL;
+	BL_Status_t status = BL_Status_OK;
+
+	pthread_mutex_lock(&channel->lock);
+
+	for (uint32_t i = 0; i < len;) {
+		uint64_t now = bl_sim_now_ns();
+		uint32_t index = channel->tail & BL_SIM_LINK_QUEUE_MASK;
+
+		if (channel->head != channel->tail
+				&& channel->arrival_ns[index] <= now) {
+			data[i++] = bl_sim_channel_deliver(channel);
+			continue;
+		}
+
+		if (now >= deadline_ns) {
+			status = BL_Status_Error;
+			break;
+		}
+
+		/* Sleep until the next byte arrives or the timeout expires */
+		uint64_t wake_ns = deadline_ns;
+		if (channel->head != channel->tail
+				&& channel->arrival_ns[index] < wake_ns) {
+			wake_ns = channel->arrival_ns[index];
+		}
+		bl_sim_channel_wait(channel, wake_ns);
+	}
+
+	pthread_mutex_unlock(&channel->lock);
+
+	return status;
+}
+
+static void* bl_sim_rx_task(void *arg) {
+	BL_SimChannel_t *channel = &bl_sim_to_bl;
+
+	(void) arg;
+
+	pthread_mutex_lock(&channel->lock);
+
+	for (;;) {
+		uint32_t index = channel->tail & BL_SIM_LINK_QUEUE_MASK;
+
+		if (bl_sim_rx_callback == NULL || channel->head == channel->tail) {
+			bl_sim_channel_wait(channel, 0);
+			continue;
+		}
+		if (channel->arrival_ns[index] > bl_sim_now_ns()) {
+			bl_sim_channel_wait(channel, channel->arrival_ns[index]);
+			continue;
+		}
+
+		uint8_t byte = bl_sim_channel_deliver(channel);
+		void (*callback)(uint8_t) = bl_sim_rx_callback;
+
+		bl_sim_rx_callback = NULL;
+
+		/* The callback may re-arm the interrupt or send */
+		pthread_mutex_unlock(&channel->lock);
+		callback(byte);
+		pthread_mutex_lock(&channel->lock);
+	}
+
+	return NULL;
+}
+
+/*******************************************************************************
+ *                         	Weak functions overrides	                       *
+ *******************************************************************************/
+
+BL_Status_t BL_send(uint8_t *data, uint32_t len, uint32_t timeout) {
+	(void) timeout;
+
+	bl_sim_sleep_until(bl_sim_channel_write(&bl_sim_to_host, data, len));
+
+	return BL_Status_OK;
+}
+
+BL_Status_t BL_sendv(const BL_IoVec_t iov[], uint32_t iov_count,
+		uint32_t timeout) {
+	uint64_t done_ns = 0;
+
+	(void) timeout;
+
+	/* Back to back on the line, as a single DMA transfer would be */
+	for (uint32_t i = 0; i < iov_count; i++) {
+		done_ns = bl_sim_channel_write(&bl_sim_to_host, iov[i].data,
+				iov[i].len);
+	}
+	bl_sim_sleep_until(done_ns);
+
+	return BL_Status_OK;
+}
+
+BL_Status_t BL_receive(uint8_t *data, uint32_t len, uint32_t timeout) {
+	return bl_sim_channel_read(&bl_sim_to_bl, data, len, timeout);
+}
+
+BL_Status_t BL_receiveInterrupt(void (*callback)(uint8_t)) {
+	pthread_mutex_lock(&bl_sim_to_bl.lock);
+	bl_sim_rx_callback = callback;
+	pthread_cond_broadcast(&bl_sim_to_bl.cond);
+	pthread_mutex_unlock(&bl_sim_to_bl.lock);
+
+	return BL_Status_OK;
+}
+
+BL_Status_t BL_disableInterrupt(void) {
+	pthread_mutex_lock(&bl_sim_to_bl.lock);
+	bl_sim_rx_callback = NULL;
+	pthread_mutex_unlock(&bl_sim_to_bl.lock);
+
+	return BL_Status_OK;
+}
+
+BL_Status_t BL_capture_edges(uint32_t timestamps[], uint32_t count,
+		uint32_t timeout) {
+	BL_SimChannel_t *channel = &bl_sim_to_bl;
+	uint64_t deadline_ns = bl_sim_now_ns() + (uint64_t) timeout * 1000000ULL;
+	BL_Status_t status = BL_Status_OK;
+
+	pthread_mutex_lock(&channel->lock);
+
+	for (uint32_t captured = 0; captured < count;) {
+		uint64_t now = bl_sim_now_ns();
+		uint32_t index = channel->tail & BL_SIM_LINK_QUEUE_MASK;
+
+		if (channel->head == channel->tail || channel->arrival_ns[index] > now) {
+			if (now >= deadline_ns) {
+				status = BL_Status_Busy;
+				break;
+			}
+			uint64_t wake_ns = deadline_ns;
+			if (channel->head != channel->tail
+					&& channel->arrival_ns[index] < wake_ns) {
+				wake_ns = channel->arrival_ns[index];
+			}
+			bl_sim_channel_wait(channel, wake_ns);
+			continue;
+		}
+
+		/* Start bit, data bits LSB first, stop bit, from an idle high line */
+		double bit_ns = 1e9 / channel->tx_rate[index];
+		uint16_t frame = (uint16_t) (channel->data[index] << 1) | (1U << 9);
+		uint64_t start_ns = channel->arrival_ns[index]
+				- (uint64_t) channel->config.latency_us * 1000
+				- (uint64_t) (BL_SIM_LINK_BITS_PER_BYTE * bit_ns);
+		uint8_t level = 1;
+
+		for (uint32_t bit = 0; bit < BL_SIM_LINK_BITS_PER_BYTE && captured < count;
+				bit++) {
+			if (((frame >> bit) & 1U) != level) {
+				level ^= 1;
+				timestamps[captured++] = (uint32_t) (start_ns
+						+ (uint64_t) (bit * bit_ns));
+			}
+		}
+
+		channel->tail++;
+		pthread_cond_broadcast(&channel->cond);
+	}
+
+	pthread_mutex_unlock(&channel->lock);
+
+	return status;
+}
+
+BL_Status_t BL_set_baud_rate(uint32_t baud) {
+	if (baud == 0 || baud > BL_SIM_LINK_MAX_BAUD_RATE) {
+		return BL_Status_Error;
+	}
+
+	__atomic_store_n(&bl_sim_bl_baud_rate, baud, __ATOMIC_RELAXED);
+
+	return BL_Status_OK;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void bl_sim_link_open(const BL_SimLinkConfig_t *to_bl,
+		const BL_SimLinkConfig_t *to_host) {
+	bl_sim_channel_init(&bl_sim_to_bl, to_bl, &bl_sim_stats.bytes_to_bl, 1, 0);
+	bl_sim_channel_init(&bl_sim_to_host, to_host, &bl_sim_stats.bytes_to_host,
+			2, 1);
+
+	pthread_create(&bl_sim_rx_thread, NULL, bl_sim_rx_task, NULL);
+}
+
+BL_Status_t bl_sim_host_send(const uint8_t *data, uint32_t len) {
+	bl_sim_sleep_until(bl_sim_channel_write(&bl_sim_to_bl, data, len));
+
+	return BL_Status_OK;
+}
+
+BL_Status_t bl_sim_host_receive(uint8_t *data, uint32_t len,
+		uint32_t timeout) {
+	return bl_sim_channel_read(&bl_sim_to_host, data, len, timeout);
+}
+
+void bl_sim_host_set_baud_rate(uint32_t baud) {
+	BL_SimChannel_t *channels[] = { &bl_sim_to_bl, &bl_sim_to_host };
+	uint32_t unset = 0;
+
+	/* The bootloader stays at the rate it followed so far */
+	__atomic_compare_exchange_n(&bl_sim_bl_baud_rate, &unset,
+			bl_sim_to_bl.config.baud_rate, 0, __ATOMIC_RELAXED,
+			__ATOMIC_RELAXED);
+
+	for (uint32_t i = 0; i < 2; i++) {
+		pthread_mutex_lock(&channels[i]->lock);
+		channels[i]->config.baud_rate = baud;
+		pthread_mutex_unlock(&channels[i]->lock);
+	}
+}
+
+void bl_sim_host_flush(void) {
+	pthread_mutex_lock(&bl_sim_to_host.lock);
+	bl_sim_to_host.tail = bl_sim_to_host.head;
+	pthread_cond_broadcast(&bl_sim_to_host.cond);
+	pthread_mutex_unlock(&bl_sim_to_host.lock);
+}
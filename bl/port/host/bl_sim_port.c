@@ -0,0 +1,260 @@
+/**
+ * @file bl_sim_port.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Timer, board and start-up hooks of the host port
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_sim_internal.h"
+#include "../../inc/bl.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*******************************************************************************
+ *                        Global Public variables                              *
+ *******************************************************************************/
+
+BL_SimStats_t bl_sim_stats;
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+/** Single shot timer of BL_setTimeout, its callback runs on the timer thread */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	void (*callback)(void);
+	uint64_t deadline_ns;
+} bl_sim_timer = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static pthread_t bl_sim_thread;
+
+/** Start of BL_main and jump to the application of the current run */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint64_t start_ns;
+	uint64_t jump_ns;
+} bl_sim_boot = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_sim_timer_task*(void*)
+ * @brief	Runs the timeout callback once its deadline has passed
+ *
+ * @param arg	Unused
+ * @return	Never returns
+ */
+static void* bl_sim_timer_task(void *arg);
+
+/**
+ * @fn void bl_sim_task*(void*)
+ * @brief	Runs the bootloader
+ *
+ * @param arg	Unused
+ * @return	Returns once the application is started
+ */
+static void* bl_sim_task(void *arg);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static void* bl_sim_timer_task(void *arg) {
+	(void) arg;
+
+	pthread_mutex_lock(&bl_sim_timer.lock);
+
+	for (;;) {
+		if (bl_sim_timer.callback == NULL) {
+			pthread_cond_wait(&bl_sim_timer.cond, &bl_sim_timer.lock);
+			continue;
+		}
+		if (bl_sim_now_ns() < bl_sim_timer.deadline_ns) {
+			struct timespec ts = { .tv_sec = bl_sim_timer.deadline_ns
+					/ 1000000000ULL, .tv_nsec = bl_sim_timer.deadline_ns
+					% 1000000000ULL };
+			pthread_cond_timedwait(&bl_sim_timer.cond, &bl_sim_timer.lock,
+					&ts);
+			continue;
+		}
+
+		void (*callback)(void) = bl_sim_timer.callback;
+		bl_sim_timer.callback = NULL;
+
+		pthread_mutex_unlock(&bl_sim_timer.lock);
+		callback();
+		pthread_mutex_lock(&bl_sim_timer.lock);
+	}
+
+	return NULL;
+}
+
+static void* bl_sim_task(void *arg) {
+	(void) arg;
+
+	bl_sim_boot.start_ns = bl_sim_now_ns();
+	BL_main();
+
+	return NULL;
+}
+
+/*******************************************************************************
+ *                         	Weak functions overrides	                       *
+ *******************************************************************************/
+
+void BL_delay(uint32_t msec) {
+	bl_sim_sleep_until(bl_sim_now_ns() + (uint64_t) msec * 1000000ULL);
+}
+
+BL_Status_t BL_initLED() {
+	return BL_Status_OK;
+}
+
+BL_Status_t BL_initButton() {
+	return BL_Status_OK;
+}
+
+BL_Status_t BL_initComm() {
+	return BL_Status_OK;
+}
+
+uint8_t BL_GetButtonState() {
+	return 0;
+}
+
+void BL_SetLEDState(uint8_t state) {
+	(void) state;
+}
+
+void BL_setTimeout(uint32_t msec, void (*callback)(void)) {
+	pthread_mutex_lock(&bl_sim_timer.lock);
+	bl_sim_timer.deadline_ns = bl_sim_now_ns() + (uint64_t) msec * 1000000ULL;
+	bl_sim_timer.callback = callback;
+	pthread_cond_broadcast(&bl_sim_timer.cond);
+	pthread_mutex_unlock(&bl_sim_timer.lock);
+}
+
+void BL_disableTimeout(void) {
+	pthread_mutex_lock(&bl_sim_timer.lock);
+	bl_sim_timer.callback = NULL;
+	pthread_mutex_unlock(&bl_sim_timer.lock);
+}
+
+void BL_jump_to_app(uint32_t *app_address) {
+	pthread_mutex_lock(&bl_sim_boot.lock);
+	bl_sim_boot.jump_ns = bl_sim_now_ns();
+	pthread_cond_broadcast(&bl_sim_boot.cond);
+	pthread_mutex_unlock(&bl_sim_boot.lock);
+
+	/* There is no application to run on the host, the bootloader stops */
+	fprintf(stderr, "Bootloader jumped to the application at 0x%08X\n",
+			(unsigned) (uintptr_t) app_address);
+	pthread_exit(NULL);
+}
+
+uint32_t BL_get_cycles(void) {
+	/* Nanoseconds, the 32 bit counter wraps every 4.29 s */
+	return (uint32_t) bl_sim_now_ns();
+}
+
+uint32_t BL_get_cycle_frequency(void) {
+	return 1000000000U;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+uint64_t bl_sim_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t bl_sim_now_us(void) {
+	return bl_sim_now_ns() / 1000;
+}
+
+void bl_sim_sleep_until(uint64_t deadline_ns) {
+	struct timespec ts = { .tv_sec = deadline_ns / 1000000000ULL, .tv_nsec =
+			deadline_ns % 1000000000ULL };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+void bl_sim_start(void) {
+	static uint8_t started;
+
+	if (started) {
+		/* Reset: the previous run has left for the application */
+		pthread_join(bl_sim_thread, NULL);
+		BL_disableTimeout();
+		BL_disableInterrupt();
+	} else {
+		pthread_condattr_t attr;
+
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&bl_sim_timer.cond, &attr);
+		pthread_cond_init(&bl_sim_boot.cond, &attr);
+		pthread_condattr_destroy(&attr);
+
+		pthread_create(&bl_sim_timer.thread, NULL, bl_sim_timer_task, NULL);
+		started = 1;
+	}
+
+	bl_sim_boot.jump_ns = 0;
+	pthread_create(&bl_sim_thread, NULL, bl_sim_task, NULL);
+}
+
+BL_Status_t bl_sim_wait_for_app(uint32_t timeout, uint64_t *boot_ns) {
+	uint64_t deadline_ns = bl_sim_now_ns() + (uint64_t) timeout * 1000000ULL;
+	struct timespec ts = { .tv_sec = deadline_ns / 1000000000ULL, .tv_nsec =
+			deadline_ns % 1000000000ULL };
+	BL_Status_t status = BL_Status_OK;
+
+	pthread_mutex_lock(&bl_sim_boot.lock);
+	while (bl_sim_boot.jump_ns == 0 && status == BL_Status_OK) {
+		if (pthread_cond_timedwait(&bl_sim_boot.cond, &bl_sim_boot.lock, &ts)
+				== ETIMEDOUT) {
+			status = BL_Status_Error;
+		}
+	}
+	if (status == BL_Status_OK) {
+		*boot_ns = bl_sim_boot.jump_ns - bl_sim_boot.start_ns;
+	}
+	pthread_mutex_unlock(&bl_sim_boot.lock);
+
+	return status;
+}
+
+void bl_sim_get_stats(BL_SimStats_t *stats) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	memcpy(stats, &bl_sim_stats, sizeof(*stats));
+}
+
+void bl_sim_reset_stats(void) {
+	memset(&bl_sim_stats, 0, sizeof(bl_sim_stats));
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
@@ -13,13 +13,21 @@
  *                              Includes                                       *
  *******************************************************************************/
 
+#if defined(__arm__)
 #include "../BluePill Drivers/CURT_NVIC/CURT_NVIC_headers/NVIC_reg.h"
+#endif
 #include "../inc/bl.h"
+#include "../inc/bl_autobaud.h"
 #include "../inc/bl_cfg.h"
 #include "../inc/bl_cmd_types.h"
+#include "../inc/bl_commands.h"
+#include "../inc/bl_comms.h"
 #include "../inc/bl_defs.h"
-#include "../inc/bl_handlers.h"
+#include "../inc/bl_ring.h"
+#include "../inc/bl_slots.h"
+#include "../inc/bl_stats.h"
 #include "LIB/DEBUG_UTILS.h"
+#include <stddef.h>
 
 /*******************************************************************************
  *                        Global Public variables                              *
@@ -27,6 +35,8 @@
 
 __attribute__((section("BL_CONTEXT")))            BL_Context_t bl_ctx;
 
+__attribute__((section("BL_NOINIT")))            volatile uint32_t bl_boot_request;
+
 /*******************************************************************************
  *                         Private functions prototypes                        *
  *******************************************************************************/
@@ -42,15 +52,6 @@ __attribute__((section("BL_CONTEXT")))            BL_Context_t bl_ctx;
  */
 static BL_AppState_t _validate_app(uint32_t *a_appAddr);
 
-/**
- * @fn void flash_led(uint8_t)
- * @brief 	Flashes the user led a number of times
- *
- * @param flashes	Number of flashes
- * @param delay_ms	Delay in milliseconds between every LED toggle
- */
-static void flash_led(uint8_t flashes, uint32_t delay_ms);
-
 /**
  * @fn BL_Status_t init_system(void)
  * @brief 	Initializes bootloader specific hardware such as indicator
@@ -60,6 +61,7 @@ static void flash_led(uint8_t flashes, uint32_t delay_ms);
  */
 static BL_Status_t init_system(void);
 
+#if defined(__arm__)
 /**
  * @fn void set_msp(uint32_t)
  * @brief Sets the main stack pointer to the given one
@@ -67,6 +69,7 @@ static BL_Status_t init_system(void);
  * @param a_msp	Main stack pointer value (must be word aligned)
  */
 static inline void set_msp(uint32_t a_msp);
+#endif
 
 /**
  * @fn void _init_ctx(void)
@@ -82,14 +85,6 @@ static void _init_ctx(void);
  */
 static void BL_CommandTimeout(void);
 
-/**
- * @fn void BL_HandleCommand(void*)
- * @brief	Handles the command received from the host
- *
- * @param buffer
- */
-static void BL_HandleCommand(void *buffer);
-
 /**
  * @fn void BL_SyncHost(uint8_t)
  * @brief	Synchronizes the host with the bootloader by receiving and sending a sync
@@ -99,6 +94,18 @@ static void BL_HandleCommand(void *buffer);
  */
 static void BL_SyncHost(uint8_t byte);
 
+#if BL_AUTOBAUD_ENABLE
+/**
+ * @fn BL_Status_t BL_AutobaudSync(void)
+ * @brief	Waits for the sync byte on the edges of the line, sets the line
+ * 	rate measured on it and answers the host
+ *
+ * @return	BL_Status_OK	If synchronized, or the command window expired
+ * @return	BL_Status_Error	If the port cannot capture edges or set the rate
+ */
+static BL_Status_t BL_AutobaudSync(void);
+#endif
+
 /**
  * @fn void BL_WaitForCommand()
  * @brief	Waits for a command from the host
@@ -133,15 +140,6 @@ static BL_AppState_t _validate_app(uint32_t *a_appAddr) {
 	}
 }
 
-static void flash_led(uint8_t flashes, uint32_t delay_ms) {
-	for (uint8_t i = 0; i < flashes; i++) {
-		BL_SetLEDState(1);
-		BL_delay(delay_ms);
-		BL_SetLEDState(0);
-		BL_delay(delay_ms);
-	}
-}
-
 static void _init_ctx(void) {
 	/* Application specific data from linker script */
 	extern uint32_t _AppStartAddr;
@@ -153,15 +151,15 @@ static void _init_ctx(void) {
 	/* Save addresses & app length to boot-loader context */
 	bl_ctx.AppStartAddress = &_AppStartAddr;
 	bl_ctx.AppEndAddress = &_AppEndAddr;
-	bl_ctx.AppLength = &_AppLength;
+	bl_ctx.AppLength = (uint32_t) (uintptr_t) &_AppLength;
 
 	bl_ctx.BL_startAddress = &_BLStartAddr;
 	bl_ctx.BL_endAddress = &_BLEndAddr;
 
-	for (uint32_t i = 0; i < sizeof(bl_ctx.CommandBuffer); i++) {
-		((uint8_t*) &bl_ctx.CommandBuffer)[i] = 0;
-	}
+	/* Until negotiated with the host, use the largest block size */
+	bl_ctx.BlockSize = BL_DATA_BLOCK_SIZE;
 
+	bl_ctx.BaudRate = BL_DEFAULT_BAUD_RATE;
 }
 
 static BL_Status_t init_system(void) {
@@ -171,81 +169,106 @@ static BL_Status_t init_system(void) {
 
 		status = BL_initLED();
 		DEBUG_ASSERT(status == BL_Status_OK);
-		flash_led(5, 50);
 
 		status = BL_initButton();
 		DEBUG_ASSERT(status == BL_Status_OK);
-		flash_led(5, 50);
 
 		DEBUG_INFO("Initialized GPIO successfully");
 
 		status = BL_initComm();
 		DEBUG_ASSERT(status == BL_Status_OK);
-		flash_led(5, 50);
 
 		DEBUG_INFO("Initialized communication stack successfully");
+
+		/* Only needed once the bootloader stays, not on the way to the app */
+		for (uint32_t i = 0; i < sizeof(bl_ctx.CommandBuffer); i++) {
+			((uint8_t*) &bl_ctx.CommandBuffer)[i] = 0;
+		}
+
+		bl_commands_init();
+
+		/* The LED stays on while the bootloader waits for the host */
+		BL_SetLEDState(1);
 	} while (0);
 
 	return status;
 }
 
+#if defined(__arm__)
 static inline void set_msp(uint32_t a_msp) {
 	__asm volatile("MSR msp, %0"
 			:
 			: "r"(a_msp)
 			:);
 }
+#endif
 
 static void BL_CommandTimeout(void) {
 	DEBUG_WARN("Timed out while waiting for a command");
 	bl_ctx.Mode = BL_Mode_default;
 }
 
-static void BL_HandleCommand(void *buffer) {
+/*******************************************************************************
+ *                         	Weak functions				                       *
+ *******************************************************************************/
 
-	BL_CommandHeader_t *ptr = buffer;
-	switch (ptr->cmd_id) {
-	case BL_GOTO_ADDR_CMD_ID:
-		// Handle BL_GOTO_ADDR_CMD_ID command
-		bl_handle_goto_addr_cmd((BL_GOTO_ADDR_CMD*) buffer);
-		break;
+#if defined(__arm__)
+BL_WEAK void BL_jump_to_app(uint32_t *app_address) {
+	/* Cast the application start address to AppIVT struct
+	 * to access the start location and MSP*/
+	const BL_AppIVT_t *const _appIVT = (BL_AppIVT_t*) app_address;
 
-	case BL_MEM_WRITE_CMD_ID:
-		// Handle BL_MEM_WRITE_CMD_ID command
-		bl_handle_mem_write_cmd((BL_MEM_WRITE_CMD*) buffer);
-		break;
+	DEBUG_INFO("Setting MSP to 0x%x", _appIVT->_MSP);
+	DEBUG_INFO("Jumping to application at 0x%x", _appIVT->_ResetHandler);
 
-	case BL_MEM_READ_CMD_ID:
-		// Handle BL_MEM_READ_CMD_ID command
-		bl_handle_mem_read_cmd((BL_MEM_READ_CMD*) buffer);
-		break;
+	/* Change the vector table offset */
+	SCB->VTOR = app_address;
 
-	case BL_VER_CMD_ID:
-		// Handle BL_VER_CMD_ID command
-		bl_handle_ver_cmd((BL_VER_CMD*) buffer);
-		break;
+	/* Set the main stack pointer to the application's */
+	set_msp(_appIVT->_MSP);
 
-	case BL_FLASH_ERASE_CMD_ID:
-		// Handle BL_FLASH_ERASE_CMD_ID command
-		bl_handle_flash_erase_cmd((BL_FLASH_ERASE_CMD*) buffer);
-		break;
+	/* Jump to the reset handler of the application */
+	_appIVT->_ResetHandler();
+}
+#endif
 
-	case BL_ENTER_CMD_MODE_CMD_ID:
-		// Handle BL_ENTER_CMD_MODE_CMD command
-		bl_handle_enter_cmd_mode_cmd((BL_ENTER_CMD_MODE_CMD*) buffer);
-		break;
+BL_WEAK uint8_t BL_update_requested(void) {
+	uint8_t requested = (bl_boot_request == BL_ENTER_CMD_MODE_KEY);
 
-	case BL_JUMP_TO_APP_CMD_ID:
-		// Handle BL_JUMP_TO_APP_CMD command
-		bl_handle_jump_to_app_cmd((BL_JUMP_TO_APP_CMD*) buffer);
-		break;
+	/* A request holds for one boot only */
+	bl_boot_request = 0;
 
-	default:
+	return requested;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void BL_HandleCommand(void *buffer) {
+
+	BL_CommandHeader_t *ptr = buffer;
+	uint8_t id = ptr->cmd_id;
+	uint32_t start = BL_STATS_TIMESTAMP();
+
+	const BL_CommandDesc_t *desc = bl_command_find(id);
+	if (desc == NULL) {
 		// Handle unknown command
-		DEBUG_ERROR("Unknown command ID received: 0x%02X",
-				((BL_CommandHeader_t* )buffer)->cmd_id);
-		break;
+		DEBUG_ERROR("Unknown command ID received: 0x%02X", id);
+		return;
 	}
+
+	DEBUG_INFO("**** %s CMD ****", desc->name);
+
+	/* Handlers only see frames of the right length with a valid CRC */
+	BL_NACK_t nack = bl_command_validate(desc, buffer);
+	if (nack != BL_NACK_SUCCESS) {
+		BL_send_ack(id, 0, nack);
+	} else {
+		desc->handler(buffer);
+	}
+
+	BL_STATS_COMMAND(id, start);
 }
 
 static void BL_SyncHost(uint8_t byte) {
@@ -253,6 +276,10 @@ static void BL_SyncHost(uint8_t byte) {
 	if (byte == BL_SYNC_BYTE_VALUE) {
 		uint8_t sync_byte = BL_SYNC_BYTE_VALUE;
 		BL_send(&sync_byte, 1, 100);
+#if BL_RX_RING_ENABLE
+		/* Everything the host sends from now on is buffered */
+		bl_ring_start();
+#endif
 		bl_ctx.Mode = BL_Mode_cmd;
 		DEBUG_INFO("Synchronized with host");
 	} else {
@@ -260,11 +287,71 @@ static void BL_SyncHost(uint8_t byte) {
 	}
 }
 
+#if BL_AUTOBAUD_ENABLE
+static BL_Status_t BL_AutobaudSync(void) {
+	uint32_t edges[BL_AUTOBAUD_EDGES];
+
+	while (bl_ctx.Mode == BL_Mode_receiveCommand) {
+		BL_Status_t status = BL_capture_edges(edges, BL_AUTOBAUD_EDGES,
+				BL_RECEIVE_TIMEOUT_MS);
+		if (status == BL_Status_Busy) {
+			continue;
+		}
+		if (status != BL_Status_OK) {
+			return BL_Status_Error;
+		}
+
+		uint32_t baud;
+		if (bl_autobaud_measure(edges, BL_get_cycle_frequency(), &baud)
+				!= BL_Status_OK) {
+			DEBUG_WARN("Not a sync byte, waiting for the next one");
+			continue;
+		}
+		if (BL_set_baud_rate(baud) != BL_Status_OK) {
+			DEBUG_ERROR("Cannot set the line rate to %u baud", baud);
+			return BL_Status_Error;
+		}
+
+		DEBUG_INFO("Line rate detected: %u baud", baud);
+		bl_ctx.BaudRate = baud;
+		BL_SyncHost(BL_SYNC_BYTE_VALUE);
+	}
+
+	return BL_Status_OK;
+}
+#endif
+
 static void BL_WaitForCommand(void) {
 
 	while (bl_ctx.Mode == BL_Mode_receiveCommand)
 		;
 
+#if BL_RX_RING_ENABLE
+	uint8_t *frame = NULL;
+
+	/* Wait for a complete frame, it is handled in place in the ring */
+	while (bl_ring_get_frame(&frame, BL_MAX_BUFFER_SIZE_BYTES) != BL_Status_OK
+			&& bl_ctx.Mode == BL_Mode_cmd)
+		;
+	/* If mode changed due to timeout, exit */
+	if (bl_ctx.Mode != BL_Mode_cmd)
+		return;
+
+	BL_disableTimeout();
+
+	if (bl_has_data_phase(((BL_CommandHeader_t*) frame)->cmd_id)) {
+		/* The command would pin the ring while its data packets arrive */
+		for (uint32_t i = 0; i < ((BL_CommandHeader_t*) frame)->payload_size;
+				i++) {
+			((uint8_t*) &bl_ctx.CommandBuffer)[i] = frame[i];
+		}
+		bl_ring_release(frame);
+		BL_HandleCommand((void*) &bl_ctx.CommandBuffer);
+	} else {
+		BL_HandleCommand((void*) frame);
+		bl_ring_release(frame);
+	}
+#else
 	/* Poll for the packet size */
 	while (BL_receive((uint8_t*) &bl_ctx.CommandBuffer.header,
 			sizeof(bl_ctx.CommandBuffer.header),
@@ -289,14 +376,11 @@ static void BL_WaitForCommand(void) {
 	BL_disableTimeout();
 	bl_ctx.Mode = BL_Mode_cmd;
 	BL_HandleCommand((void*) &bl_ctx.CommandBuffer);
+#endif
 }
 
 static void BL_ValidateApp(void) {
 
-	/* Cast the application start address to AppIVT struct
-	 * to access the start location and MSP*/
-	const BL_AppIVT_t *const _appIVT = (BL_AppIVT_t*) (bl_ctx.AppStartAddress);
-
 	/* TODO: validate app in a more systematic way, this could lead to bugs */
 	/* Check if there is an application loaded by checking the first address */
 	BL_AppState_t appState = _validate_app(bl_ctx.AppStartAddress);
@@ -308,19 +392,9 @@ static void BL_ValidateApp(void) {
 		break;
 	case BL_AppState_Valid:
 		DEBUG_INFO("Application found");
-		DEBUG_INFO("Setting MSP to 0x%x", _appIVT->_MSP);
-		DEBUG_INFO("Jumping to application at 0x%x", _appIVT->_ResetHandler);
 
-		/* TODO: Make these steps more generic to fit any MCU? */
-
-		/* Change the vector table offset */
-		SCB->VTOR = bl_ctx.AppStartAddress;
-
-		/* Set the main stack pointer to the application's */
-		set_msp(_appIVT->_MSP);
-
-		/* Jump to the reset handler of the application */
-		_appIVT->_ResetHandler();
+		BL_SetLEDState(0);
+		BL_jump_to_app(bl_ctx.AppStartAddress);
 
 		break;
 	default:
@@ -337,6 +411,23 @@ static void BL_StateMachine(void) {
 	for (;;) {
 		switch (bl_ctx.Mode) {
 		case BL_Mode_init: {
+			uint8_t update = BL_update_requested();
+
+#if BL_AB_SLOTS_ENABLE
+			/* The active slot is the application, for the host as well */
+			bl_ctx.AppStartAddress = bl_slots_boot();
+			bl_ctx.AppEndAddress = bl_slots_end(bl_ctx.AppStartAddress);
+#endif
+
+#if BL_FAST_BOOT_ENABLE
+			/* Nothing slow runs before the application is started */
+			if (!update
+					&& _validate_app(bl_ctx.AppStartAddress)
+							== BL_AppState_Valid) {
+				BL_jump_to_app(bl_ctx.AppStartAddress);
+			}
+#endif
+
 			/* Initialize system and peripherals */
 			BL_Status_t status = init_system();
 
@@ -348,8 +439,9 @@ static void BL_StateMachine(void) {
 
 			/* TODO: Check if the button is pressed or if there is a received command
 			 */
-			/* If the button is pressed, try to load applicatoin */
-			if (BL_GetButtonState()) {
+			/* If the button is pressed, try to load applicatoin, unless the
+			 * application itself asked for update mode */
+			if (!update && BL_GetButtonState()) {
 				bl_ctx.Mode = BL_Mode_default;
 			}
 		}
@@ -360,11 +452,19 @@ static void BL_StateMachine(void) {
 			DEBUG_INFO("Starting timeout %u ms for receiving command",
 					BL_COMMAND_TIMEOUT_MS);
 
-			/* Synchronize with host before receiving a command */
-			BL_receiveInterrupt(BL_SyncHost);
-
 			BL_setTimeout(BL_COMMAND_TIMEOUT_MS, BL_CommandTimeout);
 
+			/* Synchronize with host before receiving a command */
+#if BL_AUTOBAUD_ENABLE
+			BL_Status_t sync = BL_AutobaudSync();
+#else
+			BL_Status_t sync = BL_Status_Error;
+#endif
+			if (sync != BL_Status_OK) {
+				/* Keep the rate set by BL_initComm */
+				BL_receiveInterrupt(BL_SyncHost);
+			}
+
 			DEBUG_INFO("Waiting for command");
 
 			BL_WaitForCommand();
@@ -0,0 +1,78 @@
+/**
+ * @file bl_autobaud.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Line rate detection on the edges of the sync byte
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_autobaud.h"
+#include "../inc/bl.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+/** Bit time of every edge of 0xA5 from the falling edge of the start bit */
+static const uint8_t bl_autobaud_edge_bits[BL_AUTOBAUD_EDGES] = { 0, 1, 2, 3,
+		4, 6, 7, 8 };
+
+/*******************************************************************************
+ *                         	Weak functions				                       *
+ *******************************************************************************/
+
+BL_WEAK BL_Status_t BL_capture_edges(uint32_t timestamps[], uint32_t count,
+		uint32_t timeout) {
+	(void) timestamps;
+	(void) count;
+	(void) timeout;
+
+	return BL_Status_Error;
+}
+
+BL_WEAK BL_Status_t BL_set_baud_rate(uint32_t baud) {
+	(void) baud;
+
+	return BL_Status_Error;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+BL_Status_t bl_autobaud_measure(const uint32_t edges[BL_AUTOBAUD_EDGES],
+		uint32_t frequency, uint32_t *baud) {
+	/* Unsigned differences stay right across a wrap of the counter */
+	uint32_t span = edges[BL_AUTOBAUD_EDGES - 1] - edges[0];
+
+	if (span < BL_AUTOBAUD_SPAN_BITS || frequency == 0) {
+		return BL_Status_Error;
+	}
+
+	/* Edges are compared in 1/BL_AUTOBAUD_SPAN_BITS counts, no rounding */
+	uint64_t tolerance = span / BL_AUTOBAUD_EDGE_TOLERANCE;
+
+	for (uint32_t i = 1; i < BL_AUTOBAUD_EDGES - 1; i++) {
+		uint64_t actual = (uint64_t) (edges[i] - edges[0])
+				* BL_AUTOBAUD_SPAN_BITS;
+		uint64_t expected = (uint64_t) span * bl_autobaud_edge_bits[i];
+		uint64_t error = actual > expected ? actual - expected : expected - actual;
+
+		if (error > tolerance) {
+			return BL_Status_Error;
+		}
+	}
+
+	*baud = (uint32_t) (((uint64_t) frequency * BL_AUTOBAUD_SPAN_BITS
+			+ span / 2) / span);
+
+	return BL_Status_OK;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file bl_commands.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Command registry, built from descriptors linked into a section
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_commands.h"
+#include "../inc/bl.h"
+#include "../inc/bl_cmd_types.h"
+#include "../inc/bl_utils.h"
+#include "LIB/DEBUG_UTILS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Number of possible command IDs */
+#define BL_COMMAND_ID_COUNT (256U)
+
+/*******************************************************************************
+ *                        Global Public variables                              *
+ *******************************************************************************/
+
+/* Provided by the linker around the bl_commands section */
+extern const BL_CommandDesc_t __start_bl_commands[];
+extern const BL_CommandDesc_t __stop_bl_commands[];
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+/** Index + 1 of the descriptor of every command ID, 0 if not registered */
+static uint8_t bl_command_index[BL_COMMAND_ID_COUNT];
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void bl_commands_init(void) {
+	uint32_t count = __stop_bl_commands - __start_bl_commands;
+
+	/* Start over, RAM is not cleared when the bootloader restarts */
+	for (uint32_t i = 0; i < BL_COMMAND_ID_COUNT; i++) {
+		bl_command_index[i] = 0;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		const BL_CommandDesc_t *desc = &__start_bl_commands[i];
+
+		if (i >= 0xFF) {
+			DEBUG_ERROR("Too many commands, %s is not registered", desc->name);
+		} else if (bl_command_index[desc->id] != 0) {
+			DEBUG_ERROR("Command ID 0x%02X of %s is already used by %s",
+					desc->id, desc->name,
+					__start_bl_commands[bl_command_index[desc->id] - 1].name);
+		} else {
+			bl_command_index[desc->id] = (uint8_t) (i + 1);
+		}
+	}
+}
+
+const BL_CommandDesc_t* bl_command_find(uint8_t id) {
+	uint8_t index = bl_command_index[id];
+
+	return index ? &__start_bl_commands[index - 1] : NULL;
+}
+
+uint8_t bl_has_data_phase(uint8_t id) {
+	const BL_CommandDesc_t *desc = bl_command_find(id);
+
+	return desc != NULL && (desc->flags & BL_CMD_FLAG_DATA_PHASE);
+}
+
+BL_NACK_t bl_command_validate(const BL_CommandDesc_t *desc,
+		uint8_t *frame) {
+	const BL_CommandHeader_t *header = (const BL_CommandHeader_t*) frame;
+
+	if (header->payload_size < desc->min_length) {
+		DEBUG_WARN("Invalid length");
+		return BL_NACK_INVALID_LENGTH;
+	}
+
+	if (!VALIDATE_CMD(frame, header->payload_size, header->CRC32)) {
+		DEBUG_WARN("Invalid CRC");
+		return BL_NACK_INVALID_CRC;
+	}
+
+	return BL_NACK_SUCCESS;
+}
@@ -14,8 +14,74 @@
  *******************************************************************************/
 
 #include "../inc/bl_comms.h"
+#include "../inc/bl_cfg.h"
 #include "../inc/bl_defs.h"
+#include "../inc/bl_flash.h"
+#include "../inc/bl_ring.h"
+#include "../inc/bl_stats.h"
+#include "../inc/bl_utils.h"
 #include <stdint.h>
+#include <string.h>
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+/** Batch result being captured, NULL when sending normally */
+static struct {
+	BL_BATCH_RESULT *result;
+	uint32_t max_data_len;
+	uint8_t acked; /**< An ACK was captured */
+	uint8_t truncated;
+} bl_capture;
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_capture_frame(const uint8_t*)
+ * @brief	Appends the data of a response frame to the captured result
+ *
+ * @param frame	Frame starting with BL_CommandHeader_t
+ */
+static void bl_capture_frame(const uint8_t *frame);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static void bl_capture_frame(const uint8_t *frame) {
+	const BL_CommandHeader_t *header = (const BL_CommandHeader_t*) frame;
+	uint32_t len = header->payload_size - sizeof(BL_CommandHeader_t);
+	uint32_t room = bl_capture.max_data_len - bl_capture.result->data_len;
+
+	if (len > room) {
+		len = room;
+		bl_capture.truncated = 1;
+	}
+
+	memcpy((uint8_t*) (bl_capture.result + 1) + bl_capture.result->data_len,
+			frame + sizeof(BL_CommandHeader_t), len);
+	bl_capture.result->data_len += len;
+}
+
+/*******************************************************************************
+ *                         	Weak functions				                       *
+ *******************************************************************************/
+
+BL_WEAK BL_Status_t BL_sendv(const BL_IoVec_t iov[], uint32_t iov_count,
+		uint32_t timeout) {
+	for (uint32_t i = 0; i < iov_count; i++) {
+		BL_Status_t status = BL_send((uint8_t*) iov[i].data, iov[i].len,
+				timeout);
+		if (status != BL_Status_OK) {
+			return status;
+		}
+	}
+
+	return BL_Status_OK;
+}
 
 /*******************************************************************************
  *                          Public functions                                   *
@@ -23,8 +89,14 @@
 
 BL_Status_t BL_receive_ack() {
 	BL_ACK ack = { 0 };
+	uint32_t start = BL_STATS_TIMESTAMP();
 
+#if BL_RX_RING_ENABLE
+	bl_ring_read(ack.serialized_data, sizeof(ack), BL_RECEIVE_TIMEOUT_MS);
+#else
 	BL_receive(ack.serialized_data, sizeof(ack), BL_RECEIVE_TIMEOUT_MS);
+#endif
+	BL_STATS_PHASE(BL_STATS_PHASE_RECEIVE, start);
 
 	if (ack.data.ack == 1 && ack.data.cmd_id == BL_ACK_CMD_ID) {
 		return BL_Status_OK;
@@ -37,23 +109,197 @@ BL_Status_t BL_send_ack(BL_CommandID_t id, uint8_t ack_value,
 		uint8_t nack_field) {
 	BL_ACK ack = { 0 };
 
+	if (bl_capture.result != NULL) {
+		/* A sub-command succeeds only if all its ACKs are positive */
+		bl_capture.result->cmd_id = id;
+		bl_capture.result->ack = bl_capture.acked ?
+				(bl_capture.result->ack & ack_value) : ack_value;
+		bl_capture.result->field |= nack_field;
+		bl_capture.acked = 1;
+		return BL_Status_OK;
+	}
+
+	ack.data.cmd_id = id;
+	ack.data.ack = ack_value;
+	ack.data.field = nack_field;
+
+	return BL_send(ack.serialized_data, sizeof(ack), BL_SEND_TIMEOUT_MS);
+}
+
+BL_Status_t BL_send_window_ack(BL_CommandID_t id, uint8_t ack_value,
+		uint8_t nack_field, uint32_t next_seq, uint32_t missing) {
+	BL_WINDOW_ACK ack = { 0 };
+
 	ack.data.cmd_id = id;
 	ack.data.ack = ack_value;
 	ack.data.field = nack_field;
+	ack.data.next_seq = next_seq;
+	ack.data.missing = missing;
 
 	return BL_send(ack.serialized_data, sizeof(ack), BL_SEND_TIMEOUT_MS);
 }
 
+BL_Status_t BL_receive_packet(uint8_t *buffer, uint32_t max_size) {
+	uint32_t start = BL_STATS_TIMESTAMP();
+#if BL_RX_RING_ENABLE
+	uint8_t *frame = NULL;
+	BL_Status_t status;
+
+	/* The ring keeps receiving while flash operations advance */
+	while ((status = bl_ring_get_frame(&frame, max_size)) == BL_Status_Busy) {
+		bl_flash_service();
+	}
+	BL_STATS_PHASE(BL_STATS_PHASE_RECEIVE, start);
+
+	if (status != BL_Status_OK) {
+		return status;
+	}
+
+	/* Data must outlive the frame while it is programmed */
+	memcpy(buffer, frame, ((BL_CommandHeader_t*) frame)->payload_size);
+	bl_ring_release(frame);
+
+	return BL_Status_OK;
+#else
+	BL_CommandHeader_t *header = (BL_CommandHeader_t*) buffer;
+
+	/* Poll for the packet size */
+	while (BL_receive(buffer, sizeof(BL_CommandHeader_t),
+			BL_RECEIVE_TIMEOUT_MS) != BL_Status_OK) {
+		bl_flash_service();
+	}
+
+	if (header->payload_size < sizeof(BL_CommandHeader_t)
+			|| header->payload_size > max_size) {
+		return BL_Status_Error;
+	}
+
+	/* Receive packet size bytes in chunks, advancing flash operations in
+	 * between so they overlap reception */
+	uint32_t received = sizeof(BL_CommandHeader_t);
+	while (received < header->payload_size) {
+		uint32_t chunk = header->payload_size - received;
+		if (chunk > BL_RECEIVE_CHUNK_BYTES) {
+			chunk = BL_RECEIVE_CHUNK_BYTES;
+		}
+
+		while (BL_receive(&buffer[received], chunk,
+				BL_RECEIVE_TIMEOUT_MS) != BL_Status_OK) {
+			bl_flash_service();
+		}
+		received += chunk;
+		bl_flash_service();
+	}
+	BL_STATS_PHASE(BL_STATS_PHASE_RECEIVE, start);
+
+	return BL_Status_OK;
+#endif
+}
+
 BL_Status_t BL_send_response(BL_Response *response) {
+	if (bl_capture.result != NULL) {
+		bl_capture_frame(response->serialized_data);
+		return BL_Status_OK;
+	}
+
 	BL_Status_t status = BL_send(response->serialized_data,
 			response->data.header.payload_size, BL_SEND_TIMEOUT_MS);
 
 	return status;
 }
 
+BL_Status_t BL_send_frame(uint8_t *frame) {
+	if (bl_capture.result != NULL) {
+		bl_capture_frame(frame);
+		return BL_Status_OK;
+	}
+
+	BL_Status_t status = BL_send(frame,
+			((BL_CommandHeader_t*) frame)->payload_size, BL_SEND_TIMEOUT_MS);
+
+	return status;
+}
+
+BL_Status_t BL_send_data_packet(const uint8_t *data, uint32_t data_len,
+		uint32_t next_len, uint8_t end_flag) {
+	BL_DATA_PACKET_HEADER header = { 0 };
+
+	header.data.header.cmd_id = BL_DATA_PACKET_CMD_ID;
+	header.data.header.payload_size = sizeof(header) + data_len;
+	header.data.data_len = data_len;
+	header.data.next_len = next_len;
+	header.data.end_flag = end_flag;
+
+	BL_IoVec_t iov[2] = { { header.serialized_data, sizeof(header) }, { data,
+			data_len } };
+
+	/* The CRC is calculated over the block where it lies, no copy is made */
+	header.data.header.CRC32 = bl_calculate_vector_crc(iov, 2);
+
+	return BL_sendv(iov, 2, BL_SEND_TIMEOUT_MS);
+}
+
+BL_Status_t BL_send_seq_data_packet(uint32_t seq, uint32_t offset,
+		const uint8_t *data, uint32_t data_len, uint8_t end_flag) {
+	BL_SEQ_DATA_PACKET_HEADER header = { 0 };
+
+	header.data.header.cmd_id = BL_SEQ_DATA_PACKET_CMD_ID;
+	header.data.header.payload_size = sizeof(header) + data_len;
+	header.data.seq = seq;
+	header.data.offset = offset;
+	header.data.data_len = data_len;
+	header.data.end_flag = end_flag;
+
+	BL_IoVec_t iov[2] = { { header.serialized_data, sizeof(header) }, { data,
+			data_len } };
+
+	header.data.header.CRC32 = bl_calculate_vector_crc(iov, 2);
+
+	return BL_sendv(iov, 2, BL_SEND_TIMEOUT_MS);
+}
+
+BL_Status_t BL_receive_window_ack(BL_WINDOW_ACK *ack) {
+	BL_Status_t status;
+	uint32_t start = BL_STATS_TIMESTAMP();
+
+#if BL_RX_RING_ENABLE
+	status = bl_ring_read(ack->serialized_data, sizeof(*ack),
+			BL_RECEIVE_TIMEOUT_MS);
+#else
+	status = BL_receive(ack->serialized_data, sizeof(*ack),
+			BL_RECEIVE_TIMEOUT_MS);
+#endif
+	BL_STATS_PHASE(BL_STATS_PHASE_RECEIVE, start);
+
+	if (status != BL_Status_OK
+			|| ack->data.cmd_id != BL_SEQ_DATA_PACKET_CMD_ID) {
+		return BL_Status_Error;
+	}
+
+	return BL_Status_OK;
+}
+
 BL_Status_t BL_send_packet(BL_DATA_PACKET_CMD *packet) {
 	BL_Status_t status = BL_send(packet->serialized_data,
 			packet->data.header.payload_size, BL_SEND_TIMEOUT_MS);
 
 	return status;
 }
+
+void BL_capture_begin(BL_BATCH_RESULT *result, uint32_t max_data_len) {
+	result->ack = 0;
+	result->field = 0;
+	result->data_len = 0;
+
+	bl_capture.result = result;
+	bl_capture.acked = 0;
+	bl_capture.max_data_len = (max_data_len > UINT8_MAX) ?
+			UINT8_MAX : max_data_len;
+	bl_capture.truncated = 0;
+}
+
+uint8_t BL_capture_end(void) {
+	bl_capture.result = NULL;
+
+	return bl_capture.truncated;
+}
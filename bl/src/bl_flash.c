@@ -0,0 +1,760 @@
+/**
+ * @file bl_flash.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Bootloader flash programming pipeline
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_flash.h"
+#include "../inc/bl.h"
+#include "../inc/bl_cfg.h"
+#include "../inc/bl_cmd_types.h"
+#include "../inc/bl_crc.h"
+#include "../inc/bl_stats.h"
+#include <stdint.h>
+#include <string.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#define BL_FLASH_ERASED_BYTE (0xFFU)
+
+#define BL_FLASH_PAGE_COUNT	\
+	((BL_VS_FLASH_END_ADDRESS - BL_VS_FLASH_START_ADDRESS + 1) \
+			/ BL_VS_PAGE_SIZE_BYTES)
+
+#define BL_FLASH_PAGE_INDEX(address) \
+	(((address) - BL_VS_FLASH_START_ADDRESS) / BL_VS_PAGE_SIZE_BYTES)
+
+#define BL_FLASH_PAGE_ADDRESS(address) \
+	((address) - ((address) - BL_VS_FLASH_START_ADDRESS) % BL_VS_PAGE_SIZE_BYTES)
+
+/** Addresses below the start wrap around to large indexes */
+#define BL_FLASH_PAGE_VALID(address) \
+	(BL_FLASH_PAGE_INDEX(address) < BL_FLASH_PAGE_COUNT)
+
+#define BL_FLASH_BITMAP_WORDS ((BL_FLASH_PAGE_COUNT + 31) / 32)
+
+#define BL_FLASH_ERASED_WORD (0xFFFFFFFFU)
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @union	BL_FlashRxBuffer_t
+ * @brief	Receive buffer, large enough for any data packet
+ *
+ */
+typedef union {
+	BL_DATA_PACKET_CMD packet;
+	BL_SEQ_DATA_PACKET_CMD seq_packet;
+	uint32_t align;
+} BL_FlashRxBuffer_t;
+
+/**
+ * @enum	BL_FlashOp_t
+ * @brief	Asynchronous flash operation in progress
+ *
+ */
+typedef enum {
+	BL_FlashOp_none, /**< Flash idle */
+	BL_FlashOp_program, /**< Programming a queued block */
+	BL_FlashOp_erase /**< Erasing a page ahead */
+} BL_FlashOp_t;
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+/** Ping-pong buffers: one is received into while the other is programmed */
+static BL_FlashRxBuffer_t bl_flash_buffers[2];
+
+/** Index of the buffer that is free for reception */
+static uint8_t bl_flash_rx_index;
+
+/** Asynchronous operation in progress */
+static BL_FlashOp_t bl_flash_op;
+
+/** Page being erased ahead */
+static uint32_t bl_flash_op_address;
+
+/** BL_STATS_TIMESTAMP of the start of the asynchronous operation */
+static uint32_t bl_flash_op_start;
+
+/** First failure of an asynchronous operation, reported on flush */
+static BL_Status_t bl_flash_error = BL_Status_OK;
+
+/** Write session */
+static struct {
+	uint32_t start; /**< Range start address */
+	uint32_t end; /**< Range end address (exclusive) */
+	uint32_t erase_ahead; /**< Page to erase ahead, 0 if none */
+	uint8_t auto_erase; /**< Erase pages on first write */
+	uint32_t prepared[BL_FLASH_BITMAP_WORDS]; /**< Pages erased during the
+	 session */
+} bl_flash_session;
+
+/** Pages known to be blank, kept for as long as the bootloader runs */
+static uint32_t bl_flash_blank[BL_FLASH_BITMAP_WORDS];
+
+/** Results of the synchronous fallback in the default weak hooks */
+static BL_Status_t bl_flash_sync_write_status = BL_Status_OK;
+static BL_Status_t bl_flash_sync_erase_status = BL_Status_OK;
+
+/** Page being assembled by the page writer */
+static uint32_t bl_flash_page[BL_VS_PAGE_SIZE_BYTES / sizeof(uint32_t)];
+
+/** First page of the image, held back until the image is committed */
+static uint32_t bl_flash_first_page[BL_VS_PAGE_SIZE_BYTES / sizeof(uint32_t)];
+
+/** Page writer state */
+static struct {
+	uint32_t base; /**< Image address */
+	uint32_t length; /**< Bytes appended so far */
+	uint8_t hold_first_page; /**< First page is kept in RAM */
+	uint8_t first_page_erased; /**< Old first page was erased from flash */
+} bl_page_writer;
+
+#if BL_WRITE_COMBINE_ENABLE
+/** Write-combining buffers: one collects blocks while the other one is
+ * programmed */
+static uint32_t bl_flash_combine_pages[2][BL_VS_PAGE_SIZE_BYTES
+		/ sizeof(uint32_t)];
+
+/** Bytes collected for the next burst */
+static struct {
+	uint32_t page; /**< Address of the page collected */
+	uint32_t start; /**< Offset of the first byte collected in the page */
+	uint32_t end; /**< Offset after the last byte collected, start if none */
+	uint8_t index; /**< Buffer collecting */
+} bl_flash_combine;
+#endif
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn BL_Status_t bl_flash_program_start(uint32_t, uint8_t*, uint32_t)
+ * @brief	Waits for the previous operation, erases the pages of a range that
+ * 	were not prepared yet (auto-erase), then starts programming the range
+ *
+ * @param address	Flash address to program
+ * @param data		Data to program, must stay untouched until programmed
+ * @param len		Length of the data in bytes
+ * @return	BL_Status_OK	If the previous operation succeeded and this one was
+ * 	started
+ * @return	BL_Status_Error	Otherwise
+ */
+static BL_Status_t bl_flash_program_start(uint32_t address, uint8_t *data,
+		uint32_t len);
+
+#if BL_WRITE_COMBINE_ENABLE
+/**
+ * @fn BL_Status_t bl_flash_combine_program(void)
+ * @brief	Starts programming the collected bytes, padded to whole program
+ * 	units with the erased value, and collects into the other buffer from then
+ * 	on. Does nothing if no bytes are collected.
+ *
+ * @return	BL_Status_OK	If the burst was started
+ * @return	BL_Status_Error	If the previous operation failed or this one could
+ * 	not be started
+ */
+static BL_Status_t bl_flash_combine_program(void);
+#endif
+
+/**
+ * @fn BL_Status_t bl_flash_program_page(uint32_t, const uint8_t*)
+ * @brief	Erases a page and programs it with a full page of data
+ *
+ * @param address	Page address
+ * @param data		Page data
+ * @return	BL_Status_OK	If programmed successfully
+ * @return	BL_Status_Error	If erasing or programming failed
+ */
+static BL_Status_t bl_flash_program_page(uint32_t address,
+		const uint8_t *data);
+
+/**
+ * @fn BL_Status_t bl_flash_page_writer_flush(uint32_t)
+ * @brief	Programs the assembled page, or holds it if it is the first page
+ * 	and the first page is held back
+ *
+ * @param page_start	Offset of the page in the image
+ * @return	BL_Status_OK	If programmed successfully
+ * @return	BL_Status_Error	If erasing or programming failed
+ */
+static BL_Status_t bl_flash_page_writer_flush(uint32_t page_start);
+
+/**
+ * @fn uint8_t bl_flash_page_test(const uint32_t*, uint32_t)
+ * @brief	Tests the bit of a page in a page bitmap
+ *
+ * @param bitmap		Page bitmap
+ * @param page_address	Page address
+ * @return	Non-zero if the bit of the page is set
+ */
+static uint8_t bl_flash_page_test(const uint32_t *bitmap,
+		uint32_t page_address);
+
+/**
+ * @fn void bl_flash_page_set(uint32_t*, uint32_t)
+ * @brief	Sets the bit of a page in a page bitmap
+ *
+ * @param bitmap		Page bitmap
+ * @param page_address	Page address
+ */
+static void bl_flash_page_set(uint32_t *bitmap, uint32_t page_address);
+
+/**
+ * @fn uint8_t bl_flash_page_is_blank(uint32_t)
+ * @brief	Checks whether a page is blank, from the bitmap or by reading it
+ *
+ * @param page_address	Page address
+ * @return	Non-zero if the page is blank
+ */
+static uint8_t bl_flash_page_is_blank(uint32_t page_address);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static BL_Status_t bl_flash_program_start(uint32_t address, uint8_t *data,
+		uint32_t len) {
+	/* The previous operation ran while this data was received */
+	BL_Status_t status = bl_flash_wait();
+
+	if (status != BL_Status_OK) {
+		return status;
+	}
+
+	if (bl_flash_session.auto_erase && len) {
+		/* Erase the pages this block is the first to land in */
+		for (uint32_t page = BL_FLASH_PAGE_ADDRESS(address);
+				page < address + len; page += BL_VS_PAGE_SIZE_BYTES) {
+			if (!bl_flash_page_test(bl_flash_session.prepared, page)) {
+				if (bl_flash_erase_pages(page, 1, NULL) != BL_Status_OK) {
+					return BL_Status_Error;
+				}
+				bl_flash_page_set(bl_flash_session.prepared, page);
+			}
+		}
+
+		/* The next block most likely starts where this one ends */
+		uint32_t next = address + len;
+		if (next < bl_flash_session.end
+				&& !bl_flash_page_test(bl_flash_session.prepared,
+						BL_FLASH_PAGE_ADDRESS(next))) {
+			bl_flash_session.erase_ahead = BL_FLASH_PAGE_ADDRESS(next);
+		}
+	}
+
+	bl_flash_mark_written(address, len);
+	bl_flash_op_start = BL_STATS_TIMESTAMP();
+	status = BL_flash_write_start(address, data, len);
+	if (status != BL_Status_OK) {
+		bl_flash_session.erase_ahead = 0;
+		return status;
+	}
+
+	bl_flash_op = BL_FlashOp_program;
+
+	return BL_Status_OK;
+}
+
+#if BL_WRITE_COMBINE_ENABLE
+static BL_Status_t bl_flash_combine_program(void) {
+	uint8_t *buffer = (uint8_t*) bl_flash_combine_pages[bl_flash_combine.index];
+	uint32_t start = bl_flash_combine.start
+			- bl_flash_combine.start % BL_VS_FLASH_PROGRAM_UNIT_BYTES;
+	uint32_t end = (bl_flash_combine.end + BL_VS_FLASH_PROGRAM_UNIT_BYTES - 1)
+			/ BL_VS_FLASH_PROGRAM_UNIT_BYTES * BL_VS_FLASH_PROGRAM_UNIT_BYTES;
+
+	if (bl_flash_combine.start == bl_flash_combine.end) {
+		return BL_Status_OK;
+	}
+
+	/* Programming the erased value leaves the padding erased */
+	memset(&buffer[start], BL_FLASH_ERASED_BYTE, bl_flash_combine.start - start);
+	memset(&buffer[bl_flash_combine.end], BL_FLASH_ERASED_BYTE,
+			end - bl_flash_combine.end);
+
+	BL_Status_t status = bl_flash_program_start(bl_flash_combine.page + start,
+			&buffer[start], end - start);
+
+	bl_flash_combine.index ^= 1;
+	bl_flash_combine.start = 0;
+	bl_flash_combine.end = 0;
+
+	return status;
+}
+#endif
+
+static BL_Status_t bl_flash_program_page(uint32_t address,
+		const uint8_t *data) {
+	BL_Status_t status = bl_flash_erase_pages(address, 1, NULL);
+
+	if (status == BL_Status_OK) {
+		uint32_t start = BL_STATS_TIMESTAMP();
+
+		bl_flash_mark_written(address, BL_VS_PAGE_SIZE_BYTES);
+		status = BL_flash_write(address, (uint8_t*) data,
+				BL_VS_PAGE_SIZE_BYTES);
+		BL_STATS_PHASE(BL_STATS_PHASE_FLASH_WRITE, start);
+	}
+
+	return status;
+}
+
+static BL_Status_t bl_flash_page_writer_flush(uint32_t page_start) {
+	if (page_start == 0 && bl_page_writer.hold_first_page) {
+		memcpy(bl_flash_first_page, bl_flash_page, BL_VS_PAGE_SIZE_BYTES);
+		return BL_Status_OK;
+	}
+
+	/* The old first page goes before any other page changes, so a reset
+	 * midway leaves an image that is never booted instead of a mixed one */
+	if (bl_page_writer.hold_first_page && !bl_page_writer.first_page_erased) {
+		if (bl_flash_erase_pages(bl_page_writer.base, 1, NULL)
+				!= BL_Status_OK) {
+			return BL_Status_Error;
+		}
+		bl_page_writer.first_page_erased = 1;
+	}
+
+	return bl_flash_program_page(bl_page_writer.base + page_start,
+			(const uint8_t*) bl_flash_page);
+}
+
+static uint8_t bl_flash_page_test(const uint32_t *bitmap,
+		uint32_t page_address) {
+	uint32_t index = BL_FLASH_PAGE_INDEX(page_address);
+
+	/* Nothing is known about pages outside flash */
+	if (!BL_FLASH_PAGE_VALID(page_address)) {
+		return 0;
+	}
+
+	return (bitmap[index / 32] >> (index % 32)) & 1U;
+}
+
+static void bl_flash_page_set(uint32_t *bitmap, uint32_t page_address) {
+	uint32_t index = BL_FLASH_PAGE_INDEX(page_address);
+
+	if (!BL_FLASH_PAGE_VALID(page_address)) {
+		return;
+	}
+
+	bitmap[index / 32] |= 1UL << (index % 32);
+}
+
+static uint8_t bl_flash_page_is_blank(uint32_t page_address) {
+	if (bl_flash_page_test(bl_flash_blank, page_address)) {
+		return 1;
+	}
+
+	if (bl_flash_is_blank(page_address, BL_VS_PAGE_SIZE_BYTES)) {
+		bl_flash_page_set(bl_flash_blank, page_address);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*******************************************************************************
+ *                         	Weak functions				                       *
+ *******************************************************************************/
+
+BL_WEAK BL_Status_t BL_flash_write_start(uint32_t start_address,
+		uint8_t data[], uint32_t data_len) {
+	/* No asynchronous programming available, fall back to blocking write */
+	bl_flash_sync_write_status = BL_flash_write(start_address, data, data_len);
+	return BL_Status_OK;
+}
+
+BL_WEAK BL_Status_t BL_flash_write_poll(void) {
+	return bl_flash_sync_write_status;
+}
+
+BL_WEAK BL_Status_t BL_erase_flash_start(uint32_t page_address,
+		uint32_t page_count) {
+	/* No asynchronous erasing available, fall back to blocking erase */
+	bl_flash_sync_erase_status = BL_erase_flash(page_address, page_count);
+	return BL_Status_OK;
+}
+
+BL_WEAK BL_Status_t BL_erase_flash_poll(void) {
+	return bl_flash_sync_erase_status;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+BL_Status_t bl_flash_begin(uint32_t address, uint32_t length,
+		uint8_t auto_erase) {
+	bl_flash_flush();
+
+	bl_flash_session.start = address;
+	bl_flash_session.end = address + length;
+	bl_flash_session.erase_ahead = 0;
+	bl_flash_session.auto_erase = auto_erase;
+	memset(bl_flash_session.prepared, 0, sizeof(bl_flash_session.prepared));
+
+	/* Auto-erase works on whole pages of the range */
+	if (auto_erase
+			&& (BL_FLASH_PAGE_ADDRESS(address) != address || length == 0
+					|| address < BL_VS_FLASH_START_ADDRESS
+					|| bl_flash_session.end - 1 > BL_VS_FLASH_END_ADDRESS)) {
+		bl_flash_session.auto_erase = 0;
+		return BL_Status_Error;
+	}
+
+	return BL_Status_OK;
+}
+
+void bl_flash_service(void) {
+	if (bl_flash_op != BL_FlashOp_none) {
+		BL_Status_t status =
+				(bl_flash_op == BL_FlashOp_program) ?
+						BL_flash_write_poll() : BL_erase_flash_poll();
+
+		if (status == BL_Status_Busy) {
+			return;
+		}
+
+		BL_STATS_PHASE(
+				(bl_flash_op == BL_FlashOp_program) ?
+						BL_STATS_PHASE_FLASH_WRITE : BL_STATS_PHASE_FLASH_ERASE,
+				bl_flash_op_start);
+
+		if (status != BL_Status_OK) {
+			bl_flash_error = BL_Status_Error;
+		} else if (bl_flash_op == BL_FlashOp_erase) {
+			bl_flash_page_set(bl_flash_blank, bl_flash_op_address);
+			bl_flash_page_set(bl_flash_session.prepared, bl_flash_op_address);
+		}
+		bl_flash_op = BL_FlashOp_none;
+	}
+
+	/* Flash is idle: erase the page the next block lands in */
+	uint32_t page = bl_flash_session.erase_ahead;
+	if (page != 0 && bl_flash_error == BL_Status_OK) {
+		bl_flash_session.erase_ahead = 0;
+		if (bl_flash_page_test(bl_flash_session.prepared, page)) {
+			/* Already erased during the session */
+		} else if (bl_flash_page_is_blank(page)) {
+			bl_flash_page_set(bl_flash_session.prepared, page);
+		} else {
+			bl_flash_op_start = BL_STATS_TIMESTAMP();
+			if (BL_erase_flash_start(page, 1) == BL_Status_OK) {
+				bl_flash_op = BL_FlashOp_erase;
+				bl_flash_op_address = page;
+			} else {
+				bl_flash_error = BL_Status_Error;
+			}
+		}
+	}
+}
+
+uint8_t bl_flash_is_blank(uint32_t address, uint32_t length) {
+	const uint32_t *word = (const uint32_t*) (uintptr_t) address;
+
+	/* Word-wide scan, the range is word aligned */
+	for (uint32_t i = 0; i < length / sizeof(uint32_t); i++) {
+		if (word[i] != BL_FLASH_ERASED_WORD) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+BL_Status_t bl_flash_erase_pages(uint32_t page_address, uint32_t page_count,
+		uint32_t *erased) {
+	uint32_t run_start = 0;
+	uint32_t run_count = 0;
+
+	if (erased != NULL) {
+		*erased = 0;
+	}
+
+	for (uint32_t i = 0; i <= page_count; i++) {
+		uint32_t page = page_address + i * BL_VS_PAGE_SIZE_BYTES;
+
+		if (i < page_count && !bl_flash_page_is_blank(page)) {
+			/* Extend the run of pages to erase together */
+			if (run_count == 0) {
+				run_start = page;
+			}
+			run_count++;
+			continue;
+		}
+
+		if (run_count == 0) {
+			continue;
+		}
+
+		uint32_t start = BL_STATS_TIMESTAMP();
+		BL_Status_t status = BL_erase_flash(run_start, run_count);
+		BL_STATS_PHASE(BL_STATS_PHASE_FLASH_ERASE, start);
+
+		if (status != BL_Status_OK) {
+			return BL_Status_Error;
+		}
+
+		for (uint32_t j = 0; j < run_count; j++) {
+			bl_flash_page_set(bl_flash_blank,
+					run_start + j * BL_VS_PAGE_SIZE_BYTES);
+		}
+		if (erased != NULL) {
+			*erased += run_count;
+		}
+		run_count = 0;
+	}
+
+	return BL_Status_OK;
+}
+
+void bl_flash_mark_written(uint32_t address, uint32_t len) {
+	for (uint32_t page = BL_FLASH_PAGE_ADDRESS(address); page < address + len;
+			page += BL_VS_PAGE_SIZE_BYTES) {
+		uint32_t index = BL_FLASH_PAGE_INDEX(page);
+
+		if (!BL_FLASH_PAGE_VALID(page)) {
+			break;
+		}
+
+		bl_flash_blank[index / 32] &= ~(1UL << (index % 32));
+	}
+}
+
+uint8_t* bl_flash_get_rx_buffer(void) {
+	return (uint8_t*) &bl_flash_buffers[bl_flash_rx_index];
+}
+
+BL_Status_t bl_flash_queue_write(uint32_t address, uint8_t *data,
+		uint32_t len) {
+	BL_Status_t status = BL_Status_OK;
+
+	/* The page bitmaps and combining buffers only cover flash */
+	if (len
+			&& (address < BL_VS_FLASH_START_ADDRESS
+					|| address > BL_VS_FLASH_END_ADDRESS
+					|| len - 1 > BL_VS_FLASH_END_ADDRESS - address)) {
+		return BL_Status_Error;
+	}
+
+	if (bl_flash_session.auto_erase && len
+			&& (address < bl_flash_session.start
+					|| address + len > bl_flash_session.end)) {
+		return BL_Status_Error;
+	}
+
+#if BL_WRITE_COMBINE_ENABLE
+	while (len && status == BL_Status_OK) {
+		uint32_t page = BL_FLASH_PAGE_ADDRESS(address);
+		uint32_t offset = address - page;
+		uint32_t chunk = BL_VS_PAGE_SIZE_BYTES - offset;
+
+		if (chunk > len) {
+			chunk = len;
+		}
+
+		/* Data that does not follow the collected bytes starts a new burst */
+		if (bl_flash_combine.start != bl_flash_combine.end
+				&& (page != bl_flash_combine.page
+						|| offset != bl_flash_combine.end)) {
+			status = bl_flash_combine_program();
+			if (status != BL_Status_OK) {
+				break;
+			}
+		}
+		if (bl_flash_combine.start == bl_flash_combine.end) {
+			bl_flash_combine.page = page;
+			bl_flash_combine.start = offset;
+			bl_flash_combine.end = offset;
+		}
+
+		memcpy(
+				&((uint8_t*) bl_flash_combine_pages[bl_flash_combine.index])[offset],
+				data, chunk);
+		bl_flash_combine.end += chunk;
+		address += chunk;
+		data += chunk;
+		len -= chunk;
+
+		/* Page complete, programmed while the next one is collected */
+		if (bl_flash_combine.end == BL_VS_PAGE_SIZE_BYTES) {
+			status = bl_flash_combine_program();
+		}
+	}
+#else
+	status = bl_flash_program_start(address, data, len);
+#endif
+
+	if (status == BL_Status_OK) {
+		bl_flash_rx_index ^= 1;
+	}
+
+	return status;
+}
+
+BL_Status_t bl_flash_flush(void) {
+#if BL_WRITE_COMBINE_ENABLE
+	if (bl_flash_combine_program() != BL_Status_OK) {
+		bl_flash_error = BL_Status_Error;
+	}
+#endif
+
+	return bl_flash_wait();
+}
+
+BL_Status_t bl_flash_wait(void) {
+	/* An erase-ahead that did not start yet is no longer ahead of anything */
+	bl_flash_session.erase_ahead = 0;
+
+	return bl_flash_drain();
+}
+
+BL_Status_t bl_flash_drain(void) {
+	uint32_t erase_ahead = bl_flash_session.erase_ahead;
+
+	/* Held back so the loop does not wait for it as well */
+	bl_flash_session.erase_ahead = 0;
+
+	while (bl_flash_op != BL_FlashOp_none) {
+		bl_flash_service();
+	}
+
+	BL_Status_t status = bl_flash_error;
+	bl_flash_error = BL_Status_OK;
+
+	if (status == BL_Status_OK) {
+		bl_flash_session.erase_ahead = erase_ahead;
+	}
+
+	return status;
+}
+
+void bl_flash_page_writer_begin(uint32_t base, uint8_t hold_first_page) {
+	bl_page_writer.base = base;
+	bl_page_writer.length = 0;
+	bl_page_writer.hold_first_page = hold_first_page;
+	bl_page_writer.first_page_erased = 0;
+}
+
+BL_Status_t bl_flash_page_writer_write(const uint8_t *data, uint32_t len) {
+	uint8_t *page = (uint8_t*) bl_flash_page;
+
+	while (len) {
+		uint32_t offset = bl_page_writer.length % BL_VS_PAGE_SIZE_BYTES;
+		uint32_t chunk = BL_VS_PAGE_SIZE_BYTES - offset;
+
+		if (chunk > len) {
+			chunk = len;
+		}
+
+		memcpy(&page[offset], data, chunk);
+		bl_page_writer.length += chunk;
+		data += chunk;
+		len -= chunk;
+
+		if (offset + chunk < BL_VS_PAGE_SIZE_BYTES) {
+			break;
+		}
+
+		/* Page complete */
+		if (bl_flash_page_writer_flush(
+				bl_page_writer.length - BL_VS_PAGE_SIZE_BYTES) != BL_Status_OK) {
+			return BL_Status_Error;
+		}
+	}
+
+	return BL_Status_OK;
+}
+
+uint32_t bl_flash_page_writer_length(void) {
+	return bl_page_writer.length;
+}
+
+uint32_t bl_flash_page_writer_room(void) {
+	return BL_VS_PAGE_SIZE_BYTES
+			- (bl_page_writer.length % BL_VS_PAGE_SIZE_BYTES);
+}
+
+const uint8_t* bl_flash_page_writer_output(uint32_t offset,
+		uint32_t *contiguous) {
+	uint32_t page_start = bl_page_writer.length
+			- (bl_page_writer.length % BL_VS_PAGE_SIZE_BYTES);
+
+	if (offset >= page_start) {
+		*contiguous = bl_page_writer.length - offset;
+		return &((const uint8_t*) bl_flash_page)[offset - page_start];
+	}
+
+	if (bl_page_writer.hold_first_page && offset < BL_VS_PAGE_SIZE_BYTES) {
+		*contiguous = BL_VS_PAGE_SIZE_BYTES - offset;
+		return &((const uint8_t*) bl_flash_first_page)[offset];
+	}
+
+	*contiguous = page_start - offset;
+	return (const uint8_t*) (uintptr_t) (bl_page_writer.base + offset);
+}
+
+BL_Status_t bl_flash_page_writer_end(void) {
+	uint32_t offset = bl_page_writer.length % BL_VS_PAGE_SIZE_BYTES;
+
+	if (offset == 0) {
+		return BL_Status_OK;
+	}
+
+	/* Pad the last page without counting the padding in the image length */
+	memset(&((uint8_t*) bl_flash_page)[offset], BL_FLASH_ERASED_BYTE,
+			BL_VS_PAGE_SIZE_BYTES - offset);
+
+	return bl_flash_page_writer_flush(bl_page_writer.length - offset);
+}
+
+uint32_t bl_flash_page_writer_crc(void) {
+	uint32_t crc = bl_crc32_init();
+	uint32_t length = bl_page_writer.length;
+	uint32_t offset = 0;
+
+	if (bl_page_writer.hold_first_page) {
+		offset = (length < BL_VS_PAGE_SIZE_BYTES) ?
+				length : BL_VS_PAGE_SIZE_BYTES;
+		crc = bl_crc32_update(crc, bl_flash_first_page, offset);
+	}
+
+	crc = bl_crc32_update(crc,
+			(const uint8_t*) (uintptr_t) (bl_page_writer.base + offset),
+			length - offset);
+
+	return bl_crc32_final(crc);
+}
+
+BL_Status_t bl_flash_page_writer_commit(uint8_t commit) {
+	if (!bl_page_writer.hold_first_page) {
+		return BL_Status_OK;
+	}
+
+	bl_page_writer.hold_first_page = 0;
+
+	if (commit) {
+		return bl_flash_program_page(bl_page_writer.base,
+				(const uint8_t*) bl_flash_first_page);
+	}
+
+	return bl_flash_erase_pages(bl_page_writer.base, 1, NULL);
+}
@@ -16,8 +16,18 @@
 #include "../inc/bl_handlers.h"
 #include "../inc/bl.h"
 #include "../inc/bl_cfg.h"
+#include "../inc/bl_commands.h"
 #include "../inc/bl_comms.h"
 #include "../inc/bl_defs.h"
+#include "../inc/bl_crc.h"
+#include "../inc/bl_flash.h"
+#include "../inc/bl_journal.h"
+#include "../inc/bl_lz.h"
+#include "../inc/bl_patch.h"
+#include "../inc/bl_ring.h"
+#include "../inc/bl_sha256.h"
+#include "../inc/bl_slots.h"
+#include "../inc/bl_stats.h"
 #include "../inc/bl_utils.h"
 #include "LIB/DEBUG_UTILS.h"
 #include <stdint.h>
@@ -28,8 +38,23 @@
  *                              Definitions                                    *
  *******************************************************************************/
 
-#define VALIDATE_CMD(data, length, crc) \
-	(bl_calculate_command_crc(data, length) == crc)
+#if BL_MAX_WRITE_WINDOW > 32
+#error "BL_MAX_WRITE_WINDOW must fit the 32 bit missing packet bitmap"
+#endif
+
+#if BL_MAX_READ_WINDOW > 32
+#error "BL_MAX_READ_WINDOW must fit the 32 bit missing packet bitmap"
+#endif
+
+#if BL_VS_FLASH_PROGRAM_UNIT_BYTES < 4
+#error "BL_VS_FLASH_PROGRAM_UNIT_BYTES must hold a page CRC"
+#endif
+
+/** Page CRCs sent per data packet */
+#define BL_PAGE_CRCS_PER_PACKET (32U)
+
+/** Bytes garbled by a change of line rate skipped before the sync byte */
+#define BL_LINK_SPEED_NOISE_BYTES (8U)
 
 /*******************************************************************************
  *                        Global Public variables                              *
@@ -37,17 +62,33 @@
 
 extern BL_Context_t bl_ctx;
 
+#if BL_JOURNAL_ENABLE
+/* Journal location from the linker script */
+extern uint32_t _JournalAddr;
+#endif
+
+#if BL_AB_SLOTS_ENABLE
+/* Boot record location from the linker script */
+extern uint32_t _BootRecordAddr;
+#endif
+
 /*******************************************************************************
- *                         	Private functions prototypes 					   *
+ *                         	Private variables			                       *
  *******************************************************************************/
 
-/**
- * @fn void bl_debug_cmd_name(BL_CommandID_t)
- * @brief	Prints the command name
- *
- * @param id	Command ID to be printed
- */
-static void bl_debug_cmd_name(BL_CommandID_t id);
+#if BL_SIGNATURE_ENABLE
+/** Image written by the last BL_MEM_WRITE_CMD, hashed as it was received */
+static struct {
+	BL_Sha256_t sha; /**< Running hash of the data */
+	uint32_t start; /**< Start address */
+	uint32_t length; /**< Bytes written */
+	uint8_t complete; /**< Written completely, and nothing written since */
+} bl_image;
+#endif
+
+/*******************************************************************************
+ *                         	Private functions prototypes 					   *
+ *******************************************************************************/
 
 /**
  * @fn bool bl_is_address_outside_range(uint32_t, uint32_t, uint32_t)
@@ -75,42 +116,135 @@ static bool bl_is_address_outside_range(uint32_t address, uint32_t startAddress,
 static bool bl_is_block_inside_range(uint32_t startAddress, uint32_t endAddress,
 		uint32_t blockStartAddress, uint32_t blockSize);
 
+/**
+ * @fn bool bl_is_block_overlapping(uint32_t, uint32_t, uint32_t, uint32_t)
+ * @brief	Checks whether or not the given block of memory shares a byte with
+ * 	the given range.
+ *
+ * @param startAddress		Start address of the range
+ * @param endAddress		End address of the range
+ * @param blockStartAddress	Start address of the block, the block must not
+ * 	wrap around
+ * @param blockSize			Block size, at least 1
+ * @return
+ */
+static bool bl_is_block_overlapping(uint32_t startAddress, uint32_t endAddress,
+		uint32_t blockStartAddress, uint32_t blockSize);
+
+/**
+ * @fn uint32_t bl_missing_packets(uint32_t, uint32_t, uint32_t)
+ * @brief	Builds the bitmap of packets to resend in a windowed write
+ *
+ * @param received		Bitmap of received packets, bit 0 is next_seq
+ * @param next_seq		First sequence number not yet received
+ * @param highest_seq	Highest sequence number received so far
+ * @return	Bitmap of the packets between next_seq and highest_seq that were
+ * 	not received
+ */
+static uint32_t bl_missing_packets(uint32_t received, uint32_t next_seq,
+		uint32_t highest_seq);
+
+/**
+ * @fn BL_DATA_PACKET_CMD bl_receive_data_packet*(uint32_t*)
+ * @brief	Receives the next valid data packet of a stop-and-wait transfer,
+ * 	sending a NACK for every corrupted one
+ *
+ * @param retries	Retry counter of the transfer
+ * @return	The data packet, or NULL if the retry budget is exhausted or the
+ * 	host sent another command
+ */
+static BL_DATA_PACKET_CMD* bl_receive_data_packet(uint32_t *retries);
+
+/**
+ * @fn BL_NACK_t bl_begin_write(uint32_t, uint8_t, uint32_t)
+ * @brief	Validates the range of a write command and starts the flash write
+ * 	session
+ *
+ * @param start_address	Start address of the write
+ * @param flags			BL_WriteFlag_t
+ * @param length		Length of the written range, 0 if unknown, required with
+ * 	auto-erase
+ * @return	BL_NACK_SUCCESS or the errored fields
+ */
+static BL_NACK_t bl_begin_write(uint32_t start_address, uint8_t flags,
+		uint32_t length);
+
+/**
+ * @fn BL_NACK_t bl_check_write_range(uint32_t, uint32_t)
+ * @brief	Validates a range the host writes or erases: inside flash, without
+ * 	wrapping around, and clear of the bootloader and of the pages of the
+ * 	journal and boot record logs
+ *
+ * @param start_address	Start address of the range
+ * @param length		Length of the range in bytes
+ * @return	BL_NACK_SUCCESS or BL_NACK_INVALID_ADDRESS
+ */
+static BL_NACK_t bl_check_write_range(uint32_t start_address, uint32_t length);
+
+/**
+ * @fn BL_NACK_t bl_check_read_range(uint32_t, uint32_t)
+ * @brief	Validates the range of a read command
+ *
+ * @param start_address	Start address of the read
+ * @param length		Length of the read
+ * @return	BL_NACK_SUCCESS or BL_NACK_INVALID_ADDRESS
+ */
+static BL_NACK_t bl_check_read_range(uint32_t start_address, uint32_t length);
+
+/**
+ * @fn void bl_send_read_block(uint32_t, uint32_t, uint32_t, uint32_t)
+ * @brief	Sends one sequenced block of a windowed read straight from flash
+ *
+ * @param start_address	Start address of the read
+ * @param length		Length of the read
+ * @param block_size	Block size
+ * @param seq			Sequence number of the block
+ */
+static void bl_send_read_block(uint32_t start_address, uint32_t length,
+		uint32_t block_size, uint32_t seq);
+
+/**
+ * @fn void bl_image_begin(uint32_t)
+ * @brief	Starts hashing the image of a BL_MEM_WRITE_CMD
+ *
+ * @param start_address	Start address of the write
+ */
+static void bl_image_begin(uint32_t start_address);
+
+/**
+ * @fn void bl_image_append(const uint8_t*, uint32_t, uint8_t)
+ * @brief	Hashes a block that was written and acknowledged
+ *
+ * @param data	Block data
+ * @param len	Length of the block in bytes
+ * @param last	Non-zero for the last block of the image
+ */
+static void bl_image_append(const uint8_t *data, uint32_t len, uint8_t last);
+
+/**
+ * @fn void bl_image_forget(void)
+ * @brief	Invalidates the hashed image and drops the journaled one, when
+ * 	flash is modified by any other means than BL_MEM_WRITE_CMD
+ *
+ */
+static void bl_image_forget(void);
+
+#if BL_LINK_SPEED_ENABLE
+/**
+ * @fn BL_Status_t bl_link_read(uint8_t*, uint32_t)
+ * @brief	Reads one byte outside of a command frame
+ *
+ * @param byte		Output: byte read
+ * @param timeout	Timeout in ms
+ * @return	Status of the read
+ */
+static BL_Status_t bl_link_read(uint8_t *byte, uint32_t timeout);
+#endif
+
 /*******************************************************************************
  *                         	Private functions 			                       *
  *******************************************************************************/
 
-static void bl_debug_cmd_name(BL_CommandID_t id) {
-	switch (id) {
-	case BL_GOTO_ADDR_CMD_ID:
-		DEBUG_INFO("**** GO TO ADDR CMD ****");
-		break;
-	case BL_MEM_WRITE_CMD_ID:
-		DEBUG_INFO("**** MEM WRITE CMD ****");
-		break;
-	case BL_MEM_READ_CMD_ID:
-		DEBUG_INFO("**** MEM READ CMD ****");
-		break;
-	case BL_VER_CMD_ID:
-		DEBUG_INFO("**** VER CMD ****");
-		break;
-	case BL_FLASH_ERASE_CMD_ID:
-		DEBUG_INFO("**** FLASH ERASE CMD ****");
-		break;
-	case BL_ACK_CMD_ID:
-		DEBUG_INFO("**** ACK CMD ****");
-		break;
-	case BL_JUMP_TO_APP_CMD_ID:
-		DEBUG_INFO("**** JUMP TO APP CMD ****");
-		break;
-	case BL_ENTER_CMD_MODE_CMD_ID:
-		DEBUG_INFO("**** ENTER CMD MODE CMD ****");
-		break;
-	default:
-		DEBUG_INFO("Unknown command ID 0x%02X", id);
-		break;
-	}
-}
-
 static bool bl_is_address_outside_range(uint32_t address, uint32_t startAddress,
 		uint32_t endAddress) {
 	return ((address < startAddress) || (address > endAddress));
@@ -118,9 +252,224 @@ static bool bl_is_address_outside_range(uint32_t address, uint32_t startAddress,
 
 static bool bl_is_block_inside_range(uint32_t startAddress, uint32_t endAddress,
 		uint32_t blockStartAddress, uint32_t blockSize) {
-	uint32_t blockEndAddress = blockStartAddress + blockSize - 1;
+	/* Compared as sizes, a block that wraps around is never inside */
 	return (startAddress <= blockStartAddress)
-			&& (blockEndAddress <= endAddress);
+			&& (blockStartAddress <= endAddress)
+			&& (blockSize == 0 || blockSize - 1 <= endAddress - blockStartAddress);
+}
+
+static bool bl_is_block_overlapping(uint32_t startAddress, uint32_t endAddress,
+		uint32_t blockStartAddress, uint32_t blockSize) {
+	uint32_t blockEndAddress = blockStartAddress + blockSize - 1;
+	return (blockStartAddress <= endAddress)
+			&& (blockEndAddress >= startAddress);
+}
+
+static uint32_t bl_missing_packets(uint32_t received, uint32_t next_seq,
+		uint32_t highest_seq) {
+	if (highest_seq < next_seq) {
+		return 0;
+	}
+
+	uint32_t span = highest_seq - next_seq + 1;
+	uint32_t mask = (span >= 32) ? 0xFFFFFFFFU : ((1UL << span) - 1);
+
+	return ~received & mask;
+}
+
+static BL_DATA_PACKET_CMD* bl_receive_data_packet(uint32_t *retries) {
+	for (;;) {
+		BL_DATA_PACKET_CMD *data_block =
+				(BL_DATA_PACKET_CMD*) bl_flash_get_rx_buffer();
+
+		BL_Status_t status = BL_receive_packet(data_block->serialized_data,
+				sizeof(BL_DATA_PACKET_CMD));
+
+		if (status == BL_Status_OK
+				&& VALIDATE_CMD(data_block->serialized_data,
+						data_block->data.header.payload_size,
+						data_block->data.header.CRC32)) {
+			if (data_block->data.header.cmd_id != BL_DATA_PACKET_CMD_ID) {
+				/* The host gave up on the transfer, e.g. after losing the
+				 * link, and must send the command again */
+				DEBUG_WARN("Transfer abandoned by the host");
+				BL_send_ack(data_block->data.header.cmd_id, 0,
+						BL_NACK_INVALID_CMD);
+				return NULL;
+			}
+			if (data_block->data.data_len <= bl_ctx.BlockSize) {
+				return data_block;
+			}
+		}
+
+		DEBUG_ERROR("Data packet corrupted");
+		BL_send_ack(data_block->data.header.cmd_id, 0,
+				BL_NACK_INVALID_DATA | BL_NACK_INVALID_CRC);
+		if (*retries >= BL_MAX_RETRIES) {
+			return NULL;
+		}
+		(*retries)++;
+		BL_STATS_RETRIES(1);
+	}
+}
+
+static BL_NACK_t bl_begin_write(uint32_t start_address, uint8_t flags,
+		uint32_t length) {
+	/* Without a length, each block is checked as it arrives */
+	if (bl_check_write_range(start_address, length ? length : 1)
+			!= BL_NACK_SUCCESS) {
+		return BL_NACK_INVALID_ADDRESS;
+	}
+
+	if (!(flags & BL_WRITE_FLAG_AUTO_ERASE)) {
+		bl_flash_begin(start_address, 0, 0);
+		return BL_NACK_SUCCESS;
+	}
+
+	/* Pages are erased as a whole, the range must be known */
+	if (length == 0) {
+		return BL_NACK_INVALID_ADDRESS | BL_NACK_INVALID_LENGTH;
+	}
+
+	if (bl_flash_begin(start_address, length, 1) != BL_Status_OK) {
+		DEBUG_ERROR("Auto-erase range must start on a page inside flash");
+		return BL_NACK_INVALID_ADDRESS | BL_NACK_INVALID_LENGTH;
+	}
+
+	DEBUG_INFO("Auto-erase of 0x%08X to 0x%08X", start_address,
+			start_address + length);
+
+	return BL_NACK_SUCCESS;
+}
+
+static BL_NACK_t bl_check_write_range(uint32_t start_address, uint32_t length) {
+	if (length == 0 || start_address < BL_VS_FLASH_START_ADDRESS
+			|| start_address > BL_VS_FLASH_END_ADDRESS
+			|| length - 1 > BL_VS_FLASH_END_ADDRESS - start_address) {
+		DEBUG_WARN("Write range outside of flash (0x%08X, %lu bytes)",
+				start_address, length);
+		return BL_NACK_INVALID_ADDRESS;
+	}
+
+	/* Protect bootloader code against overwrite */
+	if (bl_is_block_overlapping((uint32_t) (uintptr_t) bl_ctx.BL_startAddress,
+			(uint32_t) (uintptr_t) bl_ctx.BL_endAddress, start_address,
+			length)) {
+		DEBUG_ERROR("Conflict with bootloader address: (0x%08X to 0x%08X)",
+				start_address, start_address + length - 1);
+		return BL_NACK_INVALID_ADDRESS;
+	}
+
+	/* The logs are only written through bl_log, one record at a time */
+#if BL_JOURNAL_ENABLE
+	if (bl_is_block_overlapping((uint32_t) (uintptr_t) &_JournalAddr,
+			(uint32_t) (uintptr_t) &_JournalAddr
+					+ BL_JOURNAL_PAGES * BL_VS_PAGE_SIZE_BYTES - 1,
+			start_address, length)) {
+		DEBUG_ERROR("Conflict with the journal: (0x%08X to 0x%08X)",
+				start_address, start_address + length - 1);
+		return BL_NACK_INVALID_ADDRESS;
+	}
+#endif
+
+#if BL_AB_SLOTS_ENABLE
+	if (bl_is_block_overlapping((uint32_t) (uintptr_t) &_BootRecordAddr,
+			(uint32_t) (uintptr_t) &_BootRecordAddr
+					+ BL_BOOT_RECORD_PAGES * BL_VS_PAGE_SIZE_BYTES - 1,
+			start_address, length)) {
+		DEBUG_ERROR("Conflict with the boot record: (0x%08X to 0x%08X)",
+				start_address, start_address + length - 1);
+		return BL_NACK_INVALID_ADDRESS;
+	}
+#endif
+
+	return BL_NACK_SUCCESS;
+}
+
+static BL_NACK_t bl_check_read_range(uint32_t start_address, uint32_t length) {
+	/* Protect bootloader code against read-out */
+	if (!bl_is_address_outside_range(start_address,
+			(uint32_t) (uintptr_t) bl_ctx.BL_startAddress,
+			(uint32_t) (uintptr_t) bl_ctx.BL_endAddress)) {
+		DEBUG_WARN("Attempting to read-out bootloader code");
+		return BL_NACK_INVALID_ADDRESS;
+	}
+
+	/* Ensure range is not outside the flash memory */
+	if (!bl_is_block_inside_range(BL_VS_FLASH_START_ADDRESS,
+	BL_VS_FLASH_END_ADDRESS, start_address, length)) {
+		DEBUG_WARN("Attempting to read out of range memory");
+		return BL_NACK_INVALID_ADDRESS;
+	}
+
+	return BL_NACK_SUCCESS;
+}
+
+static void bl_send_read_block(uint32_t start_address, uint32_t length,
+		uint32_t block_size, uint32_t seq) {
+	uint32_t offset = seq * block_size;
+	uint32_t len =
+			(length - offset < block_size) ? length - offset : block_size;
+
+	BL_send_seq_data_packet(seq, offset,
+			(const uint8_t*) (uintptr_t) (start_address + offset), len,
+			offset + len == length);
+}
+
+static void bl_image_begin(uint32_t start_address) {
+#if BL_SIGNATURE_ENABLE
+	bl_sha256_init(&bl_image.sha);
+	bl_image.start = start_address;
+	bl_image.length = 0;
+	bl_image.complete = 0;
+#else
+	(void) start_address;
+#endif
+}
+
+static void bl_image_append(const uint8_t *data, uint32_t len, uint8_t last) {
+#if BL_SIGNATURE_ENABLE
+	bl_sha256_update(&bl_image.sha, data, len);
+	bl_image.length += len;
+	bl_image.complete = last;
+#else
+	(void) data;
+	(void) len;
+	(void) last;
+#endif
+}
+
+static void bl_image_forget(void) {
+#if BL_SIGNATURE_ENABLE
+	bl_image.complete = 0;
+#endif
+#if BL_JOURNAL_ENABLE
+	bl_journal_forget();
+#endif
+}
+
+#if BL_LINK_SPEED_ENABLE
+static BL_Status_t bl_link_read(uint8_t *byte, uint32_t timeout) {
+#if BL_RX_RING_ENABLE
+	return bl_ring_read(byte, 1, timeout);
+#else
+	return BL_receive(byte, 1, timeout);
+#endif
+}
+#endif
+
+/*******************************************************************************
+ *                         	Weak functions				                       *
+ *******************************************************************************/
+
+BL_WEAK BL_Status_t BL_verify_signature(const uint8_t *digest,
+		const uint8_t *signature, uint32_t signature_len) {
+	(void) digest;
+	(void) signature;
+	(void) signature_len;
+
+	/* No verifier and no key: nothing can be authenticated */
+	return BL_Status_Error;
 }
 
 /*******************************************************************************
@@ -130,246 +479,542 @@ static bool bl_is_block_inside_range(uint32_t startAddress, uint32_t endAddress,
 void bl_handle_goto_addr_cmd(BL_GOTO_ADDR_CMD *cmd) {
 	DEBUG_ASSERT(cmd != NULL);
 
-	bl_debug_cmd_name(cmd->data.header.cmd_id);
-
-	if (!VALIDATE_CMD(cmd->serialized_data, sizeof(BL_GOTO_ADDR_CMD),
-			cmd->data.header.CRC32)) {
-		DEBUG_WARN("Invalid CRC");
-		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_CRC);
-		return;
-	}
-
 	/* Send ACK back */
 	BL_send_ack(cmd->data.header.cmd_id, 1, 0);
 
-	if (!bl_is_address_outside_range(cmd->data.address, bl_ctx.BL_startAddress,
-			bl_ctx.BL_endAddress)) {
+	if (!bl_is_address_outside_range(cmd->data.address,
+			(uint32_t) (uintptr_t) bl_ctx.BL_startAddress,
+			(uint32_t) (uintptr_t) bl_ctx.BL_endAddress)) {
 		DEBUG_WARN("Invalid address");
 		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_ADDRESS);
 		return;
 	}
 	DEBUG_INFO("Setting current context address to 0x%x", cmd->data.address);
-	bl_ctx.currentAddress = cmd->data.address;
+	bl_ctx.currentAddress = (uint32_t*) (uintptr_t) cmd->data.address;
 }
 
 void bl_handle_mem_write_cmd(BL_MEM_WRITE_CMD *cmd) {
 	DEBUG_ASSERT(cmd != NULL);
 
-	bl_debug_cmd_name(cmd->data.header.cmd_id);
+	/* Older hosts do not send the flags and length, nor the image fields */
+	uint8_t legacy = cmd->data.header.payload_size
+			< BL_MEM_WRITE_CMD_NO_IMAGE_SIZE;
+	uint8_t has_image = cmd->data.header.payload_size
+			>= sizeof(BL_MEM_WRITE_CMD);
 
-	if (!VALIDATE_CMD(cmd->serialized_data, sizeof(BL_MEM_WRITE_CMD),
-			cmd->data.header.CRC32)) {
-		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_CRC);
+	BL_NACK_t nack = bl_begin_write(cmd->data.start_address,
+			legacy ? 0 : cmd->data.flags, legacy ? 0 : cmd->data.length);
+	if (nack != BL_NACK_SUCCESS) {
+		BL_send_ack(cmd->data.header.cmd_id, 0, nack);
 		return;
 	}
 
-	if (bl_is_block_inside_range(bl_ctx.BL_startAddress, bl_ctx.BL_endAddress,
-			cmd->data.start_address, 1)) {
-		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_ADDRESS);
-		return;
-	}
+#if BL_JOURNAL_ENABLE
+	uint32_t resumed = bl_journal_begin(has_image ? cmd->data.image_id : 0,
+			has_image ? cmd->data.image_crc : 0, cmd->data.start_address,
+			legacy ? 0 : cmd->data.length);
+#else
+	uint32_t resumed = 0;
+	(void) has_image;
+#endif
+
+	/* A resumed image is hashed from its start, what was programmed before
+	 * is read back from flash */
+	bl_image_begin(cmd->data.start_address - resumed);
+	bl_image_append(
+			(const uint8_t*) (uintptr_t) (cmd->data.start_address - resumed),
+			resumed, 0);
 
 	/* Send ACK back */
 	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
 
-	BL_DATA_PACKET_CMD data_block = { 0 };
-
 	uint32_t start_address = cmd->data.start_address;
 	uint32_t total_bytes = 0;
 	uint32_t retries = 0;
+	uint8_t end_flag = 0;
 
-	while (data_block.data.end_flag == 0) {
+	while (end_flag == 0) {
 
-		/* Poll for the packet size */
-		while (BL_receive((uint8_t*) &data_block.data.header,
-				sizeof(data_block.data.header),
-				BL_RECEIVE_TIMEOUT_MS) != BL_Status_OK)
-			;
+		/* Receive into the free ping-pong buffer while the previous block is
+		 * still being programmed */
+		BL_DATA_PACKET_CMD *data_block =
+				(BL_DATA_PACKET_CMD*) bl_flash_get_rx_buffer();
 
-		/* Receive packet size bytes */
-		if (data_block.data.header.payload_size
-				&& data_block.data.header.payload_size
-						<= BL_MAX_BUFFER_SIZE_BYTES) {
-			while (BL_receive(
-					&((uint8_t*) &data_block.data.header)[sizeof(BL_CommandHeader_t)],
-					data_block.data.header.payload_size
-							- sizeof(BL_CommandHeader_t),
-					BL_RECEIVE_TIMEOUT_MS) != BL_Status_OK)
-				;
-		}
+		BL_Status_t status = BL_receive_packet(data_block->serialized_data,
+				sizeof(BL_DATA_PACKET_CMD));
 
-		if (!VALIDATE_CMD(data_block.serialized_data,
-				data_block.data.header.payload_size,
-				data_block.data.header.CRC32)) {
+		if (status != BL_Status_OK
+				|| !VALIDATE_CMD(data_block->serialized_data,
+						data_block->data.header.payload_size,
+						data_block->data.header.CRC32)
+				|| data_block->data.data_len > bl_ctx.BlockSize) {
 			DEBUG_ERROR("Data packet corrupted");
-			BL_send_ack(data_block.data.header.cmd_id, 0,
+			BL_send_ack(data_block->data.header.cmd_id, 0,
 					BL_NACK_INVALID_DATA | BL_NACK_INVALID_CRC);
-			/* Force end flag to stay zero */
-			data_block.data.end_flag = 0;
 			if (retries >= BL_MAX_RETRIES) {
-				return;
+				break;
 			}
 			retries++;
+			BL_STATS_RETRIES(1);
 			continue;
-		} else if (bl_is_block_inside_range(bl_ctx.BL_startAddress,
-				bl_ctx.BL_endAddress, start_address,
-				data_block.data.data_len)) {
-			/* If the incoming block will write to bootloader code, abort and send NACK */
-			DEBUG_ERROR(
-					"Conflict with bootloader address: Requested write to: (0x%08X to 0x%08X)",
-					start_address, start_address + data_block.data.data_len);
-			DEBUG_ERROR("Bootloader range: (0x%08X to 0x%08X)",
-					bl_ctx.BL_startAddress, bl_ctx.BL_endAddress);
-			/* Prevent overwrite of bootloader code */
-			BL_send_ack(data_block.data.header.cmd_id, 0,
+		} else if (data_block->data.header.cmd_id != BL_DATA_PACKET_CMD_ID) {
+			/* The host gave up on the transfer, e.g. after losing the link, and
+			 * must send the command again */
+			DEBUG_WARN("Write abandoned by the host");
+			BL_send_ack(data_block->data.header.cmd_id, 0, BL_NACK_INVALID_CMD);
+			break;
+		} else if (data_block->data.data_len
+				&& bl_check_write_range(start_address,
+						data_block->data.data_len) != BL_NACK_SUCCESS) {
+			/* The block would leave flash or reach bootloader code, abort */
+			BL_send_ack(data_block->data.header.cmd_id, 0,
 					BL_NACK_INVALID_ADDRESS);
-			return;
+			break;
 		} else {
 			DEBUG_INFO("Received valid data packet, length = %d bytes",
-					data_block.data.data_len);
+					data_block->data.data_len);
+
+#if BL_JOURNAL_ENABLE
+			/* Journals what was queued before this block, the queue would wait
+			 * for the previous block anyway */
+			status = bl_journal_progress(total_bytes);
+#endif
+
+			end_flag = data_block->data.end_flag;
+			total_bytes += data_block->data.data_len;
+
+			/* Start programming this block, the ACK goes out while it programs.
+			 * The last block must be programmed before it is acknowledged. */
+			if (status == BL_Status_OK) {
+				status = bl_flash_queue_write(start_address,
+						data_block->data.data_block, data_block->data.data_len);
+			}
+			if (status == BL_Status_OK && end_flag) {
+				status = bl_flash_flush();
+			}
+			if (status != BL_Status_OK) {
+				DEBUG_ERROR("Flash write failed near 0x%08X", start_address);
+				BL_send_ack(data_block->data.header.cmd_id, 0,
+						BL_NACK_OPERATION_FAILURE);
+				break;
+			}
+#if BL_JOURNAL_ENABLE
+			if (end_flag) {
+				bl_journal_end();
+			}
+#endif
 
-			total_bytes += data_block.data.data_len;
-			/* Perform flash write */
-			BL_flash_write(start_address, data_block.data.data_block,
-					data_block.data.data_len);
 			/* Increment the start address to point at the next block address */
-			start_address += data_block.data.data_len;
+			start_address += data_block->data.data_len;
 			/* Send ACK on last operation */
-			BL_send_ack(data_block.data.header.cmd_id, 1, BL_NACK_SUCCESS);
+			BL_send_ack(data_block->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+			/* Hash the block while the host sends the next one, the image is
+			 * never read back from flash to be authenticated */
+			bl_image_append(data_block->data.data_block,
+					data_block->data.data_len, end_flag);
 		}
 	}
 
+	/* Never leave a block programming behind an aborted transfer */
+	bl_flash_flush();
+
 	DEBUG_INFO("Total data received = %lu", total_bytes);
 }
-BL_DATA_PACKET_CMD packet = { 0 };
 
-void bl_handle_mem_read_cmd(BL_MEM_READ_CMD *cmd) {
+void bl_handle_mem_write_ex_cmd(BL_MEM_WRITE_EX_CMD *cmd) {
 	DEBUG_ASSERT(cmd != NULL);
 
-	bl_debug_cmd_name(cmd->data.header.cmd_id);
+	bl_image_forget();
 
-	if (!VALIDATE_CMD(cmd->serialized_data, sizeof(BL_MEM_READ_CMD),
-			cmd->data.header.CRC32)) {
-		DEBUG_WARN("Invalid CRC");
-		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_CRC);
+	BL_NACK_t nack = bl_begin_write(cmd->data.start_address, cmd->data.flags,
+			cmd->data.length);
+	if (nack != BL_NACK_SUCCESS) {
+		BL_send_ack(cmd->data.header.cmd_id, 0, nack);
 		return;
 	}
-	DEBUG_INFO("Start address = 0x%08X", cmd->data.start_addr);
-	DEBUG_INFO("Read length = %d", cmd->data.length);
 
-	/* Protect bootloader code against read-out */
-	if (!bl_is_address_outside_range(cmd->data.start_addr,
-			bl_ctx.BL_startAddress, bl_ctx.BL_endAddress)) {
-		DEBUG_WARN("Attempting to read-out bootloader code");
-		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_ADDRESS);
-		return;
+	/* Clamp the requested window to what the receive path can absorb */
+	uint32_t window = cmd->data.window;
+	if (window == 0) {
+		window = 1;
+	} else if (window > BL_MAX_WRITE_WINDOW) {
+		window = BL_MAX_WRITE_WINDOW;
 	}
-
-	/* Ensure range is not outside the flash memory */
-	if (!bl_is_block_inside_range(BL_VS_FLASH_START_ADDRESS,
-	BL_VS_FLASH_END_ADDRESS, cmd->data.start_addr, cmd->data.length)) {
-		DEBUG_WARN("Attempting to read out of range memory");
-		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_ADDRESS);
-		return;
+#if BL_RX_RING_ENABLE
+	/* Every packet in flight must fit in the receive ring, or it overflows
+	 * while a block is being programmed */
+	uint32_t ring_window = BL_RX_RING_SIZE_BYTES
+			/ (sizeof(BL_SEQ_DATA_PACKET_HEADER) + bl_ctx.BlockSize);
+	if (window > ring_window) {
+		window = ring_window ? ring_window : 1;
 	}
+#endif
 
-	/* Send ACK back */
+	/* Send ACK back followed by the granted window */
 	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
 
-	uint32_t blocks = cmd->data.length / BL_DATA_BLOCK_SIZE;
-	uint32_t remainderBytes = cmd->data.length % BL_DATA_BLOCK_SIZE;
-	uint32_t startAddress = cmd->data.start_addr;
-	uint32_t nextBlock = BL_DATA_BLOCK_SIZE;
-	BL_Status_t status = BL_Status_OK;
+	BL_Response response = { 0 };
+	response.data.header.cmd_id = BL_RESPONSE_CMD_ID;
+	response.data.header.payload_size = sizeof(BL_CommandHeader_t) + 1;
+	response.data.data[0] = (uint8_t) window;
+	response.data.header.CRC32 = bl_calculate_command_crc(&response,
+			response.data.header.payload_size);
+	BL_send_response(&response);
+
+	DEBUG_INFO("Windowed write, window = %lu packets", window);
+
+	uint32_t start_address = cmd->data.start_address;
+	uint32_t total_bytes = 0;
+	uint32_t retries = 0;
+	uint32_t expected_seq = 0; /* First packet not yet received */
+	uint32_t highest_seq = 0; /* Highest packet received so far */
+	uint32_t received = 0; /* Bit i: packet expected_seq + i received */
+	uint32_t last_seq = 0; /* Sequence number of the end packet */
+	uint32_t accepted = 0;
+	uint8_t end_seen = 0;
+
+	while (!end_seen || expected_seq <= last_seq) {
+
+		/* Receive into the free ping-pong buffer while the previous block is
+		 * still being programmed */
+		BL_SEQ_DATA_PACKET_CMD *data_block =
+				(BL_SEQ_DATA_PACKET_CMD*) bl_flash_get_rx_buffer();
+
+		BL_Status_t status = BL_receive_packet(data_block->serialized_data,
+				sizeof(BL_SEQ_DATA_PACKET_CMD));
+
+		if (status != BL_Status_OK
+				|| !VALIDATE_CMD(data_block->serialized_data,
+						data_block->data.header.payload_size,
+						data_block->data.header.CRC32)
+				|| data_block->data.data_len > bl_ctx.BlockSize) {
+			DEBUG_ERROR("Data packet corrupted");
+			/* Ask the host to resend only the packets that are missing */
+			BL_send_window_ack(BL_SEQ_DATA_PACKET_CMD_ID, 0,
+					BL_NACK_INVALID_DATA | BL_NACK_INVALID_CRC, expected_seq,
+					bl_missing_packets(received, expected_seq,
+							highest_seq < expected_seq ?
+									expected_seq : highest_seq));
+			if (retries >= BL_MAX_RETRIES) {
+				break;
+			}
+			retries++;
+			BL_STATS_RETRIES(1);
+			continue;
+		}
 
-	packet.data.data_len = BL_DATA_BLOCK_SIZE;
-	packet.data.next_len = BL_DATA_BLOCK_SIZE;
-	packet.data.header.cmd_id = BL_DATA_PACKET_CMD_ID;
+		uint32_t seq = data_block->data.seq;
 
-	for (uint32_t i = 0; i < blocks; i++) {
+		if (seq < expected_seq
+				|| (seq - expected_seq < window
+						&& (received & (1UL << (seq - expected_seq))))) {
+			/* Duplicate, the host probably missed an ACK: repeat it */
+			BL_send_window_ack(BL_SEQ_DATA_PACKET_CMD_ID, 1, BL_NACK_SUCCESS,
+					expected_seq,
+					bl_missing_packets(received, expected_seq, highest_seq));
+			continue;
+		}
 
-		/* If this is the last even block, assign next block size to remainder bytes size */
-		if (i == blocks - 1)
-			nextBlock = remainderBytes;
+		if (seq - expected_seq >= window) {
+			DEBUG_WARN("Packet %lu outside of window [%lu, %lu)", seq,
+					expected_seq, expected_seq + window);
+			BL_send_window_ack(BL_SEQ_DATA_PACKET_CMD_ID, 0,
+					BL_NACK_INVALID_DATA, expected_seq,
+					bl_missing_packets(received, expected_seq, highest_seq));
+			if (retries >= BL_MAX_RETRIES) {
+				break;
+			}
+			retries++;
+			BL_STATS_RETRIES(1);
+			continue;
+		}
 
-		/* Copy the block */
-		memcpy((uint8_t*) packet.data.data_block, (uint8_t*) startAddress,
-		BL_DATA_BLOCK_SIZE);
+		/* Blocks land at their explicit offset, so reordered packets are
+		 * written where they belong */
+		uint32_t address = start_address + data_block->data.offset;
 
-		/* If this is the last packet, set the end flag */
-		packet.data.end_flag = ((i + 1) * BL_DATA_BLOCK_SIZE)
-				== cmd->data.length;
+		if (data_block->data.data_len
+				&& bl_check_write_range(address, data_block->data.data_len)
+						!= BL_NACK_SUCCESS) {
+			/* The block would leave flash or reach bootloader code, abort */
+			BL_send_window_ack(BL_SEQ_DATA_PACKET_CMD_ID, 0,
+					BL_NACK_INVALID_ADDRESS, expected_seq, 0);
+			break;
+		}
 
-		if (nextBlock == 0) {
-			packet.data.next_len = 0;
-		} else {
-			packet.data.next_len = sizeof(BL_DATA_PACKET_CMD)
-					- BL_DATA_BLOCK_SIZE + nextBlock;
+		/* Start programming this block while the next ones arrive */
+		status = bl_flash_queue_write(address, data_block->data.data_block,
+				data_block->data.data_len);
+		if (status != BL_Status_OK) {
+			DEBUG_ERROR("Flash write failed near 0x%08X", address);
+			BL_send_window_ack(BL_SEQ_DATA_PACKET_CMD_ID, 0,
+					BL_NACK_OPERATION_FAILURE, expected_seq, 0);
+			break;
 		}
 
-		packet.data.header.payload_size = sizeof(BL_DATA_PACKET_CMD)
-				- BL_DATA_BLOCK_SIZE + BL_DATA_BLOCK_SIZE;
+		if (data_block->data.end_flag) {
+			end_seen = 1;
+			last_seq = seq;
+		}
+		if (seq > highest_seq) {
+			highest_seq = seq;
+		}
+		received |= 1UL << (seq - expected_seq);
+		total_bytes += data_block->data.data_len;
+		retries = 0;
+		accepted++;
+
+		/* Slide the window over the packets received in order */
+		while (received & 1) {
+			received >>= 1;
+			expected_seq++;
+		}
 
-		packet.data.header.CRC32 = bl_calculate_command_crc(&packet,
-				packet.data.header.payload_size);
+		if (end_seen && expected_seq > last_seq) {
+			/* The last block must be programmed before it is acknowledged */
+			if (bl_flash_flush() != BL_Status_OK) {
+				BL_send_window_ack(BL_SEQ_DATA_PACKET_CMD_ID, 0,
+						BL_NACK_OPERATION_FAILURE, expected_seq, 0);
+				break;
+			}
+			BL_send_window_ack(BL_SEQ_DATA_PACKET_CMD_ID, 1, BL_NACK_SUCCESS,
+					expected_seq, 0);
+		} else if (accepted >= window) {
+			/* Cumulative ACK once per window, listing the gaps */
+			BL_send_window_ack(BL_SEQ_DATA_PACKET_CMD_ID, 1, BL_NACK_SUCCESS,
+					expected_seq,
+					bl_missing_packets(received, expected_seq, highest_seq));
+			accepted = 0;
+		}
+	}
 
-		BL_send_packet(&packet);
+	/* Never leave a block programming behind an aborted transfer */
+	bl_flash_flush();
 
-		/* Wait for ack on packet*/
-		status = BL_receive_ack();
+	DEBUG_INFO("Total data received = %lu", total_bytes);
+}
 
-		if (status != BL_Status_OK) {
+void bl_handle_mem_read_cmd(BL_MEM_READ_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+	DEBUG_INFO("Start address = 0x%08X", cmd->data.start_addr);
+	DEBUG_INFO("Read length = %d", cmd->data.length);
+
+	BL_NACK_t nack = bl_check_read_range(cmd->data.start_addr,
+			cmd->data.length);
+	if (nack != BL_NACK_SUCCESS) {
+		BL_send_ack(cmd->data.header.cmd_id, 0, nack);
+		return;
+	}
+
+	/* Send ACK back */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	/* Block size negotiated with BL_GET_CAPABILITIES_CMD */
+	uint32_t blockSize = bl_ctx.BlockSize;
+	uint32_t startAddress = cmd->data.start_addr;
+	uint32_t length = cmd->data.length;
+	uint32_t offset = 0;
+
+	while (offset < length) {
+		uint32_t blockLen =
+				(length - offset < blockSize) ? length - offset : blockSize;
+		uint32_t nextLen =
+				(length - offset - blockLen < blockSize) ?
+						length - offset - blockLen : blockSize;
+
+		/* The block is sent straight from flash, and re-sent on a negative
+		 * ACK within the retry budget */
+		uint32_t retries = 0;
+		do {
+			BL_send_data_packet(
+					(const uint8_t*) (uintptr_t) (startAddress + offset),
+					blockLen,
+					nextLen ? sizeof(BL_DATA_PACKET_HEADER) + nextLen : 0,
+					offset + blockLen == length);
+		} while (BL_receive_ack() != BL_Status_OK
+				&& retries++ < BL_MAX_RETRIES);
+		BL_STATS_RETRIES(
+				(retries > BL_MAX_RETRIES) ? BL_MAX_RETRIES : retries);
+
+		if (retries > BL_MAX_RETRIES) {
+			DEBUG_ERROR("Block at 0x%08X not acknowledged",
+					startAddress + offset);
 			return;
 		}
 
-		startAddress += (BL_DATA_BLOCK_SIZE);
+		offset += blockLen;
+	}
+}
 
+void bl_handle_mem_read_ex_cmd(BL_MEM_READ_EX_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+	BL_NACK_t nack = bl_check_read_range(cmd->data.start_addr,
+			cmd->data.length);
+	if (nack != BL_NACK_SUCCESS) {
+		BL_send_ack(cmd->data.header.cmd_id, 0, nack);
+		return;
 	}
 
-	while (remainderBytes) {
+	/* Clamp the advertised window to the missing packet bitmap */
+	uint32_t window = cmd->data.window;
+	if (window == 0) {
+		window = 1;
+	} else if (window > BL_MAX_READ_WINDOW) {
+		window = BL_MAX_READ_WINDOW;
+	}
 
-		/* Copy the remaining bytes */
-		memcpy((uint8_t*) packet.data.data_block, (uint8_t*) startAddress,
-				remainderBytes);
+	/* Send ACK back followed by the granted window */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
 
-		/* Set the end flag as this is the last packet */
-		packet.data.end_flag = 1;
+	BL_Response response = { 0 };
+	response.data.header.cmd_id = BL_RESPONSE_CMD_ID;
+	response.data.header.payload_size = sizeof(BL_CommandHeader_t) + 1;
+	response.data.data[0] = (uint8_t) window;
+	response.data.header.CRC32 = bl_calculate_command_crc(&response,
+			response.data.header.payload_size);
+	BL_send_response(&response);
 
-		packet.data.header.payload_size = sizeof(BL_DATA_PACKET_CMD)
-				- BL_DATA_BLOCK_SIZE + remainderBytes;
+	DEBUG_INFO("Windowed read, window = %lu packets", window);
 
-		packet.data.data_len = remainderBytes;
+	uint32_t blockSize = bl_ctx.BlockSize;
+	uint32_t length = cmd->data.length;
+	uint32_t total = (length + blockSize - 1) / blockSize;
+	uint32_t base = 0; /* First packet not acknowledged */
+	uint32_t next = 0; /* First packet never sent */
+	uint32_t resend = 0; /* Bit i: packet base + i must be sent again */
+	uint32_t retries = 0; /* Acks in a row without progress */
 
-		packet.data.header.CRC32 = bl_calculate_command_crc(&packet,
-				packet.data.header.payload_size);
+	while (base < total) {
 
-		BL_send_packet(&packet);
+		/* Repeat the packets the host reported missing */
+		for (uint32_t i = 0; resend != 0 && base + i < next; i++) {
+			if (resend & (1UL << i)) {
+				bl_send_read_block(cmd->data.start_addr, length, blockSize,
+						base + i);
+				resend &= ~(1UL << i);
+			}
+		}
 
-		/* Wait for ack on last packet*/
-		status = BL_receive_ack();
+		/* Send new packets back to back while the window allows it */
+		while (next < total && next - base < window) {
+			bl_send_read_block(cmd->data.start_addr, length, blockSize, next);
+			next++;
+		}
 
-		if (status != BL_Status_OK) {
-			// Re-send
+		BL_WINDOW_ACK ack = { 0 };
+		uint32_t inFlight = next - base;
+		uint32_t inFlightMask =
+				(inFlight >= 32) ? 0xFFFFFFFFU : ((1UL << inFlight) - 1);
+
+		if (BL_receive_window_ack(&ack) != BL_Status_OK) {
+			/* No answer: the packets or the ack were lost, resend the window */
+			resend = inFlightMask;
+		} else if (ack.data.next_seq > base && ack.data.next_seq <= next) {
+			/* Cumulative ACK: slide the window, a shift by the whole 32 bit
+			 * mask is undefined, nothing is left in flight then */
+			uint32_t acked = ack.data.next_seq - base;
+
+			resend = ack.data.missing
+					& ((acked >= 32) ? 0 : (inFlightMask >> acked));
+			base = ack.data.next_seq;
+			retries = 0;
 			continue;
-		} else {
-			// Exit
-			break;
+		} else if (ack.data.next_seq == base) {
+			resend = ack.data.missing & inFlightMask;
+		}
+
+		if (++retries > BL_MAX_RETRIES) {
+			DEBUG_ERROR("Windowed read stalled at packet %lu", base);
+			return;
 		}
+		BL_STATS_RETRIES(1);
 	}
 
+	DEBUG_INFO("Windowed read of %lu packets complete", total);
 }
 
-void bl_handle_ver_cmd(BL_VER_CMD *cmd) {
+void bl_handle_page_crc_cmd(BL_PAGE_CRC_CMD *cmd) {
 	DEBUG_ASSERT(cmd != NULL);
 
-	bl_debug_cmd_name(cmd->data.header.cmd_id);
-	if (!VALIDATE_CMD(cmd->serialized_data, sizeof(BL_VER_CMD),
-			cmd->data.header.CRC32)) {
-		DEBUG_WARN("Invalid CRC");
-		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_CRC);
+	uint32_t appStart = (uint32_t) (uintptr_t) bl_ctx.AppStartAddress;
+	uint32_t appEnd = (uint32_t) (uintptr_t) bl_ctx.AppEndAddress;
+	uint32_t pageAddress = cmd->data.start_address;
+	uint32_t pageCount = cmd->data.page_count;
+
+	/* A zero page count maps the whole application region */
+	if (pageCount == 0) {
+		pageAddress = appStart;
+		pageCount = (appEnd - appStart + 1) / BL_VS_PAGE_SIZE_BYTES;
+	}
+
+	/* Bound the count first, so the range size cannot wrap around */
+	if ((pageAddress % BL_VS_PAGE_SIZE_BYTES) != 0 || pageCount == 0
+			|| pageCount > (appEnd - appStart + 1) / BL_VS_PAGE_SIZE_BYTES
+			|| !bl_is_block_inside_range(appStart, appEnd, pageAddress,
+					pageCount * BL_VS_PAGE_SIZE_BYTES)) {
+		DEBUG_WARN("Invalid page range");
+		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_ADDRESS);
 		return;
 	}
 
+	/* Only the CRCs of one packet are kept in RAM */
+	uint32_t crcs[BL_PAGE_CRCS_PER_PACKET];
+	uint32_t crcsPerPacket = bl_ctx.BlockSize / sizeof(uint32_t);
+
+	if (crcsPerPacket > BL_PAGE_CRCS_PER_PACKET) {
+		crcsPerPacket = BL_PAGE_CRCS_PER_PACKET;
+	}
+
+	/* A block must hold at least one CRC, or no packet makes progress */
+	if (crcsPerPacket == 0) {
+		DEBUG_WARN("Block size too small for page CRCs");
+		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_LENGTH);
+		return;
+	}
+
+	DEBUG_INFO("Page CRCs from 0x%08X, %lu pages", pageAddress, pageCount);
+
+	/* Send ACK back */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	while (pageCount) {
+		uint32_t count = (pageCount < crcsPerPacket) ? pageCount : crcsPerPacket;
+
+		/* One CRC32 per page, little-endian, in page order */
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t crc = bl_crc32_init();
+			crc = bl_crc32_update(crc,
+					(const uint8_t*) (uintptr_t) pageAddress,
+					BL_VS_PAGE_SIZE_BYTES);
+			crcs[i] = bl_crc32_final(crc);
+			pageAddress += BL_VS_PAGE_SIZE_BYTES;
+		}
+
+		pageCount -= count;
+
+		/* Re-send on a negative ACK, within the retry budget */
+		uint32_t retries = 0;
+		do {
+			BL_send_data_packet((const uint8_t*) crcs,
+					count * sizeof(uint32_t), 0, pageCount == 0);
+		} while (BL_receive_ack() != BL_Status_OK
+				&& retries++ < BL_MAX_RETRIES);
+		BL_STATS_RETRIES(
+				(retries > BL_MAX_RETRIES) ? BL_MAX_RETRIES : retries);
+
+		if (retries > BL_MAX_RETRIES) {
+			DEBUG_ERROR("Page CRC map not acknowledged");
+			return;
+		}
+	}
+}
+
+void bl_handle_ver_cmd(BL_VER_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
 	/* Send ACK back */
 	BL_send_ack(cmd->data.header.cmd_id, 1, 0);
 
@@ -387,39 +1032,371 @@ void bl_handle_ver_cmd(BL_VER_CMD *cmd) {
 	BL_send_response(&response);
 }
 
-void bl_handle_flash_erase_cmd(BL_FLASH_ERASE_CMD *cmd) {
+void bl_handle_get_capabilities_cmd(BL_GET_CAPABILITIES_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+	/* Negotiate the data block size: the largest both sides support */
+	uint32_t blockSize = BL_DATA_BLOCK_SIZE;
+	if (cmd->data.max_block_size != 0
+			&& cmd->data.max_block_size < blockSize) {
+		blockSize = cmd->data.max_block_size;
+	}
+	/* Whole program units, so data blocks keep page bursts aligned, and at
+	 * least one unit, so a block holds a page CRC (a word) */
+	blockSize -= blockSize % BL_VS_FLASH_PROGRAM_UNIT_BYTES;
+	if (blockSize < BL_VS_FLASH_PROGRAM_UNIT_BYTES) {
+		blockSize = BL_VS_FLASH_PROGRAM_UNIT_BYTES;
+	}
+	bl_ctx.BlockSize = blockSize;
 
+	DEBUG_INFO("Negotiated block size = %lu bytes", blockSize);
+
+	/* Send ACK back */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	/* Construct response */
+	BL_CAPABILITIES_RESPONSE response = { 0 };
+
+	response.data.header.cmd_id = BL_RESPONSE_CMD_ID;
+	response.data.header.payload_size = sizeof(BL_CAPABILITIES_RESPONSE);
+	response.data.version = BL_VERSION;
+	response.data.max_window = BL_MAX_WRITE_WINDOW;
+	response.data.features = BL_FEATURE_WINDOWED_WRITE
+			| BL_FEATURE_SELECTIVE_REPEAT | BL_FEATURE_PATCH
+			| BL_FEATURE_LZ_WRITE | BL_FEATURE_PAGE_CRC
+			| BL_FEATURE_AUTO_ERASE | BL_FEATURE_BATCH
+			| BL_FEATURE_WINDOWED_READ;
+#if BL_STATS_ENABLE
+	response.data.features |= BL_FEATURE_STATS;
+#endif
+#if BL_SIGNATURE_ENABLE
+	response.data.features |= BL_FEATURE_SIGNATURE;
+#endif
+#if BL_LINK_SPEED_ENABLE
+	response.data.features |= BL_FEATURE_LINK_SPEED;
+#endif
+#if BL_AB_SLOTS_ENABLE
+	response.data.features |= BL_FEATURE_AB_SLOTS;
+#endif
+#if BL_JOURNAL_ENABLE
+	response.data.features |= BL_FEATURE_JOURNAL;
+#endif
+	response.data.block_size = blockSize;
+	response.data.max_block_size = BL_DATA_BLOCK_SIZE;
+	response.data.max_packet_size = BL_MAX_BUFFER_SIZE_BYTES;
+	response.data.page_size = BL_VS_PAGE_SIZE_BYTES;
+	response.data.flash_start = BL_VS_FLASH_START_ADDRESS;
+	response.data.flash_end = BL_VS_FLASH_END_ADDRESS;
+	response.data.app_start = (uint32_t) (uintptr_t) bl_ctx.AppStartAddress;
+	response.data.app_end = (uint32_t) (uintptr_t) bl_ctx.AppEndAddress;
+
+	/* Must calculate CRC after setting all data */
+	response.data.header.CRC32 = bl_calculate_command_crc(&response,
+			response.data.header.payload_size);
+
+	BL_send_frame(response.serialized_data);
+}
+
+void bl_handle_get_stats_cmd(BL_GET_STATS_CMD *cmd) {
 	DEBUG_ASSERT(cmd != NULL);
 
-	BL_NACK_t nack_field = BL_NACK_SUCCESS;
+#if BL_STATS_ENABLE
+	/* Send ACK back */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	/* The statistics are sent in place, frozen until then */
+	BL_STATS_RESPONSE *response = bl_stats_snapshot();
+
+	response->data.header.cmd_id = BL_RESPONSE_CMD_ID;
+	response->data.header.payload_size = sizeof(BL_STATS_RESPONSE);
+
+	/* Must calculate CRC after setting all data */
+	response->data.header.CRC32 = bl_calculate_command_crc(response,
+			response->data.header.payload_size);
+
+	BL_send_frame(response->serialized_data);
+
+	bl_stats_release(cmd->data.reset);
+#else
+	DEBUG_WARN("Statistics are disabled");
+	BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_CMD);
+#endif
+}
+
+void bl_handle_verify_signature_cmd(BL_VERIFY_SIGNATURE_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+#if BL_SIGNATURE_ENABLE
+	if (cmd->data.signature_len > BL_SIGNATURE_MAX_BYTES
+			|| cmd->data.header.payload_size
+					< BL_VERIFY_SIGNATURE_CMD_MIN_SIZE
+							+ cmd->data.signature_len) {
+		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_LENGTH);
+		return;
+	}
+
+	/* Only an image written in full and left untouched since is hashed */
+	if (!bl_image.complete) {
+		DEBUG_WARN("No complete image to verify");
+		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_DATA);
+		return;
+	}
+
+	if (cmd->data.start_address != bl_image.start
+			|| cmd->data.length != bl_image.length) {
+		DEBUG_WARN("Signed range does not match the written image");
+		BL_send_ack(cmd->data.header.cmd_id, 0,
+				BL_NACK_INVALID_ADDRESS | BL_NACK_INVALID_LENGTH);
+		return;
+	}
+
+	/* Send ACK back */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	BL_VERIFY_SIGNATURE_RESPONSE response = { 0 };
+
+	bl_sha256_final(&bl_image.sha, response.data.digest);
+	response.data.valid = BL_verify_signature(response.data.digest,
+			cmd->data.signature, cmd->data.signature_len) == BL_Status_OK;
+
+	DEBUG_INFO("Image signature %s", response.data.valid ? "valid" : "invalid");
+
+	response.data.header.cmd_id = BL_RESPONSE_CMD_ID;
+	response.data.header.payload_size = sizeof(BL_VERIFY_SIGNATURE_RESPONSE);
+
+	/* Must calculate CRC after setting all data */
+	response.data.header.CRC32 = bl_calculate_command_crc(&response,
+			response.data.header.payload_size);
+
+	BL_send_frame(response.serialized_data);
+#else
+	DEBUG_WARN("Signatures are disabled");
+	BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_CMD);
+#endif
+}
+
+void bl_handle_set_link_speed_cmd(BL_SET_LINK_SPEED_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+#if BL_LINK_SPEED_ENABLE
+	uint32_t old_rate = bl_ctx.BaudRate;
+	uint8_t sync = 0;
+
+	if (cmd->data.baud_rate == 0) {
+		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_DATA);
+		return;
+	}
+
+	/* Send ACK back, still at the old rate */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	if (BL_set_baud_rate(cmd->data.baud_rate) == BL_Status_OK) {
+		/* The host confirms the new rate with a sync byte */
+		for (uint32_t i = 0;
+				i < BL_LINK_SPEED_NOISE_BYTES && sync != BL_SYNC_BYTE_VALUE;
+				i++) {
+			if (bl_link_read(&sync, BL_LINK_SPEED_TIMEOUT_MS)
+					!= BL_Status_OK) {
+				break;
+			}
+		}
+	}
+
+	if (sync == BL_SYNC_BYTE_VALUE) {
+		BL_send(&sync, 1, BL_SEND_TIMEOUT_MS);
+		bl_ctx.BaudRate = cmd->data.baud_rate;
+		DEBUG_INFO("Line rate switched to %u baud", bl_ctx.BaudRate);
+	} else {
+		BL_set_baud_rate(old_rate);
+		DEBUG_WARN("No sync byte at %u baud, back to %u baud",
+				cmd->data.baud_rate, old_rate);
+
+		/* Drop what the host still sends at the new rate until it falls back
+		 * as well, or the garbage would end up in front of its next command */
+		while (bl_link_read(&sync, BL_LINK_SPEED_TIMEOUT_MS) == BL_Status_OK)
+			;
+	}
+#else
+	DEBUG_WARN("Changing the line rate is disabled");
+	BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_CMD);
+#endif
+}
+
+void bl_handle_query_progress_cmd(BL_QUERY_PROGRESS_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+#if BL_JOURNAL_ENABLE
+	/* Send ACK back */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	BL_PROGRESS_RESPONSE response = { 0 };
+	const BL_JournalEntry_t *entry = bl_journal_get();
+
+	/* A completed image reports its full length, a dropped one reports none */
+	if (entry != NULL) {
+		response.data.image_id = entry->image_id;
+		response.data.image_crc = entry->image_crc;
+		response.data.start_address = entry->start_address;
+		response.data.length = entry->length;
+		response.data.committed = entry->committed;
+	}
+
+	response.data.header.cmd_id = BL_RESPONSE_CMD_ID;
+	response.data.header.payload_size = sizeof(BL_PROGRESS_RESPONSE);
+
+	/* Must calculate CRC after setting all data */
+	response.data.header.CRC32 = bl_calculate_command_crc(&response,
+			response.data.header.payload_size);
 
-	bl_debug_cmd_name(cmd->data.header.cmd_id);
-	if (!VALIDATE_CMD(cmd->serialized_data, sizeof(BL_FLASH_ERASE_CMD),
-			cmd->data.header.CRC32)) {
-		DEBUG_WARN("Invalid CRC");
-		nack_field |= BL_NACK_INVALID_CRC;
-		BL_send_ack(cmd->data.header.cmd_id, 0, nack_field);
-	}
-
-	/* Protect bootloader code against erase */
-	if (!bl_is_address_outside_range(cmd->data.address, bl_ctx.BL_startAddress,
-			bl_ctx.BL_endAddress)) {
-		DEBUG_WARN("Attempting to erase bootloader code");
-		DEBUG_WARN(
-				"Conflict with bootloader address: Requested erase to: (0x%08X to 0x%08X)",
-				cmd->data.address,
-				cmd->data.address+cmd->data.page_count*BL_VS_PAGE_SIZE_BYTES);
+	BL_send_frame(response.serialized_data);
+#else
+	DEBUG_WARN("The journal is disabled");
+	BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_CMD);
+#endif
+}
+
+void bl_handle_patch_cmd(BL_PATCH_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+	bl_image_forget();
+
+	/* Both images live in the application region */
+	uint32_t appStart = (uint32_t) (uintptr_t) bl_ctx.AppStartAddress;
+	uint32_t appSize = (uint32_t) (uintptr_t) bl_ctx.AppEndAddress - appStart
+			+ 1;
+
+	if (cmd->data.old_length > appSize || cmd->data.new_length > appSize
+			|| cmd->data.new_length == 0) {
+		DEBUG_WARN("Patch image lengths out of range");
+		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_LENGTH);
+		return;
+	}
+
+	/* The patch only applies to the image it was made against */
+	uint32_t crc = bl_crc32_init();
+	crc = bl_crc32_update(crc, (const uint8_t*) (uintptr_t) appStart,
+			cmd->data.old_length);
+	if (bl_crc32_final(crc) != cmd->data.old_crc) {
+		DEBUG_WARN("Installed image does not match the patch base");
+		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_DATA);
+		return;
+	}
+
+	/* Send ACK back */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	bl_patch_begin(appStart, cmd->data.old_length, cmd->data.new_length);
+
+	uint32_t retries = 0;
+	uint8_t end_flag = 0;
+
+	while (end_flag == 0) {
+		BL_DATA_PACKET_CMD *data_block = bl_receive_data_packet(&retries);
+
+		if (data_block == NULL) {
+			bl_patch_abort();
+			return;
+		}
+
+		end_flag = data_block->data.end_flag;
+
+		BL_NACK_t nack_field = bl_patch_feed(data_block->data.data_block,
+				data_block->data.data_len);
+
+		/* The last ACK reports whether the new image was committed */
+		if (nack_field == BL_NACK_SUCCESS && end_flag) {
+			nack_field = bl_patch_finish(cmd->data.new_crc);
+		} else if (nack_field != BL_NACK_SUCCESS) {
+			bl_patch_abort();
+		}
+
+		BL_send_ack(data_block->data.header.cmd_id,
+				nack_field == BL_NACK_SUCCESS, nack_field);
+
+		if (nack_field != BL_NACK_SUCCESS) {
+			return;
+		}
+	}
+}
+
+void bl_handle_mem_write_lz_cmd(BL_MEM_WRITE_LZ_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+	bl_image_forget();
+
+	/* Pages are erased and programmed whole, inside the application region */
+	if ((cmd->data.start_address % BL_VS_PAGE_SIZE_BYTES) != 0
+			|| cmd->data.length == 0
+			|| !bl_is_block_inside_range(
+					(uint32_t) (uintptr_t) bl_ctx.AppStartAddress,
+					(uint32_t) (uintptr_t) bl_ctx.AppEndAddress,
+					cmd->data.start_address, cmd->data.length)) {
+		DEBUG_WARN("Invalid compressed write range");
 		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_ADDRESS);
 		return;
 	}
 
-	/* Ensure range is not outside the flash memory */
-	if (!bl_is_block_inside_range(BL_VS_FLASH_START_ADDRESS,
-	BL_VS_FLASH_END_ADDRESS, cmd->data.address,
-			cmd->data.page_count * BL_VS_PAGE_SIZE_BYTES)) {
-		DEBUG_WARN("Attempting to erase out of range memory");
-		DEBUG_WARN("Requested erase to: (0x%08X to 0x%08X)", cmd->data.address,
-				cmd->data.address+cmd->data.page_count*BL_VS_PAGE_SIZE_BYTES);
+	/* Send ACK back */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	bl_lz_begin(cmd->data.start_address, cmd->data.length);
+
+	uint32_t retries = 0;
+	uint32_t total_bytes = 0;
+	uint8_t end_flag = 0;
+
+	while (end_flag == 0) {
+		BL_DATA_PACKET_CMD *data_block = bl_receive_data_packet(&retries);
+
+		if (data_block == NULL) {
+			bl_lz_abort();
+			return;
+		}
+
+		end_flag = data_block->data.end_flag;
+		total_bytes += data_block->data.data_len;
+
+		BL_NACK_t nack_field = bl_lz_feed(data_block->data.data_block,
+				data_block->data.data_len);
+
+		/* The last ACK reports whether the decompressed data matches */
+		if (nack_field == BL_NACK_SUCCESS && end_flag) {
+			nack_field = bl_lz_finish(cmd->data.crc);
+		} else if (nack_field != BL_NACK_SUCCESS) {
+			bl_lz_abort();
+		}
+
+		BL_send_ack(data_block->data.header.cmd_id,
+				nack_field == BL_NACK_SUCCESS, nack_field);
+
+		if (nack_field != BL_NACK_SUCCESS) {
+			return;
+		}
+	}
+
+	DEBUG_INFO("Decompressed %lu bytes into %lu bytes", total_bytes,
+			cmd->data.length);
+}
+
+void bl_handle_flash_erase_cmd(BL_FLASH_ERASE_CMD *cmd) {
+
+	DEBUG_ASSERT(cmd != NULL);
+
+	bl_image_forget();
+
+	BL_NACK_t nack_field = BL_NACK_SUCCESS;
+
+	/* Bound the count first, so the range size cannot wrap around. The range
+	 * must stay inside flash, clear of the bootloader and of the logs */
+	if (cmd->data.page_count
+			> (BL_VS_FLASH_END_ADDRESS - BL_VS_FLASH_START_ADDRESS + 1)
+					/ BL_VS_PAGE_SIZE_BYTES
+			|| bl_check_write_range(cmd->data.address,
+					cmd->data.page_count ?
+							cmd->data.page_count * BL_VS_PAGE_SIZE_BYTES : 1)
+					!= BL_NACK_SUCCESS) {
+		DEBUG_WARN("Requested erase to: (0x%08X, %lu pages)",
+				cmd->data.address, cmd->data.page_count);
 		BL_send_ack(cmd->data.header.cmd_id, 0, BL_NACK_INVALID_ADDRESS);
 		return;
 	}
@@ -433,28 +1410,35 @@ void bl_handle_flash_erase_cmd(BL_FLASH_ERASE_CMD *cmd) {
 	if (nack_field != BL_NACK_SUCCESS)
 		return;
 
-	/* Start erasing */
-	BL_Status_t status = BL_erase_flash(cmd->data.address,
-			cmd->data.page_count);
+	/* Start erasing, pages that are already blank are skipped */
+	uint32_t erased = 0;
+	BL_Status_t status = bl_flash_erase_pages(cmd->data.address,
+			cmd->data.page_count, &erased);
 
 	nack_field |= ((status == BL_Status_OK) ? 0 : BL_NACK_OPERATION_FAILURE);
 
 	DEBUG_INFO("Operation status: %d", status);
+	DEBUG_INFO("Pages erased = %lu", erased);
 	/* Send ACK with operation status */
 	BL_send_ack(cmd->data.header.cmd_id, status == BL_Status_OK, nack_field);
+
+	if (status != BL_Status_OK)
+		return;
+
+	/* Followed by the number of pages that were actually erased */
+	BL_Response response = { 0 };
+	response.data.header.cmd_id = BL_RESPONSE_CMD_ID;
+	response.data.header.payload_size = sizeof(BL_CommandHeader_t)
+			+ sizeof(erased);
+	memcpy(response.data.data, &erased, sizeof(erased));
+	response.data.header.CRC32 = bl_calculate_command_crc(&response,
+			response.data.header.payload_size);
+	BL_send_response(&response);
 }
 
 void bl_handle_enter_cmd_mode_cmd(BL_ENTER_CMD_MODE_CMD *cmd) {
 	DEBUG_ASSERT(cmd != NULL);
 
-	bl_debug_cmd_name(cmd->data.header.cmd_id);
-	if (!VALIDATE_CMD(cmd->serialized_data, sizeof(BL_ENTER_CMD_MODE_CMD),
-			cmd->data.header.CRC32)) {
-		DEBUG_WARN("Invalid CRC");
-		BL_send_ack(cmd->data.header.cmd_id, 0, 0xFF);
-		return;
-	}
-
 	if (cmd->data.key != BL_ENTER_CMD_MODE_KEY)
 		bl_ctx.Mode = BL_Mode_default;
 
@@ -466,14 +1450,6 @@ void bl_handle_enter_cmd_mode_cmd(BL_ENTER_CMD_MODE_CMD *cmd) {
 void bl_handle_jump_to_app_cmd(BL_JUMP_TO_APP_CMD *cmd) {
 	DEBUG_ASSERT(cmd != NULL);
 
-	bl_debug_cmd_name(cmd->data.header.cmd_id);
-	if (!VALIDATE_CMD(cmd->serialized_data, sizeof(BL_JUMP_TO_APP_CMD),
-			cmd->data.header.CRC32)) {
-		DEBUG_WARN("Invalid CRC");
-		BL_send_ack(cmd->data.header.cmd_id, 0, 0xFF);
-		return;
-	}
-
 	if (cmd->data.key == BL_JUMP_TO_APP_KEY)
 		bl_ctx.Mode = BL_Mode_default;
 
@@ -481,3 +1457,125 @@ void bl_handle_jump_to_app_cmd(BL_JUMP_TO_APP_CMD *cmd) {
 	BL_send_ack(cmd->data.header.cmd_id, cmd->data.key == BL_JUMP_TO_APP_KEY,
 			0);
 }
+
+void bl_handle_batch_cmd(BL_BATCH_CMD *cmd) {
+	DEBUG_ASSERT(cmd != NULL);
+
+	/* Send ACK back, the results follow in a single response */
+	BL_send_ack(cmd->data.header.cmd_id, 1, BL_NACK_SUCCESS);
+
+	static BL_BATCH_RESPONSE response;
+	memset(&response, 0, sizeof(response));
+
+	uint8_t *sub = cmd->serialized_data + sizeof(BL_BATCH_CMD);
+	uint8_t *end = cmd->serialized_data + cmd->data.header.payload_size;
+	uint8_t *deferred = NULL;
+	uint32_t used = 0;
+
+	for (uint32_t i = 0; i < cmd->data.count; i++) {
+		BL_CommandHeader_t *header = (BL_CommandHeader_t*) sub;
+
+		if (used + sizeof(BL_BATCH_RESULT) > BL_BATCH_RESULTS_SIZE_BYTES) {
+			response.data.truncated = 1;
+			break;
+		}
+
+		BL_BATCH_RESULT *result =
+				(BL_BATCH_RESULT*) &response.data.results[used];
+		response.data.count++;
+		used += sizeof(BL_BATCH_RESULT);
+
+		if ((uint32_t) (end - sub) < sizeof(BL_CommandHeader_t)
+				|| header->payload_size < sizeof(BL_CommandHeader_t)
+				|| header->payload_size > (uint32_t) (end - sub)) {
+			DEBUG_ERROR("Sub-command %lu overruns the batch", i);
+			result->cmd_id = BL_BATCH_CMD_ID;
+			result->field = BL_NACK_INVALID_LENGTH;
+			break;
+		}
+
+		if (bl_has_data_phase(header->cmd_id)) {
+			/* Only the last sub-command may talk to the host on its own,
+			 * after the results are sent */
+			if (i + 1 == cmd->data.count && header->cmd_id != BL_BATCH_CMD_ID) {
+				response.data.count--;
+				used -= sizeof(BL_BATCH_RESULT);
+				deferred = sub;
+				break;
+			}
+			result->cmd_id = header->cmd_id;
+			result->field = BL_NACK_INVALID_DATA;
+			break;
+		}
+
+		/* A sub-command that sends no ACK (unknown ID) is reported as failed */
+		result->cmd_id = header->cmd_id;
+		BL_capture_begin(result, BL_BATCH_RESULTS_SIZE_BYTES - used);
+		BL_HandleCommand(sub);
+		if (BL_capture_end()) {
+			response.data.truncated = 1;
+		}
+		used += result->data_len;
+		sub += header->payload_size;
+
+		/* Stop at the first failure, or when a sub-command left command mode */
+		if (!result->ack || response.data.truncated
+				|| bl_ctx.Mode != BL_Mode_cmd) {
+			break;
+		}
+	}
+
+	DEBUG_INFO("Batch ran %u of %u sub-commands", response.data.count,
+			cmd->data.count);
+
+	response.data.header.cmd_id = BL_RESPONSE_CMD_ID;
+	response.data.header.payload_size = sizeof(BL_CommandHeader_t) + 2 + used;
+	response.data.header.CRC32 = bl_calculate_command_crc(&response,
+			response.data.header.payload_size);
+	BL_send_frame(response.serialized_data);
+
+	if (deferred != NULL) {
+		BL_HandleCommand(deferred);
+	}
+}
+
+/*******************************************************************************
+ *                         	Command registry			                       *
+ *******************************************************************************/
+
+BL_COMMAND(BL_GOTO_ADDR_CMD_ID, bl_handle_goto_addr_cmd,
+		sizeof(BL_GOTO_ADDR_CMD), "GO TO ADDR", 0);
+BL_COMMAND(BL_MEM_WRITE_CMD_ID, bl_handle_mem_write_cmd,
+		BL_MEM_WRITE_CMD_LEGACY_SIZE, "MEM WRITE", BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_MEM_WRITE_EX_CMD_ID, bl_handle_mem_write_ex_cmd,
+		sizeof(BL_MEM_WRITE_EX_CMD), "MEM WRITE EX", BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_MEM_READ_CMD_ID, bl_handle_mem_read_cmd,
+		sizeof(BL_MEM_READ_CMD), "MEM READ", BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_MEM_READ_EX_CMD_ID, bl_handle_mem_read_ex_cmd,
+		sizeof(BL_MEM_READ_EX_CMD), "MEM READ EX", BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_PAGE_CRC_CMD_ID, bl_handle_page_crc_cmd,
+		sizeof(BL_PAGE_CRC_CMD), "PAGE CRC", BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_VER_CMD_ID, bl_handle_ver_cmd, sizeof(BL_VER_CMD), "VER", 0);
+BL_COMMAND(BL_GET_CAPABILITIES_CMD_ID, bl_handle_get_capabilities_cmd,
+		sizeof(BL_GET_CAPABILITIES_CMD), "GET CAPABILITIES", 0);
+BL_COMMAND(BL_GET_STATS_CMD_ID, bl_handle_get_stats_cmd,
+		sizeof(BL_GET_STATS_CMD), "GET STATS", 0);
+BL_COMMAND(BL_VERIFY_SIGNATURE_CMD_ID, bl_handle_verify_signature_cmd,
+		BL_VERIFY_SIGNATURE_CMD_MIN_SIZE, "VERIFY SIGNATURE", 0);
+BL_COMMAND(BL_SET_LINK_SPEED_CMD_ID, bl_handle_set_link_speed_cmd,
+		sizeof(BL_SET_LINK_SPEED_CMD), "SET LINK SPEED",
+		BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_QUERY_PROGRESS_CMD_ID, bl_handle_query_progress_cmd,
+		sizeof(BL_QUERY_PROGRESS_CMD), "QUERY PROGRESS", 0);
+BL_COMMAND(BL_PATCH_CMD_ID, bl_handle_patch_cmd, sizeof(BL_PATCH_CMD),
+		"PATCH", BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_MEM_WRITE_LZ_CMD_ID, bl_handle_mem_write_lz_cmd,
+		sizeof(BL_MEM_WRITE_LZ_CMD), "MEM WRITE LZ", BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_FLASH_ERASE_CMD_ID, bl_handle_flash_erase_cmd,
+		sizeof(BL_FLASH_ERASE_CMD), "FLASH ERASE", 0);
+BL_COMMAND(BL_BATCH_CMD_ID, bl_handle_batch_cmd, sizeof(BL_BATCH_CMD),
+		"BATCH", BL_CMD_FLAG_DATA_PHASE);
+BL_COMMAND(BL_ENTER_CMD_MODE_CMD_ID, bl_handle_enter_cmd_mode_cmd,
+		sizeof(BL_ENTER_CMD_MODE_CMD), "ENTER CMD MODE", 0);
+BL_COMMAND(BL_JUMP_TO_APP_CMD_ID, bl_handle_jump_to_app_cmd,
+		sizeof(BL_JUMP_TO_APP_CMD), "JUMP TO APP", 0);
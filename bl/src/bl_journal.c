@@ -0,0 +1,192 @@
+/**
+ * @file bl_journal.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Progress journal of resumable BL_MEM_WRITE_CMD transfers
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_journal.h"
+#include "../inc/bl.h"
+#include "../inc/bl_cfg.h"
+#include "../inc/bl_defs.h"
+#include "../inc/bl_flash.h"
+#include "../inc/bl_log.h"
+#include "LIB/DEBUG_UTILS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#if BL_JOURNAL_ENABLE
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#define BL_JOURNAL_INTERVAL_BYTES \
+		(BL_JOURNAL_INTERVAL_PAGES * BL_VS_PAGE_SIZE_BYTES)
+
+/* Journal location from the linker script */
+extern uint32_t _JournalAddr;
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static const BL_Log_t bl_journal_log = {
+		.base = &_JournalAddr,
+		.pages = BL_JOURNAL_PAGES,
+		.record_size = sizeof(BL_JournalEntry_t),
+		.magic = BL_JOURNAL_MAGIC };
+
+/** Image being written, image_id is 0 while nothing is journaled */
+static BL_JournalEntry_t bl_journal;
+
+/** Offset of the current write in the image */
+static uint32_t bl_journal_offset;
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_journal_append(uint32_t)
+ * @brief	Appends an entry for the current image
+ *
+ * @param committed	Bytes from the start of the image that are programmed
+ */
+static void bl_journal_append(uint32_t committed);
+
+/**
+ * @fn BL_Status_t bl_journal_write(BL_JournalEntry_t*)
+ * @brief	Appends an entry to the log, and reports the journal pages as
+ * 	written to bl_flash, which does not see the log program or erase them
+ *
+ * @param entry	Entry, its header and CRC are filled in
+ * @return	BL_Status_t of bl_log_append
+ */
+static BL_Status_t bl_journal_write(BL_JournalEntry_t *entry);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static void bl_journal_append(uint32_t committed) {
+	BL_JournalEntry_t entry = bl_journal;
+
+	entry.committed = committed;
+
+	/* Only costs the progress since the previous entry */
+	if (bl_journal_write(&entry) != BL_Status_OK) {
+		DEBUG_WARN("Cannot program the journal");
+		return;
+	}
+
+	bl_journal.committed = committed;
+}
+
+static BL_Status_t bl_journal_write(BL_JournalEntry_t *entry) {
+	BL_Status_t status = bl_log_append(&bl_journal_log, entry);
+
+	/* Even on failure, a page may have been erased */
+	bl_flash_mark_written((uint32_t) (uintptr_t) &_JournalAddr,
+			BL_JOURNAL_PAGES * BL_VS_PAGE_SIZE_BYTES);
+
+	return status;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+uint32_t bl_journal_begin(uint32_t image_id, uint32_t image_crc,
+		uint32_t start_address, uint32_t length) {
+	const BL_JournalEntry_t *newest = bl_journal_get();
+
+	bl_journal.image_id = 0;
+	bl_journal_offset = 0;
+
+	if (image_id == 0 || length == 0
+			|| start_address % BL_VS_PAGE_SIZE_BYTES != 0) {
+		bl_journal_forget();
+		return 0;
+	}
+
+	if (newest != NULL && newest->image_id == image_id
+			&& newest->image_crc == image_crc
+			&& start_address == newest->start_address + newest->committed
+			&& length == newest->length - newest->committed) {
+		bl_journal = *newest;
+		bl_journal_offset = newest->committed;
+
+		DEBUG_INFO("Resuming image 0x%08X at offset %u", image_id,
+				bl_journal_offset);
+		return bl_journal_offset;
+	}
+
+	bl_journal.image_id = image_id;
+	bl_journal.image_crc = image_crc;
+	bl_journal.start_address = start_address;
+	bl_journal.length = length;
+	bl_journal_append(0);
+
+	return 0;
+}
+
+BL_Status_t bl_journal_progress(uint32_t written) {
+	if (bl_journal.image_id == 0) {
+		return BL_Status_OK;
+	}
+
+	uint32_t offset = bl_journal_offset + written;
+	uint32_t committed = offset - offset % BL_JOURNAL_INTERVAL_BYTES;
+
+	if (committed <= bl_journal.committed) {
+		return BL_Status_OK;
+	}
+
+	/* The pages before the committed length are complete, so they are queued
+	 * to flash already even with write-combining. The erase-ahead of the next
+	 * page is kept, it runs while the next block is received */
+	if (bl_flash_drain() != BL_Status_OK) {
+		return BL_Status_Error;
+	}
+
+	bl_journal_append(committed);
+
+	return BL_Status_OK;
+}
+
+void bl_journal_end(void) {
+	if (bl_journal.image_id != 0) {
+		bl_journal_append(bl_journal.length);
+		bl_journal.image_id = 0;
+	}
+}
+
+void bl_journal_forget(void) {
+	const BL_JournalEntry_t *newest = bl_journal_get();
+
+	bl_journal.image_id = 0;
+
+	/* Costs a flash write only the first time */
+	if (newest != NULL && newest->image_id != 0) {
+		BL_JournalEntry_t entry = { 0 };
+
+		if (bl_journal_write(&entry) != BL_Status_OK) {
+			DEBUG_WARN("Cannot program the journal");
+		}
+	}
+}
+
+const BL_JournalEntry_t* bl_journal_get(void) {
+	return bl_log_newest(&bl_journal_log);
+}
+
+#endif
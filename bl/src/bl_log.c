@@ -0,0 +1,195 @@
+/**
+ * @file bl_log.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Power loss safe record log in reserved flash pages
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_log.h"
+#include "../inc/bl.h"
+#include "../inc/bl_cfg.h"
+#include "../inc/bl_crc.h"
+#include "../inc/bl_defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn const BL_LogHeader_t bl_log_record*(const BL_Log_t*, uint32_t, uint32_t)
+ * @brief	Returns an entry of the log
+ *
+ * @param log	Log
+ * @param page	Page of the log
+ * @param index	Entry in the page
+ * @return	Entry, in flash
+ */
+static const BL_LogHeader_t* bl_log_record(const BL_Log_t *log, uint32_t page,
+		uint32_t index);
+
+/**
+ * @fn uint32_t bl_log_crc(const BL_Log_t*, const void*)
+ * @brief	Calculates the CRC32 of a record, without its CRC word
+ *
+ * @param log		Log
+ * @param record	Record
+ * @return	CRC32
+ */
+static uint32_t bl_log_crc(const BL_Log_t *log, const void *record);
+
+/**
+ * @fn uint8_t bl_log_is_valid(const BL_Log_t*, const BL_LogHeader_t*)
+ * @brief	Checks whether a record was programmed completely
+ *
+ * @param log		Log
+ * @param record	Record
+ * @return	Non-zero if valid
+ */
+static uint8_t bl_log_is_valid(const BL_Log_t *log,
+		const BL_LogHeader_t *record);
+
+/**
+ * @fn uint8_t bl_log_is_erased(const BL_Log_t*, const BL_LogHeader_t*)
+ * @brief	Checks whether a record can be programmed
+ *
+ * @param log		Log
+ * @param record	Record
+ * @return	Non-zero if every word is erased
+ */
+static uint8_t bl_log_is_erased(const BL_Log_t *log,
+		const BL_LogHeader_t *record);
+
+/**
+ * @fn const BL_LogHeader_t bl_log_find*(const BL_Log_t*, uint32_t*, uint32_t*)
+ * @brief	Finds the newest record and where it is
+ *
+ * @param log	Log
+ * @param page	Receives the page of the record
+ * @param index	Receives the index of the record in its page
+ * @return	Record, or NULL if the log holds none
+ */
+static const BL_LogHeader_t* bl_log_find(const BL_Log_t *log, uint32_t *page,
+		uint32_t *index);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static const BL_LogHeader_t* bl_log_record(const BL_Log_t *log, uint32_t page,
+		uint32_t index) {
+	return (const BL_LogHeader_t*) ((const uint8_t*) log->base
+			+ page * BL_VS_PAGE_SIZE_BYTES + index * log->record_size);
+}
+
+static uint32_t bl_log_crc(const BL_Log_t *log, const void *record) {
+	return bl_crc32_final(
+			bl_crc32_update(bl_crc32_init(), record,
+					log->record_size - sizeof(uint32_t)));
+}
+
+static uint8_t bl_log_is_valid(const BL_Log_t *log,
+		const BL_LogHeader_t *record) {
+	const uint32_t *words = (const uint32_t*) record;
+
+	return record->magic == log->magic
+			&& words[log->record_size / sizeof(uint32_t) - 1]
+					== bl_log_crc(log, record);
+}
+
+static uint8_t bl_log_is_erased(const BL_Log_t *log,
+		const BL_LogHeader_t *record) {
+	const uint32_t *words = (const uint32_t*) record;
+
+	for (uint32_t i = 0; i < log->record_size / sizeof(uint32_t); i++) {
+		if (words[i] != BL_FLASH_ERASED_STATE_1) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static const BL_LogHeader_t* bl_log_find(const BL_Log_t *log, uint32_t *page,
+		uint32_t *index) {
+	const BL_LogHeader_t *newest = NULL;
+	uint32_t per_page = BL_VS_PAGE_SIZE_BYTES / log->record_size;
+
+	for (uint32_t p = 0; p < log->pages; p++) {
+		for (uint32_t i = 0; i < per_page; i++) {
+			const BL_LogHeader_t *record = bl_log_record(log, p, i);
+
+			if (bl_log_is_valid(log, record)
+					&& (newest == NULL || record->sequence > newest->sequence)) {
+				newest = record;
+				*page = p;
+				*index = i;
+			}
+		}
+	}
+
+	return newest;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+const void* bl_log_newest(const BL_Log_t *log) {
+	uint32_t page;
+	uint32_t index;
+
+	return bl_log_find(log, &page, &index);
+}
+
+BL_Status_t bl_log_append(const BL_Log_t *log, void *record) {
+	BL_LogHeader_t *header = record;
+	uint32_t *words = record;
+	uint32_t per_page = BL_VS_PAGE_SIZE_BYTES / log->record_size;
+	uint32_t page = 0;
+	uint32_t index = 0;
+	const BL_LogHeader_t *newest = bl_log_find(log, &page, &index);
+
+	header->magic = log->magic;
+	header->sequence = newest != NULL ? newest->sequence + 1 : 0;
+	words[log->record_size / sizeof(uint32_t) - 1] = bl_log_crc(log, record);
+
+	/* Right after the newest record, skipping torn ones */
+	if (newest != NULL) {
+		index++;
+	}
+	while (index < per_page
+			&& !bl_log_is_erased(log, bl_log_record(log, page, index))) {
+		index++;
+	}
+
+	if (index == per_page) {
+		/* Continue on the next page, the newest record stays where it is */
+		if (newest != NULL) {
+			page = (page + 1) % log->pages;
+		}
+		index = 0;
+
+		if (BL_erase_flash((uint32_t) (uintptr_t) bl_log_record(log, page, 0),
+				1) != BL_Status_OK) {
+			return BL_Status_Error;
+		}
+	}
+
+	const BL_LogHeader_t *slot = bl_log_record(log, page, index);
+	if (BL_flash_write((uint32_t) (uintptr_t) slot, (uint8_t*) record,
+			log->record_size) != BL_Status_OK || !bl_log_is_valid(log, slot)
+			|| slot->sequence != header->sequence) {
+		return BL_Status_Error;
+	}
+
+	return BL_Status_OK;
+}
@@ -0,0 +1,261 @@
+/**
+ * @file bl_lz.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Streaming LZ4 block decompressor writing straight to flash pages
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_lz.h"
+#include "../inc/bl_flash.h"
+#include "LIB/DEBUG_UTILS.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#define BL_LZ_MIN_MATCH (4U)
+#define BL_LZ_LENGTH_EXTENDED (15U)
+#define BL_LZ_LENGTH_CONTINUE (255U)
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @enum	BL_LzState_t
+ * @brief	LZ4 sequence decoder state
+ *
+ */
+typedef enum {
+	BL_LzState_token, /**< Waiting for a sequence token */
+	BL_LzState_literalLength, /**< Extended literal length bytes */
+	BL_LzState_literals, /**< Literal bytes */
+	BL_LzState_offsetLow, /**< Match offset, low byte */
+	BL_LzState_offsetHigh, /**< Match offset, high byte */
+	BL_LzState_matchLength, /**< Extended match length bytes */
+	BL_LzState_done /**< All data decompressed */
+} BL_LzState_t;
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static struct {
+	uint32_t length; /**< Decompressed length */
+	uint32_t literals; /**< Literal bytes left in the sequence */
+	uint32_t match; /**< Match length of the sequence */
+	uint32_t offset; /**< Match offset of the sequence */
+	BL_LzState_t state;
+} bl_lz;
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn BL_LzState_t bl_lz_after_literals(void)
+ * @brief	Returns the state following the literals of a sequence: the last
+ * 	sequence of a block has no match.
+ *
+ * @return	Next decoder state
+ */
+static BL_LzState_t bl_lz_after_literals(void);
+
+/**
+ * @fn BL_NACK_t bl_lz_copy_match(void)
+ * @brief	Appends the match of the current sequence to the output
+ *
+ * @return	BL_NACK_t
+ */
+static BL_NACK_t bl_lz_copy_match(void);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static BL_LzState_t bl_lz_after_literals(void) {
+	if (bl_flash_page_writer_length() == bl_lz.length) {
+		return BL_LzState_done;
+	}
+	return BL_LzState_offsetLow;
+}
+
+static BL_NACK_t bl_lz_copy_match(void) {
+	uint32_t out = bl_flash_page_writer_length();
+	uint32_t length = bl_lz.match;
+
+	if (bl_lz.offset == 0 || bl_lz.offset > out
+			|| length > bl_lz.length - out) {
+		DEBUG_ERROR("Invalid LZ match (offset %lu, length %lu)", bl_lz.offset,
+				length);
+		return BL_NACK_INVALID_DATA;
+	}
+
+	while (length) {
+		uint32_t contiguous;
+		const uint8_t *src = bl_flash_page_writer_output(
+				bl_flash_page_writer_length() - bl_lz.offset, &contiguous);
+
+		/* A chunk no longer than the offset never overlaps its own output */
+		uint32_t chunk = length;
+		if (chunk > bl_lz.offset) {
+			chunk = bl_lz.offset;
+		}
+		if (chunk > contiguous) {
+			chunk = contiguous;
+		}
+		if (chunk > bl_flash_page_writer_room()) {
+			chunk = bl_flash_page_writer_room();
+		}
+
+		if (bl_flash_page_writer_write(src, chunk) != BL_Status_OK) {
+			return BL_NACK_OPERATION_FAILURE;
+		}
+		length -= chunk;
+	}
+
+	return BL_NACK_SUCCESS;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void bl_lz_begin(uint32_t address, uint32_t length) {
+	bl_lz.length = length;
+	bl_lz.state = BL_LzState_token;
+
+	bl_flash_page_writer_begin(address, 0);
+}
+
+BL_NACK_t bl_lz_feed(const uint8_t *data, uint32_t len) {
+	BL_NACK_t status = BL_NACK_SUCCESS;
+
+	while (len && status == BL_NACK_SUCCESS) {
+		uint8_t byte = *data;
+
+		switch (bl_lz.state) {
+		case BL_LzState_token:
+			bl_lz.literals = byte >> 4;
+			bl_lz.match = (byte & 0x0F) + BL_LZ_MIN_MATCH;
+			if (bl_lz.literals == BL_LZ_LENGTH_EXTENDED) {
+				bl_lz.state = BL_LzState_literalLength;
+			} else if (bl_lz.literals) {
+				bl_lz.state = BL_LzState_literals;
+			} else {
+				bl_lz.state = bl_lz_after_literals();
+			}
+			data++;
+			len--;
+			break;
+
+		case BL_LzState_literalLength:
+			bl_lz.literals += byte;
+			if (byte != BL_LZ_LENGTH_CONTINUE) {
+				bl_lz.state = BL_LzState_literals;
+			}
+			data++;
+			len--;
+			break;
+
+		case BL_LzState_literals: {
+			if (bl_lz.literals
+					> bl_lz.length - bl_flash_page_writer_length()) {
+				DEBUG_ERROR("LZ literals overflow the output");
+				status = BL_NACK_INVALID_DATA;
+				break;
+			}
+
+			uint32_t chunk = (len < bl_lz.literals) ? len : bl_lz.literals;
+
+			if (bl_flash_page_writer_write(data, chunk) != BL_Status_OK) {
+				status = BL_NACK_OPERATION_FAILURE;
+				break;
+			}
+			data += chunk;
+			len -= chunk;
+			bl_lz.literals -= chunk;
+			if (bl_lz.literals == 0) {
+				bl_lz.state = bl_lz_after_literals();
+			}
+		}
+			break;
+
+		case BL_LzState_offsetLow:
+			bl_lz.offset = byte;
+			bl_lz.state = BL_LzState_offsetHigh;
+			data++;
+			len--;
+			break;
+
+		case BL_LzState_offsetHigh:
+			bl_lz.offset |= (uint32_t) byte << 8;
+			data++;
+			len--;
+			if (bl_lz.match == BL_LZ_LENGTH_EXTENDED + BL_LZ_MIN_MATCH) {
+				bl_lz.state = BL_LzState_matchLength;
+			} else {
+				status = bl_lz_copy_match();
+				bl_lz.state = BL_LzState_token;
+			}
+			break;
+
+		case BL_LzState_matchLength:
+			bl_lz.match += byte;
+			data++;
+			len--;
+			if (byte != BL_LZ_LENGTH_CONTINUE) {
+				status = bl_lz_copy_match();
+				bl_lz.state = BL_LzState_token;
+			}
+			break;
+
+		case BL_LzState_done:
+		default:
+			DEBUG_ERROR("Trailing data after the LZ block");
+			status = BL_NACK_INVALID_DATA;
+			break;
+		}
+	}
+
+	/* A match may complete the output, no last literals sequence follows */
+	if (status == BL_NACK_SUCCESS && bl_lz.state == BL_LzState_token
+			&& bl_flash_page_writer_length() == bl_lz.length) {
+		bl_lz.state = BL_LzState_done;
+	}
+
+	return status;
+}
+
+BL_NACK_t bl_lz_finish(uint32_t crc) {
+	if (bl_lz.state != BL_LzState_done) {
+		DEBUG_ERROR("LZ stream ended early (%lu of %lu bytes)",
+				bl_flash_page_writer_length(), bl_lz.length);
+		bl_lz_abort();
+		return BL_NACK_INVALID_LENGTH;
+	}
+
+	if (bl_flash_page_writer_end() != BL_Status_OK) {
+		return BL_NACK_OPERATION_FAILURE;
+	}
+
+	if (bl_flash_page_writer_crc() != crc) {
+		DEBUG_ERROR("Decompressed data CRC mismatch");
+		return BL_NACK_INVALID_CRC;
+	}
+
+	return BL_NACK_SUCCESS;
+}
+
+void bl_lz_abort(void) {
+	bl_flash_page_writer_end();
+}
@@ -0,0 +1,322 @@
+/**
+ * @file bl_patch.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Delta (binary diff) update applied in place over the application
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_patch.h"
+#include "../inc/bl_cfg.h"
+#include "../inc/bl_flash.h"
+#include "LIB/DEBUG_UTILS.h"
+#include <stdint.h>
+#include <string.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#define BL_PATCH_FILL_CHUNK_BYTES (32U)
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @enum	BL_PatchState_t
+ * @brief	Patch stream decoder state
+ *
+ */
+typedef enum {
+	BL_PatchState_opcode, /**< Waiting for an opcode */
+	BL_PatchState_args, /**< Collecting the arguments of an operation */
+	BL_PatchState_literal /**< Streaming the literal bytes of an INSERT */
+} BL_PatchState_t;
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static struct {
+	uint32_t base; /**< Image address */
+	uint32_t old_length; /**< Installed image length */
+	uint32_t new_length; /**< New image length */
+	uint32_t remaining; /**< Literal bytes left in the current INSERT */
+	BL_PatchState_t state;
+	uint8_t op; /**< Current operation */
+	uint8_t arg_count; /**< Argument bytes collected */
+	uint8_t args[8]; /**< Argument bytes */
+} bl_patch;
+
+/** First page of the installed image, erased from flash once the second page
+ * of the new image is programmed */
+static uint32_t bl_patch_first_page[BL_VS_PAGE_SIZE_BYTES / sizeof(uint32_t)];
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn uint8_t bl_patch_arg_size(uint8_t)
+ * @brief	Returns the argument size of an operation
+ *
+ * @param op	Operation
+ * @return	Argument size in bytes, 0 for an unknown operation
+ */
+static uint8_t bl_patch_arg_size(uint8_t op);
+
+/**
+ * @fn uint32_t bl_patch_arg_u32(uint8_t)
+ * @brief	Reads a little-endian argument
+ *
+ * @param index	Byte index of the argument
+ * @return	Argument value
+ */
+static uint32_t bl_patch_arg_u32(uint8_t index);
+
+/**
+ * @fn BL_NACK_t bl_patch_copy(uint32_t, uint32_t)
+ * @brief	Copies a range of the installed image to the new image
+ *
+ * @param src		Offset in the installed image
+ * @param length	Length in bytes
+ * @return	BL_NACK_t
+ */
+static BL_NACK_t bl_patch_copy(uint32_t src, uint32_t length);
+
+/**
+ * @fn BL_NACK_t bl_patch_fill(uint8_t, uint32_t)
+ * @brief	Appends a repeated byte to the new image
+ *
+ * @param value		Byte value
+ * @param length	Length in bytes
+ * @return	BL_NACK_t
+ */
+static BL_NACK_t bl_patch_fill(uint8_t value, uint32_t length);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static uint8_t bl_patch_arg_size(uint8_t op) {
+	switch (op) {
+	case BL_PATCH_OP_COPY:
+		return 8;
+	case BL_PATCH_OP_INSERT:
+		return 4;
+	case BL_PATCH_OP_FILL:
+		return 5;
+	default:
+		return 0;
+	}
+}
+
+static uint32_t bl_patch_arg_u32(uint8_t index) {
+	return (uint32_t) bl_patch.args[index]
+			| ((uint32_t) bl_patch.args[index + 1] << 8)
+			| ((uint32_t) bl_patch.args[index + 2] << 16)
+			| ((uint32_t) bl_patch.args[index + 3] << 24);
+}
+
+static BL_NACK_t bl_patch_copy(uint32_t src, uint32_t length) {
+	uint32_t out = bl_flash_page_writer_length();
+
+	if (length > bl_patch.new_length - out || src > bl_patch.old_length
+			|| length > bl_patch.old_length - src) {
+		DEBUG_ERROR("Patch copy out of range");
+		return BL_NACK_INVALID_DATA;
+	}
+
+	while (length) {
+		/* Never cross an output page, so the source check holds per chunk */
+		uint32_t chunk = bl_flash_page_writer_room();
+		uint32_t page_start = bl_flash_page_writer_length()
+				- (BL_VS_PAGE_SIZE_BYTES - chunk);
+
+		if (chunk > length) {
+			chunk = length;
+		}
+
+		const uint8_t *source = (const uint8_t*) (uintptr_t) (bl_patch.base
+				+ src);
+		if (src < BL_VS_PAGE_SIZE_BYTES) {
+			if (chunk > BL_VS_PAGE_SIZE_BYTES - src) {
+				chunk = BL_VS_PAGE_SIZE_BYTES - src;
+			}
+			source = &((const uint8_t*) bl_patch_first_page)[src];
+		}
+
+		/* Pages before the current one were rewritten, except the first */
+		if (src < page_start && src + chunk > BL_VS_PAGE_SIZE_BYTES) {
+			DEBUG_ERROR("Patch copies from rewritten page (0x%08X)", src);
+			return BL_NACK_INVALID_DATA;
+		}
+
+		if (bl_flash_page_writer_write(source, chunk) != BL_Status_OK) {
+			return BL_NACK_OPERATION_FAILURE;
+		}
+
+		src += chunk;
+		length -= chunk;
+	}
+
+	return BL_NACK_SUCCESS;
+}
+
+static BL_NACK_t bl_patch_fill(uint8_t value, uint32_t length) {
+	uint8_t fill[BL_PATCH_FILL_CHUNK_BYTES];
+
+	if (length > bl_patch.new_length - bl_flash_page_writer_length()) {
+		DEBUG_ERROR("Patch fill out of range");
+		return BL_NACK_INVALID_DATA;
+	}
+
+	memset(fill, value, sizeof(fill));
+
+	while (length) {
+		uint32_t chunk = (length < sizeof(fill)) ? length : sizeof(fill);
+
+		if (bl_flash_page_writer_write(fill, chunk) != BL_Status_OK) {
+			return BL_NACK_OPERATION_FAILURE;
+		}
+		length -= chunk;
+	}
+
+	return BL_NACK_SUCCESS;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void bl_patch_begin(uint32_t base, uint32_t old_length, uint32_t new_length) {
+	bl_patch.base = base;
+	bl_patch.old_length = old_length;
+	bl_patch.new_length = new_length;
+	bl_patch.remaining = 0;
+	bl_patch.state = BL_PatchState_opcode;
+	bl_patch.arg_count = 0;
+
+	/* COPY reads the first page of the installed image from RAM, as it is
+	 * erased before the rest of the image is rewritten */
+	memcpy(bl_patch_first_page, (const void*) (uintptr_t) base,
+			(old_length < BL_VS_PAGE_SIZE_BYTES) ?
+					old_length : BL_VS_PAGE_SIZE_BYTES);
+
+	/* The new first page is only programmed once the new image is verified */
+	bl_flash_page_writer_begin(base, 1);
+}
+
+BL_NACK_t bl_patch_feed(const uint8_t *data, uint32_t len) {
+	BL_NACK_t status = BL_NACK_SUCCESS;
+
+	while (len && status == BL_NACK_SUCCESS) {
+		switch (bl_patch.state) {
+		case BL_PatchState_opcode:
+			bl_patch.op = *data++;
+			len--;
+			if (bl_patch_arg_size(bl_patch.op) == 0) {
+				DEBUG_ERROR("Unknown patch operation 0x%02X", bl_patch.op);
+				status = BL_NACK_INVALID_DATA;
+				break;
+			}
+			bl_patch.arg_count = 0;
+			bl_patch.state = BL_PatchState_args;
+			break;
+
+		case BL_PatchState_args:
+			bl_patch.args[bl_patch.arg_count++] = *data++;
+			len--;
+			if (bl_patch.arg_count < bl_patch_arg_size(bl_patch.op)) {
+				break;
+			}
+
+			bl_patch.state = BL_PatchState_opcode;
+			if (bl_patch.op == BL_PATCH_OP_COPY) {
+				status = bl_patch_copy(bl_patch_arg_u32(0),
+						bl_patch_arg_u32(4));
+			} else if (bl_patch.op == BL_PATCH_OP_FILL) {
+				status = bl_patch_fill(bl_patch.args[4], bl_patch_arg_u32(0));
+			} else {
+				bl_patch.remaining = bl_patch_arg_u32(0);
+				if (bl_patch.remaining
+						> bl_patch.new_length - bl_flash_page_writer_length()) {
+					DEBUG_ERROR("Patch insert out of range");
+					status = BL_NACK_INVALID_DATA;
+				} else if (bl_patch.remaining) {
+					bl_patch.state = BL_PatchState_literal;
+				}
+			}
+			break;
+
+		case BL_PatchState_literal: {
+			uint32_t chunk =
+					(len < bl_patch.remaining) ? len : bl_patch.remaining;
+
+			if (bl_flash_page_writer_write(data, chunk) != BL_Status_OK) {
+				status = BL_NACK_OPERATION_FAILURE;
+				break;
+			}
+			data += chunk;
+			len -= chunk;
+			bl_patch.remaining -= chunk;
+			if (bl_patch.remaining == 0) {
+				bl_patch.state = BL_PatchState_opcode;
+			}
+		}
+			break;
+
+		default:
+			status = BL_NACK_INVALID_DATA;
+			break;
+		}
+	}
+
+	return status;
+}
+
+BL_NACK_t bl_patch_finish(uint32_t target_crc) {
+	if (bl_patch.state != BL_PatchState_opcode
+			|| bl_flash_page_writer_length() != bl_patch.new_length) {
+		DEBUG_ERROR("Patch ended early (%lu of %lu bytes)",
+				bl_flash_page_writer_length(), bl_patch.new_length);
+		bl_patch_abort();
+		return BL_NACK_INVALID_LENGTH;
+	}
+
+	if (bl_flash_page_writer_end() != BL_Status_OK) {
+		bl_patch_abort();
+		return BL_NACK_OPERATION_FAILURE;
+	}
+
+	if (bl_flash_page_writer_crc() != target_crc) {
+		DEBUG_ERROR("Patched image CRC mismatch");
+		bl_flash_page_writer_commit(0);
+		return BL_NACK_INVALID_CRC;
+	}
+
+	if (bl_flash_page_writer_commit(1) != BL_Status_OK) {
+		return BL_NACK_OPERATION_FAILURE;
+	}
+
+	DEBUG_INFO("Patched image committed, %lu bytes", bl_patch.new_length);
+	return BL_NACK_SUCCESS;
+}
+
+void bl_patch_abort(void) {
+	/* No page was programmed yet: the installed image is intact. Otherwise its
+	 * first page is gone already, make sure. */
+	if (bl_flash_page_writer_length() < 2 * BL_VS_PAGE_SIZE_BYTES) {
+		return;
+	}
+
+	bl_flash_page_writer_commit(0);
+}
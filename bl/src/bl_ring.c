@@ -0,0 +1,238 @@
+/**
+ * @file bl_ring.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Interrupt fed receive ring and in-place command framer
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_ring.h"
+#include "../inc/bl.h"
+#include "../inc/bl_cfg.h"
+#include "../inc/bl_cmd_types.h"
+#include <stdint.h>
+#include <string.h>
+
+#if BL_RX_RING_ENABLE
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#if (BL_RX_RING_SIZE_BYTES & (BL_RX_RING_SIZE_BYTES - 1)) != 0
+#error "BL_RX_RING_SIZE_BYTES must be a power of two"
+#endif
+
+#if BL_RX_RING_SIZE_BYTES < BL_MAX_BUFFER_SIZE_BYTES
+#error "BL_RX_RING_SIZE_BYTES must hold a frame of BL_MAX_BUFFER_SIZE_BYTES"
+#endif
+
+#define BL_RING_MASK (BL_RX_RING_SIZE_BYTES - 1)
+
+/** Frames that can be held at once: a command and the packets it receives */
+#define BL_RING_MAX_HELD (4U)
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+/**
+ * Ring storage. The first BL_MAX_BUFFER_SIZE_BYTES are mirrored past the end,
+ * so any frame starting inside the ring can be read in place.
+ */
+static uint8_t bl_ring_buffer[BL_RX_RING_SIZE_BYTES + BL_MAX_BUFFER_SIZE_BYTES];
+
+/** Free running indices, only the interrupt writes 'head' */
+static struct {
+	volatile uint32_t head; /**< Next byte to be received */
+	uint32_t read; /**< Next byte to be framed */
+	uint32_t tail; /**< Oldest byte still in use */
+	volatile uint32_t dropped; /**< Bytes lost to a full ring */
+	uint32_t held; /**< Frames returned and not freed yet, oldest first */
+	struct {
+		uint32_t start; /**< Index of the first byte */
+		uint32_t end; /**< Index past the last byte */
+		uint8_t released;
+	} frames[BL_RING_MAX_HELD];
+} bl_ring;
+
+/** Set by the timeouts of bl_ring_read and of resynchronization */
+static volatile uint8_t bl_ring_expired;
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_ring_push(uint8_t)
+ * @brief	Stores a byte received by the interrupt and re-arms it
+ *
+ * @param byte	Received byte
+ */
+static void bl_ring_push(uint8_t byte);
+
+/**
+ * @fn void bl_ring_store(uint8_t)
+ * @brief	Stores a byte at the head of the ring and in its mirror
+ *
+ * @param byte	Received byte
+ */
+static void bl_ring_store(uint8_t byte);
+
+/**
+ * @fn void bl_ring_timeout(void)
+ * @brief	Ends the wait of bl_ring_read
+ *
+ */
+static void bl_ring_timeout(void);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static void bl_ring_store(uint8_t byte) {
+	uint32_t head = bl_ring.head;
+
+	if (head - bl_ring.tail >= BL_RX_RING_SIZE_BYTES) {
+		bl_ring.dropped++;
+		return;
+	}
+
+	uint32_t index = head & BL_RING_MASK;
+	bl_ring_buffer[index] = byte;
+	if (index < BL_MAX_BUFFER_SIZE_BYTES) {
+		bl_ring_buffer[BL_RX_RING_SIZE_BYTES + index] = byte;
+	}
+
+	bl_ring.head = head + 1;
+}
+
+static void bl_ring_push(uint8_t byte) {
+	bl_ring_store(byte);
+
+	BL_receiveInterrupt(bl_ring_push);
+}
+
+static void bl_ring_timeout(void) {
+	bl_ring_expired = 1;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void bl_ring_start(void) {
+	bl_ring.head = 0;
+	bl_ring.read = 0;
+	bl_ring.tail = 0;
+	bl_ring.held = 0;
+	bl_ring.dropped = 0;
+
+	BL_receiveInterrupt(bl_ring_push);
+}
+
+void bl_ring_write(const uint8_t *data, uint32_t len) {
+	for (uint32_t i = 0; i < len; i++) {
+		bl_ring_store(data[i]);
+	}
+}
+
+BL_Status_t bl_ring_get_frame(uint8_t **frame, uint32_t max_size) {
+	uint32_t available = bl_ring.head - bl_ring.read;
+
+	if (available < sizeof(BL_CommandHeader_t)) {
+		return BL_Status_Busy;
+	}
+
+	uint8_t *start = &bl_ring_buffer[bl_ring.read & BL_RING_MASK];
+	uint32_t size = ((BL_CommandHeader_t*) start)->payload_size;
+
+	if (size < sizeof(BL_CommandHeader_t) || size > max_size
+			|| size > BL_MAX_BUFFER_SIZE_BYTES) {
+		/* Out of sync with the host. Whatever arrives back to back belongs to
+		 * the frames in flight, start over once the line goes quiet. */
+		uint32_t head;
+		do {
+			head = bl_ring.head;
+			bl_ring_expired = 0;
+			BL_setTimeout(BL_RX_RESYNC_IDLE_MS, bl_ring_timeout);
+			while (bl_ring.head == head && !bl_ring_expired)
+				;
+			BL_disableTimeout();
+		} while (bl_ring.head != head);
+
+		bl_ring.read = head;
+		if (bl_ring.held == 0) {
+			bl_ring.tail = bl_ring.read;
+		}
+		return BL_Status_Error;
+	}
+
+	if (available < size || bl_ring.held == BL_RING_MAX_HELD) {
+		return BL_Status_Busy;
+	}
+
+	bl_ring.frames[bl_ring.held].start = bl_ring.read;
+	bl_ring.frames[bl_ring.held].end = bl_ring.read + size;
+	bl_ring.frames[bl_ring.held].released = 0;
+	bl_ring.held++;
+
+	*frame = start;
+	bl_ring.read += size;
+
+	return BL_Status_OK;
+}
+
+void bl_ring_release(const uint8_t *frame) {
+	uint32_t index = (uint32_t) (frame - bl_ring_buffer);
+
+	for (uint32_t i = 0; i < bl_ring.held; i++) {
+		if ((bl_ring.frames[i].start & BL_RING_MASK) == index) {
+			bl_ring.frames[i].released = 1;
+			break;
+		}
+	}
+
+	/* Room is given back in order: up to the oldest frame still held */
+	while (bl_ring.held && bl_ring.frames[0].released) {
+		bl_ring.tail = bl_ring.frames[0].end;
+		bl_ring.held--;
+		memmove(&bl_ring.frames[0], &bl_ring.frames[1],
+				bl_ring.held * sizeof(bl_ring.frames[0]));
+	}
+
+	if (bl_ring.held == 0) {
+		bl_ring.tail = bl_ring.read;
+	}
+}
+
+BL_Status_t bl_ring_read(uint8_t *data, uint32_t len, uint32_t timeout) {
+	bl_ring_expired = 0;
+	BL_setTimeout(timeout, bl_ring_timeout);
+
+	while (bl_ring.head - bl_ring.read < len && !bl_ring_expired)
+		;
+
+	BL_disableTimeout();
+
+	if (bl_ring.head - bl_ring.read < len) {
+		return BL_Status_Error;
+	}
+
+	memcpy(data, &bl_ring_buffer[bl_ring.read & BL_RING_MASK], len);
+	bl_ring.read += len;
+	if (bl_ring.held == 0) {
+		bl_ring.tail = bl_ring.read;
+	}
+
+	return BL_Status_OK;
+}
+
+#endif /* BL_RX_RING_ENABLE */
@@ -0,0 +1,183 @@
+/**
+ * @file bl_sha256.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Incremental SHA-256 (FIPS 180-4)
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_sha256.h"
+#include "../inc/bl.h"
+#include <stdint.h>
+#include <string.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#define BL_SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define BL_SHA256_CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define BL_SHA256_MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+#define BL_SHA256_SIGMA0(x) \
+	(BL_SHA256_ROTR(x, 2) ^ BL_SHA256_ROTR(x, 13) ^ BL_SHA256_ROTR(x, 22))
+#define BL_SHA256_SIGMA1(x) \
+	(BL_SHA256_ROTR(x, 6) ^ BL_SHA256_ROTR(x, 11) ^ BL_SHA256_ROTR(x, 25))
+#define BL_SHA256_GAMMA0(x) \
+	(BL_SHA256_ROTR(x, 7) ^ BL_SHA256_ROTR(x, 18) ^ ((x) >> 3))
+#define BL_SHA256_GAMMA1(x) \
+	(BL_SHA256_ROTR(x, 17) ^ BL_SHA256_ROTR(x, 19) ^ ((x) >> 10))
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+/** Round constants */
+static const uint32_t bl_sha256_k[64] = { 0x428A2F98, 0x71374491, 0xB5C0FBCF,
+		0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5, 0xD807AA98,
+		0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7,
+		0xC19BF174, 0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F,
+		0x4A7484AA, 0x5CB0A9DC, 0x76F988DA, 0x983E5152, 0xA831C66D, 0xB00327C8,
+		0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967, 0x27B70A85,
+		0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E,
+		0x92722C85, 0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819,
+		0xD6990624, 0xF40E3585, 0x106AA070, 0x19A4C116, 0x1E376C08, 0x2748774C,
+		0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3, 0x748F82EE,
+		0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7,
+		0xC67178F2 };
+
+/** Initial hash value */
+static const uint32_t bl_sha256_h0[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+		0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+/*******************************************************************************
+ *                         	Weak functions				                       *
+ *******************************************************************************/
+
+BL_WEAK void BL_sha256_hw_compress(uint32_t state[8], const uint8_t *blocks,
+		uint32_t block_count) {
+	/* No hash peripheral available, fall back to software */
+	bl_sha256_compress(state, blocks, block_count);
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void bl_sha256_compress(uint32_t state[8], const uint8_t *blocks,
+		uint32_t block_count) {
+	uint32_t w[16];
+
+	while (block_count--) {
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+		/* The message schedule is kept in a 16 word window */
+		for (uint32_t i = 0; i < 64; i++) {
+			uint32_t word;
+
+			if (i < 16) {
+				word = ((uint32_t) blocks[4 * i] << 24)
+						| ((uint32_t) blocks[4 * i + 1] << 16)
+						| ((uint32_t) blocks[4 * i + 2] << 8)
+						| blocks[4 * i + 3];
+			} else {
+				word = BL_SHA256_GAMMA1(w[(i - 2) & 15]) + w[(i - 7) & 15]
+						+ BL_SHA256_GAMMA0(w[(i - 15) & 15]) + w[i & 15];
+			}
+			w[i & 15] = word;
+
+			uint32_t t1 = h + BL_SHA256_SIGMA1(e) + BL_SHA256_CH(e, f, g)
+					+ bl_sha256_k[i] + word;
+			uint32_t t2 = BL_SHA256_SIGMA0(a) + BL_SHA256_MAJ(a, b, c);
+
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+
+		blocks += BL_SHA256_BLOCK_BYTES;
+	}
+}
+
+void bl_sha256_init(BL_Sha256_t *sha) {
+	memcpy(sha->state, bl_sha256_h0, sizeof(sha->state));
+	sha->length = 0;
+}
+
+void bl_sha256_update(BL_Sha256_t *sha, const void *data, uint32_t len) {
+	const uint8_t *bytes = data;
+	uint32_t used = (uint32_t) (sha->length % BL_SHA256_BLOCK_BYTES);
+
+	sha->length += len;
+
+	/* Complete the partial block first */
+	if (used) {
+		uint32_t chunk = BL_SHA256_BLOCK_BYTES - used;
+
+		if (chunk > len) {
+			chunk = len;
+		}
+		memcpy(&sha->buffer[used], bytes, chunk);
+		bytes += chunk;
+		len -= chunk;
+
+		if (used + chunk < BL_SHA256_BLOCK_BYTES) {
+			return;
+		}
+		BL_sha256_hw_compress(sha->state, sha->buffer, 1);
+	}
+
+	/* Whole blocks are hashed straight from the caller's buffer */
+	if (len >= BL_SHA256_BLOCK_BYTES) {
+		BL_sha256_hw_compress(sha->state, bytes, len / BL_SHA256_BLOCK_BYTES);
+		bytes += len - len % BL_SHA256_BLOCK_BYTES;
+		len %= BL_SHA256_BLOCK_BYTES;
+	}
+
+	memcpy(sha->buffer, bytes, len);
+}
+
+void bl_sha256_final(const BL_Sha256_t *sha,
+		uint8_t digest[BL_SHA256_DIGEST_BYTES]) {
+	BL_Sha256_t last = *sha;
+	uint64_t bits = sha->length * 8;
+	uint8_t pad[BL_SHA256_BLOCK_BYTES + 8] = { 0x80 };
+	uint32_t used = (uint32_t) (sha->length % BL_SHA256_BLOCK_BYTES);
+
+	/* Pad to 56 bytes modulo 64, then append the length in bits */
+	uint32_t pad_len = (used < 56) ? 56 - used : 120 - used;
+	for (uint32_t i = 0; i < 8; i++) {
+		pad[pad_len + i] = (uint8_t) (bits >> (56 - 8 * i));
+	}
+	bl_sha256_update(&last, pad, pad_len + 8);
+
+	for (uint32_t i = 0; i < 8; i++) {
+		digest[4 * i] = (uint8_t) (last.state[i] >> 24);
+		digest[4 * i + 1] = (uint8_t) (last.state[i] >> 16);
+		digest[4 * i + 2] = (uint8_t) (last.state[i] >> 8);
+		digest[4 * i + 3] = (uint8_t) last.state[i];
+	}
+}
@@ -0,0 +1,260 @@
+/**
+ * @file bl_slots.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	A/B application slots, boot record and the API shared with the
+ * 	application
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_slots.h"
+#include "../inc/bl.h"
+#include "../inc/bl_cfg.h"
+#include "../inc/bl_crc.h"
+#include "../inc/bl_defs.h"
+#include "../inc/bl_log.h"
+#include "LIB/DEBUG_UTILS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#if BL_AB_SLOTS_ENABLE
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/* Slot layout from the linker script */
+extern uint32_t _AppStartAddr;
+extern uint32_t _AppEndAddr;
+extern uint32_t _AppSlotBStartAddr;
+extern uint32_t _AppSlotBEndAddr;
+extern uint32_t _BootRecordAddr;
+
+/*******************************************************************************
+ *                        Global Public variables                              *
+ *******************************************************************************/
+
+__attribute__((section("BL_API"))) const BL_Api_t bl_api = {
+		.magic = BL_API_MAGIC,
+		.version = BL_API_VERSION,
+		.get_info = bl_slots_get_info,
+		.stage_erase = bl_slots_stage_erase,
+		.stage_write = bl_slots_stage_write,
+		.commit = bl_slots_commit };
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static const BL_Log_t bl_slots_log = {
+		.base = &_BootRecordAddr,
+		.pages = BL_BOOT_RECORD_PAGES,
+		.record_size = sizeof(BL_BootRecord_t),
+		.magic = BL_BOOT_RECORD_MAGIC };
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn uint32_t bl_slots_start*(uint32_t)
+ * @brief	Returns the start address of a slot
+ *
+ * @param slot	BL_SLOT_A or BL_SLOT_B
+ * @return	Start address of the slot
+ */
+static uint32_t* bl_slots_start(uint32_t slot);
+
+/**
+ * @fn uint32_t bl_slots_size(uint32_t)
+ * @brief	Returns the size of a slot
+ *
+ * @param slot	BL_SLOT_A or BL_SLOT_B
+ * @return	Size in bytes
+ */
+static uint32_t bl_slots_size(uint32_t slot);
+
+/**
+ * @fn uint32_t bl_slots_active(void)
+ * @brief	Returns the slot that boots according to the newest record
+ *
+ * @return	BL_SLOT_A or BL_SLOT_B
+ */
+static uint32_t bl_slots_active(void);
+
+/**
+ * @fn uint8_t bl_slots_image_is_valid(uint32_t, uint32_t, uint32_t)
+ * @brief	Checks an image in a slot against its length and CRC32, and that its
+ * 	vector table points into the slot
+ *
+ * @param slot		Slot of the image
+ * @param length	Length of the image
+ * @param crc		CRC32 of the image
+ * @return	Non-zero if the image can be booted
+ */
+static uint8_t bl_slots_image_is_valid(uint32_t slot, uint32_t length,
+		uint32_t crc);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static uint32_t* bl_slots_start(uint32_t slot) {
+	return slot == BL_SLOT_B ? &_AppSlotBStartAddr : &_AppStartAddr;
+}
+
+static uint32_t bl_slots_size(uint32_t slot) {
+	uint32_t *start = bl_slots_start(slot);
+
+	return (uint32_t) (uintptr_t) bl_slots_end(start)
+			- (uint32_t) (uintptr_t) start + 1;
+}
+
+static uint32_t bl_slots_active(void) {
+	const BL_BootRecord_t *newest = bl_log_newest(&bl_slots_log);
+
+	return newest != NULL ? newest->active : BL_SLOT_A;
+}
+
+static uint8_t bl_slots_image_is_valid(uint32_t slot, uint32_t length,
+		uint32_t crc) {
+	uint32_t address = (uint32_t) (uintptr_t) bl_slots_start(slot);
+	const uint32_t *start = (const uint32_t*) (uintptr_t) address;
+
+	if (length < 2 * sizeof(uint32_t) || length > bl_slots_size(slot)) {
+		return 0;
+	}
+
+	/* Stack pointer, then the reset handler (Thumb bit set) inside the image */
+	uint32_t reset = start[1] & ~1U;
+	if (start[0] == BL_FLASH_ERASED_STATE_1
+			|| start[0] == BL_FLASH_ERASED_STATE_2 || reset < address
+			|| reset - address >= length) {
+		return 0;
+	}
+
+	return bl_crc32_final(bl_crc32_update(bl_crc32_init(), start, length))
+			== crc;
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+uint32_t* bl_slots_boot(void) {
+	const BL_BootRecord_t *newest = bl_log_newest(&bl_slots_log);
+
+	if (newest == NULL) {
+		return bl_slots_start(BL_SLOT_A);
+	}
+
+	uint32_t active = newest->active;
+
+	if (newest->pending != BL_SLOT_NONE) {
+		BL_BootRecord_t record = *newest;
+
+		if (bl_slots_image_is_valid(record.pending, record.image_length,
+				record.image_crc)) {
+			DEBUG_INFO("Activating the image staged in slot %u",
+					record.pending);
+			record.active = record.pending;
+		} else {
+			DEBUG_WARN("Image staged in slot %u is invalid, dropped",
+					record.pending);
+		}
+		record.pending = BL_SLOT_NONE;
+
+		/* Only switch once it is recorded, or every boot would check again.
+		 * Runs before any command, bl_flash knows nothing of these pages yet */
+		if (bl_log_append(&bl_slots_log, &record) == BL_Status_OK) {
+			active = record.active;
+		} else {
+			DEBUG_ERROR("Cannot program the boot record");
+		}
+	}
+
+	return bl_slots_start(active);
+}
+
+uint32_t* bl_slots_end(const uint32_t *start) {
+	return start == &_AppSlotBStartAddr ? &_AppSlotBEndAddr : &_AppEndAddr;
+}
+
+BL_Status_t bl_slots_get_info(BL_SlotInfo_t *info) {
+	uint32_t active = bl_slots_active();
+	uint32_t staging = active == BL_SLOT_A ? BL_SLOT_B : BL_SLOT_A;
+
+	info->active = active;
+	info->active_address = (uint32_t) (uintptr_t) bl_slots_start(active);
+	info->staging = staging;
+	info->staging_address = (uint32_t) (uintptr_t) bl_slots_start(staging);
+	info->staging_size = bl_slots_size(staging);
+
+	return BL_Status_OK;
+}
+
+BL_Status_t bl_slots_stage_erase(uint32_t offset, uint32_t length) {
+	BL_SlotInfo_t info;
+
+	bl_slots_get_info(&info);
+
+	if (offset > info.staging_size || length > info.staging_size - offset) {
+		return BL_Status_Error;
+	}
+	if (length == 0) {
+		return BL_Status_OK;
+	}
+
+	uint32_t first = offset / BL_VS_PAGE_SIZE_BYTES;
+	uint32_t last = (offset + length - 1) / BL_VS_PAGE_SIZE_BYTES;
+
+	return BL_erase_flash(info.staging_address + first * BL_VS_PAGE_SIZE_BYTES,
+			last - first + 1);
+}
+
+BL_Status_t bl_slots_stage_write(uint32_t offset, const uint8_t *data,
+		uint32_t length) {
+	BL_SlotInfo_t info;
+
+	bl_slots_get_info(&info);
+
+	if ((offset & 3U) != 0 || offset > info.staging_size
+			|| length > info.staging_size - offset) {
+		return BL_Status_Error;
+	}
+	if (length == 0) {
+		return BL_Status_OK;
+	}
+
+	return BL_flash_write(info.staging_address + offset, (uint8_t*) data,
+			length);
+}
+
+BL_Status_t bl_slots_commit(uint32_t image_length, uint32_t image_crc) {
+	BL_SlotInfo_t info;
+	BL_BootRecord_t record;
+
+	bl_slots_get_info(&info);
+
+	/* Caught now rather than at the next boot */
+	if (!bl_slots_image_is_valid(info.staging, image_length, image_crc)) {
+		return BL_Status_Error;
+	}
+
+	record.active = info.active;
+	record.pending = info.staging;
+	record.image_length = image_length;
+	record.image_crc = image_crc;
+	record.reserved = BL_FLASH_ERASED_STATE_1;
+
+	return bl_log_append(&bl_slots_log, &record);
+}
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * @file bl_stats.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Timing and error statistics reported by BL_GET_STATS_CMD
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../inc/bl_stats.h"
+#include "../inc/bl.h"
+#include "../inc/bl_cfg.h"
+#include "../inc/bl_cmd_types.h"
+#include <stdint.h>
+#include <string.h>
+
+#if BL_STATS_ENABLE
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+#if BL_STATS_CMD_SLOTS > 255
+#error "BL_STATS_CMD_SLOTS must fit the cmd_slots field of the response"
+#endif
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) \
+	|| defined(__ARM_ARCH_8M_MAIN__)
+#define BL_STATS_HAS_DWT (1)
+
+/** Debug exception and monitor control, TRCENA powers the DWT */
+#define BL_DEMCR (*(volatile uint32_t*) 0xE000EDFCU)
+#define BL_DEMCR_TRCENA (1UL << 24)
+
+#define BL_DWT_CTRL (*(volatile uint32_t*) 0xE0001000U)
+#define BL_DWT_CTRL_CYCCNTENA (1UL << 0)
+#define BL_DWT_CYCCNT (*(volatile uint32_t*) 0xE0001004U)
+#endif
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+/** Statistics, kept in the layout of the response so they are sent in place */
+static BL_STATS_RESPONSE bl_stats;
+
+/** Recording is suspended while the statistics are being sent */
+static uint8_t bl_stats_frozen;
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_stats_add(BL_STATS_ENTRY*, uint32_t)
+ * @brief	Adds a sample ending now to an entry
+ *
+ * @param entry	Entry
+ * @param start	Counter value when the sample started
+ */
+static void bl_stats_add(BL_STATS_ENTRY *entry, uint32_t start);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static void bl_stats_add(BL_STATS_ENTRY *entry, uint32_t start) {
+	/* Unsigned difference, correct across one wrap of the counter */
+	uint32_t cycles = BL_get_cycles() - start;
+
+	if (bl_stats_frozen) {
+		return;
+	}
+
+	if (entry->count == 0 || cycles < entry->min) {
+		entry->min = cycles;
+	}
+	if (cycles > entry->max) {
+		entry->max = cycles;
+	}
+	entry->total += cycles;
+	entry->count++;
+}
+
+/*******************************************************************************
+ *                         	Weak functions				                       *
+ *******************************************************************************/
+
+BL_WEAK uint32_t BL_get_cycles(void) {
+#if defined(BL_STATS_HAS_DWT)
+	if (!(BL_DWT_CTRL & BL_DWT_CTRL_CYCCNTENA)) {
+		BL_DEMCR |= BL_DEMCR_TRCENA;
+		BL_DWT_CYCCNT = 0;
+		BL_DWT_CTRL |= BL_DWT_CTRL_CYCCNTENA;
+	}
+
+	return BL_DWT_CYCCNT;
+#else
+	return 0;
+#endif
+}
+
+BL_WEAK uint32_t BL_get_cycle_frequency(void) {
+#if defined(BL_STATS_HAS_DWT)
+	return BL_VS_CORE_CLOCK_HZ;
+#else
+	return 0;
+#endif
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void bl_stats_add_phase(BL_StatsPhase_t phase, uint32_t start) {
+	bl_stats_add(&bl_stats.data.phases[phase], start);
+}
+
+void bl_stats_add_command(BL_CommandID_t id, uint32_t start) {
+	if (id < BL_STATS_CMD_SLOTS) {
+		bl_stats_add(&bl_stats.data.commands[id], start);
+	}
+}
+
+void bl_stats_count_crc_failure(void) {
+	if (!bl_stats_frozen) {
+		bl_stats.data.crc_failures++;
+	}
+}
+
+void bl_stats_count_retries(uint32_t count) {
+	if (!bl_stats_frozen) {
+		bl_stats.data.retries += count;
+	}
+}
+
+BL_STATS_RESPONSE* bl_stats_snapshot(void) {
+	bl_stats_frozen = 1;
+
+	bl_stats.data.cycle_frequency = BL_get_cycle_frequency();
+	bl_stats.data.phase_count = BL_STATS_PHASE_COUNT;
+	bl_stats.data.cmd_slots = BL_STATS_CMD_SLOTS;
+
+	return &bl_stats;
+}
+
+void bl_stats_release(uint8_t reset) {
+	if (reset) {
+		memset(&bl_stats, 0, sizeof(bl_stats));
+	}
+
+	bl_stats_frozen = 0;
+}
+
+#endif /* BL_STATS_ENABLE */
@@ -15,6 +15,8 @@
 
 #include "../inc/bl_utils.h"
 #include "../inc/bl_cmd_types.h"
+#include "../inc/bl_crc.h"
+#include "../inc/bl_stats.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -24,19 +26,40 @@
 
 uint32_t bl_calculate_command_crc(void *command, uint32_t size) {
 	const uint8_t *data = (const uint8_t*) command;
-	uint32_t crc = 0xFFFFFFFF;
-	uint32_t crc_offset = offsetof(BL_CommandHeader_t, CRC32);
-
-	// Calculate CRC for the command (excluding the CRC field)
-	for (uint32_t i = 0; i < size; i++) {
-		if (i < crc_offset || i >= crc_offset + sizeof(uint32_t)) {
-			crc ^= data[i];
-
-			for (int j = 0; j < 8; j++) {
-				crc = (crc >> 1) ^ ((crc & 1) * CRC32_POLY);
-			}
-		}
+	const uint32_t crc_offset = offsetof(BL_CommandHeader_t, CRC32);
+	const uint32_t crc_end = crc_offset + sizeof(uint32_t);
+	uint32_t start = BL_STATS_TIMESTAMP();
+	uint32_t crc = bl_crc32_init();
+
+	/* Calculate CRC for the command (excluding the CRC field), as two
+	 * contiguous runs around the field */
+	crc = bl_crc32_update(crc, data, (size < crc_offset) ? size : crc_offset);
+	if (size > crc_end) {
+		crc = bl_crc32_update(crc, &data[crc_end], size - crc_end);
 	}
+	crc = bl_crc32_final(crc);
+
+	BL_STATS_PHASE(BL_STATS_PHASE_CRC, start);
+
+	return crc;
+}
+
+uint32_t bl_calculate_vector_crc(const BL_IoVec_t iov[], uint32_t iov_count) {
+	const uint32_t crc_offset = offsetof(BL_CommandHeader_t, CRC32);
+	const uint32_t crc_end = crc_offset + sizeof(uint32_t);
+	uint32_t start = BL_STATS_TIMESTAMP();
+	uint32_t crc = bl_crc32_init();
+
+	/* The header is in the first buffer, skip its CRC field */
+	crc = bl_crc32_update(crc, iov[0].data, crc_offset);
+	crc = bl_crc32_update(crc, &iov[0].data[crc_end], iov[0].len - crc_end);
+
+	for (uint32_t i = 1; i < iov_count; i++) {
+		crc = bl_crc32_update(crc, iov[i].data, iov[i].len);
+	}
+	crc = bl_crc32_final(crc);
+
+	BL_STATS_PHASE(BL_STATS_PHASE_CRC, start);
 
-	return ~crc;
+	return crc;
 }
@@ -0,0 +1,293 @@
+/**
+ * @file bl_fleet.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Flashes one image into many bootloaders at once
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Every port gets its own session, all of them driven by a single epoll loop,
+ * so a slow or dead device never holds back the others. The image is mapped
+ * once and its packet headers are calculated once; every session sends them
+ * straight from there.
+ *
+ * Usage: bl_fleet -i image [-a address] [-k block_bytes] [-b baud]
+ * 	[-t reply_timeout_ms] [-s sync_attempts] port...
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_fleet.h"
+#include "../../bl/inc/bl_cfg.h"
+#include "../../bl/inc/bl_cmd_types.h"
+#include "../../bl/inc/bl_defs.h"
+#include "../../bl/inc/bl_utils.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                         	Private variables			                       *
+ *******************************************************************************/
+
+static BL_FleetConfig_t bl_fleet_config = { .baud_rate = 115200,
+		.reply_timeout_ms = BL_RECEIVE_TIMEOUT_MS * 2, .sync_attempts = 20 };
+
+static BL_FleetImage_t bl_fleet_image = { .block_size = BL_DATA_BLOCK_SIZE };
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn int bl_fleet_load_image(const char*)
+ * @brief	Maps the image and builds the header of every data packet
+ *
+ * @param path	Image file
+ * @return	0 on success, -1 otherwise
+ */
+static int bl_fleet_load_image(const char *path);
+
+/**
+ * @fn void bl_fleet_update_events(int, BL_FleetSession_t*)
+ * @brief	Keeps the epoll registration of a session in line with its state
+ *
+ * @param epoll_fd	epoll instance
+ * @param session	Session
+ */
+static void bl_fleet_update_events(int epoll_fd, BL_FleetSession_t *session);
+
+/**
+ * @fn void bl_fleet_run(BL_FleetSession_t*, uint32_t)
+ * @brief	Drives every session until all of them are done or failed
+ *
+ * @param sessions	Sessions, already started
+ * @param count		Number of sessions
+ */
+static void bl_fleet_run(BL_FleetSession_t *sessions, uint32_t count);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static int bl_fleet_load_image(const char *path) {
+	BL_FleetImage_t *image = &bl_fleet_image;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0
+			|| st.st_size > UINT32_MAX) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	image->size = st.st_size;
+	image->data = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image->data == MAP_FAILED) {
+		return -1;
+	}
+
+	image->packet_count = (image->size + image->block_size - 1)
+			/ image->block_size;
+	image->headers = calloc(image->packet_count, sizeof(*image->headers));
+	if (image->headers == NULL) {
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < image->packet_count; i++) {
+		BL_DATA_PACKET_HEADER *header = &image->headers[i];
+		uint32_t offset = i * image->block_size;
+		uint32_t len = image->size - offset;
+		if (len > image->block_size) {
+			len = image->block_size;
+		}
+
+		header->data.header.cmd_id = BL_DATA_PACKET_CMD_ID;
+		header->data.header.payload_size = sizeof(*header) + len;
+		header->data.data_len = len;
+		header->data.end_flag = i == image->packet_count - 1;
+		if (!header->data.end_flag) {
+			uint32_t next_len = image->size - offset - len;
+			header->data.next_len =
+					(next_len > image->block_size) ?
+							image->block_size : next_len;
+		}
+
+		BL_IoVec_t iov[] = { { header->serialized_data, sizeof(*header) }, {
+				image->data + offset, len } };
+		header->data.header.CRC32 = bl_calculate_vector_crc(iov, 2);
+	}
+
+	return 0;
+}
+
+static void bl_fleet_update_events(int epoll_fd, BL_FleetSession_t *session) {
+	uint8_t polling_out = session->tx[0] != NULL;
+
+	if (polling_out != session->polling_out
+			&& bl_fleet_session_active(session)) {
+		struct epoll_event ev = { .events = EPOLLIN
+				| (polling_out ? EPOLLOUT : 0), .data.ptr = session };
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->fd, &ev);
+		session->polling_out = polling_out;
+	}
+}
+
+static void bl_fleet_run(BL_FleetSession_t *sessions, uint32_t count) {
+	struct epoll_event events[32];
+	int epoll_fd = epoll_create1(0);
+	uint32_t active = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (bl_fleet_session_active(&sessions[i])) {
+			struct epoll_event ev = { .events = EPOLLIN, .data.ptr =
+					&sessions[i] };
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sessions[i].fd, &ev);
+			bl_fleet_update_events(epoll_fd, &sessions[i]);
+			active++;
+		}
+	}
+
+	while (active) {
+		/* Sleep until the earliest deadline at most */
+		uint64_t now = bl_fleet_now_ns();
+		uint64_t wake = UINT64_MAX;
+		for (uint32_t i = 0; i < count; i++) {
+			if (bl_fleet_session_active(&sessions[i])
+					&& sessions[i].deadline_ns < wake) {
+				wake = sessions[i].deadline_ns;
+			}
+		}
+		int timeout_ms = (wake <= now) ? 0 : (int) ((wake - now) / 1000000 + 1);
+
+		int n = epoll_wait(epoll_fd, events, 32, timeout_ms);
+		for (int i = 0; i < n; i++) {
+			BL_FleetSession_t *session = events[i].data.ptr;
+
+			if (bl_fleet_session_active(session)
+					&& (events[i].events & EPOLLOUT)) {
+				bl_fleet_session_writable(session);
+			}
+			if (bl_fleet_session_active(session)
+					&& (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+				bl_fleet_session_readable(session);
+			}
+		}
+
+		now = bl_fleet_now_ns();
+		active = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			BL_FleetSession_t *session = &sessions[i];
+
+			if (bl_fleet_session_active(session)
+					&& session->deadline_ns <= now) {
+				bl_fleet_session_timeout(session);
+			}
+			if (bl_fleet_session_active(session)) {
+				bl_fleet_update_events(epoll_fd, session);
+				active++;
+			}
+		}
+	}
+
+	close(epoll_fd);
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	const char *image_path = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:a:k:b:t:s:")) != -1) {
+		switch (opt) {
+		case 'i':
+			image_path = optarg;
+			break;
+		case 'a':
+			bl_fleet_image.address = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			bl_fleet_image.block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bl_fleet_config.baud_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			bl_fleet_config.reply_timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			bl_fleet_config.sync_attempts = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			image_path = NULL;
+			optind = argc;
+			break;
+		}
+	}
+
+	if (image_path == NULL || optind == argc) {
+		fprintf(stderr, "Usage: %s -i image [-a address] [-k block_bytes] "
+				"[-b baud] [-t reply_timeout_ms] [-s sync_attempts] "
+				"port...\n", argv[0]);
+		return 2;
+	}
+
+	if (bl_fleet_image.block_size == 0
+			|| bl_fleet_image.block_size > BL_DATA_BLOCK_SIZE
+			|| bl_fleet_config.reply_timeout_ms == 0
+			|| bl_fleet_config.sync_attempts == 0) {
+		fprintf(stderr, "Invalid settings\n");
+		return 2;
+	}
+
+	if (bl_fleet_load_image(image_path) != 0) {
+		fprintf(stderr, "Cannot load %s\n", image_path);
+		return 1;
+	}
+
+	uint32_t count = argc - optind;
+	BL_FleetSession_t *sessions = calloc(count, sizeof(*sessions));
+
+	for (uint32_t i = 0; i < count; i++) {
+		sessions[i].port = argv[optind + i];
+		bl_fleet_session_start(&sessions[i], &bl_fleet_image,
+				&bl_fleet_config);
+	}
+
+	bl_fleet_run(sessions, count);
+
+	uint32_t failed = 0;
+	printf("%-24s %-6s %8s %9s %8s %7s  %s\n", "port", "result", "bytes",
+			"time[ms]", "KiB/s", "retries", "error");
+	for (uint32_t i = 0; i < count; i++) {
+		const BL_FleetSession_t *session = &sessions[i];
+		uint8_t ok = session->state == BL_FleetState_done;
+		double ms = (session->end_ns - session->start_ns) / 1e6;
+
+		failed += !ok;
+		printf("%-24s %-6s %8u %9.1f %8.1f %7u  %s\n", session->port,
+				ok ? "ok" : "FAILED", ok ? bl_fleet_image.size : 0, ms,
+				(ok && ms > 0) ? bl_fleet_image.size / 1.024 / ms : 0.0,
+				session->retries, ok ? "" : session->error);
+	}
+	printf("\n%u of %u devices flashed\n", count - failed, count);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+/**
+ * @file bl_fleet.h
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief   Host tool flashing many bootloaders at once over serial ports
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BL_FLEET_H_
+#define BL_FLEET_H_
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "../../bl/inc/bl_cmd_types.h"
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Largest reply a session waits for */
+#define BL_FLEET_RX_BUFFER_BYTES (sizeof(BL_CAPABILITIES_RESPONSE))
+
+/** Largest command a session sends, data packets excepted */
+#define BL_FLEET_TX_BUFFER_BYTES (64U)
+
+/*******************************************************************************
+ *							Type declarations  				        		   *
+ *******************************************************************************/
+
+/**
+ * @struct	BL_FleetImage_t
+ * @brief	Image shared by every session, split in data packets whose headers
+ * 	and CRCs are calculated once
+ *
+ */
+typedef struct {
+	const uint8_t *data; /**< Image contents, mapped read only */
+	uint32_t size; /**< Image size in bytes */
+	uint32_t address; /**< Flash address of the image, 0 for the start of the
+	 application region reported by each device */
+	uint32_t block_size; /**< Data bytes per packet */
+	uint32_t packet_count;
+	BL_DATA_PACKET_HEADER *headers; /**< Header of every packet, CRC included */
+} BL_FleetImage_t;
+
+/**
+ * @struct	BL_FleetConfig_t
+ * @brief	Settings shared by every session
+ *
+ */
+typedef struct {
+	uint32_t baud_rate;
+	uint32_t reply_timeout_ms; /**< Time allowed for any reply */
+	uint32_t sync_attempts; /**< Sync bytes sent before giving up on a device */
+} BL_FleetConfig_t;
+
+/**
+ * @enum	BL_FleetState_t
+ * @brief	Step of a flashing session
+ *
+ */
+typedef enum {
+	BL_FleetState_sync, /**< Waiting for the sync byte to be echoed */
+	BL_FleetState_capabilities, /**< Negotiating the block size */
+	BL_FleetState_erase, /**< Erasing, for bootloaders without auto-erase */
+	BL_FleetState_write, /**< Waiting for BL_MEM_WRITE_CMD to be accepted */
+	BL_FleetState_data, /**< Sending data packets */
+	BL_FleetState_done, /**< Image written */
+	BL_FleetState_failed /**< Gave up, see 'error' */
+} BL_FleetState_t;
+
+/**
+ * @enum	BL_FleetExpect_t
+ * @brief	Part of a reply being received
+ *
+ */
+typedef enum {
+	BL_FleetExpect_none,
+	BL_FleetExpect_sync, /**< The sync byte */
+	BL_FleetExpect_ack, /**< A BL_ACK */
+	BL_FleetExpect_header, /**< The header of a frame */
+	BL_FleetExpect_body /**< The rest of the frame */
+} BL_FleetExpect_t;
+
+/**
+ * @struct	BL_FleetSession_t
+ * @brief	Flashing of one device
+ *
+ */
+typedef struct {
+	const char *port; /**< Serial port path */
+	const BL_FleetImage_t *image;
+	const BL_FleetConfig_t *config;
+	int fd;
+	uint8_t polling_out; /**< Registered for writability */
+	BL_FleetState_t state;
+	const char *error; /**< Reason of the failure */
+
+	/* Transmission, written as the port accepts it */
+	uint8_t tx_buffer[BL_FLEET_TX_BUFFER_BYTES];
+	const uint8_t *tx[2]; /**< Pending buffers, NULL when done */
+	uint32_t tx_len[2];
+
+	/* Reception */
+	BL_FleetExpect_t expect;
+	uint8_t rx_buffer[BL_FLEET_RX_BUFFER_BYTES];
+	uint32_t rx_len; /**< Bytes received of the expected part */
+	uint32_t rx_size; /**< Size of the expected part */
+	uint8_t acks; /**< ACKs still expected before the frame, if any */
+	uint8_t frame; /**< Non-zero if a frame follows the ACKs */
+
+	uint64_t deadline_ns; /**< End of the wait for the reply */
+	uint32_t attempts; /**< Attempts of the current step */
+	uint32_t retries; /**< Steps repeated over the whole session */
+	uint8_t auto_erase; /**< The bootloader erases pages on first write */
+	uint32_t address; /**< Flash address of the image on this device */
+	uint32_t packet; /**< Data packet being sent */
+	uint64_t start_ns;
+	uint64_t end_ns;
+} BL_FleetSession_t;
+
+/*******************************************************************************
+ *                         Public functions prototypes                         *
+ *******************************************************************************/
+
+/**
+ * @fn void bl_fleet_session_start(BL_FleetSession_t*, const BL_FleetImage_t*, const BL_FleetConfig_t*)
+ * @brief	Opens the port of a session and sends the sync byte
+ *
+ * 	The session fails right away if the port cannot be opened.
+ *
+ * @param session	Session, with its port set
+ * @param image		Shared image
+ * @param config	Shared settings
+ */
+void bl_fleet_session_start(BL_FleetSession_t *session,
+		const BL_FleetImage_t *image, const BL_FleetConfig_t *config);
+
+/**
+ * @fn void bl_fleet_session_readable(BL_FleetSession_t*)
+ * @brief	Consumes what the bootloader sent and advances the session
+ *
+ * @param session	Session
+ */
+void bl_fleet_session_readable(BL_FleetSession_t *session);
+
+/**
+ * @fn void bl_fleet_session_writable(BL_FleetSession_t*)
+ * @brief	Writes as much of the pending transmission as the port accepts
+ *
+ * @param session	Session
+ */
+void bl_fleet_session_writable(BL_FleetSession_t *session);
+
+/**
+ * @fn void bl_fleet_session_timeout(BL_FleetSession_t*)
+ * @brief	Repeats the current step, or fails the session once its attempts
+ * 	are used up. Called once the deadline of the session has passed.
+ *
+ * @param session	Session
+ */
+void bl_fleet_session_timeout(BL_FleetSession_t *session);
+
+/**
+ * @fn uint8_t bl_fleet_session_active(const BL_FleetSession_t*)
+ * @brief	Tells whether a session is still running
+ *
+ * @param session	Session
+ * @return	Non-zero until the session is done or failed
+ */
+uint8_t bl_fleet_session_active(const BL_FleetSession_t *session);
+
+/**
+ * @fn uint64_t bl_fleet_now_ns(void)
+ * @brief	Returns the monotonic time
+ *
+ * @return	Time in nanoseconds
+ */
+uint64_t bl_fleet_now_ns(void);
+
+#endif /* BL_FLEET_H_ */
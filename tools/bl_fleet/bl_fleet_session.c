@@ -0,0 +1,557 @@
+/**
+ * @file bl_fleet_session.c
+ * @author Hazem Montasser (h4z3m.private@gmail.com)
+ * @brief	Non-blocking flashing session of one device
+ * @version 0.1
+ * @date 2023-08-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * A session walks through sync, capabilities, erase (only for bootloaders
+ * without auto-erase), BL_MEM_WRITE_CMD and the data packets. It never blocks:
+ * the event loop calls it when its port is readable or writable, or when the
+ * reply it waits for is late.
+ *
+ */
+
+/*******************************************************************************
+ *                              Includes                                       *
+ *******************************************************************************/
+
+#include "bl_fleet.h"
+#include "../../bl/inc/bl_cfg.h"
+#include "../../bl/inc/bl_cmd_types.h"
+#include "../../bl/inc/bl_defs.h"
+#include "../../bl/inc/bl_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                              Definitions                                    *
+ *******************************************************************************/
+
+/** Interval between sync bytes while a device boots */
+#define BL_FLEET_SYNC_INTERVAL_MS (500U)
+
+/*******************************************************************************
+ *                         Private functions prototypes                        *
+ *******************************************************************************/
+
+/**
+ * @fn speed_t bl_fleet_speed(uint32_t)
+ * @brief	Converts a baud rate to its termios constant
+ *
+ * @param baud_rate	Baud rate
+ * @return	termios speed, B0 if unsupported
+ */
+static speed_t bl_fleet_speed(uint32_t baud_rate);
+
+/**
+ * @fn void bl_fleet_finish(BL_FleetSession_t*, BL_FleetState_t, const char*)
+ * @brief	Ends a session and closes its port
+ *
+ * @param session	Session
+ * @param state		BL_FleetState_done or BL_FleetState_failed
+ * @param error		Reason of the failure, NULL on success
+ */
+static void bl_fleet_finish(BL_FleetSession_t *session, BL_FleetState_t state,
+		const char *error);
+
+/**
+ * @fn void bl_fleet_enter(BL_FleetSession_t*, BL_FleetState_t)
+ * @brief	Moves a session to a new step and sends its request
+ *
+ * @param session	Session
+ * @param state		New step
+ */
+static void bl_fleet_enter(BL_FleetSession_t *session, BL_FleetState_t state);
+
+/**
+ * @fn void bl_fleet_request(BL_FleetSession_t*)
+ * @brief	Sends the request of the current step and waits for its reply
+ *
+ * @param session	Session
+ */
+static void bl_fleet_request(BL_FleetSession_t *session);
+
+/**
+ * @fn void bl_fleet_retry(BL_FleetSession_t*, const char*)
+ * @brief	Repeats the current step, within the retry budget
+ *
+ * @param session	Session
+ * @param error		Reason of the failure once the budget is used up
+ */
+static void bl_fleet_retry(BL_FleetSession_t *session, const char *error);
+
+/**
+ * @fn void bl_fleet_send_command(BL_FleetSession_t*, void*, uint32_t)
+ * @brief	Fills in the size and CRC of a command and queues it
+ *
+ * @param session	Session
+ * @param command	Command, starting with BL_CommandHeader_t
+ * @param size		Size of the command
+ */
+static void bl_fleet_send_command(BL_FleetSession_t *session, void *command,
+		uint32_t size);
+
+/**
+ * @fn void bl_fleet_expect(BL_FleetSession_t*, BL_FleetExpect_t, uint32_t)
+ * @brief	Starts receiving a part of the reply
+ *
+ * @param session	Session
+ * @param expect	Part
+ * @param size		Size of the part
+ */
+static void bl_fleet_expect(BL_FleetSession_t *session, BL_FleetExpect_t expect,
+		uint32_t size);
+
+/**
+ * @fn void bl_fleet_received(BL_FleetSession_t*)
+ * @brief	Handles a completely received part of the reply
+ *
+ * @param session	Session
+ */
+static void bl_fleet_received(BL_FleetSession_t *session);
+
+/**
+ * @fn void bl_fleet_replied(BL_FleetSession_t*)
+ * @brief	Advances the session once the whole reply is received
+ *
+ * @param session	Session
+ */
+static void bl_fleet_replied(BL_FleetSession_t *session);
+
+/**
+ * @fn BL_CommandID_t bl_fleet_acked_id(const BL_FleetSession_t*)
+ * @brief	Command ID the ACKs of the current step carry
+ *
+ * @param session	Session
+ * @return	Command ID
+ */
+static BL_CommandID_t bl_fleet_acked_id(const BL_FleetSession_t *session);
+
+/*******************************************************************************
+ *                         	Private functions			                       *
+ *******************************************************************************/
+
+static speed_t bl_fleet_speed(uint32_t baud_rate) {
+	switch (baud_rate) {
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	case 230400:
+		return B230400;
+	case 460800:
+		return B460800;
+	case 921600:
+		return B921600;
+	case 1000000:
+		return B1000000;
+	case 2000000:
+		return B2000000;
+	default:
+		return B0;
+	}
+}
+
+static void bl_fleet_finish(BL_FleetSession_t *session, BL_FleetState_t state,
+		const char *error) {
+	session->state = state;
+	session->error = error;
+	session->expect = BL_FleetExpect_none;
+	session->tx[0] = NULL;
+	session->end_ns = bl_fleet_now_ns();
+
+	if (session->fd >= 0) {
+		close(session->fd);
+		session->fd = -1;
+	}
+}
+
+static void bl_fleet_enter(BL_FleetSession_t *session, BL_FleetState_t state) {
+	session->state = state;
+	session->attempts = 0;
+
+	bl_fleet_request(session);
+}
+
+static void bl_fleet_retry(BL_FleetSession_t *session, const char *error) {
+	uint32_t limit =
+			(session->state == BL_FleetState_sync) ?
+					session->config->sync_attempts : BL_MAX_RETRIES;
+
+	if (++session->attempts >= limit) {
+		bl_fleet_finish(session, BL_FleetState_failed, error);
+		return;
+	}
+	session->retries++;
+
+	/* Whatever is left of the failed reply would be taken for the next one */
+	tcflush(session->fd, TCIOFLUSH);
+
+	bl_fleet_request(session);
+}
+
+static void bl_fleet_send_command(BL_FleetSession_t *session, void *command,
+		uint32_t size) {
+	BL_CommandHeader_t *header = command;
+
+	header->payload_size = size;
+	header->CRC32 = bl_calculate_command_crc(command, size);
+
+	memcpy(session->tx_buffer, command, size);
+	session->tx[0] = session->tx_buffer;
+	session->tx_len[0] = size;
+	session->tx[1] = NULL;
+	session->tx_len[1] = 0;
+}
+
+static void bl_fleet_expect(BL_FleetSession_t *session, BL_FleetExpect_t expect,
+		uint32_t size) {
+	session->expect = expect;
+	session->rx_size = size;
+	if (expect != BL_FleetExpect_body) {
+		session->rx_len = 0;
+	}
+}
+
+static BL_CommandID_t bl_fleet_acked_id(const BL_FleetSession_t *session) {
+	switch (session->state) {
+	case BL_FleetState_capabilities:
+		return BL_GET_CAPABILITIES_CMD_ID;
+	case BL_FleetState_erase:
+		return BL_FLASH_ERASE_CMD_ID;
+	case BL_FleetState_write:
+		return BL_MEM_WRITE_CMD_ID;
+	default:
+		return BL_DATA_PACKET_CMD_ID;
+	}
+}
+
+static void bl_fleet_request(BL_FleetSession_t *session) {
+	const BL_FleetImage_t *image = session->image;
+	uint32_t timeout_ms = session->config->reply_timeout_ms;
+
+	session->acks = 1;
+	session->frame = 0;
+
+	switch (session->state) {
+	case BL_FleetState_sync: {
+		session->tx_buffer[0] = BL_SYNC_BYTE_VALUE;
+		session->tx[0] = session->tx_buffer;
+		session->tx_len[0] = 1;
+		session->tx[1] = NULL;
+		session->acks = 0;
+		timeout_ms = BL_FLEET_SYNC_INTERVAL_MS;
+		bl_fleet_expect(session, BL_FleetExpect_sync, 1);
+	}
+		break;
+	case BL_FleetState_capabilities: {
+		BL_GET_CAPABILITIES_CMD cmd = { 0 };
+		cmd.data.header.cmd_id = BL_GET_CAPABILITIES_CMD_ID;
+		cmd.data.max_block_size = image->block_size;
+		bl_fleet_send_command(session, &cmd, sizeof(cmd));
+		session->frame = 1;
+		bl_fleet_expect(session, BL_FleetExpect_ack, sizeof(BL_ACK));
+	}
+		break;
+	case BL_FleetState_erase: {
+		BL_FLASH_ERASE_CMD cmd = { 0 };
+		cmd.data.header.cmd_id = BL_FLASH_ERASE_CMD_ID;
+		cmd.data.address = session->address;
+		cmd.data.page_count = (image->size + BL_VS_PAGE_SIZE_BYTES - 1)
+				/ BL_VS_PAGE_SIZE_BYTES;
+		bl_fleet_send_command(session, &cmd, sizeof(cmd));
+		/* Command accepted, then erased, then the erased page count */
+		session->acks = 2;
+		session->frame = 1;
+		bl_fleet_expect(session, BL_FleetExpect_ack, sizeof(BL_ACK));
+	}
+		break;
+	case BL_FleetState_write: {
+		BL_MEM_WRITE_CMD cmd = { 0 };
+		cmd.data.header.cmd_id = BL_MEM_WRITE_CMD_ID;
+		cmd.data.start_address = session->address;
+		cmd.data.flags = session->auto_erase ? BL_WRITE_FLAG_AUTO_ERASE : 0;
+		cmd.data.length = image->size;
+		bl_fleet_send_command(session, &cmd, sizeof(cmd));
+		bl_fleet_expect(session, BL_FleetExpect_ack, sizeof(BL_ACK));
+	}
+		break;
+	case BL_FleetState_data: {
+		/* Header and CRC were calculated once for all devices, the block is
+		 * sent straight from the mapped image */
+		const BL_DATA_PACKET_HEADER *header = &image->headers[session->packet];
+		session->tx[0] = header->serialized_data;
+		session->tx_len[0] = sizeof(*header);
+		session->tx[1] = image->data + session->packet * image->block_size;
+		session->tx_len[1] = header->data.data_len;
+		bl_fleet_expect(session, BL_FleetExpect_ack, sizeof(BL_ACK));
+	}
+		break;
+	default:
+		return;
+	}
+
+	session->deadline_ns = bl_fleet_now_ns()
+			+ (uint64_t) timeout_ms * 1000000ULL;
+
+	bl_fleet_session_writable(session);
+}
+
+static void bl_fleet_received(BL_FleetSession_t *session) {
+	switch (session->expect) {
+	case BL_FleetExpect_sync:
+		if (session->rx_buffer[0] != BL_SYNC_BYTE_VALUE) {
+			/* Noise from a booting device, keep listening */
+			bl_fleet_expect(session, BL_FleetExpect_sync, 1);
+			return;
+		}
+		bl_fleet_replied(session);
+		break;
+	case BL_FleetExpect_ack: {
+		const BL_ACK *ack = (const BL_ACK*) session->rx_buffer;
+
+		if (ack->data.cmd_id != bl_fleet_acked_id(session)
+				|| ack->data.ack != 1) {
+			bl_fleet_retry(session, "rejected");
+			return;
+		}
+		if (--session->acks) {
+			bl_fleet_expect(session, BL_FleetExpect_ack, sizeof(BL_ACK));
+		} else if (session->frame) {
+			bl_fleet_expect(session, BL_FleetExpect_header,
+					sizeof(BL_CommandHeader_t));
+		} else {
+			bl_fleet_replied(session);
+		}
+	}
+		break;
+	case BL_FleetExpect_header: {
+		const BL_CommandHeader_t *header =
+				(const BL_CommandHeader_t*) session->rx_buffer;
+
+		if (header->payload_size < sizeof(*header)
+				|| header->payload_size > sizeof(session->rx_buffer)) {
+			bl_fleet_retry(session, "bad frame");
+			return;
+		}
+		bl_fleet_expect(session, BL_FleetExpect_body, header->payload_size);
+		if (session->rx_len == session->rx_size) {
+			bl_fleet_received(session);
+		}
+	}
+		break;
+	case BL_FleetExpect_body: {
+		const BL_CommandHeader_t *header =
+				(const BL_CommandHeader_t*) session->rx_buffer;
+
+		if (bl_calculate_command_crc(session->rx_buffer, header->payload_size)
+				!= header->CRC32) {
+			bl_fleet_retry(session, "bad frame");
+			return;
+		}
+		bl_fleet_replied(session);
+	}
+		break;
+	default:
+		break;
+	}
+}
+
+static void bl_fleet_replied(BL_FleetSession_t *session) {
+	const BL_FleetImage_t *image = session->image;
+
+	session->expect = BL_FleetExpect_none;
+
+	switch (session->state) {
+	case BL_FleetState_sync:
+		bl_fleet_enter(session, BL_FleetState_capabilities);
+		break;
+	case BL_FleetState_capabilities: {
+		const BL_CAPABILITIES_RESPONSE *caps =
+				(const BL_CAPABILITIES_RESPONSE*) session->rx_buffer;
+
+		/* The packets were built for one block size */
+		if (caps->data.block_size != image->block_size) {
+			bl_fleet_finish(session, BL_FleetState_failed,
+					"block size not supported");
+			return;
+		}
+
+		session->address =
+				image->address ? image->address : caps->data.app_start;
+		if (session->address < caps->data.app_start
+				|| session->address > caps->data.app_end
+				|| image->size > caps->data.app_end - session->address + 1) {
+			bl_fleet_finish(session, BL_FleetState_failed,
+					"image outside the application region");
+			return;
+		}
+
+		session->auto_erase = (caps->data.features & BL_FEATURE_AUTO_ERASE)
+				!= 0;
+		bl_fleet_enter(session,
+				session->auto_erase ?
+						BL_FleetState_write : BL_FleetState_erase);
+	}
+		break;
+	case BL_FleetState_erase:
+		bl_fleet_enter(session, BL_FleetState_write);
+		break;
+	case BL_FleetState_write:
+		session->packet = 0;
+		bl_fleet_enter(session, BL_FleetState_data);
+		break;
+	case BL_FleetState_data:
+		if (++session->packet == image->packet_count) {
+			bl_fleet_finish(session, BL_FleetState_done, NULL);
+		} else {
+			bl_fleet_enter(session, BL_FleetState_data);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*******************************************************************************
+ *                         	Public functions			                       *
+ *******************************************************************************/
+
+void bl_fleet_session_start(BL_FleetSession_t *session,
+		const BL_FleetImage_t *image, const BL_FleetConfig_t *config) {
+	struct termios tio;
+	speed_t speed = bl_fleet_speed(config->baud_rate);
+
+	session->image = image;
+	session->config = config;
+	session->start_ns = bl_fleet_now_ns();
+	session->retries = 0;
+	session->polling_out = 0;
+	session->error = NULL;
+
+	session->fd = open(session->port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (session->fd < 0) {
+		bl_fleet_finish(session, BL_FleetState_failed, "cannot open port");
+		return;
+	}
+
+	/* Raw 8N1, no flow control */
+	if (speed == B0 || tcgetattr(session->fd, &tio) != 0) {
+		bl_fleet_finish(session, BL_FleetState_failed,
+				"cannot configure port");
+		return;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(session->fd, TCSANOW, &tio) != 0) {
+		bl_fleet_finish(session, BL_FleetState_failed,
+				"cannot configure port");
+		return;
+	}
+	tcflush(session->fd, TCIOFLUSH);
+
+	bl_fleet_enter(session, BL_FleetState_sync);
+}
+
+void bl_fleet_session_readable(BL_FleetSession_t *session) {
+	uint8_t buffer[256];
+
+	while (bl_fleet_session_active(session)) {
+		ssize_t count = read(session->fd, buffer, sizeof(buffer));
+
+		if (count < 0 && (errno == EAGAIN || errno == EINTR)) {
+			return;
+		}
+		if (count <= 0) {
+			bl_fleet_finish(session, BL_FleetState_failed, "port closed");
+			return;
+		}
+
+		for (ssize_t i = 0; i < count && bl_fleet_session_active(session);) {
+			if (session->expect == BL_FleetExpect_none) {
+				/* Not waiting for anything, drop it */
+				break;
+			}
+
+			uint32_t take = session->rx_size - session->rx_len;
+			if (take > (uint32_t) (count - i)) {
+				take = count - i;
+			}
+			memcpy(session->rx_buffer + session->rx_len, buffer + i, take);
+			session->rx_len += take;
+			i += take;
+
+			if (session->rx_len == session->rx_size) {
+				bl_fleet_received(session);
+			}
+		}
+	}
+}
+
+void bl_fleet_session_writable(BL_FleetSession_t *session) {
+	while (session->tx[0] != NULL) {
+		struct iovec iov[2] = { { (void*) session->tx[0], session->tx_len[0] },
+				{ (void*) session->tx[1], session->tx_len[1] } };
+		ssize_t count = writev(session->fd, iov, session->tx[1] ? 2 : 1);
+
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EINTR) {
+				bl_fleet_finish(session, BL_FleetState_failed, "write failed");
+			}
+			return;
+		}
+
+		/* Drop what was written, the event loop waits for room for the rest */
+		for (uint32_t i = 0; i < 2 && count > 0; i++) {
+			uint32_t done =
+					((size_t) count < session->tx_len[0]) ?
+							(uint32_t) count : session->tx_len[0];
+			session->tx[0] += done;
+			session->tx_len[0] -= done;
+			count -= done;
+			if (session->tx_len[0] == 0) {
+				session->tx[0] = session->tx[1];
+				session->tx_len[0] = session->tx_len[1];
+				session->tx[1] = NULL;
+				session->tx_len[1] = 0;
+			}
+		}
+	}
+}
+
+void bl_fleet_session_timeout(BL_FleetSession_t *session) {
+	bl_fleet_retry(session,
+			(session->state == BL_FleetState_sync) ?
+					"no bootloader" : "no reply");
+}
+
+uint8_t bl_fleet_session_active(const BL_FleetSession_t *session) {
+	return session->state != BL_FleetState_done
+			&& session->state != BL_FleetState_failed;
+}
+
+uint64_t bl_fleet_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}